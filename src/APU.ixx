@@ -1,35 +1,37 @@
 export module APU;
 
+import Scheduler;
 import Util;
 
 import <array>;
 import <cstring>;
 
-namespace APU
+export struct APU
 {
-	export
-	{
-		enum class Reg {
-			NR10, NR11, NR12, NR13, NR14, NR21, NR22, NR23, NR24, NR30, NR31, 
-			NR32, NR33, NR34, NR41, NR42, NR43, NR44, NR50, NR51, NR52,
-			PCM12, PCM34
-		};
-
-		template<Reg reg>
-		u8 ReadReg();
-
-		template<Reg reg>
-		void WriteReg(u8 value);
-
-		void ApplyNewSampleRate();
-		bool Enabled();
-		void Initialize(bool hle_boot_rom);
-		u8 ReadWaveRamCpu(u16 addr);
-		void StepFrameSequencer();
-		void StreamState(SerializationStream& stream);
-		void Update();
-		void WriteWaveRamCpu(u16 addr, u8 data);
-	}
+	enum class Reg {
+		NR10, NR11, NR12, NR13, NR14, NR21, NR22, NR23, NR24, NR30, NR31, 
+		NR32, NR33, NR34, NR41, NR42, NR43, NR44, NR50, NR51, NR52,
+		PCM12, PCM34
+	};
+
+	template<Reg reg>
+	u8 ReadReg();
+
+	template<Reg reg>
+	void WriteReg(u8 value);
+
+	void ApplyNewSampleRate();
+	bool Enabled();
+	void Initialize(bool hle_boot_rom);
+	u8 ReadWaveRamCpu(u16 addr);
+	/* If disabled, no samples are produced, and the frontend's audio is not used */
+	void SetAudioOutputEnabled(bool enabled);
+	void StepFrameSequencer();
+	void StreamState(SerializationStream& stream);
+	void WriteWaveRamCpu(u16 addr, u8 data);
+
+private:
+	friend struct Scheduler; /* runs the event handler */
 
 	enum class Direction { 
 		Decreasing, Increasing /* Sweep and envelope */
@@ -37,6 +39,8 @@ namespace APU
 
 	struct Channel
 	{
+		explicit Channel(APU* apu) : apu(apu) {}
+
 		virtual void Disable() = 0;
 		bool dac_enabled;
 		bool enabled;
@@ -44,6 +48,7 @@ namespace APU
 		uint timer;
 		uint volume;
 		f32 output;
+		APU* const apu;
 	};
 
 	struct Envelope
@@ -98,6 +103,8 @@ namespace APU
 	template<uint id>
 	struct PulseChannel : Channel
 	{
+		using Channel::Channel;
+
 		void Disable() override;
 		void Enable();
 		void EnableEnvelope();
@@ -113,11 +120,13 @@ namespace APU
 		Sweep sweep{this};
 	};
 
-	PulseChannel<0> pulse_ch_1;
-	PulseChannel<1> pulse_ch_2;
+	PulseChannel<0> pulse_ch_1{this};
+	PulseChannel<1> pulse_ch_2{this};
 
 	struct WaveChannel : Channel
 	{
+		using Channel::Channel;
+
 		void Disable() override;
 		void Enable();
 		f32 GetOutput();
@@ -129,10 +138,12 @@ namespace APU
 		uint wave_pos;
 		u8 sample_buffer;
 		LengthCounter length_counter{this};
-	} wave_ch;
+	} wave_ch{this};
 
 	struct NoiseChannel : Channel
 	{
+		using Channel::Channel;
+
 		void Disable() override;
 		void Enable();
 		void EnableEnvelope();
@@ -144,14 +155,21 @@ namespace APU
 		u16 lfsr;
 		Envelope envelope{this};
 		LengthCounter length_counter{this};
-	} noise_ch;
+	} noise_ch{this};
 
 	void DisableAPU();
 	void EnableAPU();
+	void OnSyncEvent();
 	void ResetAllRegisters();
 	void Sample();
+	void Sync();
+
+	/* The APU is only stepped when the CPU accesses it, when the frame sequencer is stepped,
+	   and periodically so that audio samples keep being produced. */
+	static constexpr uint m_cycles_per_sync_event = 1024;
 	
 	bool apu_enabled;
+	bool audio_output_enabled = true;
 	bool wave_ram_accessible_by_cpu_when_ch3_enabled = true;
 
 	u8 nr10, nr11, nr12, nr13, nr14, nr21, nr22, nr23, nr24,
@@ -163,5 +181,8 @@ namespace APU
 	uint t_cycle_sample_counter;
 	uint t_cycles_since_ch3_read_wave_ram;
 
+	/* The scheduler time up until which the APU has been stepped */
+	u64 time_synced;
+
 	std::array<u8, 0x10> wave_ram;
-}
\ No newline at end of file
+};
\ No newline at end of file
@@ -0,0 +1,296 @@
+module BatchRunner;
+
+import Bus;
+import Cartridge;
+import Joypad;
+import PPU;
+import PPU.ScanlineMixer;
+import Serial;
+import System;
+
+namespace BatchRunner
+{
+	std::string EscapeCsv(std::string_view str)
+	{
+		std::string escaped = "\"";
+		for (char c : str) {
+			if (c == '"') {
+				escaped += "\"\"";
+			}
+			else if (c == '\n') {
+				escaped += "\\n";
+			}
+			else if (c == '\\') {
+				escaped += "\\\\";
+			}
+			else if (c < 0x20 || c >= 0x7F) {
+				escaped += std::format("\\x{:02X}", u8(c));
+			}
+			else {
+				escaped.push_back(c);
+			}
+		}
+		escaped.push_back('"');
+		return escaped;
+	}
+
+
+	u64 Hash(std::span<const u8> data, u64 hash)
+	{
+		/* FNV-1a */
+		for (u8 byte : data) {
+			hash = (hash ^ byte) * fnv_prime;
+		}
+		return hash;
+	}
+
+
+	u64 HashFramebuffer(GB& gb)
+	{
+		u64 hash = Hash(gb.PPU::GetIndexedFramebuffer());
+		if (gb.System::mode == System::Mode::CGB) { /* the indices are into the colours of each scanline */
+			for (uint scanline = 0; scanline < 144; ++scanline) {
+				std::span<const PPU::RGB, 64> colours = gb.PPU::GetScanlineColours(scanline);
+				hash = Hash({ reinterpret_cast<const u8*>(colours.data()), colours.size_bytes() }, hash);
+			}
+		}
+		return hash;
+	}
+
+
+	std::vector<ThroughputSample> MeasureScaling(std::span<const Job> jobs, uint max_num_threads)
+	{
+		u64 total_num_frames = 0;
+		for (const Job& job : jobs) {
+			total_num_frames += job.num_frames;
+		}
+		std::vector<ThroughputSample> samples;
+		max_num_threads = std::max(max_num_threads, 1u);
+		for (uint num_threads = 1; ; num_threads = std::min(2 * num_threads, max_num_threads)) {
+			auto start = std::chrono::steady_clock::now();
+			RunJobs(jobs, num_threads);
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			samples.emplace_back(num_threads, seconds, seconds > 0 ? total_num_frames / seconds : 0);
+			if (num_threads == max_num_threads) {
+				return samples;
+			}
+		}
+	}
+
+
+	std::expected<std::vector<InputEvent>, std::string> ParseInputScript(const std::string& path)
+	{
+		std::ifstream ifs{ path };
+		if (!ifs) {
+			return std::unexpected(std::format("Could not open the input script at {}", path));
+		}
+		const auto& action_names = Joypad::button_names;
+		std::vector<InputEvent> events;
+		std::string line;
+		for (uint line_num = 1; std::getline(ifs, line); ++line_num) {
+			if (line.empty() || line.front() == '#') {
+				continue;
+			}
+			std::istringstream iss{ line };
+			uint frame;
+			std::string action_name, transition;
+			iss >> frame >> action_name >> transition;
+			auto action = std::find(action_names.begin(), action_names.end(), action_name);
+			if (!iss || action == action_names.end() || (transition != "press" && transition != "release")) {
+				return std::unexpected(std::format("Invalid input event on line {} of {}", line_num, path));
+			}
+			events.emplace_back(frame, uint(action - action_names.begin()), transition == "press");
+		}
+		std::stable_sort(events.begin(), events.end(), [](const InputEvent& lhs, const InputEvent& rhs) {
+			return lhs.frame < rhs.frame;
+		});
+		return events;
+	}
+
+
+	std::expected<std::vector<Job>, std::string> ParseManifest(const std::string& path)
+	{
+		std::ifstream ifs{ path };
+		if (!ifs) {
+			return std::unexpected(std::format("Could not open the manifest at {}", path));
+		}
+		std::filesystem::path manifest_dir = std::filesystem::path(path).parent_path();
+		/* Jobs often share input scripts, so each script is parsed only once */
+		std::map<std::string, std::vector<InputEvent>> input_scripts;
+		std::vector<Job> jobs;
+		std::string line;
+		for (uint line_num = 1; std::getline(ifs, line); ++line_num) {
+			if (line.empty() || line.front() == '#') {
+				continue;
+			}
+			std::istringstream iss{ line };
+			std::string rom_path, input_script_path;
+			uint num_frames;
+			iss >> std::quoted(rom_path) >> num_frames;
+			if (!iss) {
+				return std::unexpected(std::format("Invalid job on line {} of {}", line_num, path));
+			}
+			Job& job = jobs.emplace_back();
+			job.rom_path = (manifest_dir / rom_path).string();
+			job.num_frames = num_frames;
+			/* Checked here so that a mistyped path is caught before any job is run */
+			if (!std::filesystem::is_regular_file(job.rom_path)) {
+				return std::unexpected(std::format("Could not find the ROM at {}", job.rom_path));
+			}
+			if (iss >> std::quoted(input_script_path)) {
+				input_script_path = (manifest_dir / input_script_path).string();
+				auto script = input_scripts.find(input_script_path);
+				if (script == input_scripts.end()) {
+					std::expected<std::vector<InputEvent>, std::string> events = ParseInputScript(input_script_path);
+					if (!events) {
+						return std::unexpected(std::move(events.error()));
+					}
+					script = input_scripts.emplace(input_script_path, std::move(*events)).first;
+				}
+				job.input_events = script->second;
+			}
+		}
+		return jobs;
+	}
+
+
+	JobResult RunJob(const Job& job)
+	{
+		JobResult result{};
+		auto gb = std::make_unique<GB>();
+		/* The frontend is not thread-safe; the machine runs without audio and video output */
+		gb->DisableAudio();
+		gb->PPU::SetVideoOutputEnabled(false);
+		gb->Serial::SetOutputCaptureEnabled(true);
+		gb->System::SetMessageCaptureEnabled(true);
+		if (!gb->LoadRom(job.rom_path)) {
+			result.messages = gb->System::GetCapturedMessages();
+			return result;
+		}
+		gb->Initialize();
+		/* Only the colour indices are written, as they are all that the framebuffer hash is made from */
+		gb->PPU::SetFramebufferMode(PPU::FramebufferMode::IndexedOnly);
+
+		auto start = std::chrono::steady_clock::now();
+		auto next_event = job.input_events.begin();
+		for (uint frame = 0; frame < job.num_frames; ++frame) {
+			for (; next_event != job.input_events.end() && next_event->frame <= frame; ++next_event) {
+				if (next_event->pressed) {
+					gb->NotifyButtonPressed(0, next_event->action_index);
+				}
+				else {
+					gb->NotifyButtonReleased(0, next_event->action_index);
+				}
+			}
+			gb->RunFrame();
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		result.completed = true;
+		result.framebuffer_hash = HashFramebuffer(*gb);
+		result.ram_hash = Hash(gb->Cartridge::GetRam(), Hash(gb->Bus::GetHram(), Hash(gb->Bus::GetWram())));
+		result.serial_output = gb->Serial::GetCapturedOutput();
+		result.messages = gb->System::GetCapturedMessages();
+		result.frames_per_sec = seconds > 0 ? job.num_frames / seconds : 0;
+		return result;
+	}
+
+
+	std::vector<JobResult> RunJobs(std::span<const Job> jobs, uint num_threads)
+	{
+		std::vector<JobResult> results(jobs.size());
+		/* Done here rather than by the first machine to be initialized, whose messages are captured */
+		if (!ScanlineMixer::Initialize()) {
+			std::cerr << ScanlineMixer::self_test_failure_message << '\n';
+		}
+		num_threads = uint(std::clamp<size_t>(num_threads, 1, std::max<size_t>(jobs.size(), 1)));
+		/* Each worker starts out with an even share of consecutive jobs, as jobs next to each other in a manifest
+		   tend to be of the same ROM, whose image is then loaded only once */
+		std::vector<WorkQueue> queues(num_threads);
+		for (size_t i = 0; i < jobs.size(); ++i) {
+			queues[i * num_threads / jobs.size()].job_indices.push_back(i);
+		}
+		{
+			std::vector<std::jthread> workers;
+			for (uint worker_index = 0; worker_index < num_threads; ++worker_index) {
+				workers.emplace_back([&, worker_index] {
+					while (std::optional<size_t> job_index = TakeJob(queues, worker_index)) {
+						results[*job_index] = RunJob(jobs[*job_index]);
+					}
+				});
+			}
+		}
+		return results;
+	}
+
+
+	int RunManifest(const std::string& path, bool measure_scaling)
+	{
+		std::expected<std::vector<Job>, std::string> jobs = ParseManifest(path);
+		if (!jobs) {
+			std::cerr << jobs.error() << '\n';
+			return 1;
+		}
+		uint num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+		std::vector<JobResult> results = RunJobs(*jobs, num_threads);
+
+		bool all_completed = true;
+		std::cout << "job,rom,frames,framebuffer_hash,ram_hash,frames_per_sec,serial_output,messages\n";
+		for (size_t i = 0; i < jobs->size(); ++i) {
+			const Job& job = (*jobs)[i];
+			const JobResult& result = results[i];
+			if (result.completed) {
+				std::cout << std::format("{},{},{},{:016X},{:016X},{:.1f},{},{}\n", i, EscapeCsv(job.rom_path),
+					job.num_frames, result.framebuffer_hash, result.ram_hash, result.frames_per_sec,
+					EscapeCsv(result.serial_output), EscapeCsv(result.messages));
+			}
+			else {
+				std::cout << std::format("{},{},{},,,,,{}\n", i, EscapeCsv(job.rom_path), job.num_frames,
+					EscapeCsv(result.messages));
+				all_completed = false;
+			}
+		}
+
+		if (measure_scaling) {
+			std::vector<ThroughputSample> samples = MeasureScaling(*jobs, num_threads);
+			std::cout << "\nthreads,seconds,frames_per_sec,speedup,efficiency\n";
+			for (const ThroughputSample& sample : samples) {
+				std::cout << std::format("{},{:.3f},{:.1f},", sample.num_threads, sample.seconds, sample.frames_per_sec);
+				/* The single-threaded run may have been too short to be timed, leaving nothing to compare with */
+				if (samples.front().frames_per_sec > 0) {
+					double speedup = sample.frames_per_sec / samples.front().frames_per_sec;
+					std::cout << std::format("{:.2f},{:.2f}\n", speedup, speedup / sample.num_threads);
+				}
+				else {
+					std::cout << ",\n";
+				}
+			}
+		}
+		return all_completed ? 0 : 1;
+	}
+
+
+	std::optional<size_t> TakeJob(std::span<WorkQueue> queues, uint worker_index)
+	{
+		{
+			WorkQueue& own_queue = queues[worker_index];
+			std::scoped_lock lock{ own_queue.mutex };
+			if (!own_queue.job_indices.empty()) {
+				size_t job_index = own_queue.job_indices.front();
+				own_queue.job_indices.pop_front();
+				return job_index;
+			}
+		}
+		/* No jobs are added once the workers have started, so there is nothing left to run once all queues are empty */
+		for (size_t i = 1; i < queues.size(); ++i) {
+			WorkQueue& victim_queue = queues[(worker_index + i) % queues.size()];
+			std::scoped_lock lock{ victim_queue.mutex };
+			if (!victim_queue.job_indices.empty()) {
+				size_t job_index = victim_queue.job_indices.back();
+				victim_queue.job_indices.pop_back();
+				return job_index;
+			}
+		}
+		return {};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,100 @@
+export module BatchRunner;
+
+import GB;
+import Util;
+
+import <algorithm>;
+import <chrono>;
+import <deque>;
+import <expected>;
+import <filesystem>;
+import <format>;
+import <fstream>;
+import <iomanip>;
+import <iostream>;
+import <map>;
+import <mutex>;
+import <optional>;
+import <span>;
+import <sstream>;
+import <string>;
+import <string_view>;
+import <thread>;
+import <vector>;
+
+/* Runs many short emulation jobs at once, headless, e.g. to check a set of ROMs and input scripts against known
+   results. Each job runs on a machine of its own, on one worker thread from start to finish; the workers balance the
+   load by stealing whole jobs from one another. */
+namespace BatchRunner
+{
+	export
+	{
+		/* A button press or release, made before the given frame (counted from 0) is run */
+		struct InputEvent
+		{
+			uint frame;
+			uint action_index; /* as in 'Joypad::button_names' */
+			bool pressed;
+		};
+
+		struct Job
+		{
+			std::string rom_path;
+			uint num_frames;
+			std::vector<InputEvent> input_events; /* sorted by frame */
+		};
+
+		struct JobResult
+		{
+			bool completed; /* false if the ROM could not be loaded */
+			u64 framebuffer_hash;
+			u64 ram_hash; /* WRAM, HRAM and cartridge RAM */
+			std::string serial_output;
+			std::string messages; /* the messages of the machine, e.g. why the ROM could not be loaded, one per line */
+			double frames_per_sec; /* emulated frames per second of wall time */
+		};
+
+		struct ThroughputSample
+		{
+			uint num_threads;
+			double seconds;
+			double frames_per_sec; /* over all jobs */
+		};
+
+		/* Run each job count from 1 up to 'max_num_threads' threads, doubling the count each time */
+		std::vector<ThroughputSample> MeasureScaling(std::span<const Job> jobs, uint max_num_threads);
+		/* Each line of a manifest is a job: the path to a ROM, the number of frames to run, and optionally the path to an
+		   input script. Paths that contain spaces are put in double quotes, and relative paths are relative to the
+		   manifest. Empty lines and lines starting with '#' are skipped. On failure, the error is returned rather than
+		   shown to the user. */
+		std::expected<std::vector<Job>, std::string> ParseManifest(const std::string& path);
+		/* Each line of an input script is an input event: the frame, the name of the button (see 'Joypad::button_names'),
+		   and 'press' or 'release'. Empty lines and lines starting with '#' are skipped. On failure, the error is
+		   returned rather than shown to the user. */
+		std::expected<std::vector<InputEvent>, std::string> ParseInputScript(const std::string& path);
+		/* Run a job on the calling thread. Nothing is shown to the user; the messages of the machine are returned. */
+		JobResult RunJob(const Job& job);
+		/* The results are in the order of the jobs */
+		std::vector<JobResult> RunJobs(std::span<const Job> jobs, uint num_threads = std::thread::hardware_concurrency());
+		/* Run the jobs of the manifest on all hardware threads and print their results as CSV, followed by the
+		   throughput scaling if 'measure_scaling' is set. Errors are printed to stderr; nothing is shown in a dialog.
+		   Returns the exit code of the batch runner. */
+		int RunManifest(const std::string& path, bool measure_scaling);
+	}
+
+	/* The jobs yet to be run by a worker. The worker takes them from the front, and the other workers steal from the
+	   back once their own queues are empty. */
+	struct WorkQueue
+	{
+		std::mutex mutex;
+		std::deque<size_t> job_indices;
+	};
+
+	constexpr u64 fnv_offset_basis = 0xCBF29CE484222325;
+	constexpr u64 fnv_prime = 0x100000001B3;
+
+	std::string EscapeCsv(std::string_view str);
+	u64 Hash(std::span<const u8> data, u64 hash = fnv_offset_basis);
+	u64 HashFramebuffer(GB& gb);
+	std::optional<size_t> TakeJob(std::span<WorkQueue> queues, uint worker_index);
+}
\ No newline at end of file
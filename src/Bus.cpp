@@ -6,6 +6,7 @@ import Cartridge;
 import CPU;
 import Debug;
 import DMA;
+import GB;
 import Joypad;
 import PPU;
 import Serial;
@@ -13,536 +14,554 @@ import System;
 import Timer;
 import UserMessage;
 
-namespace Bus
+/* The handlers in 'io_registers' are member functions of any of the components, which are all bases of the machine */
+template<auto read>
+u8 Bus::ReadIoRegister(Bus& bus)
 {
-	void Initialize()
-	{
-		wram.fill(0);
-		unused_memory_area.fill(0);
-		hram.fill(0);
-		current_wram_bank = 1;
-		boot_rom_mapped = true;
-	}
+	return (static_cast<GB&>(bus).*read)();
+}
+
+
+template<auto write>
+void Bus::WriteIoRegister(Bus& bus, u8 data)
+{
+	(static_cast<GB&>(bus).*write)(data);
+}
 
 
-	constexpr std::string_view IoAddrToString(u16 addr)
-	{
-		switch (addr) {
-		case P1: return "P1";
-		case SB: return "SB";
-		case SC: return "SC";
-		case DIV: return "DIV";
-		case TIMA: return "TIMA";
-		case TMA: return "TMA";
-		case TAC: return "TAC";
-		case IF: return "IF";
-		case NR10: return "NR10";
-		case NR11: return "NR11";
-		case NR12: return "NR12";
-		case NR13: return "NR13";
-		case NR14: return "NR14";
-		case NR21: return "NR21";
-		case NR22: return "NR22";
-		case NR23: return "NR23";
-		case NR24: return "NR24";
-		case NR30: return "NR30";
-		case NR31: return "NR31";
-		case NR32: return "NR32";
-		case NR33: return "NR33";
-		case NR34: return "NR34";
-		case NR41: return "NR41";
-		case NR42: return "NR42";
-		case NR43: return "NR43";
-		case NR44: return "NR44";
-		case NR50: return "NR50";
-		case NR51: return "NR51";
-		case NR52: return "NR52";
-		case LCDC: return "LCDC";
-		case STAT: return "STAT";
-		case SCY: return "SCY";
-		case SCX: return "SCX";
-		case LY: return "LY";
-		case LYC: return "LYC";
-		case DMA: return "DMA";
-		case BGP: return "BGP";
-		case OBP0: return "OBP0";
-		case OBP1: return "OBP1";
-		case WY: return "WY";
-		case WX: return "WX";
-		case KEY0: return "KEY0";
-		case KEY1: return "KEY1";
-		case VBK: return "VBK";
-		case BOOT: return "BOOT";
-		case HDMA1: return "HDMA1";
-		case HDMA2: return "HDMA2";
-		case HDMA3: return "HDMA3";
-		case HDMA4: return "HDMA4";
-		case HDMA5: return "HDMA5";
-		case RP: return "RP";
-		case BCPS: return "BCPS";
-		case BCPD: return "BCPD";
-		case OCPS: return "OCPS";
-		case OCPD: return "OCPD";
-		case OPRI: return "OPRI";
-		case SVBK: return "SVBK";
-		case PCM12: return "PCM12";
-		case PCM34: return "PCM34";
-		case IE: return "IE";
-		default: return {};
+/* Every register in the I/O area. Wave RAM has no name, so that it is logged by address.
+   Registers listed without a read (write) handler read as open bus (ignore writes). */
+constexpr std::array<Bus::IoRegister, 0x80> Bus::MakeIoRegisterTable()
+{
+	constexpr std::array io_register_list = std::to_array<IoRegister>({
+		{ P1, "P1", ReadIoRegister<&Joypad::ReadP1>, WriteIoRegister<&Joypad::WriteP1> },
+		{ SB, "SB", ReadIoRegister<&Serial::ReadSB>, WriteIoRegister<&Serial::WriteSB> },
+		{ SC, "SC", ReadIoRegister<&Serial::ReadSC>, WriteIoRegister<&Serial::WriteSC> },
+		{ DIV, "DIV", ReadIoRegister<&Timer::ReadDIV>, WriteIoRegister<&Timer::WriteDIV> },
+		{ TIMA, "TIMA", ReadIoRegister<&Timer::ReadTIMA>, WriteIoRegister<&Timer::WriteTIMA> },
+		{ TMA, "TMA", ReadIoRegister<&Timer::ReadTMA>, WriteIoRegister<&Timer::WriteTMA> },
+		{ TAC, "TAC", ReadIoRegister<&Timer::ReadTAC>, WriteIoRegister<&Timer::WriteTAC> },
+		{ IF, "IF", ReadIoRegister<&CPU::ReadIF>, WriteIoRegister<&CPU::WriteIF> },
+		{ NR10, "NR10", ReadIoRegister<&APU::ReadReg<APU::Reg::NR10>>, WriteIoRegister<&APU::WriteReg<APU::Reg::NR10>> },
+		{ NR11, "NR11", ReadIoRegister<&APU::ReadReg<APU::Reg::NR11>>, WriteIoRegister<&APU::WriteReg<APU::Reg::NR11>> },
+		{ NR12, "NR12", ReadIoRegister<&APU::ReadReg<APU::Reg::NR12>>, WriteIoRegister<&APU::WriteReg<APU::Reg::NR12>> },
+		{ NR13, "NR13", ReadIoRegister<&APU::ReadReg<APU::Reg::NR13>>, WriteIoRegister<&APU::WriteReg<APU::Reg::NR13>> },
+		{ NR14, "NR14", ReadIoRegister<&APU::ReadReg<APU::Reg::NR14>>, WriteIoRegister<&APU::WriteReg<APU::Reg::NR14>> },
+		{ NR21, "NR21", ReadIoRegister<&APU::ReadReg<APU::Reg::NR21>>, WriteIoRegister<&APU::WriteReg<APU::Reg::NR21>> },
+		{ NR22, "NR22", ReadIoRegister<&APU::ReadReg<APU::Reg::NR22>>, WriteIoRegister<&APU::WriteReg<APU::Reg::NR22>> },
+		{ NR23, "NR23", ReadIoRegister<&APU::ReadReg<APU::Reg::NR23>>, WriteIoRegister<&APU::WriteReg<APU::Reg::NR23>> },
+		{ NR24, "NR24", ReadIoRegister<&APU::ReadReg<APU::Reg::NR24>>, WriteIoRegister<&APU::WriteReg<APU::Reg::NR24>> },
+		{ NR30, "NR30", ReadIoRegister<&APU::ReadReg<APU::Reg::NR30>>, WriteIoRegister<&APU::WriteReg<APU::Reg::NR30>> },
+		{ NR31, "NR31", ReadIoRegister<&APU::ReadReg<APU::Reg::NR31>>, WriteIoRegister<&APU::WriteReg<APU::Reg::NR31>> },
+		{ NR32, "NR32", ReadIoRegister<&APU::ReadReg<APU::Reg::NR32>>, WriteIoRegister<&APU::WriteReg<APU::Reg::NR32>> },
+		{ NR33, "NR33", ReadIoRegister<&APU::ReadReg<APU::Reg::NR33>>, WriteIoRegister<&APU::WriteReg<APU::Reg::NR33>> },
+		{ NR34, "NR34", ReadIoRegister<&APU::ReadReg<APU::Reg::NR34>>, WriteIoRegister<&APU::WriteReg<APU::Reg::NR34>> },
+		{ NR41, "NR41", ReadIoRegister<&APU::ReadReg<APU::Reg::NR41>>, WriteIoRegister<&APU::WriteReg<APU::Reg::NR41>> },
+		{ NR42, "NR42", ReadIoRegister<&APU::ReadReg<APU::Reg::NR42>>, WriteIoRegister<&APU::WriteReg<APU::Reg::NR42>> },
+		{ NR43, "NR43", ReadIoRegister<&APU::ReadReg<APU::Reg::NR43>>, WriteIoRegister<&APU::WriteReg<APU::Reg::NR43>> },
+		{ NR44, "NR44", ReadIoRegister<&APU::ReadReg<APU::Reg::NR44>>, WriteIoRegister<&APU::WriteReg<APU::Reg::NR44>> },
+		{ NR50, "NR50", ReadIoRegister<&APU::ReadReg<APU::Reg::NR50>>, WriteIoRegister<&APU::WriteReg<APU::Reg::NR50>> },
+		{ NR51, "NR51", ReadIoRegister<&APU::ReadReg<APU::Reg::NR51>>, WriteIoRegister<&APU::WriteReg<APU::Reg::NR51>> },
+		{ NR52, "NR52", ReadIoRegister<&APU::ReadReg<APU::Reg::NR52>>, WriteIoRegister<&APU::WriteReg<APU::Reg::NR52>> },
+		{ 0xFF30, {}, ReadIoRegister<&Bus::ReadWaveRam<0xFF30>>, WriteIoRegister<&Bus::WriteWaveRam<0xFF30>> },
+		{ 0xFF31, {}, ReadIoRegister<&Bus::ReadWaveRam<0xFF31>>, WriteIoRegister<&Bus::WriteWaveRam<0xFF31>> },
+		{ 0xFF32, {}, ReadIoRegister<&Bus::ReadWaveRam<0xFF32>>, WriteIoRegister<&Bus::WriteWaveRam<0xFF32>> },
+		{ 0xFF33, {}, ReadIoRegister<&Bus::ReadWaveRam<0xFF33>>, WriteIoRegister<&Bus::WriteWaveRam<0xFF33>> },
+		{ 0xFF34, {}, ReadIoRegister<&Bus::ReadWaveRam<0xFF34>>, WriteIoRegister<&Bus::WriteWaveRam<0xFF34>> },
+		{ 0xFF35, {}, ReadIoRegister<&Bus::ReadWaveRam<0xFF35>>, WriteIoRegister<&Bus::WriteWaveRam<0xFF35>> },
+		{ 0xFF36, {}, ReadIoRegister<&Bus::ReadWaveRam<0xFF36>>, WriteIoRegister<&Bus::WriteWaveRam<0xFF36>> },
+		{ 0xFF37, {}, ReadIoRegister<&Bus::ReadWaveRam<0xFF37>>, WriteIoRegister<&Bus::WriteWaveRam<0xFF37>> },
+		{ 0xFF38, {}, ReadIoRegister<&Bus::ReadWaveRam<0xFF38>>, WriteIoRegister<&Bus::WriteWaveRam<0xFF38>> },
+		{ 0xFF39, {}, ReadIoRegister<&Bus::ReadWaveRam<0xFF39>>, WriteIoRegister<&Bus::WriteWaveRam<0xFF39>> },
+		{ 0xFF3A, {}, ReadIoRegister<&Bus::ReadWaveRam<0xFF3A>>, WriteIoRegister<&Bus::WriteWaveRam<0xFF3A>> },
+		{ 0xFF3B, {}, ReadIoRegister<&Bus::ReadWaveRam<0xFF3B>>, WriteIoRegister<&Bus::WriteWaveRam<0xFF3B>> },
+		{ 0xFF3C, {}, ReadIoRegister<&Bus::ReadWaveRam<0xFF3C>>, WriteIoRegister<&Bus::WriteWaveRam<0xFF3C>> },
+		{ 0xFF3D, {}, ReadIoRegister<&Bus::ReadWaveRam<0xFF3D>>, WriteIoRegister<&Bus::WriteWaveRam<0xFF3D>> },
+		{ 0xFF3E, {}, ReadIoRegister<&Bus::ReadWaveRam<0xFF3E>>, WriteIoRegister<&Bus::WriteWaveRam<0xFF3E>> },
+		{ 0xFF3F, {}, ReadIoRegister<&Bus::ReadWaveRam<0xFF3F>>, WriteIoRegister<&Bus::WriteWaveRam<0xFF3F>> },
+		{ LCDC, "LCDC", ReadIoRegister<&PPU::ReadLCDC>, WriteIoRegister<&PPU::WriteLCDC> },
+		{ STAT, "STAT", ReadIoRegister<&PPU::ReadSTAT>, WriteIoRegister<&PPU::WriteSTAT> },
+		{ SCY, "SCY", ReadIoRegister<&PPU::ReadSCY>, WriteIoRegister<&PPU::WriteSCY> },
+		{ SCX, "SCX", ReadIoRegister<&PPU::ReadSCX>, WriteIoRegister<&PPU::WriteSCX> },
+		{ LY, "LY", ReadIoRegister<&PPU::ReadLY>, WriteIoRegister<&PPU::WriteLY> },
+		{ LYC, "LYC", ReadIoRegister<&PPU::ReadLYC>, WriteIoRegister<&PPU::WriteLYC> },
+		{ DMA, "DMA", ReadIoRegister<&DMA::ReadReg<DMA::Reg::DMA>>, WriteIoRegister<&DMA::WriteReg<DMA::Reg::DMA>> },
+		{ BGP, "BGP", ReadIoRegister<&PPU::ReadBGP>, WriteIoRegister<&PPU::WriteBGP> },
+		{ OBP0, "OBP0", ReadIoRegister<&PPU::ReadOBP0>, WriteIoRegister<&PPU::WriteOBP0> },
+		{ OBP1, "OBP1", ReadIoRegister<&PPU::ReadOBP1>, WriteIoRegister<&PPU::WriteOBP1> },
+		{ WY, "WY", ReadIoRegister<&PPU::ReadWY>, WriteIoRegister<&PPU::WriteWY> },
+		{ WX, "WX", ReadIoRegister<&PPU::ReadWX>, WriteIoRegister<&PPU::WriteWX> },
+		{ KEY0, "KEY0", nullptr, nullptr },
+		{ KEY1, "KEY1", ReadIoRegister<&System::ReadKey1>, WriteIoRegister<&System::WriteKey1> },
+		{ VBK, "VBK", ReadIoRegister<&PPU::ReadVBK>, WriteIoRegister<&PPU::WriteVBK> },
+		{ BOOT, "BOOT", nullptr, WriteIoRegister<&Bus::WriteBOOT> },
+		{ HDMA1, "HDMA1", ReadIoRegister<&DMA::ReadReg<DMA::Reg::HDMA1>>, WriteIoRegister<&DMA::WriteReg<DMA::Reg::HDMA1>> },
+		{ HDMA2, "HDMA2", ReadIoRegister<&DMA::ReadReg<DMA::Reg::HDMA2>>, WriteIoRegister<&DMA::WriteReg<DMA::Reg::HDMA2>> },
+		{ HDMA3, "HDMA3", ReadIoRegister<&DMA::ReadReg<DMA::Reg::HDMA3>>, WriteIoRegister<&DMA::WriteReg<DMA::Reg::HDMA3>> },
+		{ HDMA4, "HDMA4", ReadIoRegister<&DMA::ReadReg<DMA::Reg::HDMA4>>, WriteIoRegister<&DMA::WriteReg<DMA::Reg::HDMA4>> },
+		{ HDMA5, "HDMA5", ReadIoRegister<&DMA::ReadReg<DMA::Reg::HDMA5>>, WriteIoRegister<&DMA::WriteReg<DMA::Reg::HDMA5>> },
+		{ RP, "RP", nullptr, nullptr },
+		{ BCPS, "BCPS", ReadIoRegister<&PPU::ReadBCPS>, WriteIoRegister<&PPU::WriteBCPS> },
+		{ BCPD, "BCPD", ReadIoRegister<&PPU::ReadBCPD>, WriteIoRegister<&PPU::WriteBCPD> },
+		{ OCPS, "OCPS", ReadIoRegister<&PPU::ReadOCPS>, WriteIoRegister<&PPU::WriteOCPS> },
+		{ OCPD, "OCPD", ReadIoRegister<&PPU::ReadOCPD>, WriteIoRegister<&PPU::WriteOCPD> },
+		{ OPRI, "OPRI", ReadIoRegister<&PPU::ReadOPRI>, WriteIoRegister<&PPU::WriteOPRI> },
+		{ SVBK, "SVBK", ReadIoRegister<&Bus::ReadSVBK>, WriteIoRegister<&Bus::WriteSVBK> },
+		{ PCM12, "PCM12", ReadIoRegister<&APU::ReadReg<APU::Reg::PCM12>>, WriteIoRegister<&APU::WriteReg<APU::Reg::PCM12>> },
+		{ PCM34, "PCM34", ReadIoRegister<&APU::ReadReg<APU::Reg::PCM34>>, WriteIoRegister<&APU::WriteReg<APU::Reg::PCM34>> }
+	});
+
+	std::array<IoRegister, 0x80> table{};
+	for (uint i = 0; i < table.size(); ++i) {
+		table[i] = { u16(0xFF00 + i), {}, nullptr, nullptr };
+	}
+	for (const IoRegister& reg : io_register_list) {
+		table[reg.addr - 0xFF00] = reg;
+	}
+	for (IoRegister& reg : table) {
+		if (!reg.read) {
+			reg.read = ReadIoRegister<&Bus::ReadOpenBus>;
+			reg.open_bus_bits = 0xFF;
+		}
+		if (!reg.write) {
+			reg.write = WriteIoRegister<&Bus::WriteOpenBus>;
 		}
 	}
+	return table;
+}
+
+
+constinit const std::array<Bus::IoRegister, 0x80> Bus::io_registers = MakeIoRegisterTable();
+
+
+std::span<const u8> Bus::GetHram()
+{
+	return hram;
+}
+
+
+u8* Bus::GetHramHostPointer()
+{
+	return hram.data();
+}
+
+
+u64 Bus::GetIoAccessCount(u16 addr)
+{
+	return io_access_counts[addr - 0xFF00];
+}
+
+
+uint Bus::GetMapGeneration()
+{
+	return map_generation;
+}
 
 
-	bool LoadBootRom(const std::string& path)
-	{
-		//std::optional<std::vector<u8>> opt_vec = Util::Files::LoadBinaryFileVec(path);
-		//if (!opt_vec.has_value()) {
-		//	UserMessage::Show(std::format("Could not load boot rom at path {}", path), 
-		//		UserMessage::Type::Warning);
-		//	boot_rom_mapped = false;
-		//	return false;
-		//}
-		//cgb_boot_rom = opt_vec.value();
-		//boot_rom_mapped = true;
-		return true;
+const u8* const* Bus::GetReadPageTable()
+{
+	return read_pages.data();
+}
+
+
+const u8* Bus::GetRomHostPointer(u16 addr)
+{
+	if (addr >= 0x8000) {
+		return nullptr;
 	}
+	const u8* page = read_pages[addr >> 8];
+	return page ? page + (addr & 0xFF) : nullptr;
+}
+
 
+std::span<const u8> Bus::GetWram()
+{
+	return wram;
+}
 
-	u8 Peek(u16 addr)
-	{
-		/* No read in my emulator has side-effects. */
-		return Read(addr);
+
+u8* const* Bus::GetWritePageTable()
+{
+	return write_pages.data();
+}
+
+
+void Bus::Initialize()
+{
+	wram.fill(0);
+	unused_memory_area.fill(0);
+	hram.fill(0);
+	io_access_counts.fill(0);
+	current_wram_bank = 1;
+	boot_rom_mapped = true;
+	UpdateRomPages();
+	UpdateWramPages();
+}
+
+
+std::string_view Bus::IoAddrToString(u16 addr)
+{
+	if (addr >= 0xFF00 && addr <= 0xFF7F) {
+		return io_registers[addr - 0xFF00].name;
 	}
+	return addr == IE ? "IE" : std::string_view{};
+}
 
 
-	u8 Read(u16 addr)
-	{
-		switch (addr >> 12) {
-		case 0: /* $0000-$0FFF -- Cartridge ROM / boot ROM (0-FF DMG / 0-8FF CGB) */
-			if (boot_rom_mapped) {
-				if (System::mode == System::Mode::DMG && addr < Boot::dmg_boot_rom.size()) {
-					return Boot::dmg_boot_rom[addr];
-				}
-				else if (System::mode == System::Mode::CGB && addr < Boot::cgb_boot_rom.size()) {
-					return Boot::cgb_boot_rom[addr];
-				}
-				else {
-					return Cartridge::ReadRom(addr);
-				}
-			}
-			else {
-				return Cartridge::ReadRom(addr);
-			}
+bool Bus::LoadBootRom(const std::string& path)
+{
+	//std::optional<std::vector<u8>> opt_vec = Util::Files::LoadBinaryFileVec(path);
+	//if (!opt_vec.has_value()) {
+	//	UserMessage::Show(std::format("Could not load boot rom at path {}", path), 
+	//		UserMessage::Type::Warning);
+	//	boot_rom_mapped = false;
+	//	return false;
+	//}
+	//cgb_boot_rom = opt_vec.value();
+	//boot_rom_mapped = true;
+	return true;
+}
+
+
+void Bus::MapCartridgeRam(u8* bank, uint size)
+{
+	MapPages(0xA0, 0x20, nullptr, nullptr);
+	MapPages(0xA0, size / page_size, bank, bank);
+}
+
 
-		case 1: case 2: case 3: case 4: case 5: case 6: case 7: /* $1000-$7FFF -- Cartridge ROM */
-			return Cartridge::ReadRom(addr);
+void Bus::MapCartridgeRom(const u8* bank_0, const u8* bank_x)
+{
+	cartridge_rom_bank_0 = bank_0;
+	cartridge_rom_bank_x = bank_x;
+	UpdateRomPages();
+}
 
-		case 8: case 9: /* $8000-$9FFF -- VRAM */
-			return PPU::ReadVramCpu(addr);
 
-		case 0xA: case 0xB: /* $A000-$BFFF -- Cartridge RAM */
-			return Cartridge::ReadRam(addr);
+void Bus::MapPages(uint first_page, uint num_pages, const u8* read_memory, u8* write_memory)
+{
+	fetch_region_size = 0;
+	++map_generation;
+	for (uint page = first_page; page < first_page + num_pages; ++page) {
+		read_pages[page] = read_memory;
+		write_pages[page] = write_memory;
+		if (read_memory) {
+			read_memory += page_size;
+		}
+		if (write_memory) {
+			write_memory += page_size;
+		}
+	}
+}
 
-		case 0xC: /* $C000-$CFFF -- WRAM bank 0 */
-			return wram[addr - 0xC000];
 
-		case 0xD: /* $D000-$DFFF -- WRAM bank 1-7 (switchable in GBC mode only; in DMG mode always 1) */
-			return wram[addr - 0xD000 + current_wram_bank * wram_bank_size];
+u8 Bus::Peek(u16 addr)
+{
+	/* No read in my emulator has side-effects. */
+	return Read(addr);
+}
 
-		case 0xE: /* $E000-$EFFF -- ECHO; mirror of $C000-$CFFF */
-			return wram[addr - 0xE000];
 
-		case 0xF:
-			if (addr <= 0xFDFF) { /* $F000-$FDFF -- ECHO; mirror of $D000-$DDFF */
-				return wram[addr - 0xF000 + current_wram_bank * wram_bank_size];
-			}
-			else if (addr <= 0xFE9F) { /* $FE00-$FE9F -- OAM */
-				return PPU::ReadOamCpu(addr - 0xFE00);
-			}
-			else if (addr <= 0xFEFF) { /* $FEA0-$FEFF -- "Unused" */
-				// In DMG mode, reading returns 0. In CGB mode, see section 2.10 in TCAGBD.pdf
-				if (System::mode == System::Mode::CGB) {
-					return (PPU::ReadLCDC() & 3) == 3
-						? 0xFF
-						: unused_memory_area[addr - 0xFEA0];
-				}
-				else {
-					return 0;
-				}
-			}
-			else if (addr <= 0xFF7F) { /* $FF00-$FF7F -- I/O */
-				u8 value = ReadIO(addr);
-				if constexpr (Debug::log_io) {
-					Debug::LogIoRead(addr, value);
-				}
-				return value;
+u8 Bus::Read(u16 addr)
+{
+	if (const u8* page = read_pages[addr >> 8]) {
+		return page[addr & 0xFF];
+	}
+	return ReadSlow(addr);
+}
+
+
+u8 Bus::ReadSVBK()
+{
+	GB& gb = static_cast<GB&>(*this);
+	return gb.System::mode == System::Mode::CGB
+		? current_wram_bank | 0xF8
+		: 0xFF;
+}
+
+
+u8 Bus::ReadSlow(u16 addr)
+{
+	GB& gb = static_cast<GB&>(*this);
+	switch (addr >> 12) {
+	case 0: /* $0000-$0FFF -- Cartridge ROM / boot ROM (0-FF DMG / 0-8FF CGB) */
+		if (boot_rom_mapped) {
+			if (gb.System::mode == System::Mode::DMG && addr < Boot::dmg_boot_rom.size()) {
+				return Boot::dmg_boot_rom[addr];
 			}
-			else if (addr <= 0xFFFE) { /* $FF80-$FFFE -- HRAM */
-				return hram[addr - 0xFF80];
+			else if (gb.System::mode == System::Mode::CGB && addr < Boot::cgb_boot_rom.size()) {
+				return Boot::cgb_boot_rom[addr];
 			}
-			else { /* $FFFF -- IE */
-				u8 value = CPU::ReadIE();
-				if constexpr (Debug::log_io) {
-					Debug::LogIoRead(addr, value);
-				}
-				return value;
+			else {
+				return gb.Cartridge::ReadRom(addr);
 			}
-
-		default:
-			std::unreachable();
 		}
-	}
+		else {
+			return gb.Cartridge::ReadRom(addr);
+		}
 
+	case 1: case 2: case 3: case 4: case 5: case 6: case 7: /* $1000-$7FFF -- Cartridge ROM */
+		return gb.Cartridge::ReadRom(addr);
 
-	u8 ReadIO(u16 addr)
-	{
-		switch (addr) {
-		case Addr::P1: return Joypad::ReadP1();
-		case Addr::SB: return Serial::ReadSB();
-		case Addr::SC: return Serial::ReadSC();
-		case Addr::DIV: return Timer::ReadDIV();
-		case Addr::TIMA: return Timer::ReadTIMA();
-		case Addr::TMA: return Timer::ReadTMA();
-		case Addr::TAC: return Timer::ReadTAC();
-		case Addr::IF: return CPU::ReadIF();
-		case Addr::NR10: return APU::ReadReg<APU::Reg::NR10>();
-		case Addr::NR11: return APU::ReadReg<APU::Reg::NR11>();
-		case Addr::NR12: return APU::ReadReg<APU::Reg::NR12>();
-		case Addr::NR13: return APU::ReadReg<APU::Reg::NR13>();
-		case Addr::NR14: return APU::ReadReg<APU::Reg::NR14>();
-		case Addr::NR21: return APU::ReadReg<APU::Reg::NR21>();
-		case Addr::NR22: return APU::ReadReg<APU::Reg::NR22>();
-		case Addr::NR23: return APU::ReadReg<APU::Reg::NR23>();
-		case Addr::NR24: return APU::ReadReg<APU::Reg::NR24>();
-		case Addr::NR30: return APU::ReadReg<APU::Reg::NR30>();
-		case Addr::NR31: return APU::ReadReg<APU::Reg::NR31>();
-		case Addr::NR32: return APU::ReadReg<APU::Reg::NR32>();
-		case Addr::NR33: return APU::ReadReg<APU::Reg::NR33>();
-		case Addr::NR34: return APU::ReadReg<APU::Reg::NR34>();
-		case Addr::NR41: return APU::ReadReg<APU::Reg::NR41>();
-		case Addr::NR42: return APU::ReadReg<APU::Reg::NR42>();
-		case Addr::NR43: return APU::ReadReg<APU::Reg::NR43>();
-		case Addr::NR44: return APU::ReadReg<APU::Reg::NR44>();
-		case Addr::NR50: return APU::ReadReg<APU::Reg::NR50>();
-		case Addr::NR51: return APU::ReadReg<APU::Reg::NR51>();
-		case Addr::NR52: return APU::ReadReg<APU::Reg::NR52>();
-		case Addr::LCDC: return PPU::ReadLCDC();
-		case Addr::STAT: return PPU::ReadSTAT();
-		case Addr::SCY: return PPU::ReadSCY();
-		case Addr::SCX: return PPU::ReadSCX();
-		case Addr::LY: return PPU::ReadLY();
-		case Addr::LYC: return PPU::ReadLYC();
-		case Addr::DMA: return DMA::ReadReg<DMA::Reg::DMA>();
-		case Addr::BGP: return PPU::ReadBGP();
-		case Addr::OBP0: return PPU::ReadOBP0();
-		case Addr::OBP1: return PPU::ReadOBP1();
-		case Addr::WY: return PPU::ReadWY();
-		case Addr::WX: return PPU::ReadWX();
-		case Addr::KEY1: return System::ReadKey1();
-		case Addr::VBK: return PPU::ReadVBK();
-		case Addr::HDMA1: return DMA::ReadReg<DMA::Reg::HDMA1>();
-		case Addr::HDMA2: return DMA::ReadReg<DMA::Reg::HDMA2>();
-		case Addr::HDMA3: return DMA::ReadReg<DMA::Reg::HDMA3>();
-		case Addr::HDMA4: return DMA::ReadReg<DMA::Reg::HDMA4>();
-		case Addr::HDMA5: return DMA::ReadReg<DMA::Reg::HDMA5>();
-		case Addr::RP: return 0xFF; // todo
-		case Addr::BCPS: return PPU::ReadBCPS();
-		case Addr::BCPD: return PPU::ReadBCPD();
-		case Addr::OCPS: return PPU::ReadOCPS();
-		case Addr::OCPD: return PPU::ReadOCPD();
-		case Addr::OPRI: return PPU::ReadOPRI();
-		case Addr::PCM12: return APU::ReadReg<APU::Reg::PCM12>();
-		case Addr::PCM34: return APU::ReadReg<APU::Reg::PCM34>();
-
-		case Addr::SVBK:
-			return System::mode == System::Mode::CGB
-				? current_wram_bank | 0xF8
-				: 0xFF;
-
-		case 0xFF30: case 0xFF31: case 0xFF32: case 0xFF33:
-		case 0xFF34: case 0xFF35: case 0xFF36: case 0xFF37:
-		case 0xFF38: case 0xFF39: case 0xFF3A: case 0xFF3B:
-		case 0xFF3C: case 0xFF3D: case 0xFF3E: case 0xFF3F:
-			return APU::ReadWaveRamCpu(addr);
-
-		default:
-			return 0xFF;
-		}
-	}
+	case 8: case 9: /* $8000-$9FFF -- VRAM */
+		return gb.PPU::ReadVramCpu(addr);
 
+	case 0xA: case 0xB: /* $A000-$BFFF -- Cartridge RAM */
+		return gb.Cartridge::ReadRam(addr);
 
-	u8 ReadPageFF(u8 offset)
-	{
-		u16 addr = 0xFF00 | offset;
-		if (addr <= 0xFF7F) { /* $FF00-$FF7F -- I/O */
-			u8 value = ReadIO(addr);
-			if constexpr (Debug::log_io) {
-				Debug::LogIoRead(addr, value);
+	case 0xC: /* $C000-$CFFF -- WRAM bank 0 */
+		return wram[addr - 0xC000];
+
+	case 0xD: /* $D000-$DFFF -- WRAM bank 1-7 (switchable in GBC mode only; in DMG mode always 1) */
+		return wram[addr - 0xD000 + current_wram_bank * wram_bank_size];
+
+	case 0xE: /* $E000-$EFFF -- ECHO; mirror of $C000-$CFFF */
+		return wram[addr - 0xE000];
+
+	case 0xF:
+		if (addr <= 0xFDFF) { /* $F000-$FDFF -- ECHO; mirror of $D000-$DDFF */
+			return wram[addr - 0xF000 + current_wram_bank * wram_bank_size];
+		}
+		else if (addr <= 0xFE9F) { /* $FE00-$FE9F -- OAM */
+			return gb.PPU::ReadOamCpu(addr - 0xFE00);
+		}
+		else if (addr <= 0xFEFF) { /* $FEA0-$FEFF -- "Unused" */
+			// In DMG mode, reading returns 0. In CGB mode, see section 2.10 in TCAGBD.pdf
+			if (gb.System::mode == System::Mode::CGB) {
+				return (gb.PPU::ReadLCDC() & 3) == 3
+					? 0xFF
+					: unused_memory_area[addr - 0xFEA0];
 			}
-			return value;
+			else {
+				return 0;
+			}
+		}
+		else if (addr <= 0xFF7F) { /* $FF00-$FF7F -- I/O */
+			return ReadIO(addr);
 		}
 		else if (addr <= 0xFFFE) { /* $FF80-$FFFE -- HRAM */
 			return hram[addr - 0xFF80];
 		}
 		else { /* $FFFF -- IE */
-			u8 value = CPU::ReadIE();
+			u8 value = gb.CPU::ReadIE();
 			if constexpr (Debug::log_io) {
 				Debug::LogIoRead(addr, value);
 			}
 			return value;
 		}
-	}
-
 
-	/* This function is identical to the ordinary "Read" function. However, most of the time,
-	   when we read from PC, it should be in game code. Thus, we can get better branch prediction
-	   by splitting up PC and non-PC reads. */
-	u8 ReadPC(u16 addr)
-	{
-		switch (addr >> 12) {
-		case 0: /* $0000-$0FFF -- Cartridge ROM / boot ROM (0-FF DMG / 0-8FF CGB) */
-			if (boot_rom_mapped) {
-				if (System::mode == System::Mode::DMG && addr < Boot::dmg_boot_rom.size()) {
-					return Boot::dmg_boot_rom[addr];
-				}
-				else if (System::mode == System::Mode::CGB && addr < Boot::cgb_boot_rom.size()) {
-					return Boot::cgb_boot_rom[addr];
-				}
-				else {
-					return Cartridge::ReadRom(addr);
-				}
-			}
-			else {
-				return Cartridge::ReadRom(addr);
-			}
-
-		case 1: case 2: case 3: case 4: case 5: case 6: case 7: /* $1000-$7FFF -- Cartridge ROM */
-			return Cartridge::ReadRom(addr);
-
-		case 8: case 9: /* $8000-$9FFF -- VRAM */
-			return PPU::ReadVramCpu(addr);
+	default:
+		std::unreachable();
+	}
+}
 
-		case 0xA: case 0xB: /* $A000-$BFFF -- Cartridge RAM */
-			return Cartridge::ReadRam(addr);
 
-		case 0xC: /* $C000-$CFFF -- WRAM bank 0 */
-			return wram[addr - 0xC000];
+u8 Bus::ReadIO(u16 addr)
+{
+	const IoRegister& reg = io_registers[addr - 0xFF00];
+	u8 value = reg.read(*this) | reg.open_bus_bits;
+	if constexpr (Debug::count_io_accesses) {
+		++io_access_counts[addr - 0xFF00];
+	}
+	if constexpr (Debug::log_io) {
+		Debug::LogIoRead(addr, value);
+	}
+	return value;
+}
 
-		case 0xD: /* $D000-$DFFF -- WRAM bank 1-7 (switchable in GBC mode only; in DMG mode always 1) */
-			return wram[addr - 0xD000 + current_wram_bank * wram_bank_size];
 
-		case 0xE: /* $E000-$EFFF -- ECHO; mirror of $C000-$CFFF */
-			return wram[addr - 0xE000];
+u8 Bus::ReadOpenBus()
+{
+	return 0;
+}
 
-		case 0xF:
-			if (addr <= 0xFDFF) { /* $F000-$FDFF -- ECHO; mirror of $D000-$DDFF */
-				return wram[addr - 0xF000 + current_wram_bank * wram_bank_size];
-			}
-			else if (addr <= 0xFE9F) { /* $FE00-$FE9F -- OAM */
-				return PPU::ReadOamCpu(addr - 0xFE00);
-			}
-			else if (addr <= 0xFEFF) { /* $FEA0-$FEFF -- "Unused" */
-				// In DMG mode, reading returns 0. In CGB mode, see section 2.10 in TCAGBD.pdf
-				if (System::mode == System::Mode::CGB) {
-					return (PPU::ReadLCDC() & 3) == 3
-						? 0xFF
-						: unused_memory_area[addr - 0xFEA0];
-				}
-				else {
-					return 0;
-				}
-			}
-			else if (addr <= 0xFF7F) { /* $FF00-$FF7F -- I/O */
-				u8 value = ReadIO(addr);
-				if constexpr (Debug::log_io) {
-					Debug::LogIoRead(addr, value);
-				}
-				return value;
-			}
-			else if (addr <= 0xFFFE) { /* $FF80-$FFFE -- HRAM */
-				return hram[addr - 0xFF80];
-			}
-			else { /* $FFFF -- IE */
-				u8 value = CPU::ReadIE();
-				if constexpr (Debug::log_io) {
-					Debug::LogIoRead(addr, value);
-				}
-				return value;
-			}
 
-		default:
-			std::unreachable();
+u8 Bus::ReadPageFF(u8 offset)
+{
+	GB& gb = static_cast<GB&>(*this);
+	u16 addr = 0xFF00 | offset;
+	if (addr <= 0xFF7F) { /* $FF00-$FF7F -- I/O */
+		return ReadIO(addr);
+	}
+	else if (addr <= 0xFFFE) { /* $FF80-$FFFE -- HRAM */
+		return hram[addr - 0xFF80];
+	}
+	else { /* $FFFF -- IE */
+		u8 value = gb.CPU::ReadIE();
+		if constexpr (Debug::log_io) {
+			Debug::LogIoRead(addr, value);
 		}
+		return value;
 	}
+}
 
 
-	void StreamState(SerializationStream& stream)
-	{
-		stream.StreamPrimitive(boot_rom_mapped);
-		stream.StreamPrimitive(current_wram_bank);
-		stream.StreamArray(wram);
-		stream.StreamArray(unused_memory_area);
-		stream.StreamArray(hram);
+/* Opcode and immediate fetches make up most bus accesses, and nearly all of them are made in the same
+   region of memory as the previous fetch. The region is only looked up again when PC leaves it, or when
+   the memory map changes (see 'MapPages'). */
+u8 Bus::ReadPC(u16 addr)
+{
+	u16 offset = addr - fetch_region_start;
+	if (offset < fetch_region_size) {
+		return fetch_region[offset];
 	}
+	UpdateFetchRegion(addr);
+	if (fetch_region_size > 0) {
+		return fetch_region[addr - fetch_region_start];
+	}
+	return ReadSlow(addr); /* executing from VRAM, OAM, I/O, or cart RAM behind the banking controller */
+}
 
 
-	void Write(const u16 addr, const u8 data)
-	{
-		switch (addr >> 12) {
-		case 0: case 1: case 2: case 3: case 4: case 5: case 6: case 7: /* $0000-$7FFF -- Cartridge ROM */
-			Cartridge::WriteRom(addr, data);
-			break;
-
-		case 8: case 9: /* $8000-$9FFF -- VRAM */
-			PPU::WriteVramCpu(addr, data);
-			break;
+template<u16 addr>
+u8 Bus::ReadWaveRam()
+{
+	GB& gb = static_cast<GB&>(*this);
+	return gb.APU::ReadWaveRamCpu(addr);
+}
 
-		case 0xA: case 0xB: /* $A000-$BFFF -- Cartridge RAM */
-			Cartridge::WriteRam(addr, data);
-			break;
 
-		case 0xC: /* $C000-$CFFF -- WRAM bank 0 */
-			wram[addr - 0xC000] = data;;
-			break;
+void Bus::StreamState(SerializationStream& stream)
+{
+	stream.StreamPrimitive(boot_rom_mapped);
+	stream.StreamPrimitive(current_wram_bank);
+	stream.StreamArray(wram);
+	stream.StreamArray(unused_memory_area);
+	stream.StreamArray(hram);
+	UpdateRomPages();
+	UpdateWramPages();
+}
 
-		case 0xD: /* $D000-$DFFF -- WRAM bank 1-7 (switchable in GBC mode only; in DMG mode always 1) */
-			wram[addr - 0xD000 + current_wram_bank * wram_bank_size] = data;
-			break;
 
-		case 0xE: /* $E000-$EFFF -- ECHO; mirror of $C000-$CFFF */
-			wram[addr - 0xE000] = data;
-			break;
+void Bus::UpdateFetchRegion(u16 addr)
+{
+	if (addr >= 0xFF80 && addr <= 0xFFFE) { /* HRAM is not part of the page table, as it shares its page with I/O */
+		fetch_region = hram.data();
+		fetch_region_start = 0xFF80;
+		fetch_region_size = 0x7F;
+		return;
+	}
+	uint page = addr >> 8;
+	const u8* memory = read_pages[page];
+	if (!memory) {
+		fetch_region_size = 0;
+		return;
+	}
+	/* Bound the region to the ROM bank (16 KiB), cart RAM bank (8 KiB) or WRAM bank (4 KiB) that PC is in,
+	   and within that, to the pages that are contiguous in host memory (the boot ROM only covers part of bank 0). */
+	uint area_first_page = page < 0x80 ? page & 0xC0 : page < 0xC0 ? page & 0xE0 : page & 0xF0;
+	uint area_end_page = std::min(area_first_page + (page < 0x80 ? 0x40 : page < 0xC0 ? 0x20 : 0x10), 0xFEu);
+	uint first_page = page, end_page = page + 1;
+	auto continues_region = [this, memory, page](uint other_page) {
+		const u8* other_memory = read_pages[other_page];
+		return other_memory && other_memory - (s64(other_page) - s64(page)) * page_size == memory;
+	};
+	while (first_page > area_first_page && continues_region(first_page - 1)) {
+		--first_page;
+	}
+	while (end_page < area_end_page && continues_region(end_page)) {
+		++end_page;
+	}
+	fetch_region = read_pages[first_page];
+	fetch_region_start = u16(first_page * page_size);
+	fetch_region_size = (end_page - first_page) * page_size;
+}
 
-		case 0xF:
-			if (addr <= 0xFDFF) { /* $E000-$FDFF -- ECHO; mirror of $D000-$DDFF */
-				wram[addr - 0xF000 + current_wram_bank * wram_bank_size] = data;
-			}
-			else if (addr <= 0xFE9F) { /* $FE00-$FE9F -- OAM */
-				PPU::WriteOamCpu(addr - 0xFE00, data);
-			}
-			else if (addr <= 0xFEFF) { /* $FEA0-$FEFF -- "Unused" */
-				// In DMG mode, writing is ignored. In CGB mode, see section 2.10 in TCAGBD.pdf
-				if (System::mode == System::Mode::CGB && (PPU::ReadLCDC() & 3) != 3) {
-					if (addr <= 0xFEBF) {
-						unused_memory_area[addr - 0xFEA0] = data;
-					}
-					else {
-						unused_memory_area[addr & 0xF | 0x20] = data;
-						unused_memory_area[addr & 0xF | 0x30] = data;
-						unused_memory_area[addr & 0xF | 0x40] = data;
-						unused_memory_area[addr & 0xF | 0x50] = data;
-					}
-				}
-			}
-			else if (addr <= 0xFF7F) { /* $FF00-$FF7F -- I/O */
-				if constexpr (Debug::log_io) {
-					Debug::LogIoWrite(addr, data);
-				}
-				WriteIO(addr, data);
-			}
-			else if (addr <= 0xFFFE) { /* $FF80-$FFFE -- HRAM */
-				hram[addr - 0xFF80] = data;
-			}
-			else { /* $FFFF -- IE */
-				if constexpr (Debug::log_io) {
-					Debug::LogIoWrite(addr, data);
-				}
-				CPU::WriteIE(data);
-			}
-			break;
 
-		default:
-			std::unreachable();
+void Bus::UpdateRomPages()
+{
+	GB& gb = static_cast<GB&>(*this);
+	MapPages(0x00, 0x40, cartridge_rom_bank_0, nullptr);
+	MapPages(0x40, 0x40, cartridge_rom_bank_x, nullptr);
+	if (boot_rom_mapped) { /* the boot ROM is laid over the start of ROM bank 0 */
+		if (gb.System::mode == System::Mode::DMG) {
+			MapPages(0x00, Boot::dmg_boot_rom.size() / page_size, Boot::dmg_boot_rom.data(), nullptr);
+		}
+		else {
+			MapPages(0x00, Boot::cgb_boot_rom.size() / page_size, Boot::cgb_boot_rom.data(), nullptr);
 		}
 	}
+}
 
 
-	void WriteIO(u16 addr, u8 data)
-	{
-		switch (addr) {
-		case Addr::P1: Joypad::WriteP1(data); break;
-		case Addr::SB: Serial::WriteSB(data); break;
-		case Addr::SC: Serial::WriteSC(data); break;
-		case Addr::DIV: Timer::WriteDIV(data); break;
-		case Addr::TIMA: Timer::WriteTIMA(data); break;
-		case Addr::TMA: Timer::WriteTMA(data); break;
-		case Addr::TAC: Timer::WriteTAC(data); break;
-		case Addr::IF: CPU::WriteIF(data); break;
-		case Addr::NR10: APU::WriteReg<APU::Reg::NR10>(data); break;
-		case Addr::NR11: APU::WriteReg<APU::Reg::NR11>(data); break;
-		case Addr::NR12: APU::WriteReg<APU::Reg::NR12>(data); break;
-		case Addr::NR13: APU::WriteReg<APU::Reg::NR13>(data); break;
-		case Addr::NR14: APU::WriteReg<APU::Reg::NR14>(data); break;
-		case Addr::NR21: APU::WriteReg<APU::Reg::NR21>(data); break;
-		case Addr::NR22: APU::WriteReg<APU::Reg::NR22>(data); break;
-		case Addr::NR23: APU::WriteReg<APU::Reg::NR23>(data); break;
-		case Addr::NR24: APU::WriteReg<APU::Reg::NR24>(data); break;
-		case Addr::NR30: APU::WriteReg<APU::Reg::NR30>(data); break;
-		case Addr::NR31: APU::WriteReg<APU::Reg::NR31>(data); break;
-		case Addr::NR32: APU::WriteReg<APU::Reg::NR32>(data); break;
-		case Addr::NR33: APU::WriteReg<APU::Reg::NR33>(data); break;
-		case Addr::NR34: APU::WriteReg<APU::Reg::NR34>(data); break;
-		case Addr::NR41: APU::WriteReg<APU::Reg::NR41>(data); break;
-		case Addr::NR42: APU::WriteReg<APU::Reg::NR42>(data); break;
-		case Addr::NR43: APU::WriteReg<APU::Reg::NR43>(data); break;
-		case Addr::NR44: APU::WriteReg<APU::Reg::NR44>(data); break;
-		case Addr::NR50: APU::WriteReg<APU::Reg::NR50>(data); break;
-		case Addr::NR51: APU::WriteReg<APU::Reg::NR51>(data); break;
-		case Addr::NR52: APU::WriteReg<APU::Reg::NR52>(data); break;
-		case Addr::LCDC: PPU::WriteLCDC(data); break;
-		case Addr::STAT: PPU::WriteSTAT(data); break;
-		case Addr::SCY: PPU::WriteSCY(data); break;
-		case Addr::SCX: PPU::WriteSCX(data); break;
-		case Addr::LY: PPU::WriteLY(data); break;
-		case Addr::LYC: PPU::WriteLYC(data); break;
-		case Addr::DMA: DMA::WriteReg<DMA::Reg::DMA>(data); break;
-		case Addr::BGP: PPU::WriteBGP(data); break;
-		case Addr::OBP0: PPU::WriteOBP0(data); break;
-		case Addr::OBP1: PPU::WriteOBP1(data); break;
-		case Addr::WY: PPU::WriteWY(data); break;
-		case Addr::WX: PPU::WriteWX(data); break;
-		case Addr::KEY1: System::WriteKey1(data); break;
-		case Addr::VBK: PPU::WriteVBK(data); break;
-		case Addr::BOOT: boot_rom_mapped = false; break;
-		case Addr::HDMA1: DMA::WriteReg<DMA::Reg::HDMA1>(data); break;
-		case Addr::HDMA2: DMA::WriteReg<DMA::Reg::HDMA2>(data); break;
-		case Addr::HDMA3: DMA::WriteReg<DMA::Reg::HDMA3>(data); break;
-		case Addr::HDMA4: DMA::WriteReg<DMA::Reg::HDMA4>(data); break;
-		case Addr::HDMA5: DMA::WriteReg<DMA::Reg::HDMA5>(data); break;
-		case Addr::BCPS: PPU::WriteBCPS(data); break;
-		case Addr::BCPD: PPU::WriteBCPD(data); break;
-		case Addr::OCPS: PPU::WriteOCPS(data); break;
-		case Addr::OCPD: PPU::WriteOCPD(data); break;
-		case Addr::OPRI: PPU::WriteOPRI(data); break;
-		case Addr::PCM12: APU::WriteReg<APU::Reg::PCM12>(data); break;
-		case Addr::PCM34: APU::WriteReg<APU::Reg::PCM34>(data); break;
-
-		case Addr::SVBK: // 0xFF70
-			if (System::mode == System::Mode::CGB) {
-				current_wram_bank = std::min(1, data & 7); // selecting bank 0 will select bank 1
-			}
-			break;
+void Bus::UpdateWramPages()
+{
+	u8* wram_bank_x = &wram[current_wram_bank * wram_bank_size];
+	MapPages(0xC0, 0x10, wram.data(), wram.data()); /* WRAM bank 0 */
+	MapPages(0xD0, 0x10, wram_bank_x, wram_bank_x); /* WRAM bank 1-7 */
+	MapPages(0xE0, 0x10, wram.data(), wram.data()); /* ECHO of bank 0 */
+	MapPages(0xF0, 0x0E, wram_bank_x, wram_bank_x); /* ECHO of bank 1-7, up to $FDFF */
+}
 
-		case 0xFF30: case 0xFF31: case 0xFF32: case 0xFF33:
-		case 0xFF34: case 0xFF35: case 0xFF36: case 0xFF37:
-		case 0xFF38: case 0xFF39: case 0xFF3A: case 0xFF3B:
-		case 0xFF3C: case 0xFF3D: case 0xFF3E: case 0xFF3F:
-			APU::WriteWaveRamCpu(addr, data);
-			break;
 
-		default:
-			break;
-		}
+void Bus::Write(const u16 addr, const u8 data)
+{
+	if (u8* page = write_pages[addr >> 8]) {
+		page[addr & 0xFF] = data;
 	}
+	else {
+		WriteSlow(addr, data);
+	}
+}
 
 
-	void WritePageFF(u8 offset, u8 data)
-	{
-		u16 addr = 0xFF00 | offset;
-		if (addr <= 0xFF7F) { /* $FF00-$FF7F -- I/O */
-			if constexpr (Debug::log_io) {
-				Debug::LogIoWrite(addr, data);
+void Bus::WriteBOOT(u8 data)
+{
+	boot_rom_mapped = false;
+	UpdateRomPages();
+}
+
+
+void Bus::WriteSlow(const u16 addr, const u8 data)
+{
+	GB& gb = static_cast<GB&>(*this);
+	switch (addr >> 12) {
+	case 0: case 1: case 2: case 3: case 4: case 5: case 6: case 7: /* $0000-$7FFF -- Cartridge ROM */
+		gb.Cartridge::WriteRom(addr, data);
+		break;
+
+	case 8: case 9: /* $8000-$9FFF -- VRAM */
+		gb.PPU::WriteVramCpu(addr, data);
+		break;
+
+	case 0xA: case 0xB: /* $A000-$BFFF -- Cartridge RAM */
+		gb.Cartridge::WriteRam(addr, data);
+		break;
+
+	case 0xC: /* $C000-$CFFF -- WRAM bank 0 */
+		wram[addr - 0xC000] = data;;
+		break;
+
+	case 0xD: /* $D000-$DFFF -- WRAM bank 1-7 (switchable in GBC mode only; in DMG mode always 1) */
+		wram[addr - 0xD000 + current_wram_bank * wram_bank_size] = data;
+		break;
+
+	case 0xE: /* $E000-$EFFF -- ECHO; mirror of $C000-$CFFF */
+		wram[addr - 0xE000] = data;
+		break;
+
+	case 0xF:
+		if (addr <= 0xFDFF) { /* $E000-$FDFF -- ECHO; mirror of $D000-$DDFF */
+			wram[addr - 0xF000 + current_wram_bank * wram_bank_size] = data;
+		}
+		else if (addr <= 0xFE9F) { /* $FE00-$FE9F -- OAM */
+			gb.PPU::WriteOamCpu(addr - 0xFE00, data);
+		}
+		else if (addr <= 0xFEFF) { /* $FEA0-$FEFF -- "Unused" */
+			// In DMG mode, writing is ignored. In CGB mode, see section 2.10 in TCAGBD.pdf
+			if (gb.System::mode == System::Mode::CGB && (gb.PPU::ReadLCDC() & 3) != 3) {
+				if (addr <= 0xFEBF) {
+					unused_memory_area[addr - 0xFEA0] = data;
+				}
+				else {
+					unused_memory_area[addr & 0xF | 0x20] = data;
+					unused_memory_area[addr & 0xF | 0x30] = data;
+					unused_memory_area[addr & 0xF | 0x40] = data;
+					unused_memory_area[addr & 0xF | 0x50] = data;
+				}
 			}
+		}
+		else if (addr <= 0xFF7F) { /* $FF00-$FF7F -- I/O */
 			WriteIO(addr, data);
 		}
 		else if (addr <= 0xFFFE) { /* $FF80-$FFFE -- HRAM */
@@ -552,7 +571,66 @@ namespace Bus
 			if constexpr (Debug::log_io) {
 				Debug::LogIoWrite(addr, data);
 			}
-			CPU::WriteIE(data);
+			gb.CPU::WriteIE(data);
 		}
+		break;
+
+	default:
+		std::unreachable();
 	}
+}
+
+
+void Bus::WriteIO(u16 addr, u8 data)
+{
+	if constexpr (Debug::count_io_accesses) {
+		++io_access_counts[addr - 0xFF00];
+	}
+	if constexpr (Debug::log_io) {
+		Debug::LogIoWrite(addr, data);
+	}
+	io_registers[addr - 0xFF00].write(*this, data);
+}
+
+
+void Bus::WriteSVBK(u8 data)
+{
+	GB& gb = static_cast<GB&>(*this);
+	if (gb.System::mode == System::Mode::CGB) {
+		current_wram_bank = std::min(1, data & 7); // selecting bank 0 will select bank 1
+		UpdateWramPages();
+	}
+}
+
+
+void Bus::WriteOpenBus(u8 data)
+{
+
+}
+
+
+void Bus::WritePageFF(u8 offset, u8 data)
+{
+	GB& gb = static_cast<GB&>(*this);
+	u16 addr = 0xFF00 | offset;
+	if (addr <= 0xFF7F) { /* $FF00-$FF7F -- I/O */
+		WriteIO(addr, data);
+	}
+	else if (addr <= 0xFFFE) { /* $FF80-$FFFE -- HRAM */
+		hram[addr - 0xFF80] = data;
+	}
+	else { /* $FFFF -- IE */
+		if constexpr (Debug::log_io) {
+			Debug::LogIoWrite(addr, data);
+		}
+		gb.CPU::WriteIE(data);
+	}
+}
+
+
+template<u16 addr>
+void Bus::WriteWaveRam(u8 data)
+{
+	GB& gb = static_cast<GB&>(*this);
+	gb.APU::WriteWaveRamCpu(addr, data);
 }
\ No newline at end of file
@@ -5,6 +5,7 @@ import Util;
 import <array>;
 import <format>;
 import <optional>;
+import <span>;
 import <string>;
 import <string_view>;
 
@@ -23,96 +24,162 @@ import <string_view>;
 * FFFFh       -- IE Register   -- Interrupt enable flags.
 */
 
-namespace Bus
+export struct Bus
 {
-	export
+	enum Addr : u16
 	{
-		enum Addr : u16
-		{
-			P1    = 0xFF00,
-			SB    = 0xFF01,
-			SC    = 0xFF02,
-			DIV   = 0xFF04,
-			TIMA  = 0xFF05,
-			TMA   = 0xFF06,
-			TAC   = 0xFF07,
-			IF    = 0xFF0F,
-			NR10  = 0xFF10,
-			NR11  = 0xFF11,
-			NR12  = 0xFF12,
-			NR13  = 0xFF13,
-			NR14  = 0xFF14,
-			NR21  = 0xFF16,
-			NR22  = 0xFF17,
-			NR23  = 0xFF18,
-			NR24  = 0xFF19,
-			NR30  = 0xFF1A,
-			NR31  = 0xFF1B,
-			NR32  = 0xFF1C,
-			NR33  = 0xFF1D,
-			NR34  = 0xFF1E,
-			NR41  = 0xFF20,
-			NR42  = 0xFF21,
-			NR43  = 0xFF22,
-			NR44  = 0xFF23,
-			NR50  = 0xFF24,
-			NR51  = 0xFF25,
-			NR52  = 0xFF26,
-			LCDC  = 0xFF40,
-			STAT  = 0xFF41,
-			SCY   = 0xFF42,
-			SCX   = 0xFF43,
-			LY    = 0xFF44,
-			LYC   = 0xFF45,
-			DMA   = 0xFF46,
-			BGP   = 0xFF47,
-			OBP0  = 0xFF48,
-			OBP1  = 0xFF49,
-			WY    = 0xFF4A,
-			WX    = 0xFF4B,
-			KEY0  = 0xFF4C,
-			KEY1  = 0xFF4D,
-			VBK   = 0xFF4F,
-			BOOT  = 0xFF50,
-			HDMA1 = 0xFF51,
-			HDMA2 = 0xFF52,
-			HDMA3 = 0xFF53,
-			HDMA4 = 0xFF54,
-			HDMA5 = 0xFF55,
-			RP    = 0xFF56,
-			BCPS  = 0xFF68,
-			BCPD  = 0xFF69,
-			OCPS  = 0xFF6A,
-			OCPD  = 0xFF6B,
-			OPRI  = 0xFF6C,
-			SVBK  = 0xFF70,
-			PCM12 = 0xFF76,
-			PCM34 = 0xFF77,
-			IE    = 0xFFFF
-		};
-
-		void Initialize();
-		constexpr std::string_view IoAddrToString(u16 addr);
-		bool LoadBootRom(const std::string& path);
-		u8 Peek(u16 addr);
-		u8 Read(u16 addr);
-		u8 ReadPageFF(u8 offset);
-		u8 ReadPC(u16 addr);
-		void StreamState(SerializationStream& stream);
-		void Write(u16 addr, u8 data);
-		void WritePageFF(u8 offset, u8 data);
-	}
+		P1    = 0xFF00,
+		SB    = 0xFF01,
+		SC    = 0xFF02,
+		DIV   = 0xFF04,
+		TIMA  = 0xFF05,
+		TMA   = 0xFF06,
+		TAC   = 0xFF07,
+		IF    = 0xFF0F,
+		NR10  = 0xFF10,
+		NR11  = 0xFF11,
+		NR12  = 0xFF12,
+		NR13  = 0xFF13,
+		NR14  = 0xFF14,
+		NR21  = 0xFF16,
+		NR22  = 0xFF17,
+		NR23  = 0xFF18,
+		NR24  = 0xFF19,
+		NR30  = 0xFF1A,
+		NR31  = 0xFF1B,
+		NR32  = 0xFF1C,
+		NR33  = 0xFF1D,
+		NR34  = 0xFF1E,
+		NR41  = 0xFF20,
+		NR42  = 0xFF21,
+		NR43  = 0xFF22,
+		NR44  = 0xFF23,
+		NR50  = 0xFF24,
+		NR51  = 0xFF25,
+		NR52  = 0xFF26,
+		LCDC  = 0xFF40,
+		STAT  = 0xFF41,
+		SCY   = 0xFF42,
+		SCX   = 0xFF43,
+		LY    = 0xFF44,
+		LYC   = 0xFF45,
+		DMA   = 0xFF46,
+		BGP   = 0xFF47,
+		OBP0  = 0xFF48,
+		OBP1  = 0xFF49,
+		WY    = 0xFF4A,
+		WX    = 0xFF4B,
+		KEY0  = 0xFF4C,
+		KEY1  = 0xFF4D,
+		VBK   = 0xFF4F,
+		BOOT  = 0xFF50,
+		HDMA1 = 0xFF51,
+		HDMA2 = 0xFF52,
+		HDMA3 = 0xFF53,
+		HDMA4 = 0xFF54,
+		HDMA5 = 0xFF55,
+		RP    = 0xFF56,
+		BCPS  = 0xFF68,
+		BCPD  = 0xFF69,
+		OCPS  = 0xFF6A,
+		OCPD  = 0xFF6B,
+		OPRI  = 0xFF6C,
+		SVBK  = 0xFF70,
+		PCM12 = 0xFF76,
+		PCM34 = 0xFF77,
+		IE    = 0xFFFF
+	};
 
+	std::span<const u8> GetHram();
+	/* For the JIT, whose code accesses memory directly */
+	u8* GetHramHostPointer();
+	/* Number of reads and writes made to an I/O register, if 'Debug::count_io_accesses' is set */
+	u64 GetIoAccessCount(u16 addr);
+	/* Incremented whenever any part of the memory map changes */
+	uint GetMapGeneration();
+	/* The page tables (see 'read_pages'), for the JIT */
+	const u8* const* GetReadPageTable();
+	/* The host memory backing a ROM (or boot ROM) address, or nullptr if none is mapped there */
+	const u8* GetRomHostPointer(u16 addr);
+	/* All WRAM banks; on DMG, only the first two are used */
+	std::span<const u8> GetWram();
+	u8* const* GetWritePageTable();
+	void Initialize();
+	static std::string_view IoAddrToString(u16 addr);
+	bool LoadBootRom(const std::string& path);
+	/* Called by the cartridge whenever its banking changes. The ROM banks are 16 KiB, and a nullptr for a cart RAM
+	   bank means that accesses go through 'Cartridge::ReadRam'/'WriteRam' (RAM disabled, MBC2, RTC registers). */
+	void MapCartridgeRam(u8* bank, uint size);
+	void MapCartridgeRom(const u8* bank_0, const u8* bank_x);
+	u8 Peek(u16 addr);
+	u8 Read(u16 addr);
+	u8 ReadPageFF(u8 offset);
+	u8 ReadPC(u16 addr);
+	void StreamState(SerializationStream& stream);
+	void Write(u16 addr, u8 data);
+	void WritePageFF(u8 offset, u8 data);
+
+private:
+	struct IoRegister
+	{
+		u16 addr;
+		std::string_view name;
+		u8(*read)(Bus& bus);
+		void(*write)(Bus& bus, u8 data);
+		u8 open_bus_bits = 0; /* bits that always read as 1 */
+	};
+
+	static constexpr std::array<IoRegister, 0x80> MakeIoRegisterTable();
+
+	template<auto read> static u8 ReadIoRegister(Bus& bus);
+
+	template<u16 addr> u8 ReadWaveRam();
+
+	template<auto write> static void WriteIoRegister(Bus& bus, u8 data);
+
+	template<u16 addr> void WriteWaveRam(u8 data);
+
+	void MapPages(uint first_page, uint num_pages, const u8* read_memory, u8* write_memory);
 	u8 ReadIO(u16 addr);
+	u8 ReadOpenBus();
+	u8 ReadSlow(u16 addr);
+	u8 ReadSVBK();
+	void UpdateFetchRegion(u16 addr);
+	void UpdateRomPages();
+	void UpdateWramPages();
+	void WriteBOOT(u8 data);
 	void WriteIO(u16 addr, u8 data);
+	void WriteOpenBus(u8 data);
+	void WriteSlow(u16 addr, u8 data);
+	void WriteSVBK(u8 data);
+
+	/* Indexed by the address minus 0xFF00. Built at compile time ('constinit' on the definition). */
+	static const std::array<IoRegister, 0x80> io_registers;
 
-	constexpr uint wram_bank_size = 0x1000;
+	static constexpr uint page_size = 0x100;
+	static constexpr uint wram_bank_size = 0x1000;
 
 	bool boot_rom_mapped = false;
 
 	uint current_wram_bank = 1;
+	uint fetch_region_size = 0;
+	uint map_generation = 0;
+
+	u16 fetch_region_start;
+
+	const u8* cartridge_rom_bank_0 = nullptr;
+	const u8* cartridge_rom_bank_x = nullptr;
+	/* Host memory backing the region of the address space that instructions were last fetched from */
+	const u8* fetch_region = nullptr;
+
+	/* The host memory backing each 256-byte page, or nullptr if accesses to the page need handling beyond a load or
+	   store (VRAM, OAM, I/O, cartridge banking controllers). Kept up to date whenever banking registers are written. */
+	std::array<const u8*, 0x100> read_pages;
+	std::array<u8*, 0x100> write_pages;
 
 	std::array<u8, 0x8000> wram;
 	std::array<u8, 0x60>   unused_memory_area;
 	std::array<u8, 0x80>   hram;
-}
\ No newline at end of file
+
+	std::array<u64, 0x80> io_access_counts;
+};
\ No newline at end of file
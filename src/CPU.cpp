@@ -1,1384 +1,1986 @@
 module CPU;
 
 import Bus;
+import Cartridge;
 import Debug;
 import DMA;
+import GB;
+import Scheduler;
 import System;
 import Timer;
 import UserMessage;
 
-namespace CPU
-{
-	bool IsHalted()
-	{
-		return in_halt_mode;
-	}
-
-
-	bool IsStopped()
-	{
-		return in_stop_mode;
-	}
-
-
-	void Initialize(bool hle_boot_rom)
-	{
-		if (hle_boot_rom) {
-			switch (System::mode) {
-			case System::Mode::DMG:
-				A = 0x01;
-				B = 0x00;
-				C = 0x13;
-				D = 0x00;
-				E = 0xD8;
-				H = 0x01;
-				L = 0x4D;
-				F.neg = F.half = F.carry = 0;
-				F.zero = 1;
-				pc = 0x0100;
-				sp = 0xFFFE;
-				break;
-
-			case System::Mode::CGB:
-				A = 0x11;
-				B = 0x00;
-				C = 0x00;
-				D = 0xFF;
-				E = 0x56;
-				H = 0x00;
-				L = 0x0D;
-				F.neg = F.half = F.carry = 0;
-				F.zero = 1;
-				pc = 0x0100;
-				sp = 0xFFFE;
-				break;
-
-			default:
-				assert(false);
-			}
-		}
-		else {
-			sp = pc = 0;
-			A = B = C = D = E = H = L = 0;
-			std::memset(&F, 0, sizeof(F));
+/* Computed goto is a GCC and Clang extension; other compilers keep the table loop even if GB_THREADED_DISPATCH is defined */
+#if defined(GB_THREADED_DISPATCH) && defined(__GNUC__)
+#define GB_USE_THREADED_DISPATCH 1
+#else
+#define GB_USE_THREADED_DISPATCH 0
+#endif
+
+std::vector<std::string> CPU::idle_loop_skipping_disabled_titles;
+std::mutex CPU::idle_loop_skipping_disabled_titles_mutex;
+
+
+void CPU::ApplyRomOverrides(std::string_view rom_title)
+{
+	std::lock_guard lock{ idle_loop_skipping_disabled_titles_mutex };
+	idle_loop_skipping_disabled_for_rom = std::ranges::find(idle_loop_skipping_disabled_titles, rom_title)
+		!= idle_loop_skipping_disabled_titles.end();
+}
+
+
+void CPU::DisableIdleLoopSkipping(std::string_view rom_title)
+{
+	std::lock_guard lock{ idle_loop_skipping_disabled_titles_mutex };
+	idle_loop_skipping_disabled_titles.emplace_back(rom_title);
+}
+
+
+u64 CPU::GetCyclesLeftInRun()
+{
+	GB& gb = static_cast<GB&>(*this);
+	u64 time = gb.Scheduler::GetTime();
+	return time < run_until_time ? run_until_time - time : 0;
+}
+
+
+u64 CPU::GetIdleLoopCyclesSkipped()
+{
+	return idle_loop_m_cycles_skipped;
+}
+
+
+bool CPU::IsHalted()
+{
+	return in_halt_mode;
+}
+
+
+bool CPU::IsStopped()
+{
+	return in_stop_mode;
+}
+
+
+void CPU::Initialize(bool hle_boot_rom)
+{
+	GB& gb = static_cast<GB&>(*this);
+	pending_flags.op = FlagOp::None;
+	if (hle_boot_rom) {
+		switch (gb.System::mode) {
+		case System::Mode::DMG:
+			regs.A = 0x01;
+			regs.B = 0x00;
+			regs.C = 0x13;
+			regs.D = 0x00;
+			regs.E = 0xD8;
+			regs.H = 0x01;
+			regs.L = 0x4D;
+			regs.F.neg = regs.F.half = regs.F.carry = 0;
+			regs.F.zero = 1;
+			regs.pc = 0x0100;
+			regs.sp = 0xFFFE;
+			break;
+
+		case System::Mode::CGB:
+			regs.A = 0x11;
+			regs.B = 0x00;
+			regs.C = 0x00;
+			regs.D = 0xFF;
+			regs.E = 0x56;
+			regs.H = 0x00;
+			regs.L = 0x0D;
+			regs.F.neg = regs.F.half = regs.F.carry = 0;
+			regs.F.zero = 1;
+			regs.pc = 0x0100;
+			regs.sp = 0xFFFE;
+			break;
+
+		default:
+			assert(false);
 		}
-		halt_bug = ime = in_halt_mode = in_stop_mode = ei_executed = false;
-		speed_switch_is_active = false;
 	}
+	else {
+		regs.sp = regs.pc = 0;
+		regs.A = regs.B = regs.C = regs.D = regs.E = regs.H = regs.L = 0;
+		std::memset(&regs.F, 0, sizeof(regs.F));
+	}
+	halt_bug = ime = in_halt_mode = in_stop_mode = ei_executed = false;
+	speed_switch_is_active = false;
+	idle_loop_check_pending = ei_delay_step_due = false;
+	attention = true;
+	idle_loop_m_cycles_skipped = 0;
+	run_until_vblank = false;
+	run_until_time = 0;
+	m_cycles_overrun = 0;
+}
 
 
-	u8 ReadCycle(u16 addr)
-	{
-		u8 data = Bus::Read(addr);
-		System::StepAllComponentsButCpu();
-		return data;
-	}
+u8 CPU::ReadCycle(u16 addr)
+{
+	GB& gb = static_cast<GB&>(*this);
+	u8 data = gb.Bus::Read(addr);
+	gb.System::StepAllComponentsButCpu();
+	return data;
+}
 
 
-	u8 ReadCyclePageFF(u8 offset)
-	{
-		u8 data = Bus::ReadPageFF(offset);
-		System::StepAllComponentsButCpu();
-		return data;
-	}
+u8 CPU::ReadCyclePageFF(u8 offset)
+{
+	GB& gb = static_cast<GB&>(*this);
+	u8 data = gb.Bus::ReadPageFF(offset);
+	gb.System::StepAllComponentsButCpu();
+	return data;
+}
 
 
-	u8 ReadCyclePC()
-	{
-		u8 data = Bus::ReadPC(pc++);
-		System::StepAllComponentsButCpu();
-		return data;
-	}
+u8 CPU::ReadCyclePC()
+{
+	GB& gb = static_cast<GB&>(*this);
+	u8 data = gb.Bus::ReadPC(regs.pc++);
+	gb.System::StepAllComponentsButCpu();
+	return data;
+}
 
 
-	void WaitCycle()
-	{
-		System::StepAllComponentsButCpu();
-	}
+void CPU::WaitCycle()
+{
+	GB& gb = static_cast<GB&>(*this);
+	gb.System::StepAllComponentsButCpu();
+}
 
 
-	void WriteCycle(u16 addr, u8 data)
-	{
-		Bus::Write(addr, data);
-		System::StepAllComponentsButCpu();
-	}
+void CPU::WriteCycle(u16 addr, u8 data)
+{
+	GB& gb = static_cast<GB&>(*this);
+	gb.Bus::Write(addr, data);
+	gb.System::StepAllComponentsButCpu();
+}
+
+
+void CPU::WriteCyclePageFF(u8 offset, u8 data)
+{
+	GB& gb = static_cast<GB&>(*this);
+	gb.Bus::WritePageFF(offset, data);
+	gb.System::StepAllComponentsButCpu();
+}
+
+
+void CPU::InitiateSpeedSwitch()
+{
+	speed_switch_is_active = true;
+	speed_switch_m_cycles_remaining = speed_switch_m_cycle_length;
+	attention = true;
+}
 
 
-	void WriteCyclePageFF(u8 offset, u8 data)
-	{
-		Bus::WritePageFF(offset, data);
-		System::StepAllComponentsButCpu();
+void CPU::ExitSpeedSwitch()
+{
+	GB& gb = static_cast<GB&>(*this);
+	speed_switch_is_active = false;
+	gb.System::EndSpeedSwitchInitialization();
+}
+
+
+CPU::Status& CPU::Flags()
+{
+	/* Write the flags of the last ALU operation to F, if that has not been done yet */
+	const LazyFlags& f = pending_flags;
+	switch (f.op) {
+	case FlagOp::None:
+		return regs.F;
+
+	case FlagOp::Add:
+	case FlagOp::Adc:
+		regs.F.neg = 0;
+		regs.F.half = (f.lhs & 0xF) + (f.rhs & 0xF) + f.carry > 0xF; // check if overflow from bit 3
+		regs.F.carry = f.lhs + f.rhs + f.carry > 0xFF; // check if overflow from bit 7
+		break;
+
+	case FlagOp::Sub:
+	case FlagOp::Sbc:
+		regs.F.neg = 1;
+		regs.F.half = (f.rhs & 0xF) + f.carry > (f.lhs & 0xF); // check if borrow from bit 4
+		regs.F.carry = f.rhs + f.carry > f.lhs; // check if borrow
+		break;
+
+	case FlagOp::And:
+		regs.F.neg = regs.F.carry = 0;
+		regs.F.half = 1;
+		break;
+
+	case FlagOp::OrXor:
+		regs.F.neg = regs.F.half = regs.F.carry = 0;
+		break;
+
+	case FlagOp::Inc:
+		regs.F.neg = 0;
+		regs.F.half = (f.lhs & 0xF) == 0xF; // check if overflow from bit 3
+		regs.F.carry = f.carry;
+		break;
+
+	case FlagOp::Dec:
+		regs.F.neg = 1;
+		regs.F.half = (f.lhs & 0xF) == 0; // check if borrow from bit 4
+		regs.F.carry = f.carry;
+		break;
+	}
+	regs.F.zero = f.result == 0;
+	pending_flags.op = FlagOp::None;
+	return regs.F;
+}
+
+
+bool CPU::GetCarry()
+{
+	/* Cheaper than 'Flags().carry' when only the carry is needed, as it does not materialise the other flags */
+	const LazyFlags& f = pending_flags;
+	switch (f.op) {
+	case FlagOp::None:
+		return regs.F.carry;
+
+	case FlagOp::Add:
+	case FlagOp::Adc:
+		return f.lhs + f.rhs + f.carry > 0xFF;
+
+	case FlagOp::Sub:
+	case FlagOp::Sbc:
+		return f.rhs + f.carry > f.lhs;
+
+	case FlagOp::And:
+	case FlagOp::OrXor:
+		return false;
+
+	case FlagOp::Inc:
+	case FlagOp::Dec:
+		return f.carry;
+
+	default:
+		std::unreachable();
 	}
+}
 
 
-	void InitiateSpeedSwitch()
-	{
-		speed_switch_is_active = true;
-		speed_switch_m_cycles_remaining = speed_switch_m_cycle_length;
+bool CPU::GetZero()
+{
+	return pending_flags.op == FlagOp::None ? regs.F.zero : pending_flags.result == 0;
+}
+
+
+void CPU::SetFlagsLazily(FlagOp op, u8 lhs, u8 rhs, u8 result, bool carry)
+{
+	pending_flags = { op, lhs, rhs, result, carry };
+	if constexpr (!lazy_flag_evaluation) {
+		Flags();
 	}
+}
 
 
-	void ExitSpeedSwitch()
-	{
-		speed_switch_is_active = false;
-		System::EndSpeedSwitchInitialization();
+template<CPU::Condition cond>
+bool CPU::EvalCond()
+{
+	using enum Condition;
+	if constexpr (cond == Carry)  return GetCarry();
+	if constexpr (cond == NCarry) return !GetCarry();
+	if constexpr (cond == Zero)   return GetZero();
+	if constexpr (cond == NZero)  return !GetZero();
+	if constexpr (cond == True)   return true;
+}
+
+
+template<uint index>
+u8 CPU::GetReg8()
+{
+	if constexpr (index == 6) {
+		read_hl = ReadCycle(regs.HL);
 	}
+	return Reg8<index>();
+}
 
 
-	template<Condition cond>
-	bool EvalCond()
-	{
-		using enum Condition;
-		if constexpr (cond == Carry)  return F.carry;
-		if constexpr (cond == NCarry) return !F.carry;
-		if constexpr (cond == Zero)   return F.zero;
-		if constexpr (cond == NZero)  return !F.zero;
-		if constexpr (cond == True)   return true;
+/* The 8-bit register encoded as 'index' in an opcode; (HL) is the value last read from there */
+template<uint index>
+u8& CPU::Reg8()
+{
+	if constexpr (index == 0) return regs.B;
+	if constexpr (index == 1) return regs.C;
+	if constexpr (index == 2) return regs.D;
+	if constexpr (index == 3) return regs.E;
+	if constexpr (index == 4) return regs.H;
+	if constexpr (index == 5) return regs.L;
+	if constexpr (index == 6) return read_hl;
+	if constexpr (index == 7) return regs.A;
+}
+
+
+template<uint index>
+void CPU::SetReg8(u8 value)
+{
+	if constexpr (index == 6) {
+		WriteCycle(regs.HL, value);
+	}
+	else {
+		Reg8<index>() = value;
 	}
+}
 
 
-	u8 GetReg8(uint index)
-	{
-		if (index == 6) {
-			read_hl = ReadCycle(H << 8 | L);
-		}
-		return *reg8_table[index];
+template<CPU::Reg16 reg>
+u16 CPU::GetReg16()
+{
+	if constexpr (reg == Reg16::AF) return regs.A << 8 | std::bit_cast<u8, Status>(Flags());
+	if constexpr (reg == Reg16::BC) return regs.BC;
+	if constexpr (reg == Reg16::DE) return regs.DE;
+	if constexpr (reg == Reg16::HL) return regs.HL;
+	if constexpr (reg == Reg16::PC) return regs.pc;
+	if constexpr (reg == Reg16::SP) return regs.sp;
+}
+
+
+template<CPU::Reg16 reg>
+void CPU::SetReg16(const u16 value)
+{
+	if constexpr (reg == Reg16::AF) {
+		regs.AF = value & 0xFFF0;
+		pending_flags.op = FlagOp::None;
+	}
+	if constexpr (reg == Reg16::BC) {
+		regs.BC = value;
+	}
+	if constexpr (reg == Reg16::DE) {
+		regs.DE = value;
 	}
+	if constexpr (reg == Reg16::HL) {
+		regs.HL = value;
+	}
+	if constexpr (reg == Reg16::PC) {
+		regs.pc = value;
+	}
+	if constexpr (reg == Reg16::SP) {
+		regs.sp = value;
+	}
+}
+
+
+u8 CPU::Read8()
+{
+	return ReadCyclePC();
+}
+
+
+u16 CPU::Read16()
+{
+	u8 low = ReadCyclePC();
+	u8 high = ReadCyclePC();
+	return low | high << 8;
+}
+
+
+void CPU::Write8(u8 value)
+{
+	WriteCycle(regs.pc++, value);
+}
+
+
+void CPU::Write16(u16 value)
+{
+	WriteCycle(regs.pc++, value & 0xFF);
+	WriteCycle(regs.pc++, value >> 8 & 0xFF);
+}
 
 
-	void SetReg8(uint index, u8 value)
-	{
-		if (index == 6) {
-			WriteCycle(H << 8 | L, value);
+bool CPU::HandleAttention()
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* The slow path of 'Run', taken before an instruction while 'attention' is set. It handles everything but running
+	   the instruction, and returns whether the caller is to run it; if not, the iteration was spent here.
+	   'attention' is cleared first, and is set again if the slow path is needed before the next instruction too,
+	   including when anything that would need it is raised in the meantime (e.g. an interrupt requested by the
+	   components stepped in 'CheckInterrupts'). */
+	attention = false;
+	if (ei_delay_step_due) {
+		StepEiDelay();
+	}
+	if (gb.DMA::CgbDmaCurrentlyCopyingData()) {
+		WaitCycle();
+		attention = true;
+		return false;
+	}
+	if (speed_switch_is_active) {
+		WaitCycle();
+		if (--speed_switch_m_cycles_remaining == 0) {
+			ExitSpeedSwitch();
 		}
 		else {
-			*reg8_table[index] = value;
+			speed_switch_m_cycles_remaining -= SkipIdleCycles(speed_switch_m_cycles_remaining - 1);
 		}
+		attention = true;
+		return false;
 	}
-
-
-	template<Reg16 reg>
-	u16 GetReg16()
-	{
-		if constexpr (reg == Reg16::AF) return A << 8 | std::bit_cast<u8, decltype(F)>(F);
-		if constexpr (reg == Reg16::BC) return B << 8 | C;
-		if constexpr (reg == Reg16::DE) return D << 8 | E;
-		if constexpr (reg == Reg16::HL) return H << 8 | L;
-		if constexpr (reg == Reg16::PC) return pc;
-		if constexpr (reg == Reg16::SP) return sp;
+	if (in_halt_mode) {
+		CheckInterrupts();
+		if (in_halt_mode && !(IF & IE & 0x1F)) {
+			SkipIdleCycles();
+		}
+		attention = true;
+		return false;
+	}
+	CheckInterrupts();
+	if (idle_loop_check_pending) {
+		idle_loop_check_pending = false;
+		SkipIdleLoop();
+	}
+	if (ei_executed) {
+		ei_delay_step_due = true;
+		attention = true;
+	}
+	// If the previous instruction was HALT, there is a hardware bug in which PC is not incremented after the current instruction
+	if (halt_bug) {
+		halt_bug = false;
+		opcode = ReadCyclePC();
+		if constexpr (Debug::log_instr) {
+			Debug::LogInstr(gb, opcode, regs.A << 8 | std::bit_cast<u8, Status>(Flags()), regs.BC, regs.DE, regs.HL, regs.pc - 1, regs.sp, IE, IF);
+		}
+		regs.pc--;
+		(this->*instr_table[opcode])();
+		return false;
 	}
+	return true;
+}
 
 
-	template<Reg16 reg>
-	void SetReg16(const u16 value)
-	{
-		if constexpr (reg == Reg16::AF) {
-			A = value >> 8 & 0xFF;
-			F = std::bit_cast<decltype(F), u8>(u8(value & 0xFF));
-		}
-		if constexpr (reg == Reg16::BC) {
-			B = value >> 8 & 0xFF;
-			C = value & 0xFF;
-		}
-		if constexpr (reg == Reg16::DE) {
-			D = value >> 8 & 0xFF;
-			E = value & 0xFF;
+/* Otherwise, 'Run' is defined at the end of the file, after the opcode tables */
+#if !GB_USE_THREADED_DISPATCH
+void CPU::Run()
+{
+	GB& gb = static_cast<GB&>(*this);
+	while (gb.Scheduler::GetTime() < run_until_time) {
+		if (attention && !HandleAttention()) {
+			continue;
 		}
-		if constexpr (reg == Reg16::HL) {
-			H = value >> 8 & 0xFF;
-			L = value & 0xFF;
+		if (block_cache_enabled) {
+			if (Block* block = GetBlock()) {
+				RunBlock(*block);
+				continue;
+			}
 		}
-		if constexpr (reg == Reg16::PC) {
-			pc = value;
+		opcode = ReadCyclePC();
+
+		if constexpr (Debug::log_instr) {
+			Debug::LogInstr(
+				gb,
+				opcode,
+				regs.A << 8 | std::bit_cast<u8, Status>(Flags()),
+				regs.BC,
+				regs.DE,
+				regs.HL,
+				regs.pc - 1,
+				regs.sp,
+				IE,
+				IF
+			);
 		}
-		if constexpr (reg == Reg16::SP) {
-			sp = value;
+		(this->*instr_table[opcode])();
+	}
+	if (ei_delay_step_due) {
+		StepEiDelay();
+	}
+}
+#endif
+
+
+void CPU::DecodeBlock(Block& block, const u8* code)
+{
+	/* The block may not extend past the page it starts in, as the next page can be backed by other memory */
+	block.code = code;
+	block.start_pc = regs.pc;
+	block.num_ops = 0;
+	block.native_code = nullptr;
+	block.run_count = 0;
+	uint offset = 0;
+	uint page_bytes_left = 0x100 - (regs.pc & 0xFF);
+	while (offset < page_bytes_left && block.num_ops < max_block_length) {
+		u8 op = code[offset];
+		u8 length = Debug::instr_len[op];
+		block.ops[block.num_ops++] = { instr_table[op], op, length };
+		if (EndsBlock(op)) {
+			break;
 		}
+		offset += length;
 	}
+}
+
 
+bool CPU::EndsBlock(u8 opcode)
+{
+	/* Instructions that may change PC to anything but the next instruction, or stop execution */
+	switch (opcode) {
+	case 0x10: case 0x76: /* STOP, HALT */
+	case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: /* JR */
+	case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: case 0xE9: /* JP */
+	case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC: /* CALL */
+	case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8: case 0xD9: /* RET, RETI */
+	case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF: /* RST */
+	case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4: case 0xEB: case 0xEC: case 0xED: case 0xF4: case 0xFC: case 0xFD: /* illegal */
+		return true;
 
-	u8 Read8()
-	{
-		return ReadCyclePC();
+	default:
+		return false;
 	}
+}
 
 
-	u16 Read16()
-	{
-		u8 low = ReadCyclePC();
-		u8 high = ReadCyclePC();
-		return low | high << 8;
+void CPU::FlushBlockCache()
+{
+	for (Block& block : block_cache) {
+		block.code = nullptr;
 	}
+	jit_code.Clear();
+}
 
 
-	void Write8(u8 value)
-	{
-		WriteCycle(pc++, value);
+CPU::Block* CPU::GetBlock()
+{
+	GB& gb = static_cast<GB&>(*this);
+	const u8* code = gb.Bus::GetRomHostPointer(regs.pc);
+	if (!code) {
+		return nullptr;
 	}
+	/* 'code - pc' is the same for all addresses in one ROM bank, and differs between banks (by multiples of 0x4000).
+	   Hashing the address itself with the host pointer would map most blocks in a bank to only a few entries. */
+	Block& block = block_cache[(regs.pc ^ (std::bit_cast<size_t>(code) - regs.pc) >> 14) & (block_cache_size - 1)];
+	if (block.code != code || block.start_pc != regs.pc) {
+		DecodeBlock(block, code);
+	}
+	return &block;
+}
 
 
-	void Write16(u16 value)
-	{
-		WriteCycle(pc++, value & 0xFF);
-		WriteCycle(pc++, value >> 8 & 0xFF);
+void CPU::RunCycles(u64 m_cycles)
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* Instructions are not split, so a run may end up to a few m-cycles after its target. The excess is taken
+	   off the next call, so that the number of m-cycles run over many calls is exact. */
+	if (m_cycles <= m_cycles_overrun) {
+		m_cycles_overrun -= m_cycles;
+		return;
 	}
+	run_until_time = gb.Scheduler::GetTime() + m_cycles - m_cycles_overrun;
+	Run();
+	m_cycles_overrun = gb.Scheduler::GetTime() - run_until_time;
+}
 
 
-	void Run()
-	{
-		// run the cpu for 5000 instructions. Each frame is 17556 m-cycles in single-speed mode.
-		// This is not terribly important, as audio and video synchronization is handled elsewhere.
-		uint instruction_counter = 0;
-		while (instruction_counter++ < 3000) {
-			if (DMA::CgbDmaCurrentlyCopyingData()) {
-				WaitCycle();
-				continue;
-			}
-			if (speed_switch_is_active) {
-				WaitCycle();
-				if (--speed_switch_m_cycles_remaining == 0) {
-					ExitSpeedSwitch();
-				}
-				continue;
-			}
-			if (in_halt_mode) {
-				CheckInterrupts();
-				continue;
-			}
-			CheckInterrupts();
-			opcode = ReadCyclePC();
-
-			if constexpr (Debug::log_instr) {
-				Debug::LogInstr(
-					opcode,
-					A << 8 | std::bit_cast<u8, Status>(F),
-					B << 8 | C,
-					D << 8 | E,
-					H << 8 | L,
-					pc - 1,
-					sp,
-					IE,
-					IF
-				);
-			}
+void CPU::RunFrame()
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* With the LCD off there is no VBlank, so the run is also ended after one frame's worth of m-cycles */
+	run_until_vblank = true;
+	run_until_time = gb.Scheduler::GetTime() + System::m_cycles_per_frame_base * std::to_underlying(gb.System::speed);
+	Run();
+	run_until_vblank = false;
+}
 
-			// If the previous instruction was HALT, there is a hardware bug in which PC is not incremented after the current instruction
-			if (halt_bug) {
-				halt_bug = false;
-				pc--;
-			}
-			instr_table[opcode]();
-			// If the previous instruction was EI, the ime flag is set only after the instruction after the EI has been executed
-			if (ei_executed) {
-				if (instr_executed_after_ei_executed) {
-					ime = 1;
-					ei_executed = false;
-				}
-				else {
-					instr_executed_after_ei_executed = true;
-				}
-			}
-		}
-	}
 
+void CPU::RunUntil(bool(*predicate)(CPU& cpu))
+{
+	GB& gb = static_cast<GB&>(*this);
+	while (!predicate(*this)) {
+		run_until_time = gb.Scheduler::GetTime() + 1; /* a single instruction, or a single m-cycle spent waiting */
+		Run();
+	}
+}
 
-	void CheckInterrupts()
-	{
-		// This function does not only dispatch interrupts if necessary,
-		// it also checks if HALT mode should be exited if the CPU is in it
 
-		/* Behaviour for when  (IF & IE & 0x1F) != 0  :
-		*  HALT,  ime : jump to interrupt vector, clear IF flag
-		* !HALT,  ime : same as above
-		*  HALT, !ime : don't jump to interrupt vector, don't clear IF flag
-		* !HALT, !ime : do nothing
-		* In addition: clear HALT flag in each case
-		*/
-		if (ime) {
-			// fetch bits 0-4 of the IF IE registers
-			u8 AND = IF & IE & 0x1F;
-			if (AND) { // if any enabled interrupt is requested
-				WaitCycle();
-				WaitCycle();
-				PushPC();
-				for (int i = 0; i <= 4; ++i) {
-					if (AND & 1 << i) {
-						pc = 0x40 + 8 * i;
-						WaitCycle();
-						IF &= ~(1 << i); // todo: when does this happen exactly?
-						if constexpr (Debug::log_interrupts) {
-							Debug::LogInterrupt(static_cast<Interrupt>(i));
-						}
-					}
-				}
-				if (in_halt_mode) {
-					WaitCycle();
-				}
-				ime = in_halt_mode = false;
+void CPU::RunBlock(Block& block)
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* The first instruction is run under the same conditions as in 'Run'. Before every following one, execution
+	   falls back to 'Run' if 'attention' is set, if the previous instruction branched, or if it changed the memory
+	   map (e.g. switched the ROM bank). The instructions run by compiled code do neither. */
+	uint map_generation = gb.Bus::GetMapGeneration();
+	uint first_op = jit_enabled ? RunCompiledBlock(block) : 0;
+	u16 next_pc = regs.pc;
+	for (uint i = first_op; i < block.num_ops; ++i) {
+		if (i > 0) {
+			if (gb.Scheduler::GetTime() >= run_until_time || regs.pc != next_pc || gb.Bus::GetMapGeneration() != map_generation
+				|| attention) {
 				return;
 			}
 		}
-		if (in_halt_mode) {
-			// check if HALT mode should be exited, which is when enabled interrupt is requested
-			if (IF & IE & 0x1F) {
-				in_halt_mode = false;
-			}
-			WaitCycle();
+		const MicroOp& op = block.ops[i];
+		next_pc = regs.pc + op.length;
+		opcode = op.opcode;
+		++regs.pc;
+		WaitCycle(); /* the opcode fetch */
+		if constexpr (Debug::log_instr) {
+			Debug::LogInstr(gb, opcode, regs.A << 8 | std::bit_cast<u8, Status>(Flags()), regs.BC, regs.DE, regs.HL, regs.pc - 1, regs.sp, IE, IF);
 		}
+		(this->*op.handler)();
 	}
+}
 
 
-	void PushPC()
-	{
-		WriteCycle(--sp, pc >> 8 & 0xFF);
-		WriteCycle(--sp, pc & 0xFF);
-	}
+uint CPU::SkipIdleCycles(uint max_m_cycles)
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* Called while the CPU only waits (in HALT mode with no interrupt pending, or during a speed switch), after the
+	   wait for the current m-cycle. Only a scheduled event can request an interrupt, so the m-cycles before the next
+	   one are skipped in one step, though not past the end of the run. */
+	u64 m_cycles = std::min({ gb.Scheduler::GetCyclesUntilNextEvent() - 1, u64(max_m_cycles), GetCyclesLeftInRun() });
+	gb.Scheduler::SkipCycles(m_cycles);
+	return uint(m_cycles);
+}
 
 
-	void PopPC()
-	{
-		u8 low = ReadCycle(sp++);
-		u8 high = ReadCycle(sp++);
-		pc = high << 8 | low;
+void CPU::StepEiDelay()
+{
+	/* Called once after every instruction from EI up to the one after it, though only by the next 'HandleAttention'
+	   (or at the end of the run), so that the instructions in between are not slowed down.
+	   If the previous instruction was EI, the ime flag is set only after the instruction after the EI has been executed. */
+	ei_delay_step_due = false;
+	if (instr_executed_after_ei_executed) {
+		ime = 1;
+		ei_executed = false;
 	}
+	else {
+		instr_executed_after_ei_executed = true;
+	}
+}
 
 
-	void RequestInterrupt(Interrupt interrupt)
-	{
-		IF |= std::to_underlying(interrupt);
+void CPU::SetBlockCacheEnabled(bool enabled)
+{
+	block_cache_enabled = enabled;
+	if (enabled) {
+		block_cache.assign(block_cache_size, Block{});
 	}
+	else {
+		block_cache.clear();
+		block_cache.shrink_to_fit();
+		jit_code.Clear();
+	}
+}
 
 
-	u8 ReadIE()
-	{
-		return IE;
-	}
+void CPU::SetIdleLoopSkippingEnabled(bool enabled)
+{
+	idle_loop_skipping_enabled = enabled;
+}
 
 
-	void WriteIE(u8 data)
-	{
-		IE = data | 0xE0;
+void CPU::SkipIdleLoop()
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* Called at the target of a short backward JR. If the loop starting there only reads LY, STAT or IF, optionally
+	   tests the value, and jumps back (e.g. 'LDH A,(44h); CP 90h; JR NZ'), then every iteration leaves the CPU in the
+	   same state until the value changes. LY and IF only change at scheduled events, and so does STAT in HBlank and
+	   VBlank. The iterations that end before the next event (and before the end of the run) are therefore skipped
+	   in one step. */
+	if (idle_loop_skipping_disabled_for_rom || in_halt_mode || halt_bug || ei_executed || speed_switch_is_active
+		|| ime && IF & IE & 0x1F || gb.DMA::CgbDmaCurrentlyCopyingData()) {
+		return;
+	}
+	const u8* code = gb.Bus::GetRomHostPointer(regs.pc);
+	if (!code || (regs.pc & 0xFF) > 0x100 - max_idle_loop_length) {
+		return;
+	}
+
+	/* The read of the polled register */
+	u16 polled_addr;
+	uint length, m_cycles;
+	if (code[0] == 0xF0) { /* LDH A, (u8) */
+		polled_addr = 0xFF00 | code[1];
+		length = 2;
+		m_cycles = 3;
+	}
+	else if (code[0] == 0xFA) { /* LD A, (u16) */
+		polled_addr = code[2] << 8 | code[1];
+		length = 3;
+		m_cycles = 4;
+	}
+	else {
+		return;
+	}
+	if (polled_addr != gb.Bus::IF && polled_addr != gb.Bus::STAT && polled_addr != gb.Bus::LY) {
+		return;
+	}
+
+	/* An optional test of the value, which only affects the flags */
+	u8 test_opcode = code[length];
+	u8 test_operand = code[length + 1];
+	switch (test_opcode) {
+	case 0xA7: case 0xB7: /* AND A, OR A */
+		length += 1;
+		m_cycles += 1;
+		break;
+
+	case 0xCB: /* BIT b, A */
+		if ((test_operand & 0xC7) != 0x47) {
+			return;
+		}
+		[[fallthrough]];
+	case 0xE6: case 0xFE: /* AND u8, CP u8 */
+		length += 2;
+		m_cycles += 2;
+		break;
+
+	default:
+		test_opcode = 0;
+	}
+
+	/* The conditional jump back to the start of the loop */
+	u8 branch_opcode = code[length];
+	if ((branch_opcode & 0xE7) != 0x20 || s8(code[length + 1]) != -s8(length + 2)) {
+		return;
+	}
+	m_cycles += 3;
+
+	u64 num_iterations = std::min(gb.Scheduler::GetCyclesUntilNextEvent() - 1, GetCyclesLeftInRun()) / m_cycles;
+	if (num_iterations == 0) {
+		return;
+	}
+	u8 value = gb.Bus::ReadPageFF(polled_addr & 0xFF);
+	if (polled_addr == gb.Bus::STAT && (value & 3) >= 2) {
+		return; /* OAM scan or pixel transfer; the mode may change before the next event */
+	}
+
+	/* Run the test as the loop would, and find out if it would jump back */
+	u8 prev_A = regs.A;
+	Status prev_F = regs.F;
+	LazyFlags prev_pending_flags = pending_flags;
+	regs.A = value;
+	switch (test_opcode) {
+	case 0xCB: (this->*cb_table[test_operand])(); break;
+	case 0xE6: AND(test_operand); break;
+	case 0xFE: CP(test_operand); break;
+	case 0: break;
+	default: (this->*instr_table[test_opcode])(); break;
+	}
+	bool loops = [&] {
+		switch (branch_opcode) {
+		case 0x20: return !GetZero();
+		case 0x28: return GetZero();
+		case 0x30: return !GetCarry();
+		default: return GetCarry();
+		}
+	}();
+	if (!loops) {
+		regs.A = prev_A;
+		regs.F = prev_F;
+		pending_flags = prev_pending_flags;
+		return;
 	}
+	gb.Scheduler::SkipCycles(num_iterations * m_cycles);
+	idle_loop_m_cycles_skipped += num_iterations * m_cycles;
+}
 
 
-	u8 ReadIF()
-	{
-		return IF;
+void CPU::CheckInterrupts()
+{
+	// This function does not only dispatch interrupts if necessary,
+	// it also checks if HALT mode should be exited if the CPU is in it
+
+	/* Behaviour for when  (IF & IE & 0x1F) != 0  :
+	*  HALT,  ime : jump to interrupt vector, clear IF flag
+	* !HALT,  ime : same as above
+	*  HALT, !ime : don't jump to interrupt vector, don't clear IF flag
+	* !HALT, !ime : do nothing
+	* In addition: clear HALT flag in each case
+	*/
+	if (ime) {
+		// fetch bits 0-4 of the IF IE registers
+		u8 AND = IF & IE & 0x1F;
+		if (AND) { // if any enabled interrupt is requested
+			WaitCycle();
+			WaitCycle();
+			PushPC();
+			for (int i = 0; i <= 4; ++i) {
+				if (AND & 1 << i) {
+					regs.pc = 0x40 + 8 * i;
+					WaitCycle();
+					IF &= ~(1 << i); // todo: when does this happen exactly?
+					if constexpr (Debug::log_interrupts) {
+						Debug::LogInterrupt(static_cast<Interrupt>(i));
+					}
+				}
+			}
+			if (in_halt_mode) {
+				WaitCycle();
+			}
+			ime = in_halt_mode = false;
+			return;
+		}
+	}
+	if (in_halt_mode) {
+		// check if HALT mode should be exited, which is when enabled interrupt is requested
+		if (IF & IE & 0x1F) {
+			in_halt_mode = false;
+		}
+		WaitCycle();
 	}
+}
 
 
-	void WriteIF(u8 data)
-	{
-		IF = data | 0xE0;
-	}
+void CPU::PushPC()
+{
+	WriteCycle(--regs.sp, regs.pc >> 8 & 0xFF);
+	WriteCycle(--regs.sp, regs.pc & 0xFF);
+}
 
 
-	// Load the value of the second r8 into the first r8
-	void LD_r8_r8() // LD r8, r8    len: 4t if the first and second r8 != (HL), else 8t
-	{
-		auto dst_reg_idx = (opcode - 0x40) >> 3;
-		auto src_reg_idx = opcode & 7;
-		SetReg8(dst_reg_idx, GetReg8(src_reg_idx));
-	}
+void CPU::PopPC()
+{
+	u8 low = ReadCycle(regs.sp++);
+	u8 high = ReadCycle(regs.sp++);
+	regs.pc = high << 8 | low;
+}
 
 
-	// Load u8 into r8
-	void LD_r8_u8() // LD r8, u8    len: 8t if r8 != (HL), else 12t
-	{
-		auto dst_reg_idx = opcode >> 3;
-		u8 immediate = Read8();
-		SetReg8(dst_reg_idx, immediate);
+void CPU::NotifyVBlank()
+{
+	if (run_until_vblank) {
+		run_until_time = 0; /* the run ends after the current instruction */
 	}
+}
 
 
-	// Load u16 into r16
-	template<Reg16 r16>
-	void LD_r16_u16() // LD r16, u16    len: 12t
-	{
-		u16 immediate = Read16();
-		SetReg16<r16>(immediate);
-	}
+void CPU::RequestAttention()
+{
+	attention = true;
+}
 
 
-	// Load HL into SP
-	void LD_SP_HL() // LD SP, HL    len: 8t
-	{
-		sp = H << 8 | L;
-		WaitCycle();
-	}
+void CPU::RequestInterrupt(Interrupt interrupt)
+{
+	IF |= std::to_underlying(interrupt);
+	attention = true;
+}
 
 
-	// Load A into the byte at address r16
-	template<Reg16 r16>
-	void LD_r16_A() // LD (r16), A    len: 8t
-	{
-		WriteCycle(GetReg16<r16>(), A);
-	}
+u8 CPU::ReadIE()
+{
+	return IE;
+}
 
 
-	// Load the byte at address r16 into A
-	template<Reg16 r16>
-	void LD_A_r16() // LD A, (r16)    len: 8t
-	{
-		A = ReadCycle(GetReg16<r16>());
-	}
+void CPU::WriteIE(u8 data)
+{
+	IE = data | 0xE0;
+	attention = true;
+}
 
 
-	// Load A into the byte at address pointed to by u16
-	void LD_u16_A() // LD (u16), A    len: 16t
-	{
-		u16 immediate = Read16();
-		WriteCycle(immediate, A);
-	}
+u8 CPU::ReadIF()
+{
+	return IF;
+}
 
 
-	// Load the byte at address u16 into A
-	void LD_A_u16() // LD A, (u16)    len: 16t
-	{
-		u16 immediate = Read16();
-		A = ReadCycle(immediate);
-	}
+void CPU::WriteIF(u8 data)
+{
+	IF = data | 0xE0;
+	attention = true;
+}
 
 
-	// Load SP & 0xFF into the byte at address u16 and SP >> 8 into the byte at address u16 + 1
-	void LD_u16_SP() // LD (u16), SP    len: 20t
-	{
-		u16 immediate = Read16();
-		WriteCycle(immediate, sp & 0xFF);
-		WriteCycle(immediate + 1, sp >> 8);
-	}
+// Load the value of the second r8 into the first r8
+template<uint dst_reg_idx, uint src_reg_idx>
+void CPU::LD_r8_r8() // LD r8, r8    len: 4t if the first and second r8 != (HL), else 8t
+{
+	SetReg8<dst_reg_idx>(GetReg8<src_reg_idx>());
+}
 
 
-	// Load SP+s8 into HL
-	void LD_HL_SP_s8() // LD HL, SP + s8    len: 12t
-	{
-		s8 offset = Read8();
-		F.half = (sp & 0xF) + (offset & 0xF) > 0xF; // check if overflow from bit 3
-		F.carry = (sp & 0xFF) + (offset & 0xFF) > 0xFF; // check if overflow from bit 7
-		u16 result = sp + offset;
-		H = result >> 8;
-		L = result & 0xFF;
-		F.zero = F.neg = 0;
-		WaitCycle();
-	}
+// Load u8 into r8
+template<uint dst_reg_idx>
+void CPU::LD_r8_u8() // LD r8, u8    len: 8t if r8 != (HL), else 12t
+{
+	u8 immediate = Read8();
+	SetReg8<dst_reg_idx>(immediate);
+}
 
 
-	// Load A into the byte at address HL, and thereafter increment HL by 1
-	void LD_HLp_A() // LD (HL+), A    len: 8t
-	{
-		WriteCycle(H << 8 | L, A);
-		if (++L == 0) {
-			++H;
-		}
-	}
+// Load u16 into r16
+template<CPU::Reg16 r16>
+void CPU::LD_r16_u16() // LD r16, u16    len: 12t
+{
+	u16 immediate = Read16();
+	SetReg16<r16>(immediate);
+}
 
 
-	// Load A into the byte at address HL, and thereafter decrement HL by 1
-	void LD_HLm_A() // LD (HL-), A    len: 8t
-	{
-		WriteCycle(H << 8 | L, A);
-		if (--L == 0xFF) {
-			--H;
-		}
-	}
+// Load HL into SP
+void CPU::LD_SP_HL() // LD SP, HL    len: 8t
+{
+	regs.sp = regs.HL;
+	WaitCycle();
+}
 
 
-	// Load the byte at address HL into A, and thereafter increment HL by 1
-	void LD_A_HLp() // LD (HL+), A    len: 8t
-	{
-		A = ReadCycle(H << 8 | L);
-		if (++L == 0) {
-			++H;
-		}
-	}
+// Load A into the byte at address r16
+template<CPU::Reg16 r16>
+void CPU::LD_r16_A() // LD (r16), A    len: 8t
+{
+	WriteCycle(GetReg16<r16>(), regs.A);
+}
 
 
-	// Load the byte at address HL into A, and thereafter decrement HL by 1
-	void LD_A_HLm() // LD (HL-), A    len: 8t
-	{
-		A = ReadCycle(H << 8 | L);
-		if (--L == 0xFF) {
-			--H;
-		}
-	}
+// Load the byte at address r16 into A
+template<CPU::Reg16 r16>
+void CPU::LD_A_r16() // LD A, (r16)    len: 8t
+{
+	regs.A = ReadCycle(GetReg16<r16>());
+}
 
 
-	// Load A into the byte at address FF00+u8
-	void LDH_u8_A() // LD (FF00+u8), A    len: 12t
-	{
-		WriteCyclePageFF(Read8(), A);
-	}
+// Load A into the byte at address pointed to by u16
+void CPU::LD_u16_A() // LD (u16), A    len: 16t
+{
+	u16 immediate = Read16();
+	WriteCycle(immediate, regs.A);
+}
 
 
-	// Load the byte at address FF00+u8 into A
-	void LDH_A_u8() // LD A, (FF00+u8)    len: 12t
-	{
-		A = ReadCyclePageFF(Read8());
-	}
+// Load the byte at address u16 into A
+void CPU::LD_A_u16() // LD A, (u16)    len: 16t
+{
+	u16 immediate = Read16();
+	regs.A = ReadCycle(immediate);
+}
 
 
-	// Load A into the byte at address FF00+C
-	void LDH_C_A() // LD (FF00+C), A    len: 8t
-	{
-		WriteCyclePageFF(C, A);
-	}
+// Load SP & 0xFF into the byte at address u16 and SP >> 8 into the byte at address u16 + 1
+void CPU::LD_u16_SP() // LD (u16), SP    len: 20t
+{
+	u16 immediate = Read16();
+	WriteCycle(immediate, regs.sp & 0xFF);
+	WriteCycle(immediate + 1, regs.sp >> 8);
+}
 
 
-	// Load the byte at address FF00+C into A
-	void LDH_A_C() // LD A, (FF00+C)    len: 8t
-	{
-		A = ReadCyclePageFF(C);
-	}
+// Load SP+s8 into HL
+void CPU::LD_HL_SP_s8() // LD HL, SP + s8    len: 12t
+{
+	Status& flags = Flags();
+	s8 offset = Read8();
+	flags.half = (regs.sp & 0xF) + (offset & 0xF) > 0xF; // check if overflow from bit 3
+	flags.carry = (regs.sp & 0xFF) + (offset & 0xFF) > 0xFF; // check if overflow from bit 7
+	regs.HL = regs.sp + offset;
+	flags.zero = flags.neg = 0;
+	WaitCycle();
+}
+
+
+// Load A into the byte at address HL, and thereafter increment HL by 1
+void CPU::LD_HLp_A() // LD (HL+), A    len: 8t
+{
+	WriteCycle(regs.HL, regs.A);
+	++regs.HL;
+}
 
 
-	// Add r8 and carry flag to register A
-	void ADC_r8() // ADC A, r8    len: 4t if r8 != (HL), otherwise 8t
-	{
-		auto src_reg_idx = opcode & 7;
-		ADC(GetReg8(src_reg_idx));
-	}
+// Load A into the byte at address HL, and thereafter decrement HL by 1
+void CPU::LD_HLm_A() // LD (HL-), A    len: 8t
+{
+	WriteCycle(regs.HL, regs.A);
+	--regs.HL;
+}
 
 
-	// Add u8 and carry flag to register A
-	void ADC_u8() // ADC A, u8    len: 8t
-	{
-		ADC(Read8());
-	}
+// Load the byte at address HL into A, and thereafter increment HL by 1
+void CPU::LD_A_HLp() // LD (HL+), A    len: 8t
+{
+	regs.A = ReadCycle(regs.HL);
+	++regs.HL;
+}
 
 
-	// Add r8 to register A
-	void ADD_r8() // ADD A, r8    len: 4t if r8 != (HL), otherwise 8t
-	{
-		auto src_reg_idx = opcode & 7;
-		ADD(GetReg8(src_reg_idx));
-	}
+// Load the byte at address HL into A, and thereafter decrement HL by 1
+void CPU::LD_A_HLm() // LD (HL-), A    len: 8t
+{
+	regs.A = ReadCycle(regs.HL);
+	--regs.HL;
+}
 
 
-	// Add u8 to register A
-	void ADD_u8() // ADD A, u8    len: 8t
-	{
-		ADD(Read8());
-	}
+// Load A into the byte at address FF00+u8
+void CPU::LDH_u8_A() // LD (FF00+u8), A    len: 12t
+{
+	WriteCyclePageFF(Read8(), regs.A);
+}
 
 
-	// Add r16 to register HL
-	template<Reg16 r16>
-	void ADD_HL_r16() // ADD HL, r16    len: 8t
-	{
-		u16 reg = GetReg16<r16>();
-		u16 HL = H << 8 | L;
-		F.neg = 0;
-		F.half = (HL & 0xFFF) + (reg & 0xFFF) > 0xFFF; // check if overflow from bit 11
-		F.carry = (HL + reg > 0xFFFF); // check if overflow from bit 15
-		u16 result = HL + reg;
-		H = result >> 8;
-		L = result & 0xFF;
-		WaitCycle();
-	}
+// Load the byte at address FF00+u8 into A
+void CPU::LDH_A_u8() // LD A, (FF00+u8)    len: 12t
+{
+	regs.A = ReadCyclePageFF(Read8());
+}
 
 
-	// Add signed value to SP
-	void ADD_SP() // ADD SP, s8   len: 16t
-	{
-		s8 offset = Read8();
-		F.half = (sp & 0xF) + (offset & 0xF) > 0xF; // check if overflow from bit 3
-		F.carry = (sp & 0xFF) + (offset & 0xFF) > 0xFF; // check if overflow from bit 7
-		sp += offset;
-		F.zero = F.neg = 0;
-		WaitCycle();
-		WaitCycle();
-	}
+// Load A into the byte at address FF00+C
+void CPU::LDH_C_A() // LD (FF00+C), A    len: 8t
+{
+	WriteCyclePageFF(regs.C, regs.A);
+}
 
 
-	// Store bitwise AND between r8 and A in A
-	void AND_r8() // AND A, r8    len: 4t if r8 != (HL), otherwise 8t
-	{
-		auto src_reg_idx = opcode & 7;
-		AND(GetReg8(src_reg_idx));
-	}
+// Load the byte at address FF00+C into A
+void CPU::LDH_A_C() // LD A, (FF00+C)    len: 8t
+{
+	regs.A = ReadCyclePageFF(regs.C);
+}
 
 
-	// Store bitwise AND between u8 and A in A
-	void AND_u8() // AND A, u8    len: 8t
-	{
-		AND(Read8());
-	}
+// Add r8 and carry flag to register A
+template<uint src_reg_idx>
+void CPU::ADC_r8() // ADC A, r8    len: 4t if r8 != (HL), otherwise 8t
+{
+	ADC(GetReg8<src_reg_idx>());
+}
 
 
-	// Perform subtraction of r8 from A, but don't store the result
-	void CP_r8() // CP A, r8    len: 4t if r8 != (HL), otherwise 8t
-	{
-		auto src_reg_idx = opcode & 7;
-		CP(GetReg8(src_reg_idx));
-	}
+// Add u8 and carry flag to register A
+void CPU::ADC_u8() // ADC A, u8    len: 8t
+{
+	ADC(Read8());
+}
 
 
-	// Perform subtraction of u8 from A, but don't store the result
-	void CP_u8() // CP A, u8    len: 8t
-	{
-		CP(Read8());
-	}
+// Add r8 to register A
+template<uint src_reg_idx>
+void CPU::ADD_r8() // ADD A, r8    len: 4t if r8 != (HL), otherwise 8t
+{
+	ADD(GetReg8<src_reg_idx>());
+}
 
 
-	// Decrement 8-bit register by 1
-	void DEC_r8() // DEC r8    len: 4t if r8 != (HL), otherwise 12t
-	{
-		auto reg_idx = opcode >> 3;
-		u8 reg = GetReg8(reg_idx);
-		F.neg = 1;
-		F.half = (reg & 0xF) == 0; // check if borrow from bit 4
-		--reg;
-		F.zero = reg == 0;
-		SetReg8(reg_idx, reg);
-	}
+// Add u8 to register A
+void CPU::ADD_u8() // ADD A, u8    len: 8t
+{
+	ADD(Read8());
+}
 
 
-	// Decrement 16-bit register by 1
-	template<Reg16 r16>
-	void DEC_r16() // DEC r16    len: 8t
-	{
-		if constexpr (r16 == Reg16::BC) { /* DEC BC */
-			if (--C == 0xFF) {
-				--B;
-			}
-		}
-		else if constexpr (r16 == Reg16::DE) { /* DEC DE */
-			if (--E == 0xFF) {
-				--D;
-			}
-		}
-		else if constexpr (r16 == Reg16::HL) { /* DEC HL */
-			if (--L == 0xFF) {
-				--H;
-			}
-		}
-		else if constexpr (r16 == Reg16::SP) { /* DEC SP */
-			--sp;
-		}
-		else {
-			static_assert(AlwaysFalse<r16>);
-		}
-		WaitCycle();
-	}
+// Add r16 to register HL
+template<CPU::Reg16 r16>
+void CPU::ADD_HL_r16() // ADD HL, r16    len: 8t
+{
+	Status& flags = Flags();
+	u16 reg = GetReg16<r16>();
+	flags.neg = 0;
+	flags.half = (regs.HL & 0xFFF) + (reg & 0xFFF) > 0xFFF; // check if overflow from bit 11
+	flags.carry = (regs.HL + reg > 0xFFFF); // check if overflow from bit 15
+	regs.HL += reg;
+	WaitCycle();
+}
+
+
+// Add signed value to SP
+void CPU::ADD_SP() // ADD SP, s8   len: 16t
+{
+	Status& flags = Flags();
+	s8 offset = Read8();
+	flags.half = (regs.sp & 0xF) + (offset & 0xF) > 0xF; // check if overflow from bit 3
+	flags.carry = (regs.sp & 0xFF) + (offset & 0xFF) > 0xFF; // check if overflow from bit 7
+	regs.sp += offset;
+	flags.zero = flags.neg = 0;
+	WaitCycle();
+	WaitCycle();
+}
+
+
+// Store bitwise AND between r8 and A in A
+template<uint src_reg_idx>
+void CPU::AND_r8() // AND A, r8    len: 4t if r8 != (HL), otherwise 8t
+{
+	AND(GetReg8<src_reg_idx>());
+}
 
 
-	// Increment 8-bit register by 1
-	void INC_r8() // INC r8    len: 4t if r8 != (HL), otherwise 12t
-	{
-		auto reg_idx = opcode >> 3;
-		u8 reg = GetReg8(reg_idx);
-		F.half = (reg & 0xF) == 0xF; // check if overflow from bit 3
-		++reg;
-		F.neg = 0;
-		F.zero = reg == 0;
-		SetReg8(reg_idx, reg);
-	}
+// Store bitwise AND between u8 and A in A
+void CPU::AND_u8() // AND A, u8    len: 8t
+{
+	AND(Read8());
+}
 
 
-	// Increment 16-bit register by 1
-	template<Reg16 r16>
-	void INC_r16() // INC r16    len: 8t
-	{
-		if constexpr (r16 == Reg16::BC) { /* INC BC */
-			if (++C == 0) {
-				++B;
-			}
-		}
-		else if constexpr (r16 == Reg16::DE) { /* INC DE */
-			if (++E == 0) {
-				++D;
-			}
-		}
-		else if constexpr (r16 == Reg16::HL) { /* INC HL */
-			if (++L == 0) {
-				++H;
-			}
-		}
-		else if constexpr (r16 == Reg16::SP) { /* INC SP */
-			++sp;
-		}
-		else {
-			static_assert(AlwaysFalse<r16>);
-		}
-		WaitCycle();
-	}
+// Perform subtraction of r8 from A, but don't store the result
+template<uint src_reg_idx>
+void CPU::CP_r8() // CP A, r8    len: 4t if r8 != (HL), otherwise 8t
+{
+	CP(GetReg8<src_reg_idx>());
+}
 
 
-	// Perform bitwise OR between A and r8, and store the result in A
-	void OR_r8() // OR A, r8    len: 4t if r8 != (HL), otherwise 8t
-	{
-		auto src_reg_idx = opcode & 7;
-		OR(GetReg8(src_reg_idx));
-	}
+// Perform subtraction of u8 from A, but don't store the result
+void CPU::CP_u8() // CP A, u8    len: 8t
+{
+	CP(Read8());
+}
 
 
-	// Perform bitwise OR between A and u8, and store the result in A
-	void OR_u8() // OR A, u8    len: 8t
-	{
-		OR(Read8());
-	}
+// Decrement 8-bit register by 1
+template<uint reg_idx>
+void CPU::DEC_r8() // DEC r8    len: 4t if r8 != (HL), otherwise 12t
+{
+	u8 reg = GetReg8<reg_idx>();
+	SetFlagsLazily(FlagOp::Dec, reg, 1, reg - 1, GetCarry());
+	SetReg8<reg_idx>(reg - 1);
+}
 
 
-	// Subtract r8 and carry flag from A
-	void SBC_r8() // SBC A, r8    len: 4t if r8 != (HL), otherwise 8t
-	{
-		auto src_reg_idx = opcode & 7;
-		SBC(GetReg8(src_reg_idx));
+// Decrement 16-bit register by 1
+template<CPU::Reg16 r16>
+void CPU::DEC_r16() // DEC r16    len: 8t
+{
+	if constexpr (r16 == Reg16::BC) { /* DEC BC */
+		--regs.BC;
+	}
+	else if constexpr (r16 == Reg16::DE) { /* DEC DE */
+		--regs.DE;
+	}
+	else if constexpr (r16 == Reg16::HL) { /* DEC HL */
+		--regs.HL;
 	}
+	else if constexpr (r16 == Reg16::SP) { /* DEC SP */
+		--regs.sp;
+	}
+	else {
+		static_assert(AlwaysFalse<r16>);
+	}
+	WaitCycle();
+}
 
 
-	// Subtract u8 and carry flag from A
-	void SBC_u8() // SBC A, u8    len: 8t
-	{
-		SBC(Read8());
-	}
+// Increment 8-bit register by 1
+template<uint reg_idx>
+void CPU::INC_r8() // INC r8    len: 4t if r8 != (HL), otherwise 12t
+{
+	u8 reg = GetReg8<reg_idx>();
+	SetFlagsLazily(FlagOp::Inc, reg, 1, reg + 1, GetCarry());
+	SetReg8<reg_idx>(reg + 1);
+}
 
 
-	// Subtract r8 from A
-	void SUB_r8() // SUB A, r8    len: 4t if r8 != (HL), otherwise 8t
-	{
-		auto src_reg_idx = opcode & 7;
-		SUB(GetReg8(src_reg_idx));
+// Increment 16-bit register by 1
+template<CPU::Reg16 r16>
+void CPU::INC_r16() // INC r16    len: 8t
+{
+	if constexpr (r16 == Reg16::BC) { /* INC BC */
+		++regs.BC;
+	}
+	else if constexpr (r16 == Reg16::DE) { /* INC DE */
+		++regs.DE;
+	}
+	else if constexpr (r16 == Reg16::HL) { /* INC HL */
+		++regs.HL;
 	}
+	else if constexpr (r16 == Reg16::SP) { /* INC SP */
+		++regs.sp;
+	}
+	else {
+		static_assert(AlwaysFalse<r16>);
+	}
+	WaitCycle();
+}
 
 
-	// Subtract u8 from A
-	void SUB_u8() // SUB A, u8    len: 8t
-	{
-		SUB(Read8());
-	}
+// Perform bitwise OR between A and r8, and store the result in A
+template<uint src_reg_idx>
+void CPU::OR_r8() // OR A, r8    len: 4t if r8 != (HL), otherwise 8t
+{
+	OR(GetReg8<src_reg_idx>());
+}
 
 
-	// Perform bitwise XOR between A and r8, and store the result in A
-	void XOR_r8() // XOR A, r8    len: 4t if r8 != (HL), otherwise 8t
-	{
-		auto src_reg_idx = opcode & 7;
-		XOR(GetReg8(src_reg_idx));
-	}
+// Perform bitwise OR between A and u8, and store the result in A
+void CPU::OR_u8() // OR A, u8    len: 8t
+{
+	OR(Read8());
+}
 
 
-	// Perform bitwise XOR between A and u8, and store the result in A
-	void XOR_u8() // XOR A, u8    len: 8t
-	{
-		XOR(Read8());
-	}
+// Subtract r8 and carry flag from A
+template<uint src_reg_idx>
+void CPU::SBC_r8() // SBC A, r8    len: 4t if r8 != (HL), otherwise 8t
+{
+	SBC(GetReg8<src_reg_idx>());
+}
 
 
-	void ADC(const u8 op)
-	{
-		u16 delta = op + F.carry;
-		F.neg = 0;
-		F.half = (A & 0xF) + (op & 0xF) + F.carry > 0xF; // check if overflow from bit 3
-		F.carry = A + delta > 0xFF; // check if overflow from bit 7
-		A += delta;
-		F.zero = A == 0;
-	}
+// Subtract u8 and carry flag from A
+void CPU::SBC_u8() // SBC A, u8    len: 8t
+{
+	SBC(Read8());
+}
 
 
-	void ADD(const u8 op)
-	{
-		F.neg = 0;
-		F.half = ((A & 0xF) + (op & 0xF) > 0xF); // check if overflow from bit 3
-		F.carry = A + op > 0xFF; // check if overflow from bit 7
-		A += op;
-		F.zero = A == 0;
-	}
+// Subtract r8 from A
+template<uint src_reg_idx>
+void CPU::SUB_r8() // SUB A, r8    len: 4t if r8 != (HL), otherwise 8t
+{
+	SUB(GetReg8<src_reg_idx>());
+}
 
 
-	void AND(const u8 op)
-	{
-		A &= op;
-		F.zero = A == 0;
-		F.neg = 0;
-		F.half = 1;
-		F.carry = 0;
-	}
+// Subtract u8 from A
+void CPU::SUB_u8() // SUB A, u8    len: 8t
+{
+	SUB(Read8());
+}
 
 
-	void CP(const u8 op)
-	{
-		F.zero = A - op == 0;
-		F.neg = 1;
-		F.half = (op & 0xF) > (A & 0xF); // check if borrow from bit 4
-		F.carry = op > A; // check if borrow
-	}
+// Perform bitwise XOR between A and r8, and store the result in A
+template<uint src_reg_idx>
+void CPU::XOR_r8() // XOR A, r8    len: 4t if r8 != (HL), otherwise 8t
+{
+	XOR(GetReg8<src_reg_idx>());
+}
 
 
-	void OR(const u8 op)
-	{
-		A |= op;
-		F.zero = A == 0;
-		F.neg = F.half = F.carry = 0;
-	}
+// Perform bitwise XOR between A and u8, and store the result in A
+void CPU::XOR_u8() // XOR A, u8    len: 8t
+{
+	XOR(Read8());
+}
 
 
-	void SBC(const u8 op)
-	{
-		u16 delta = op + F.carry;
-		F.neg = 1;
-		F.half = (op & 0xF) + F.carry > (A & 0xF); // check if borrow from bit 4
-		F.carry = delta > A; // check if borrow
-		A -= delta;
-		F.zero = A == 0;
-	}
+void CPU::ADC(const u8 op)
+{
+	bool carry = GetCarry();
+	u8 result = regs.A + op + carry;
+	SetFlagsLazily(FlagOp::Adc, regs.A, op, result, carry);
+	regs.A = result;
+}
 
 
-	void SUB(const u8 op)
-	{
-		F.neg = 1;
-		F.half = (op & 0xF) > (A & 0xF); // check if borrow from bit 4
-		F.carry = op > A; // check if borrow
-		A -= op;
-		F.zero = A == 0;
-	}
+void CPU::ADD(const u8 op)
+{
+	u8 result = regs.A + op;
+	SetFlagsLazily(FlagOp::Add, regs.A, op, result);
+	regs.A = result;
+}
 
 
-	void XOR(const u8 op)
-	{
-		A ^= op;
-		F.zero = A == 0;
-		F.neg = F.half = F.carry = 0;
-	}
+void CPU::AND(const u8 op)
+{
+	regs.A &= op;
+	SetFlagsLazily(FlagOp::And, regs.A, op, regs.A);
+}
 
 
-	// Rotate register r8 left through carry.
-	void RL() // RL r8    len: 8t if r8 != (HL), otherwise 16t (prefixed instruction)
-	{
-		auto reg_idx = opcode & 7;
-		u8 reg = GetReg8(reg_idx);
-		bool prev_bit7 = reg >> 7;
-		reg = reg << 1 | F.carry;
-		F.carry = prev_bit7;
-		F.zero = reg == 0;
-		F.neg = F.half = 0;
-		SetReg8(reg_idx, reg);
-	}
+void CPU::CP(const u8 op)
+{
+	SetFlagsLazily(FlagOp::Sub, regs.A, op, u8(regs.A - op));
+}
 
 
-	// Rotate A left through carry (and clear the zero flag)
-	void RLA() // RLA    len: 4t
-	{
-		bool prev_bit7 = A >> 7;
-		A = A << 1 | F.carry;
-		F.carry = prev_bit7;
-		F.zero = F.neg = F.half = 0;
-	}
+void CPU::OR(const u8 op)
+{
+	regs.A |= op;
+	SetFlagsLazily(FlagOp::OrXor, regs.A, op, regs.A);
+}
 
 
-	// Rotate register r8 left
-	void RLC() // RLC r8    len: 8t if r8 != (HL), otherwise 16t (prefixed instruction)
-	{
-		auto reg_idx = opcode & 7;
-		u8 reg = GetReg8(reg_idx);
-		F.carry = reg >> 7;
-		reg = std::rotl(reg, 1);
-		F.zero = reg == 0;
-		F.neg = F.half = 0;
-		SetReg8(reg_idx, reg);
-	}
+void CPU::SBC(const u8 op)
+{
+	bool carry = GetCarry();
+	u8 result = regs.A - op - carry;
+	SetFlagsLazily(FlagOp::Sbc, regs.A, op, result, carry);
+	regs.A = result;
+}
 
 
-	// Rotate A left (and clear the zero flag)
-	void RLCA() // RLCA    len: 4t
-	{
-		F.carry = A >> 7;
-		A = std::rotl(A, 1);
-		F.zero = F.neg = F.half = 0;
-	}
+void CPU::SUB(const u8 op)
+{
+	u8 result = regs.A - op;
+	SetFlagsLazily(FlagOp::Sub, regs.A, op, result);
+	regs.A = result;
+}
 
 
-	// Rotate register r8 right through carry.
-	void RR() // RR r8    len: 8t if r8 != (HL), otherwise 16t (prefixed instruction)
-	{
-		auto reg_idx = opcode & 7;
-		u8 reg = GetReg8(reg_idx);
-		bool prev_bit0 = reg & 1;
-		reg = reg >> 1 | F.carry << 7;
-		F.carry = prev_bit0;
-		F.zero = reg == 0;
-		F.neg = F.half = 0;
-		SetReg8(reg_idx, reg);
-	}
+void CPU::XOR(const u8 op)
+{
+	regs.A ^= op;
+	SetFlagsLazily(FlagOp::OrXor, regs.A, op, regs.A);
+}
 
 
-	// Rotate A right through carry (and clear the zero flag)
-	void RRA() // RRA    len: 4t
-	{
-		bool prev_bit0 = A & 1;
-		A = A >> 1 | F.carry << 7;
-		F.carry = prev_bit0;
-		F.zero = F.neg = F.half = 0;
-	}
+// Rotate register r8 left through carry.
+template<uint reg_idx>
+void CPU::RL() // RL r8    len: 8t if r8 != (HL), otherwise 16t (prefixed instruction)
+{
+	Status& flags = Flags();
+	u8 reg = GetReg8<reg_idx>();
+	bool prev_bit7 = reg >> 7;
+	reg = reg << 1 | flags.carry;
+	flags.carry = prev_bit7;
+	flags.zero = reg == 0;
+	flags.neg = flags.half = 0;
+	SetReg8<reg_idx>(reg);
+}
+
+
+// Rotate A left through carry (and clear the zero flag)
+void CPU::RLA() // RLA    len: 4t
+{
+	Status& flags = Flags();
+	bool prev_bit7 = regs.A >> 7;
+	regs.A = regs.A << 1 | flags.carry;
+	flags.carry = prev_bit7;
+	flags.zero = flags.neg = flags.half = 0;
+}
 
 
-	// Rotate register r8 right
-	void RRC() // RRC r8    len: 8t if r8 != (HL), otherwise 16t (prefixed instruction)
-	{
-		auto reg_idx = opcode & 7;
-		u8 reg = GetReg8(reg_idx);
-		F.carry = reg & 1;
-		reg = std::rotr(reg, 1);
-		F.zero = reg == 0;
-		F.neg = F.half = 0;
-		SetReg8(reg_idx, reg);
-	}
+// Rotate register r8 left
+template<uint reg_idx>
+void CPU::RLC() // RLC r8    len: 8t if r8 != (HL), otherwise 16t (prefixed instruction)
+{
+	Status& flags = Flags();
+	u8 reg = GetReg8<reg_idx>();
+	flags.carry = reg >> 7;
+	reg = std::rotl(reg, 1);
+	flags.zero = reg == 0;
+	flags.neg = flags.half = 0;
+	SetReg8<reg_idx>(reg);
+}
+
+
+// Rotate A left (and clear the zero flag)
+void CPU::RLCA() // RLCA    len: 4t
+{
+	Status& flags = Flags();
+	flags.carry = regs.A >> 7;
+	regs.A = std::rotl(regs.A, 1);
+	flags.zero = flags.neg = flags.half = 0;
+}
 
 
-	// Rotate A right (and clear the zero flag)
-	void RRCA() // RRCA    len: 4t
-	{
-		F.carry = A & 1;
-		A = std::rotr(A, 1);
-		F.zero = F.neg = F.half = 0;
-	}
+// Rotate register r8 right through carry.
+template<uint reg_idx>
+void CPU::RR() // RR r8    len: 8t if r8 != (HL), otherwise 16t (prefixed instruction)
+{
+	Status& flags = Flags();
+	u8 reg = GetReg8<reg_idx>();
+	bool prev_bit0 = reg & 1;
+	reg = reg >> 1 | flags.carry << 7;
+	flags.carry = prev_bit0;
+	flags.zero = reg == 0;
+	flags.neg = flags.half = 0;
+	SetReg8<reg_idx>(reg);
+}
+
+
+// Rotate A right through carry (and clear the zero flag)
+void CPU::RRA() // RRA    len: 4t
+{
+	Status& flags = Flags();
+	bool prev_bit0 = regs.A & 1;
+	regs.A = regs.A >> 1 | flags.carry << 7;
+	flags.carry = prev_bit0;
+	flags.zero = flags.neg = flags.half = 0;
+}
 
 
-	// Shift arithmetic register r8 left
-	void SLA() // SLA r8    len: 8t if r8 != (HL), otherwise 16t (prefixed instruction)
-	{
-		auto reg_idx = opcode & 7;
-		u8 reg = GetReg8(reg_idx);
-		F.carry = reg >> 7;
-		reg <<= 1;
-		F.zero = reg == 0;
-		F.neg = F.half = 0;
-		SetReg8(reg_idx, reg);
-	}
-
-
-	// Shift arithmetic register r8 right
-	void SRA() // SRA r8    len: 8t if r8 != (HL), otherwise 16t (prefixed instruction)
-	{
-		auto reg_idx = opcode & 7;
-		u8 reg = GetReg8(reg_idx);
-		F.carry = reg & 1;
-		reg = reg >> 1 | reg & 0x80;
-		F.zero = reg == 0;
-		F.neg = F.half = 0;
-		SetReg8(reg_idx, reg);
-	}
-
-
-	// Shift logic register r8 right
-	void SRL() // SRL r8    len: 8t if r8 != (HL), otherwise 16t (prefixed instruction)
-	{
-		auto reg_idx = opcode & 7;
-		u8 reg = GetReg8(reg_idx);
-		F.carry = reg & 1;
-		reg >>= 1;
-		F.zero = reg == 0;
-		F.neg = F.half = 0;
-		SetReg8(reg_idx, reg);
-	}
-
-
-	// Set the zero flag according to whether a bit with position pos in register r8 is set or not
-	void BIT() // BIT pos, r8    len: 8t if r8 != (HL), otherwise 12t (prefixed instruction)
-	{
-		auto reg_idx = opcode & 7;
-		u8 reg = GetReg8(reg_idx);
-		auto pos = (opcode - 0x40) >> 3;
-		F.zero = (reg & 1 << pos) == 0;
-		F.neg = 0;
-		F.half = 1;
-	}
-
-
-	// Clear bit number pos in register r8
-	void RES() // RES pos, r8    len: 8t if r8 != (HL), otherwise 16t (prefixed instruction)
-	{
-		auto reg_idx = opcode & 7;
-		u8 reg = GetReg8(reg_idx);
-		auto pos = (opcode - 0x80) >> 3;
-		reg &= ~(1 << pos);
-		SetReg8(reg_idx, reg);
-	}
-
-
-	// Set bit number pos in register r8
-	void SET() // SET pos, r8    len: 8t if r8 != (HL), otherwise 16t (prefixed instruction)
-	{
-		auto reg_idx = opcode & 7;
-		u8 reg = GetReg8(reg_idx);
-		auto pos = (opcode - 0xC0) >> 3;
-		reg |= 1 << pos;
-		SetReg8(reg_idx, reg);
-	}
-
-
-	// Swap upper 4 bits in register r8 and the lower 4 ones. 
-	void SWAP() // SWAP r8    len: 8t if r8 != (HL), otherwise 16t (prefixed instruction)
-	{
-		auto reg_idx = opcode & 7;
-		u8 reg = GetReg8(reg_idx);
-		reg = std::rotl(reg, 4);
-		F.zero = reg == 0;
-		F.neg = F.half = F.carry = 0;
-		SetReg8(reg_idx, reg);
-	}
-
-
-	// Prefixed instructions
-	void CB() // CB <instr>
-	{
-		opcode = Read8();
-		switch (opcode >> 3) {
-		case 0: RLC(); break;
-		case 1: RRC(); break;
-		case 2: RL(); break;
-		case 3: RR(); break;
-		case 4: SLA(); break;
-		case 5: SRA(); break;
-		case 6: SWAP(); break;
-		case 7: SRL(); break;
-		case 8: case 9: case 10: case 11: case 12: case 13: case 14: case 15: BIT(); break;
-		case 16: case 17: case 18: case 19: case 20: case 21: case 22: case 23: RES(); break;
-		case 24: case 25: case 26: case 27: case 28: case 29: case 30: case 31: SET(); break;
-		default: std::unreachable();
-		}
-	}
-
+// Rotate register r8 right
+template<uint reg_idx>
+void CPU::RRC() // RRC r8    len: 8t if r8 != (HL), otherwise 16t (prefixed instruction)
+{
+	Status& flags = Flags();
+	u8 reg = GetReg8<reg_idx>();
+	flags.carry = reg & 1;
+	reg = std::rotr(reg, 1);
+	flags.zero = reg == 0;
+	flags.neg = flags.half = 0;
+	SetReg8<reg_idx>(reg);
+}
+
+
+// Rotate A right (and clear the zero flag)
+void CPU::RRCA() // RRCA    len: 4t
+{
+	Status& flags = Flags();
+	flags.carry = regs.A & 1;
+	regs.A = std::rotr(regs.A, 1);
+	flags.zero = flags.neg = flags.half = 0;
+}
 
-	// Jump to subroutine; set PC to u16 if condition holds
-	template<Condition cond>
-	void CALL() // CALL cc, u16    len: 24t if branch is successful, else 12t
-	{
-		u16 target = Read16();
-		if (EvalCond<cond>()) {
-			WaitCycle();
-			PushPC();
-			pc = target;
-		}
-	}
 
+// Shift arithmetic register r8 left
+template<uint reg_idx>
+void CPU::SLA() // SLA r8    len: 8t if r8 != (HL), otherwise 16t (prefixed instruction)
+{
+	Status& flags = Flags();
+	u8 reg = GetReg8<reg_idx>();
+	flags.carry = reg >> 7;
+	reg <<= 1;
+	flags.zero = reg == 0;
+	flags.neg = flags.half = 0;
+	SetReg8<reg_idx>(reg);
+}
+
+
+// Shift arithmetic register r8 right
+template<uint reg_idx>
+void CPU::SRA() // SRA r8    len: 8t if r8 != (HL), otherwise 16t (prefixed instruction)
+{
+	Status& flags = Flags();
+	u8 reg = GetReg8<reg_idx>();
+	flags.carry = reg & 1;
+	reg = reg >> 1 | reg & 0x80;
+	flags.zero = reg == 0;
+	flags.neg = flags.half = 0;
+	SetReg8<reg_idx>(reg);
+}
+
+
+// Shift logic register r8 right
+template<uint reg_idx>
+void CPU::SRL() // SRL r8    len: 8t if r8 != (HL), otherwise 16t (prefixed instruction)
+{
+	Status& flags = Flags();
+	u8 reg = GetReg8<reg_idx>();
+	flags.carry = reg & 1;
+	reg >>= 1;
+	flags.zero = reg == 0;
+	flags.neg = flags.half = 0;
+	SetReg8<reg_idx>(reg);
+}
+
+
+// Set the zero flag according to whether a bit with position pos in register r8 is set or not
+template<uint pos, uint reg_idx>
+void CPU::BIT() // BIT pos, r8    len: 8t if r8 != (HL), otherwise 12t (prefixed instruction)
+{
+	Status& flags = Flags();
+	u8 reg = GetReg8<reg_idx>();
+	flags.zero = (reg & 1 << pos) == 0;
+	flags.neg = 0;
+	flags.half = 1;
+}
 
-	// Return from subroutine; set PC by popping the stack if condition holds
-	template<Condition cond>
-	void RET() // RET cc    len: 16t if opcode == $C9 (RET). Otherwise: 20t if branch is successful, else 8t
-	{
-		if constexpr (cond == Condition::True) {
-			PopPC();
-			WaitCycle();
-		}
-		else {
-			WaitCycle();
-			if (EvalCond<cond>()) {
-				PopPC();
-				WaitCycle();
-			}
-		}
-	}
 
+// Clear bit number pos in register r8
+template<uint pos, uint reg_idx>
+void CPU::RES() // RES pos, r8    len: 8t if r8 != (HL), otherwise 16t (prefixed instruction)
+{
+	u8 reg = GetReg8<reg_idx>();
+	reg &= ~(1 << pos);
+	SetReg8<reg_idx>(reg);
+}
 
-	// Return from subroutine and enable interrupts
-	void RETI() // RETI    len: 16t
-	{
-		PopPC();
-		WaitCycle();
-		ime = 1;
-	}
 
+// Set bit number pos in register r8
+template<uint pos, uint reg_idx>
+void CPU::SET() // SET pos, r8    len: 8t if r8 != (HL), otherwise 16t (prefixed instruction)
+{
+	u8 reg = GetReg8<reg_idx>();
+	reg |= 1 << pos;
+	SetReg8<reg_idx>(reg);
+}
 
-	// Relative jump; add a signed 8-bit integer to the address of the instruction following the JR if the condition holds
-	template<Condition cond>
-	void JR() // JR cc, s8    len: 12t if the branch is successful, else 8t
-	{
-		s8 offset = Read8();
-		if (EvalCond<cond>()) {
-			pc += offset;
-			WaitCycle();
-		}
+
+// Swap upper 4 bits in register r8 and the lower 4 ones. 
+template<uint reg_idx>
+void CPU::SWAP() // SWAP r8    len: 8t if r8 != (HL), otherwise 16t (prefixed instruction)
+{
+	Status& flags = Flags();
+	u8 reg = GetReg8<reg_idx>();
+	reg = std::rotl(reg, 4);
+	flags.zero = reg == 0;
+	flags.neg = flags.half = flags.carry = 0;
+	SetReg8<reg_idx>(reg);
+}
+
+
+// Prefixed instructions
+void CPU::CB() // CB <instr>
+{
+	opcode = Read8();
+	(this->*cb_table[opcode])();
+}
+
+
+// Jump to subroutine; set PC to u16 if condition holds
+template<CPU::Condition cond>
+void CPU::CALL() // CALL cc, u16    len: 24t if branch is successful, else 12t
+{
+	u16 target = Read16();
+	if (EvalCond<cond>()) {
+		WaitCycle();
+		PushPC();
+		regs.pc = target;
 	}
+}
 
 
-	// Absolute jump; jump to the address specified by u16 if the condition holds
-	template<Condition cond>
-	void JP_u16() // JP cc, u16    len: 16t if the branch is successful, else 12t
-	{
-		u16 target = Read16();
+// Return from subroutine; set PC by popping the stack if condition holds
+template<CPU::Condition cond>
+void CPU::RET() // RET cc    len: 16t if opcode == $C9 (RET). Otherwise: 20t if branch is successful, else 8t
+{
+	if constexpr (cond == Condition::True) {
+		PopPC();
+		WaitCycle();
+	}
+	else {
+		WaitCycle();
 		if (EvalCond<cond>()) {
-			pc = target;
+			PopPC();
 			WaitCycle();
 		}
 	}
+}
 
 
-	// Absolute jump; jump to the address specified by HL
-	void JP_HL() // JP HL    len: 4t
-	{
-		pc = H << 8 | L;
-	}
+// Return from subroutine and enable interrupts
+void CPU::RETI() // RETI    len: 16t
+{
+	PopPC();
+	WaitCycle();
+	ime = 1;
+	attention = true;
+}
 
 
-	// Jump to subroutine at specific addresses
-	void RST() // RST vec    len: 16t
-	{
+// Relative jump; add a signed 8-bit integer to the address of the instruction following the JR if the condition holds
+template<CPU::Condition cond>
+void CPU::JR() // JR cc, s8    len: 12t if the branch is successful, else 8t
+{
+	s8 offset = Read8();
+	if (EvalCond<cond>()) {
+		regs.pc += offset;
 		WaitCycle();
-		PushPC();
-		pc = opcode - 0xC7;
+		idle_loop_check_pending = idle_loop_skipping_enabled && offset < 0 && offset >= -s8(max_idle_loop_length);
+		attention |= idle_loop_check_pending;
 	}
+}
 
 
-	// Toggle the carry flag
-	void CCF() // CCF    len: 4t
-	{
-		F.carry = !F.carry;
-		F.neg = F.half = 0;
+// Absolute jump; jump to the address specified by u16 if the condition holds
+template<CPU::Condition cond>
+void CPU::JP_u16() // JP cc, u16    len: 16t if the branch is successful, else 12t
+{
+	u16 target = Read16();
+	if (EvalCond<cond>()) {
+		regs.pc = target;
+		WaitCycle();
 	}
+}
 
 
-	// Invert all bits in A
-	void CPL() // CPL    len: 4t
-	{
-		A = ~A;
-		F.neg = F.half = 1;
-	}
+// Absolute jump; jump to the address specified by HL
+void CPU::JP_HL() // JP HL    len: 4t
+{
+	regs.pc = regs.HL;
+}
 
 
-	void DAA() // DAA    len: 4t
-	{
-		// https://forums.nesdev.com/viewtopic.php?t=15944
-		if (F.neg) {
-			if (F.carry) {
-				A -= 0x60;
-			}
-			if (F.half) {
-				A -= 0x6;
-			}
-		}
-		else {
-			if (F.carry || A > 0x99) {
-				A += 0x60;
-				F.carry = 1;
-			}
-			if (F.half || (A & 0xF) > 0x9) {
-				A += 0x6;
-			}
-		}
-		F.zero = A == 0;
-		F.half = 0;
-	}
+// Jump to subroutine at specific addresses
+template<u8 vec>
+void CPU::RST() // RST vec    len: 16t
+{
+	WaitCycle();
+	PushPC();
+	regs.pc = vec;
+}
 
 
-	// Disable interrupts
-	void DI() // DI    len: 4t
-	{
-		ime = 0;
-	}
+// Toggle the carry flag
+void CPU::CCF() // CCF    len: 4t
+{
+	Status& flags = Flags();
+	flags.carry = !flags.carry;
+	flags.neg = flags.half = 0;
+}
 
 
-	// Enable interrupts (delayed by one instruction)
-	void EI() // EI    len: 4t
-	{
-		ei_executed = true;
-		instr_executed_after_ei_executed = false;
-	}
+// Invert all bits in A
+void CPU::CPL() // CPL    len: 4t
+{
+	Status& flags = Flags();
+	regs.A = ~regs.A;
+	flags.neg = flags.half = 1;
+}
 
 
-	// (Attempt to) enter HALT mode
-	void HALT() // HALT    len: 4t
-	{
-		if (ime || (IF & IE & 0x1F) == 0) {
-			in_halt_mode = true;
+void CPU::DAA() // DAA    len: 4t
+{
+	Status& flags = Flags();
+	// https://forums.nesdev.com/viewtopic.php?t=15944
+	if (flags.neg) {
+		if (flags.carry) {
+			regs.A -= 0x60;
 		}
-		else {
-			// HALT is not entered, causing a bug where the CPU fails to increase PC when executing the next instruction
-			halt_bug = true;
+		if (flags.half) {
+			regs.A -= 0x6;
 		}
 	}
+	else {
+		if (flags.carry || regs.A > 0x99) {
+			regs.A += 0x60;
+			flags.carry = 1;
+		}
+		if (flags.half || (regs.A & 0xF) > 0x9) {
+			regs.A += 0x6;
+		}
+	}
+	flags.zero = regs.A == 0;
+	flags.half = 0;
+}
 
 
-	// Illegal opcode
-	void Illegal()
-	{
-		UserMessage::Show(std::format("Illegal opcode ${:02X} encountered. Stopping emulation.", opcode),
-			UserMessage::Type::Error);
-	}
+// Disable interrupts
+void CPU::DI() // DI    len: 4t
+{
+	ime = 0;
+	attention = true;
+}
 
 
-	// No operation
-	void NOP() // NOP    len: 4t
-	{
+// Enable interrupts (delayed by one instruction)
+void CPU::EI() // EI    len: 4t
+{
+	ei_executed = true;
+	instr_executed_after_ei_executed = false;
+	ei_delay_step_due = true;
+	attention = true;
+}
 
+
+// (Attempt to) enter HALT mode
+void CPU::HALT() // HALT    len: 4t
+{
+	if (ime || (IF & IE & 0x1F) == 0) {
+		in_halt_mode = true;
+	}
+	else {
+		// HALT is not entered, causing a bug where the CPU fails to increase PC when executing the next instruction
+		halt_bug = true;
 	}
+	attention = true;
+}
 
 
-	// Pop a word off of the stack and put into a 16-bit register
-	template<Reg16 r16>
-	void POP() // POP r16    len: 12t
-	{
-		if constexpr (r16 == Reg16::AF) { /* POP AF */
-			F = std::bit_cast<Status, u8>(u8(ReadCycle(sp++) & 0xF0));
-			A = ReadCycle(sp++);
-		}
-		else if constexpr (r16 == Reg16::BC) { /* POP BC */
-			C = ReadCycle(sp++);
-			B = ReadCycle(sp++);
-		}
-		else if constexpr (r16 == Reg16::DE) { /* POP DE */
-			E = ReadCycle(sp++);
-			D = ReadCycle(sp++);
-		}
-		else if constexpr (r16 == Reg16::HL) { /* POP HL */
-			L = ReadCycle(sp++);
-			H = ReadCycle(sp++);
-		}
-		else {
-			static_assert(AlwaysFalse<r16>);
-		}
-	}
+// Illegal opcode
+void CPU::Illegal()
+{
+	GB& gb = static_cast<GB&>(*this);
+	gb.System::ShowMessage(std::format("Illegal opcode ${:02X} encountered. Stopping emulation.", opcode),
+		UserMessage::Type::Error);
+}
 
 
-	// Push a 16-bit register onto the stack
-	template<Reg16 r16>
-	void PUSH() // PUSH r16    len: 16t
-	{
-		WaitCycle();
-		if constexpr (r16 == Reg16::AF) { /* PUSH AF */
-			WriteCycle(--sp, A);
-			WriteCycle(--sp, std::bit_cast<u8, Status>(F));
-		}
-		else if constexpr (r16 == Reg16::BC) { /* PUSH BC */
-			WriteCycle(--sp, B);
-			WriteCycle(--sp, C);
-		}
-		else if constexpr (r16 == Reg16::DE) { /* PUSH DE */
-			WriteCycle(--sp, D);
-			WriteCycle(--sp, E);
-		}
-		else if constexpr (r16 == Reg16::HL) { /* PUSH HL */
-			WriteCycle(--sp, H);
-			WriteCycle(--sp, L);
-		}
-		else {
-			static_assert(AlwaysFalse<r16>);
-		}
+// No operation
+void CPU::NOP() // NOP    len: 4t
+{
+
+}
+
+
+// Pop a word off of the stack and put into a 16-bit register
+template<CPU::Reg16 r16>
+void CPU::POP() // POP r16    len: 12t
+{
+	if constexpr (r16 == Reg16::AF) { /* POP AF */
+		regs.F = std::bit_cast<Status, u8>(u8(ReadCycle(regs.sp++) & 0xF0));
+		pending_flags.op = FlagOp::None;
+		regs.A = ReadCycle(regs.sp++);
+	}
+	else if constexpr (r16 == Reg16::BC) { /* POP BC */
+		regs.C = ReadCycle(regs.sp++);
+		regs.B = ReadCycle(regs.sp++);
 	}
+	else if constexpr (r16 == Reg16::DE) { /* POP DE */
+		regs.E = ReadCycle(regs.sp++);
+		regs.D = ReadCycle(regs.sp++);
+	}
+	else if constexpr (r16 == Reg16::HL) { /* POP HL */
+		regs.L = ReadCycle(regs.sp++);
+		regs.H = ReadCycle(regs.sp++);
+	}
+	else {
+		static_assert(AlwaysFalse<r16>);
+	}
+}
 
 
-	// Set the carry flag
-	void SCF() // SCF    len: 4t
-	{
-		F.carry = 1;
-		F.neg = F.half = 0;
+// Push a 16-bit register onto the stack
+template<CPU::Reg16 r16>
+void CPU::PUSH() // PUSH r16    len: 16t
+{
+	WaitCycle();
+	if constexpr (r16 == Reg16::AF) { /* PUSH AF */
+		WriteCycle(--regs.sp, regs.A);
+		WriteCycle(--regs.sp, std::bit_cast<u8, Status>(Flags()));
+	}
+	else if constexpr (r16 == Reg16::BC) { /* PUSH BC */
+		WriteCycle(--regs.sp, regs.B);
+		WriteCycle(--regs.sp, regs.C);
+	}
+	else if constexpr (r16 == Reg16::DE) { /* PUSH DE */
+		WriteCycle(--regs.sp, regs.D);
+		WriteCycle(--regs.sp, regs.E);
+	}
+	else if constexpr (r16 == Reg16::HL) { /* PUSH HL */
+		WriteCycle(--regs.sp, regs.H);
+		WriteCycle(--regs.sp, regs.L);
 	}
+	else {
+		static_assert(AlwaysFalse<r16>);
+	}
+}
 
 
-	// Enter stop mode on DMG, switch between single and double speed modes on CGB
-	void STOP() // STOP    len: 4t
-	{
-		// This instruction is very glitchy, see https://pbs.twimg.com/media/E5jlgW9XIAEKj0t.png:large
-		// On DMG, enter low power mode. On the CGB, switch between normal and double speed (if KEY1.0 has been set).
+// Set the carry flag
+void CPU::SCF() // SCF    len: 4t
+{
+	Status& flags = Flags();
+	flags.carry = 1;
+	flags.neg = flags.half = 0;
+}
 
-		// TODO: Test if a button is being held and selected in JOYP
-		// TODO: enter power mode on CGB if key1 == 0?
-		bool interrupt_pending = IE & IF & 0x1F;
-		if (System::SpeedSwitchPrepared()) { // If a speed switch was requested (and in CGB mode)
-			if (interrupt_pending) {
-				if (ime) {
-					// Glitch non-deterministically.
-					// For now, emulated as successfully performing a speed switch.
-					InitiateSpeedSwitch();
-				}
-				else {
-					// Successfully perform a speed switch.
-					InitiateSpeedSwitch();
-				}
+
+// Enter stop mode on DMG, switch between single and double speed modes on CGB
+void CPU::STOP() // STOP    len: 4t
+{
+	GB& gb = static_cast<GB&>(*this);
+	// This instruction is very glitchy, see https://pbs.twimg.com/media/E5jlgW9XIAEKj0t.png:large
+	// On DMG, enter low power mode. On the CGB, switch between normal and double speed (if KEY1.0 has been set).
+
+	// TODO: Test if a button is being held and selected in JOYP
+	// TODO: enter power mode on CGB if key1 == 0?
+	bool interrupt_pending = IE & IF & 0x1F;
+	if (gb.System::SpeedSwitchPrepared()) { // If a speed switch was requested (and in CGB mode)
+		if (interrupt_pending) {
+			if (ime) {
+				// Glitch non-deterministically.
+				// For now, emulated as successfully performing a speed switch.
+				InitiateSpeedSwitch();
 			}
 			else {
-				// Successfully perform a speed switch with STOP as a 2-byte instruction. Also, enter HALT.
-				++pc;
-				HALT();
+				// Successfully perform a speed switch.
 				InitiateSpeedSwitch();
 			}
 		}
 		else {
-			// DIV is reset and STOP mode is reset. STOP is a 2-byte opcode if an interrupt is not pending
-			if (!interrupt_pending) {
-				++pc;
-			}
-			in_stop_mode = true;
+			// Successfully perform a speed switch with STOP as a 2-byte instruction. Also, enter HALT.
+			++regs.pc;
+			HALT();
+			InitiateSpeedSwitch();
+		}
+	}
+	else {
+		// DIV is reset and STOP mode is reset. STOP is a 2-byte opcode if an interrupt is not pending
+		if (!interrupt_pending) {
+			++regs.pc;
 		}
-		Timer::WriteDIV(0);
-	}
-
-
-	void StreamState(SerializationStream& stream)
-	{
-		stream.StreamPrimitive(ei_executed);
-		stream.StreamPrimitive(halt_bug);
-		stream.StreamPrimitive(ime);
-		stream.StreamPrimitive(in_halt_mode);
-		stream.StreamPrimitive(in_stop_mode);
-		stream.StreamPrimitive(instr_executed_after_ei_executed);
-		stream.StreamPrimitive(speed_switch_is_active);
-		stream.StreamPrimitive(speed_switch_m_cycles_remaining);
-		stream.StreamPrimitive(opcode);
-		stream.StreamPrimitive(A);
-		stream.StreamPrimitive(B);
-		stream.StreamPrimitive(C);
-		stream.StreamPrimitive(D);
-		stream.StreamPrimitive(E);
-		stream.StreamPrimitive(H);
-		stream.StreamPrimitive(L);
-		stream.StreamPrimitive(F);
-		stream.StreamPrimitive(pc);
-		stream.StreamPrimitive(sp);
-		stream.StreamPrimitive(IE);
-		stream.StreamPrimitive(IF);
-		stream.StreamPrimitive(read_hl);
-	}
-
-
-	template void CALL< Condition::Carry>();
-	template void CALL< Condition::Zero>();
-	template void CALL< Condition::NCarry>();
-	template void CALL< Condition::NZero>();
-	template void CALL< Condition::True>();
-	template void JP_u16< Condition::Carry>();
-	template void JP_u16< Condition::Zero>();
-	template void JP_u16< Condition::NCarry>();
-	template void JP_u16< Condition::NZero>();
-	template void JP_u16< Condition::True>();
-	template void JR< Condition::Carry>();
-	template void JR< Condition::Zero>();
-	template void JR< Condition::NCarry>();
-	template void JR< Condition::NZero>();
-	template void JR< Condition::True>();
-	template void RET< Condition::Carry>();
-	template void RET< Condition::Zero>();
-	template void RET< Condition::NCarry>();
-	template void RET< Condition::NZero>();
-	template void RET< Condition::True>();
-
-	template void ADD_HL_r16<Reg16::BC>();
-	template void ADD_HL_r16<Reg16::DE>();
-	template void ADD_HL_r16<Reg16::HL>();
-	template void ADD_HL_r16<Reg16::SP>();
-	template void DEC_r16<Reg16::BC>();
-	template void DEC_r16<Reg16::DE>();
-	template void DEC_r16<Reg16::HL>();
-	template void DEC_r16<Reg16::SP>();
-	template void INC_r16<Reg16::BC>();
-	template void INC_r16<Reg16::DE>();
-	template void INC_r16<Reg16::HL>();
-	template void INC_r16<Reg16::SP>();
-	template void LD_A_r16<Reg16::BC>();
-	template void LD_A_r16<Reg16::DE>();
-	template void LD_r16_u16<Reg16::BC>();
-	template void LD_r16_u16<Reg16::DE>();
-	template void LD_r16_u16<Reg16::HL>();
-	template void LD_r16_u16<Reg16::SP>();
-	template void LD_r16_A<Reg16::BC>();
-	template void LD_r16_A<Reg16::DE>();
-	template void LD_r16_A<Reg16::HL>();
-	template void LD_r16_A<Reg16::SP>();
-	template void POP<Reg16::BC>();
-	template void POP<Reg16::DE>();
-	template void POP<Reg16::HL>();
-	template void POP<Reg16::AF>();
-	template void PUSH<Reg16::BC>();
-	template void PUSH<Reg16::DE>();
-	template void PUSH<Reg16::HL>();
-	template void PUSH<Reg16::AF>();
-}
\ No newline at end of file
+		in_stop_mode = true;
+	}
+	gb.Timer::WriteDIV(0);
+}
+
+
+void CPU::StreamState(SerializationStream& stream)
+{
+	stream.StreamPrimitive(ei_executed);
+	stream.StreamPrimitive(halt_bug);
+	stream.StreamPrimitive(ime);
+	stream.StreamPrimitive(in_halt_mode);
+	stream.StreamPrimitive(in_stop_mode);
+	stream.StreamPrimitive(instr_executed_after_ei_executed);
+	stream.StreamPrimitive(speed_switch_is_active);
+	stream.StreamPrimitive(speed_switch_m_cycles_remaining);
+	stream.StreamPrimitive(opcode);
+	Flags();
+	stream.StreamPrimitive(regs);
+	stream.StreamPrimitive(IE);
+	stream.StreamPrimitive(IF);
+	stream.StreamPrimitive(read_hl);
+	attention = true; /* not streamed; re-derived before the next instruction */
+}
+
+
+/* Make these constexpr, and MSVC will freak out */
+const std::array<void(CPU::*)(), 256> CPU::instr_table = [] {
+	using enum Condition;
+	using enum Reg16;
+	constexpr std::array<void(CPU::*)(), 256> table = {
+		&CPU::NOP       , &CPU::LD_r16_u16<BC>, &CPU::LD_r16_A<BC>, &CPU::INC_r16<BC>, &CPU::INC_r8<0>, &CPU::DEC_r8<0>, &CPU::LD_r8_u8<0>, &CPU::RLCA, /* 0x */
+		&CPU::LD_u16_SP , &CPU::ADD_HL_r16<BC>, &CPU::LD_A_r16<BC>, &CPU::DEC_r16<BC>, &CPU::INC_r8<1>, &CPU::DEC_r8<1>, &CPU::LD_r8_u8<1>, &CPU::RRCA, /* 0x */
+		&CPU::STOP      , &CPU::LD_r16_u16<DE>, &CPU::LD_r16_A<DE>, &CPU::INC_r16<DE>, &CPU::INC_r8<2>, &CPU::DEC_r8<2>, &CPU::LD_r8_u8<2>, &CPU::RLA , /* 1x */
+		&CPU::JR<True>  , &CPU::ADD_HL_r16<DE>, &CPU::LD_A_r16<DE>, &CPU::DEC_r16<DE>, &CPU::INC_r8<3>, &CPU::DEC_r8<3>, &CPU::LD_r8_u8<3>, &CPU::RRA , /* 1x */
+		&CPU::JR<NZero> , &CPU::LD_r16_u16<HL>, &CPU::LD_HLp_A    , &CPU::INC_r16<HL>, &CPU::INC_r8<4>, &CPU::DEC_r8<4>, &CPU::LD_r8_u8<4>, &CPU::DAA , /* 2x */
+		&CPU::JR<Zero>  , &CPU::ADD_HL_r16<HL>, &CPU::LD_A_HLp    , &CPU::DEC_r16<HL>, &CPU::INC_r8<5>, &CPU::DEC_r8<5>, &CPU::LD_r8_u8<5>, &CPU::CPL , /* 2x */
+		&CPU::JR<NCarry>, &CPU::LD_r16_u16<SP>, &CPU::LD_HLm_A    , &CPU::INC_r16<SP>, &CPU::INC_r8<6>, &CPU::DEC_r8<6>, &CPU::LD_r8_u8<6>, &CPU::SCF , /* 3x */
+		&CPU::JR<Carry> , &CPU::ADD_HL_r16<SP>, &CPU::LD_A_HLm    , &CPU::DEC_r16<SP>, &CPU::INC_r8<7>, &CPU::DEC_r8<7>, &CPU::LD_r8_u8<7>, &CPU::CCF , /* 3x */
+
+		&CPU::LD_r8_r8<0, 0>, &CPU::LD_r8_r8<0, 1>, &CPU::LD_r8_r8<0, 2>, &CPU::LD_r8_r8<0, 3>, &CPU::LD_r8_r8<0, 4>, &CPU::LD_r8_r8<0, 5>, &CPU::LD_r8_r8<0, 6>, &CPU::LD_r8_r8<0, 7>, /* 4x */
+		&CPU::LD_r8_r8<1, 0>, &CPU::LD_r8_r8<1, 1>, &CPU::LD_r8_r8<1, 2>, &CPU::LD_r8_r8<1, 3>, &CPU::LD_r8_r8<1, 4>, &CPU::LD_r8_r8<1, 5>, &CPU::LD_r8_r8<1, 6>, &CPU::LD_r8_r8<1, 7>, /* 4x */
+		&CPU::LD_r8_r8<2, 0>, &CPU::LD_r8_r8<2, 1>, &CPU::LD_r8_r8<2, 2>, &CPU::LD_r8_r8<2, 3>, &CPU::LD_r8_r8<2, 4>, &CPU::LD_r8_r8<2, 5>, &CPU::LD_r8_r8<2, 6>, &CPU::LD_r8_r8<2, 7>, /* 5x */
+		&CPU::LD_r8_r8<3, 0>, &CPU::LD_r8_r8<3, 1>, &CPU::LD_r8_r8<3, 2>, &CPU::LD_r8_r8<3, 3>, &CPU::LD_r8_r8<3, 4>, &CPU::LD_r8_r8<3, 5>, &CPU::LD_r8_r8<3, 6>, &CPU::LD_r8_r8<3, 7>, /* 5x */
+		&CPU::LD_r8_r8<4, 0>, &CPU::LD_r8_r8<4, 1>, &CPU::LD_r8_r8<4, 2>, &CPU::LD_r8_r8<4, 3>, &CPU::LD_r8_r8<4, 4>, &CPU::LD_r8_r8<4, 5>, &CPU::LD_r8_r8<4, 6>, &CPU::LD_r8_r8<4, 7>, /* 6x */
+		&CPU::LD_r8_r8<5, 0>, &CPU::LD_r8_r8<5, 1>, &CPU::LD_r8_r8<5, 2>, &CPU::LD_r8_r8<5, 3>, &CPU::LD_r8_r8<5, 4>, &CPU::LD_r8_r8<5, 5>, &CPU::LD_r8_r8<5, 6>, &CPU::LD_r8_r8<5, 7>, /* 6x */
+		&CPU::LD_r8_r8<6, 0>, &CPU::LD_r8_r8<6, 1>, &CPU::LD_r8_r8<6, 2>, &CPU::LD_r8_r8<6, 3>, &CPU::LD_r8_r8<6, 4>, &CPU::LD_r8_r8<6, 5>, &CPU::HALT          , &CPU::LD_r8_r8<6, 7>, /* 7x */
+		&CPU::LD_r8_r8<7, 0>, &CPU::LD_r8_r8<7, 1>, &CPU::LD_r8_r8<7, 2>, &CPU::LD_r8_r8<7, 3>, &CPU::LD_r8_r8<7, 4>, &CPU::LD_r8_r8<7, 5>, &CPU::LD_r8_r8<7, 6>, &CPU::LD_r8_r8<7, 7>, /* 7x */
+
+		&CPU::ADD_r8<0>, &CPU::ADD_r8<1>, &CPU::ADD_r8<2>, &CPU::ADD_r8<3>, &CPU::ADD_r8<4>, &CPU::ADD_r8<5>, &CPU::ADD_r8<6>, &CPU::ADD_r8<7>, /* 8x */
+		&CPU::ADC_r8<0>, &CPU::ADC_r8<1>, &CPU::ADC_r8<2>, &CPU::ADC_r8<3>, &CPU::ADC_r8<4>, &CPU::ADC_r8<5>, &CPU::ADC_r8<6>, &CPU::ADC_r8<7>, /* 8x */
+		&CPU::SUB_r8<0>, &CPU::SUB_r8<1>, &CPU::SUB_r8<2>, &CPU::SUB_r8<3>, &CPU::SUB_r8<4>, &CPU::SUB_r8<5>, &CPU::SUB_r8<6>, &CPU::SUB_r8<7>, /* 9x */
+		&CPU::SBC_r8<0>, &CPU::SBC_r8<1>, &CPU::SBC_r8<2>, &CPU::SBC_r8<3>, &CPU::SBC_r8<4>, &CPU::SBC_r8<5>, &CPU::SBC_r8<6>, &CPU::SBC_r8<7>, /* 9x */
+		&CPU::AND_r8<0>, &CPU::AND_r8<1>, &CPU::AND_r8<2>, &CPU::AND_r8<3>, &CPU::AND_r8<4>, &CPU::AND_r8<5>, &CPU::AND_r8<6>, &CPU::AND_r8<7>, /* Ax */
+		&CPU::XOR_r8<0>, &CPU::XOR_r8<1>, &CPU::XOR_r8<2>, &CPU::XOR_r8<3>, &CPU::XOR_r8<4>, &CPU::XOR_r8<5>, &CPU::XOR_r8<6>, &CPU::XOR_r8<7>, /* Ax */
+		&CPU::OR_r8<0> , &CPU::OR_r8<1> , &CPU::OR_r8<2> , &CPU::OR_r8<3> , &CPU::OR_r8<4> , &CPU::OR_r8<5> , &CPU::OR_r8<6> , &CPU::OR_r8<7> , /* Bx */
+		&CPU::CP_r8<0> , &CPU::CP_r8<1> , &CPU::CP_r8<2> , &CPU::CP_r8<3> , &CPU::CP_r8<4> , &CPU::CP_r8<5> , &CPU::CP_r8<6> , &CPU::CP_r8<7> , /* Bx */
+
+		&CPU::RET<NZero> , &CPU::POP<BC>  , &CPU::JP_u16<NZero> , &CPU::JP_u16<True>, &CPU::CALL<NZero> , &CPU::PUSH<BC>  , &CPU::ADD_u8, &CPU::RST<0x00>, /* Cx */
+		&CPU::RET<Zero>  , &CPU::RET<True>, &CPU::JP_u16<Zero>  , &CPU::CB          , &CPU::CALL<Zero>  , &CPU::CALL<True>, &CPU::ADC_u8, &CPU::RST<0x08>, /* Cx */
+		&CPU::RET<NCarry>, &CPU::POP<DE>  , &CPU::JP_u16<NCarry>, &CPU::Illegal     , &CPU::CALL<NCarry>, &CPU::PUSH<DE>  , &CPU::SUB_u8, &CPU::RST<0x10>, /* Dx */
+		&CPU::RET<Carry> , &CPU::RETI     , &CPU::JP_u16<Carry> , &CPU::Illegal     , &CPU::CALL<Carry> , &CPU::Illegal   , &CPU::SBC_u8, &CPU::RST<0x18>, /* Dx */
+		&CPU::LDH_u8_A   , &CPU::POP<HL>  , &CPU::LDH_C_A       , &CPU::Illegal     , &CPU::Illegal     , &CPU::PUSH<HL>  , &CPU::AND_u8, &CPU::RST<0x20>, /* Ex */
+		&CPU::ADD_SP     , &CPU::JP_HL    , &CPU::LD_u16_A      , &CPU::Illegal     , &CPU::Illegal     , &CPU::Illegal   , &CPU::XOR_u8, &CPU::RST<0x28>, /* Ex */
+		&CPU::LDH_A_u8   , &CPU::POP<AF>  , &CPU::LDH_A_C       , &CPU::DI          , &CPU::Illegal     , &CPU::PUSH<AF>  , &CPU::OR_u8 , &CPU::RST<0x30>, /* Fx */
+		&CPU::LD_HL_SP_s8, &CPU::LD_SP_HL , &CPU::LD_A_u16      , &CPU::EI          , &CPU::Illegal     , &CPU::Illegal   , &CPU::CP_u8 , &CPU::RST<0x38>  /* Fx */
+	};
+	return table;
+}();
+
+
+const std::array<void(CPU::*)(), 256> CPU::cb_table = [] {
+	constexpr std::array<void(CPU::*)(), 256> table = {
+		&CPU::RLC<0> , &CPU::RLC<1> , &CPU::RLC<2> , &CPU::RLC<3> , &CPU::RLC<4> , &CPU::RLC<5> , &CPU::RLC<6> , &CPU::RLC<7> , /* 0x */
+		&CPU::RRC<0> , &CPU::RRC<1> , &CPU::RRC<2> , &CPU::RRC<3> , &CPU::RRC<4> , &CPU::RRC<5> , &CPU::RRC<6> , &CPU::RRC<7> , /* 0x */
+		&CPU::RL<0>  , &CPU::RL<1>  , &CPU::RL<2>  , &CPU::RL<3>  , &CPU::RL<4>  , &CPU::RL<5>  , &CPU::RL<6>  , &CPU::RL<7>  , /* 1x */
+		&CPU::RR<0>  , &CPU::RR<1>  , &CPU::RR<2>  , &CPU::RR<3>  , &CPU::RR<4>  , &CPU::RR<5>  , &CPU::RR<6>  , &CPU::RR<7>  , /* 1x */
+		&CPU::SLA<0> , &CPU::SLA<1> , &CPU::SLA<2> , &CPU::SLA<3> , &CPU::SLA<4> , &CPU::SLA<5> , &CPU::SLA<6> , &CPU::SLA<7> , /* 2x */
+		&CPU::SRA<0> , &CPU::SRA<1> , &CPU::SRA<2> , &CPU::SRA<3> , &CPU::SRA<4> , &CPU::SRA<5> , &CPU::SRA<6> , &CPU::SRA<7> , /* 2x */
+		&CPU::SWAP<0>, &CPU::SWAP<1>, &CPU::SWAP<2>, &CPU::SWAP<3>, &CPU::SWAP<4>, &CPU::SWAP<5>, &CPU::SWAP<6>, &CPU::SWAP<7>, /* 3x */
+		&CPU::SRL<0> , &CPU::SRL<1> , &CPU::SRL<2> , &CPU::SRL<3> , &CPU::SRL<4> , &CPU::SRL<5> , &CPU::SRL<6> , &CPU::SRL<7> , /* 3x */
+
+		&CPU::BIT<0, 0>, &CPU::BIT<0, 1>, &CPU::BIT<0, 2>, &CPU::BIT<0, 3>, &CPU::BIT<0, 4>, &CPU::BIT<0, 5>, &CPU::BIT<0, 6>, &CPU::BIT<0, 7>, /* 4x */
+		&CPU::BIT<1, 0>, &CPU::BIT<1, 1>, &CPU::BIT<1, 2>, &CPU::BIT<1, 3>, &CPU::BIT<1, 4>, &CPU::BIT<1, 5>, &CPU::BIT<1, 6>, &CPU::BIT<1, 7>, /* 4x */
+		&CPU::BIT<2, 0>, &CPU::BIT<2, 1>, &CPU::BIT<2, 2>, &CPU::BIT<2, 3>, &CPU::BIT<2, 4>, &CPU::BIT<2, 5>, &CPU::BIT<2, 6>, &CPU::BIT<2, 7>, /* 5x */
+		&CPU::BIT<3, 0>, &CPU::BIT<3, 1>, &CPU::BIT<3, 2>, &CPU::BIT<3, 3>, &CPU::BIT<3, 4>, &CPU::BIT<3, 5>, &CPU::BIT<3, 6>, &CPU::BIT<3, 7>, /* 5x */
+		&CPU::BIT<4, 0>, &CPU::BIT<4, 1>, &CPU::BIT<4, 2>, &CPU::BIT<4, 3>, &CPU::BIT<4, 4>, &CPU::BIT<4, 5>, &CPU::BIT<4, 6>, &CPU::BIT<4, 7>, /* 6x */
+		&CPU::BIT<5, 0>, &CPU::BIT<5, 1>, &CPU::BIT<5, 2>, &CPU::BIT<5, 3>, &CPU::BIT<5, 4>, &CPU::BIT<5, 5>, &CPU::BIT<5, 6>, &CPU::BIT<5, 7>, /* 6x */
+		&CPU::BIT<6, 0>, &CPU::BIT<6, 1>, &CPU::BIT<6, 2>, &CPU::BIT<6, 3>, &CPU::BIT<6, 4>, &CPU::BIT<6, 5>, &CPU::BIT<6, 6>, &CPU::BIT<6, 7>, /* 7x */
+		&CPU::BIT<7, 0>, &CPU::BIT<7, 1>, &CPU::BIT<7, 2>, &CPU::BIT<7, 3>, &CPU::BIT<7, 4>, &CPU::BIT<7, 5>, &CPU::BIT<7, 6>, &CPU::BIT<7, 7>, /* 7x */
+
+		&CPU::RES<0, 0>, &CPU::RES<0, 1>, &CPU::RES<0, 2>, &CPU::RES<0, 3>, &CPU::RES<0, 4>, &CPU::RES<0, 5>, &CPU::RES<0, 6>, &CPU::RES<0, 7>, /* 8x */
+		&CPU::RES<1, 0>, &CPU::RES<1, 1>, &CPU::RES<1, 2>, &CPU::RES<1, 3>, &CPU::RES<1, 4>, &CPU::RES<1, 5>, &CPU::RES<1, 6>, &CPU::RES<1, 7>, /* 8x */
+		&CPU::RES<2, 0>, &CPU::RES<2, 1>, &CPU::RES<2, 2>, &CPU::RES<2, 3>, &CPU::RES<2, 4>, &CPU::RES<2, 5>, &CPU::RES<2, 6>, &CPU::RES<2, 7>, /* 9x */
+		&CPU::RES<3, 0>, &CPU::RES<3, 1>, &CPU::RES<3, 2>, &CPU::RES<3, 3>, &CPU::RES<3, 4>, &CPU::RES<3, 5>, &CPU::RES<3, 6>, &CPU::RES<3, 7>, /* 9x */
+		&CPU::RES<4, 0>, &CPU::RES<4, 1>, &CPU::RES<4, 2>, &CPU::RES<4, 3>, &CPU::RES<4, 4>, &CPU::RES<4, 5>, &CPU::RES<4, 6>, &CPU::RES<4, 7>, /* Ax */
+		&CPU::RES<5, 0>, &CPU::RES<5, 1>, &CPU::RES<5, 2>, &CPU::RES<5, 3>, &CPU::RES<5, 4>, &CPU::RES<5, 5>, &CPU::RES<5, 6>, &CPU::RES<5, 7>, /* Ax */
+		&CPU::RES<6, 0>, &CPU::RES<6, 1>, &CPU::RES<6, 2>, &CPU::RES<6, 3>, &CPU::RES<6, 4>, &CPU::RES<6, 5>, &CPU::RES<6, 6>, &CPU::RES<6, 7>, /* Bx */
+		&CPU::RES<7, 0>, &CPU::RES<7, 1>, &CPU::RES<7, 2>, &CPU::RES<7, 3>, &CPU::RES<7, 4>, &CPU::RES<7, 5>, &CPU::RES<7, 6>, &CPU::RES<7, 7>, /* Bx */
+
+		&CPU::SET<0, 0>, &CPU::SET<0, 1>, &CPU::SET<0, 2>, &CPU::SET<0, 3>, &CPU::SET<0, 4>, &CPU::SET<0, 5>, &CPU::SET<0, 6>, &CPU::SET<0, 7>, /* Cx */
+		&CPU::SET<1, 0>, &CPU::SET<1, 1>, &CPU::SET<1, 2>, &CPU::SET<1, 3>, &CPU::SET<1, 4>, &CPU::SET<1, 5>, &CPU::SET<1, 6>, &CPU::SET<1, 7>, /* Cx */
+		&CPU::SET<2, 0>, &CPU::SET<2, 1>, &CPU::SET<2, 2>, &CPU::SET<2, 3>, &CPU::SET<2, 4>, &CPU::SET<2, 5>, &CPU::SET<2, 6>, &CPU::SET<2, 7>, /* Dx */
+		&CPU::SET<3, 0>, &CPU::SET<3, 1>, &CPU::SET<3, 2>, &CPU::SET<3, 3>, &CPU::SET<3, 4>, &CPU::SET<3, 5>, &CPU::SET<3, 6>, &CPU::SET<3, 7>, /* Dx */
+		&CPU::SET<4, 0>, &CPU::SET<4, 1>, &CPU::SET<4, 2>, &CPU::SET<4, 3>, &CPU::SET<4, 4>, &CPU::SET<4, 5>, &CPU::SET<4, 6>, &CPU::SET<4, 7>, /* Ex */
+		&CPU::SET<5, 0>, &CPU::SET<5, 1>, &CPU::SET<5, 2>, &CPU::SET<5, 3>, &CPU::SET<5, 4>, &CPU::SET<5, 5>, &CPU::SET<5, 6>, &CPU::SET<5, 7>, /* Ex */
+		&CPU::SET<6, 0>, &CPU::SET<6, 1>, &CPU::SET<6, 2>, &CPU::SET<6, 3>, &CPU::SET<6, 4>, &CPU::SET<6, 5>, &CPU::SET<6, 6>, &CPU::SET<6, 7>, /* Fx */
+		&CPU::SET<7, 0>, &CPU::SET<7, 1>, &CPU::SET<7, 2>, &CPU::SET<7, 3>, &CPU::SET<7, 4>, &CPU::SET<7, 5>, &CPU::SET<7, 6>, &CPU::SET<7, 7>  /* Fx */
+	};
+	return table;
+}();
+
+
+#if GB_USE_THREADED_DISPATCH
+/* 'X' is applied to every opcode but the CB prefix, to which 'P' is applied */
+#define GB_FOR_EACH_OPCODE(X, P) \
+X(00) X(01) X(02) X(03) X(04) X(05) X(06) X(07) X(08) X(09) X(0A) X(0B) X(0C) X(0D) X(0E) X(0F) \
+X(10) X(11) X(12) X(13) X(14) X(15) X(16) X(17) X(18) X(19) X(1A) X(1B) X(1C) X(1D) X(1E) X(1F) \
+X(20) X(21) X(22) X(23) X(24) X(25) X(26) X(27) X(28) X(29) X(2A) X(2B) X(2C) X(2D) X(2E) X(2F) \
+X(30) X(31) X(32) X(33) X(34) X(35) X(36) X(37) X(38) X(39) X(3A) X(3B) X(3C) X(3D) X(3E) X(3F) \
+X(40) X(41) X(42) X(43) X(44) X(45) X(46) X(47) X(48) X(49) X(4A) X(4B) X(4C) X(4D) X(4E) X(4F) \
+X(50) X(51) X(52) X(53) X(54) X(55) X(56) X(57) X(58) X(59) X(5A) X(5B) X(5C) X(5D) X(5E) X(5F) \
+X(60) X(61) X(62) X(63) X(64) X(65) X(66) X(67) X(68) X(69) X(6A) X(6B) X(6C) X(6D) X(6E) X(6F) \
+X(70) X(71) X(72) X(73) X(74) X(75) X(76) X(77) X(78) X(79) X(7A) X(7B) X(7C) X(7D) X(7E) X(7F) \
+X(80) X(81) X(82) X(83) X(84) X(85) X(86) X(87) X(88) X(89) X(8A) X(8B) X(8C) X(8D) X(8E) X(8F) \
+X(90) X(91) X(92) X(93) X(94) X(95) X(96) X(97) X(98) X(99) X(9A) X(9B) X(9C) X(9D) X(9E) X(9F) \
+X(A0) X(A1) X(A2) X(A3) X(A4) X(A5) X(A6) X(A7) X(A8) X(A9) X(AA) X(AB) X(AC) X(AD) X(AE) X(AF) \
+X(B0) X(B1) X(B2) X(B3) X(B4) X(B5) X(B6) X(B7) X(B8) X(B9) X(BA) X(BB) X(BC) X(BD) X(BE) X(BF) \
+X(C0) X(C1) X(C2) X(C3) X(C4) X(C5) X(C6) X(C7) X(C8) X(C9) X(CA) P(CB) X(CC) X(CD) X(CE) X(CF) \
+X(D0) X(D1) X(D2) X(D3) X(D4) X(D5) X(D6) X(D7) X(D8) X(D9) X(DA) X(DB) X(DC) X(DD) X(DE) X(DF) \
+X(E0) X(E1) X(E2) X(E3) X(E4) X(E5) X(E6) X(E7) X(E8) X(E9) X(EA) X(EB) X(EC) X(ED) X(EE) X(EF) \
+X(F0) X(F1) X(F2) X(F3) X(F4) X(F5) X(F6) X(F7) X(F8) X(F9) X(FA) X(FB) X(FC) X(FD) X(FE) X(FF)
+
+/* Threaded dispatch: every opcode, the CB-prefixed ones included, has its own label, which calls its handler directly
+   and has its own copy of the code that fetches and jumps to the next instruction, so that the host branch predictor
+   can learn which instruction tends to follow which. Anything but running the next instruction is left to
+   'HandleAttention', and ROM code is run from the block cache while it is enabled, as in the table loop.
+   The handlers are still taken from the opcode tables at run time, as those are not constexpr (see above). */
+void CPU::Run()
+{
+	GB& gb = static_cast<GB&>(*this);
+#define GB_OPCODE_LABEL_ADDRESS(op) &&opcode_##op,
+#define GB_CB_OPCODE_LABEL_ADDRESS(op) &&cb_opcode_##op,
+#define GB_CB_PREFIX_LABEL_ADDRESS(op) &&cb_prefix,
+	static void* const dispatch_table[256] = { GB_FOR_EACH_OPCODE(GB_OPCODE_LABEL_ADDRESS, GB_CB_PREFIX_LABEL_ADDRESS) };
+	static void* const cb_dispatch_table[256] = { GB_FOR_EACH_OPCODE(GB_CB_OPCODE_LABEL_ADDRESS, GB_CB_OPCODE_LABEL_ADDRESS) };
+#undef GB_OPCODE_LABEL_ADDRESS
+#undef GB_CB_OPCODE_LABEL_ADDRESS
+#undef GB_CB_PREFIX_LABEL_ADDRESS
+
+next_instruction:
+	if (gb.Scheduler::GetTime() >= run_until_time) {
+		if (ei_delay_step_due) {
+			StepEiDelay();
+		}
+		return;
+	}
+	if (attention && !HandleAttention()) {
+		goto next_instruction;
+	}
+	if (block_cache_enabled) {
+		if (Block* block = GetBlock()) {
+			RunBlock(*block);
+			goto next_instruction;
+		}
+	}
+	opcode = ReadCyclePC();
+	if constexpr (Debug::log_instr) {
+		Debug::LogInstr(gb, opcode, regs.A << 8 | std::bit_cast<u8, Status>(Flags()), regs.BC, regs.DE, regs.HL, regs.pc - 1, regs.sp, IE, IF);
+	}
+	goto *dispatch_table[opcode];
+
+cb_prefix:
+	opcode = Read8();
+	goto *cb_dispatch_table[opcode];
+
+	/* The next instruction is fetched right away unless the run is over or the slow path is needed; while the block
+	   cache is enabled, every instruction goes through 'next_instruction', where the cache is looked up. */
+#define GB_DISPATCH_NEXT_INSTRUCTION \
+	if (gb.Scheduler::GetTime() < run_until_time && !attention && !block_cache_enabled) { \
+		opcode = ReadCyclePC(); \
+		if constexpr (Debug::log_instr) { \
+			Debug::LogInstr(gb, opcode, regs.A << 8 | std::bit_cast<u8, Status>(Flags()), regs.BC, regs.DE, regs.HL, \
+				regs.pc - 1, regs.sp, IE, IF); \
+		} \
+		goto *dispatch_table[opcode]; \
+	} \
+	goto next_instruction;
+
+#define GB_OPCODE_HANDLER(op) \
+opcode_##op: \
+	(this->*instr_table[0x##op])(); \
+	GB_DISPATCH_NEXT_INSTRUCTION
+
+#define GB_CB_OPCODE_HANDLER(op) \
+cb_opcode_##op: \
+	(this->*cb_table[0x##op])(); \
+	GB_DISPATCH_NEXT_INSTRUCTION
+
+#define GB_NO_HANDLER(op)
+
+	GB_FOR_EACH_OPCODE(GB_OPCODE_HANDLER, GB_NO_HANDLER)
+	GB_FOR_EACH_OPCODE(GB_CB_OPCODE_HANDLER, GB_CB_OPCODE_HANDLER)
+#undef GB_DISPATCH_NEXT_INSTRUCTION
+#undef GB_OPCODE_HANDLER
+#undef GB_CB_OPCODE_HANDLER
+#undef GB_NO_HANDLER
+}
+#endif
\ No newline at end of file
@@ -1,38 +1,70 @@
 export module CPU;
 
+import CPU.X64Emitter;
 import Util;
 
+import <algorithm>;
 import <array>;
 import <bit>;
 import <cassert>;
 import <cstring>;
 import <format>;
+import <limits>;
+import <mutex>;
+import <string>;
+import <string_view>;
 import <utility>;
+import <vector>;
 
-namespace CPU
+export struct CPU
 {
-	export
-	{
-		enum class Interrupt : u8 {
-			VBlank = 1 << 0,
-			Stat = 1 << 1,
-			Timer = 1 << 2,
-			Serial = 1 << 3,
-			Joypad = 1 << 4
-		};
-
-		void Initialize(bool hle_boot_rom);
-		bool IsHalted();
-		bool IsStopped();
-		u8 ReadIE();
-		u8 ReadIF();
-		void RequestInterrupt(Interrupt interrupt);
-		void Run();
-		void StreamState(SerializationStream& stream);
-		void WriteIE(u8 data);
-		void WriteIF(u8 data);
-	}
+	enum class Interrupt : u8 {
+		VBlank = 1 << 0,
+		Stat = 1 << 1,
+		Timer = 1 << 2,
+		Serial = 1 << 3,
+		Joypad = 1 << 4
+	};
+
+	/* Apply the per-ROM settings for the ROM with the given header title; called when a ROM has been loaded */
+	void ApplyRomOverrides(std::string_view rom_title);
+	/* Never skip idle loops in the ROM with the given header title, in any machine */
+	static void DisableIdleLoopSkipping(std::string_view rom_title);
+	/* Drop all decoded blocks; must be called whenever the ROM is replaced */
+	void FlushBlockCache();
+	u64 GetIdleLoopCyclesSkipped();
+	void Initialize(bool hle_boot_rom);
+	bool IsHalted();
+	bool IsStopped();
+	/* Called by the PPU when VBlank is entered */
+	void NotifyVBlank();
+	u8 ReadIE();
+	u8 ReadIF();
+	/* Make the CPU check for an interrupt, a DMA stall etc. before the next instruction; see 'attention' */
+	void RequestAttention();
+	void RequestInterrupt(Interrupt interrupt);
+	/* Run for the given number of m-cycles, as counted over all calls; see 'm_cycles_overrun' */
+	void RunCycles(u64 m_cycles);
+	/* Run until VBlank is entered, i.e., until the PPU has finished the frame */
+	void RunFrame();
+	/* Run until the predicate holds; it is checked before every instruction, and passed the CPU of the machine */
+	void RunUntil(bool(*predicate)(CPU& cpu));
+	/* Run instructions in ROM from blocks decoded ahead of time, rather than fetching and decoding them one by one */
+	void SetBlockCacheEnabled(bool enabled);
+	/* Skip iterations of loops that only poll LY, STAT or IF until the polled value may change */
+	void SetIdleLoopSkippingEnabled(bool enabled);
+	/* Compile blocks that are run often to x86-64 code (see 'CompileBlock'). Only blocks from the block cache are
+	   compiled, so it has no effect while that is disabled. Returns false if the host cannot run the code, i.e.
+	   is not x86-64 Linux. */
+	bool SetJitEnabled(bool enabled);
+	/* Run every compiled block through the interpreter too, and report where the two do not match (see
+	   'RunCompiledBlockInLockstep'). Slow; meant for testing the JIT. */
+	void SetJitValidationEnabled(bool enabled);
+	void StreamState(SerializationStream& stream);
+	void WriteIE(u8 data);
+	void WriteIF(u8 data);
 
+private:
 	enum class Condition {
 		Carry, Zero, NCarry, NZero, True
 	};
@@ -41,15 +73,102 @@ namespace CPU
 		AF, BC, DE, HL, PC, SP
 	};
 
+	/* ALU operations whose flags are only computed when F is read. Add/Sub also cover ADC/SBC with a carry in, and CP. */
+	enum class FlagOp : u8 {
+		None, Add, Adc, Sub, Sbc, And, OrXor, Inc, Dec
+	};
+
+	/* The last ALU operation whose flags have not yet been written to F. For INC/DEC, 'carry' is the unaffected carry flag. */
+	struct LazyFlags
+	{
+		FlagOp op;
+		u8 lhs;
+		u8 rhs;
+		u8 result;
+		bool carry;
+	};
+
+	/* status register */
+	struct Status
+	{
+		u8 : 4;
+		u8 carry : 1;
+		u8 half : 1;
+		u8 neg : 1;
+		u8 zero : 1;
+	};
+
+	/* Each 16-bit register pair overlaps the two 8-bit registers it is made of, the first named being its upper byte.
+	   The order of the two bytes in memory therefore depends on the byte order of the host. F is the status register;
+	   it may be out of date while 'pending_flags' holds an operation, so read it through 'Flags'. */
+	struct Registers
+	{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		static constexpr std::endian byte_order = std::endian::big;
+		union { struct { u8 A; Status F; }; u16 AF; };
+		union { struct { u8 B, C; }; u16 BC; };
+		union { struct { u8 D, E; }; u16 DE; };
+		union { struct { u8 H, L; }; u16 HL; };
+#else
+		static constexpr std::endian byte_order = std::endian::little;
+		union { struct { Status F; u8 A; }; u16 AF; };
+		union { struct { u8 C, B; }; u16 BC; };
+		union { struct { u8 E, D; }; u16 DE; };
+		union { struct { u8 L, H; }; u16 HL; };
+#endif
+		u16 pc; /* program counter */
+		u16 sp; /* stack pointer */
+	};
+
+	static_assert(Registers::byte_order == std::endian::native, "The register pairs do not match the byte order of the host");
+
+	struct MicroOp
+	{
+		void(CPU::*handler)();
+		u8 opcode;
+		u8 length;
+	};
+
+	static constexpr uint max_block_length = 32;
+
+	/* Straight-line code in ROM, ending at the first instruction that can branch */
+	struct Block
+	{
+		const u8* code; /* host memory that the block was decoded from, or nullptr if the cache entry is unused */
+		u16 start_pc;
+		uint num_ops;
+		std::array<MicroOp, max_block_length> ops;
+		/* The JIT-compiled prefix of the block, or nullptr. It returns how far it ran; see 'RunCompiledBlock'. */
+		u32(*native_code)();
+		uint native_m_cycles; /* taken by the whole prefix */
+		uint run_count; /* counted up to 'jit_hot_block_threshold', after which the block is compiled */
+	};
+
 	template<Condition> bool EvalCond();
 
 	template<Reg16> u16 GetReg16();
 
 	template<Reg16> void SetReg16(u16 value);
 
+	template<uint index> u8 GetReg8();
+
+	template<uint index> u8& Reg8();
+
+	template<uint index> void SetReg8(u8 value);
+
 	void CheckInterrupts();
+	void CompileBlock(Block& block);
+	void DecodeBlock(Block& block, const u8* code);
+	/* Drop the compiled code of all blocks */
+	void DropCompiledCode();
+	bool EndsBlock(u8 opcode);
 	void ExitSpeedSwitch();
-	u8 GetReg8(uint index);
+	Status& Flags();
+	Block* GetBlock();
+	u64 GetCyclesLeftInRun();
+	bool GetCarry();
+	bool GetZero();
+	bool HandleAttention();
 	void InitiateSpeedSwitch();
 	void PopPC();
 	void PushPC();
@@ -58,7 +177,16 @@ namespace CPU
 	u8 ReadCycle(u16 addr);
 	u8 ReadCyclePageFF(u8 offset);
 	u8 ReadCyclePC();
-	void SetReg8(uint index, u8 value);
+	void RestoreWritableMemory(const std::vector<u8>& snapshot);
+	void Run();
+	void RunBlock(Block& block);
+	uint RunCompiledBlock(Block& block);
+	uint RunCompiledBlockInLockstep(Block& block);
+	void SetFlagsLazily(FlagOp op, u8 lhs, u8 rhs, u8 result, bool carry = false);
+	void SkipIdleLoop();
+	void SnapshotWritableMemory(std::vector<u8>& snapshot);
+	uint SkipIdleCycles(uint max_m_cycles = std::numeric_limits<uint>::max());
+	void StepEiDelay();
 	void WaitCycle();
 	void Write8(u8 value);
 	void Write16(u16 value);
@@ -69,8 +197,8 @@ namespace CPU
 	template<Reg16> void LD_r16_u16();
 	template<Reg16> void LD_r16_A();
 	template<Reg16> void LD_A_r16();
-	void LD_r8_r8();
-	void LD_r8_u8();
+	template<uint dst_reg_idx, uint src_reg_idx> void LD_r8_r8();
+	template<uint dst_reg_idx> void LD_r8_u8();
 	void LD_SP_HL();
 	void LD_u16_A();
 	void LD_A_u16();
@@ -89,24 +217,24 @@ namespace CPU
 	template<Reg16> void ADD_HL_r16();
 	template<Reg16> void DEC_r16();
 	template<Reg16> void INC_r16();
-	void ADC_r8();
+	template<uint src_reg_idx> void ADC_r8();
+	template<uint src_reg_idx> void ADD_r8();
+	template<uint src_reg_idx> void AND_r8();
+	template<uint src_reg_idx> void CP_r8();
+	template<uint reg_idx> void DEC_r8();
+	template<uint reg_idx> void INC_r8();
+	template<uint src_reg_idx> void OR_r8();
+	template<uint src_reg_idx> void SBC_r8();
+	template<uint src_reg_idx> void SUB_r8();
+	template<uint src_reg_idx> void XOR_r8();
 	void ADC_u8();
-	void ADD_r8();
 	void ADD_SP();
 	void ADD_u8();
-	void AND_r8();
 	void AND_u8();
-	void CP_r8();
 	void CP_u8();
-	void DEC_r8();
-	void INC_r8();
-	void OR_r8();
 	void OR_u8();
-	void SBC_r8();
 	void SBC_u8();
-	void SUB_r8();
 	void SUB_u8();
-	void XOR_r8();
 	void XOR_u8();
 
 	/* arithmetic and bitwise instructions generalized to both r8 and u8 operands */
@@ -120,32 +248,32 @@ namespace CPU
 	void XOR(u8 op);
 
 	// bit operation instructions
-	void BIT();
-	void RES();
-	void SET();
-	void SWAP();
+	template<uint pos, uint reg_idx> void BIT();
+	template<uint pos, uint reg_idx> void RES();
+	template<uint pos, uint reg_idx> void SET();
+	template<uint reg_idx> void SWAP();
 
 	/* rotate instructions */
-	void RL();
+	template<uint reg_idx> void RL();
+	template<uint reg_idx> void RLC();
+	template<uint reg_idx> void RR();
+	template<uint reg_idx> void RRC();
+	template<uint reg_idx> void SLA();
+	template<uint reg_idx> void SRA();
+	template<uint reg_idx> void SRL();
 	void RLA();
-	void RLC();
 	void RLCA();
-	void RR();
 	void RRA();
-	void RRC();
 	void RRCA();
-	void SLA();
-	void SRA();
-	void SRL();
 
 	/* jump/branch instructions */
 	template<Condition> void CALL();
 	template<Condition> void JP_u16();
 	template<Condition> void JR();
 	template<Condition> void RET();
+	template<u8 vec> void RST();
 	void JP_HL();
 	void RETI();
-	void RST();
 
 	/* prefixed instructions */
 	void CB();
@@ -164,87 +292,70 @@ namespace CPU
 	void SCF();
 	void STOP();
 
-	/* Make this constexpr, and MSVC will freak out */
-	std::array instr_table = [] {
-		using enum Condition;
-		using enum Reg16;
-		constexpr std::array table = {
-			NOP       , LD_r16_u16<BC>, LD_r16_A<BC>, INC_r16<BC>, INC_r8, DEC_r8, LD_r8_u8, RLCA, /* 0x */
-			LD_u16_SP , ADD_HL_r16<BC>, LD_A_r16<BC>, DEC_r16<BC>, INC_r8, DEC_r8, LD_r8_u8, RRCA, /* 0x */
-			STOP      , LD_r16_u16<DE>, LD_r16_A<DE>, INC_r16<DE>, INC_r8, DEC_r8, LD_r8_u8, RLA , /* 1x */
-			JR<True>  , ADD_HL_r16<DE>, LD_A_r16<DE>, DEC_r16<DE>, INC_r8, DEC_r8, LD_r8_u8, RRA , /* 1x */
-			JR<NZero> , LD_r16_u16<HL>, LD_HLp_A    , INC_r16<HL>, INC_r8, DEC_r8, LD_r8_u8, DAA , /* 2x */
-			JR<Zero>  , ADD_HL_r16<HL>, LD_A_HLp    , DEC_r16<HL>, INC_r8, DEC_r8, LD_r8_u8, CPL , /* 2x */
-			JR<NCarry>, LD_r16_u16<SP>, LD_HLm_A    , INC_r16<SP>, INC_r8, DEC_r8, LD_r8_u8, SCF , /* 3x */
-			JR<Carry> , ADD_HL_r16<SP>, LD_A_HLm    , DEC_r16<SP>, INC_r8, DEC_r8, LD_r8_u8, CCF , /* 3x */
-
-			LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, /* 4x */
-			LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, /* 4x */
-			LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, /* 5x */
-			LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, /* 5x */
-			LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, /* 6x */
-			LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, /* 6x */
-			LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, HALT    , LD_r8_r8, /* 7x */
-			LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, LD_r8_r8, /* 7x */
-
-			ADD_r8, ADD_r8, ADD_r8, ADD_r8, ADD_r8, ADD_r8, ADD_r8, ADD_r8, /* 8x */
-			ADC_r8, ADC_r8, ADC_r8, ADC_r8, ADC_r8, ADC_r8, ADC_r8, ADC_r8, /* 8x */
-			SUB_r8, SUB_r8, SUB_r8, SUB_r8, SUB_r8, SUB_r8, SUB_r8, SUB_r8, /* 9x */
-			SBC_r8, SBC_r8, SBC_r8, SBC_r8, SBC_r8, SBC_r8, SBC_r8, SBC_r8, /* 9x */
-			AND_r8, AND_r8, AND_r8, AND_r8, AND_r8, AND_r8, AND_r8, AND_r8, /* Ax */
-			XOR_r8, XOR_r8, XOR_r8, XOR_r8, XOR_r8, XOR_r8, XOR_r8, XOR_r8, /* Ax */
-			OR_r8 , OR_r8 , OR_r8 , OR_r8 , OR_r8 , OR_r8 , OR_r8 , OR_r8 , /* Bx */
-			CP_r8 , CP_r8 , CP_r8 , CP_r8 , CP_r8 , CP_r8 , CP_r8 , CP_r8 , /* Bx */
-
-			RET<NZero> , POP<BC>  , JP_u16<NZero> , JP_u16<True> , CALL<NZero> , PUSH<BC>  , ADD_u8, RST, /* Cx */
-			RET<Zero>  , RET<True>, JP_u16<Zero>  , CB           , CALL<Zero>  , CALL<True>, ADC_u8, RST, /* Cx */
-			RET<NCarry>, POP<DE>  , JP_u16<NCarry>, Illegal      , CALL<NCarry>, PUSH<DE>  , SUB_u8, RST, /* Dx */
-			RET<Carry> , RETI     , JP_u16<Carry> , Illegal      , CALL<Carry> , Illegal   , SBC_u8, RST, /* Dx */
-			LDH_u8_A   , POP<HL>  , LDH_C_A       , Illegal      , Illegal     , PUSH<HL>  , AND_u8, RST, /* Ex */
-			ADD_SP     , JP_HL    , LD_u16_A      , Illegal      , Illegal     , Illegal   , XOR_u8, RST, /* Ex */
-			LDH_A_u8   , POP<AF>  , LDH_A_C       , DI           , Illegal     , PUSH<AF>  , OR_u8 , RST, /* Fx */
-			LD_HL_SP_s8, LD_SP_HL , LD_A_u16      , EI           , Illegal     , Illegal   , CP_u8 , RST  /* Fx */
-		};
-		return table;
-	}();
-
-	constexpr uint speed_switch_m_cycle_length = 2050;
+	/* Handlers of the unprefixed and the CB-prefixed opcodes, indexed by opcode */
+	static const std::array<void(CPU::*)(), 256> cb_table;
+	static const std::array<void(CPU::*)(), 256> instr_table;
 
+	static constexpr uint block_cache_size = 0x800;
+	static constexpr uint jit_code_buffer_size = 4 << 20;
+	static constexpr uint jit_hot_block_threshold = 16;
+	static constexpr uint jit_min_block_length = 2; /* in instructions; shorter prefixes are left to the interpreter */
+	static constexpr bool lazy_flag_evaluation = true; /* if false, flags are written to F by the ALU operation itself */
+	static constexpr uint max_idle_loop_length = 8; /* in bytes */
+	static constexpr uint speed_switch_m_cycle_length = 2050;
+
+	/* Set whenever something other than running the next instruction may have to happen before it: an interrupt
+	   dispatch, the EI delay, HALT mode and the HALT bug, a speed switch, a CGB DMA stall, or an idle loop check.
+	   While it is clear, 'Run' tests nothing else between instructions. */
+	bool attention = true;
+	bool block_cache_enabled = false;
+	/* The instruction that just ran counts towards the EI delay; see 'StepEiDelay' */
+	bool ei_delay_step_due = false;
 	bool ei_executed = false;
 	bool halt_bug = false;
+	bool idle_loop_check_pending = false;
+	bool idle_loop_skipping_disabled_for_rom = false;
+	bool idle_loop_skipping_enabled = true;
 	bool ime = false;
 	bool in_halt_mode = false;
 	bool in_stop_mode = false;
+	bool run_until_vblank = false;
 	bool instr_executed_after_ei_executed = false;
+	bool jit_enabled = false;
+	bool jit_validation_enabled = false;
 	bool speed_switch_is_active = false;
 
 	uint speed_switch_m_cycles_remaining;
 
+	u64 idle_loop_m_cycles_skipped;
+	/* How far past its target the last 'RunCycles' ended */
+	u64 m_cycles_overrun;
+	/* 'Run' returns before the first instruction that would start at or after this time */
+	u64 run_until_time;
+
 	/* opcode of instruction currently being executed */
 	u8 opcode;
 
-	/* 8-bit registers */
-	u8 A, B, C, D, E, H, L;
-	/* status register */
-	struct Status
-	{
-		u8 : 4;
-		u8 carry : 1;
-		u8 half : 1;
-		u8 neg : 1;
-		u8 zero : 1;
-	} F{};
-	/* program counter */
-	u16 pc;
-	/* stack pointer */
-	u16 sp;
+	/* The register file, kept in one cache line and streamed as a whole by 'StreamState' */
+	alignas(64) Registers regs{};
+	LazyFlags pending_flags{};
 
 	u8 IE, IF;
 
 	/* last value read at address HL */
 	u8 read_hl;
 
-	constexpr std::array reg8_table = {
-		&B, &C, &D, &E, &H, &L, &read_hl /* (HL) */, &A
-	};
-}
\ No newline at end of file
+	/* Shared by all machines, which may read it from other threads while it is added to */
+	static std::vector<std::string> idle_loop_skipping_disabled_titles;
+	static std::mutex idle_loop_skipping_disabled_titles_mutex;
+
+	/* Direct-mapped on the host address and PC of the first instruction. A block of the same code mapped at
+	   another address (or of another ROM bank at the same address) is a different block. Only allocated
+	   while the cache is enabled, so that machines not using it stay small. */
+	std::vector<Block> block_cache;
+
+	/* Holds the code of all compiled blocks; only allocated while the JIT is enabled */
+	X64::CodeBuffer jit_code;
+	/* The memory that compiled code can write, before and after a block that is validated */
+	std::vector<u8> jit_entry_memory, jit_exit_memory;
+};
\ No newline at end of file
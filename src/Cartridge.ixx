@@ -8,37 +8,44 @@ import <array>;
 import <cassert>;
 import <filesystem>;
 import <format>;
+import <map>;
+import <memory>;
+import <mutex>;
 import <optional>;
+import <span>;
 import <string>;
 import <vector>;
 
-namespace Cartridge
+export struct Cartridge
 {
-	export
-	{
-		void Eject();
-		void Initialize();
-		bool LoadRom(const std::string& path);
-		u8 ReadRam(u16 addr);
-		u8 ReadRom(u16 addr);
-		void StreamState(SerializationStream& stream);
-		void WriteRam(u16 addr, u8 data);
-		void WriteRom(u16 addr, u8 data);
-	}
+	void Eject();
+	/* The cartridge RAM (MBC2: the RAM built into the chip); empty if the cartridge has none */
+	std::span<const u8> GetRam();
+	std::string GetTitle();
+	void Initialize();
+	bool LoadRom(const std::string& path);
+	u8 ReadRam(u16 addr);
+	u8 ReadRom(u16 addr);
+	void StreamState(SerializationStream& stream);
+	void WriteRam(u16 addr, u8 data);
+	void WriteRom(u16 addr, u8 data);
 
+private:
 	enum class CartType {
 		NoMBC, MBC1, MBC2, MBC3, MBC5
 	} cart_type;
 
-	constexpr uint ram_bank_size = 0x2000;
-	constexpr uint rom_bank_size = 0x4000;
+	static constexpr uint ram_bank_size = 0x2000;
+	static constexpr uint rom_bank_size = 0x4000;
 
 	bool DetectCartridgeType();
 	bool DetectGbcFunctions();
 	bool DetectSgbFunctions();
 	bool DetectRamSize();
 	bool DetectRomSize();
+	static std::shared_ptr<const std::vector<u8>> LoadRomImage(const std::string& path);
 	void ReadCartridgeRAMFromDisk();
+	void UpdateBusMapping();
 	void WriteCartridgeRAMToDisk();
 
 	bool has_battery;
@@ -63,6 +70,12 @@ namespace Cartridge
 	std::array<u8, 0x200> mbc2_ram;
 	std::array<u8, 5> rtc_ram{};
 
-	std::vector<u8> rom;
+	/* The ROM is never written to, so its image is shared by all instances that have loaded the same file */
+	std::shared_ptr<const std::vector<u8>> rom_image;
+	std::span<const u8> rom;
 	std::vector<u8> ram;
-}
\ No newline at end of file
+
+	/* The images of the ROMs loaded by any machine, by file path. Shared by all machines, on any threads. */
+	static std::map<std::string, std::weak_ptr<const std::vector<u8>>> rom_image_cache;
+	static std::mutex rom_image_cache_mutex;
+};
\ No newline at end of file
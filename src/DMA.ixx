@@ -1,30 +1,30 @@
 export module DMA;
 
+import Scheduler;
 import Util;
 
 import <string_view>;
 
-namespace DMA
+export struct DMA
 {
-	export
-	{
-		enum class Reg {
-			DMA, HDMA1, HDMA2, HDMA3, HDMA4, HDMA5
-		};
-
-		template<Reg reg>
-		u8 ReadReg();
-
-		template<Reg reg>
-		void WriteReg(u8 value);
-
-		bool CgbDmaCurrentlyCopyingData();
-		void Initialize();
-		void HdmaStartBlockCopy(); // called by PPU during HBlank
-		bool HdmaTransferActive();
-		void StreamState(SerializationStream& stream);
-		void Update();
-	}
+	enum class Reg {
+		DMA, HDMA1, HDMA2, HDMA3, HDMA4, HDMA5
+	};
+
+	template<Reg reg>
+	u8 ReadReg();
+
+	template<Reg reg>
+	void WriteReg(u8 value);
+
+	bool CgbDmaCurrentlyCopyingData();
+	void Initialize();
+	void HdmaStartBlockCopy(); // called by PPU during HBlank
+	bool HdmaTransferActive();
+	void StreamState(SerializationStream& stream);
+
+private:
+	friend struct Scheduler; /* runs the event handler */
 
 	enum class CgbDmaType {
 		GDMA, HDMA
@@ -36,10 +36,12 @@ namespace DMA
 	template<CgbDmaType>
 	void UpdateCgbDma();
 
+	void ScheduleUpdate();
 	void StartDmaTransfer(u8 data_written_to_dma_reg);
+	void Update();
 	void UpdateDma();
 
-	constexpr uint dma_byte_length = 160;
+	static constexpr uint dma_byte_length = 160;
 
 	bool dma_transfer_active;
 	bool gdma_transfer_active;
@@ -53,4 +55,4 @@ namespace DMA
 	u16 hdma_bytes_written;
 	u16 hdma_dst_addr;
 	u16 hdma_src_addr;
-}
\ No newline at end of file
+};
\ No newline at end of file
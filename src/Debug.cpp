@@ -4,10 +4,10 @@ import Bus;
 
 namespace Debug
 {
-	std::string Disassemble(u16 pc, u16* new_pc)
+	std::string Disassemble(Bus& bus, u16 pc, u16* new_pc)
 	{
-		auto DisassemblePrefixed = [&pc] {
-			u8 opcode = Bus::Peek(pc + 1);
+		auto DisassemblePrefixed = [&bus, &pc] {
+			u8 opcode = bus.Peek(pc + 1);
 			switch (opcode) {
 			case 0x00: return "rlc  b";
 			case 0x01: return "rlc  c";
@@ -269,13 +269,13 @@ namespace Debug
 			}
 		};
 
-		u8 opcode = Bus::Peek(pc);
+		u8 opcode = bus.Peek(pc);
 		u8 lo, hi;
 		u16 word;
 		if (instr_len[opcode] > 1) {
-			lo = Bus::Peek(pc + 1);
+			lo = bus.Peek(pc + 1);
 			if (instr_len[opcode] > 2) {
-				hi = Bus::Peek(pc + 2);
+				hi = bus.Peek(pc + 2);
 				word = lo | hi << 8;
 			}
 		}
@@ -536,17 +536,23 @@ namespace Debug
 	}
 
 
-	std::vector<std::string> Disassemble(u16 pc, size_t num_instructions)
+	std::vector<std::string> Disassemble(Bus& bus, u16 pc, size_t num_instructions)
 	{
 		std::vector<std::string> vec{};
 		vec.reserve(num_instructions);
 		for (size_t i = 0; i < num_instructions; ++i) {
-			vec.push_back(Disassemble(pc, &pc /* new pc out param */));
+			vec.push_back(Disassemble(bus, pc, &pc /* new pc out param */));
 		}
 		return vec;
 	}
 
 
+	bool IsLogging()
+	{
+		return !logging_disabled;
+	}
+
+
 	void LogDma(u16 src_addr)
 	{
 		if (logging_disabled) {
@@ -565,12 +571,12 @@ namespace Debug
 	}
 
 
-	void LogInstr(u8 opcode, u16 AF, u16 BC, u16 DE, u16 HL, u16 PC, u16 SP, u8 IE, u8 IF)
+	void LogInstr(Bus& bus, u8 opcode, u16 AF, u16 BC, u16 DE, u16 HL, u16 PC, u16 SP, u8 IE, u8 IF)
 	{
 		if (logging_disabled) {
 			return;
 		}
-		auto instr_str = Disassemble(PC);
+		auto instr_str = Disassemble(bus, PC);
 		log << std::format("{:04X}  {:02X}  {} \tAF:{:04X} BC:{:04X} DE:{:04X} HL:{:04X} SP:{:04X} IE:{:02X} IF:{:02X}\n",
 			PC, opcode, instr_str, AF, BC, DE, HL, SP, IE, IF);
 	}
@@ -1,5 +1,6 @@
 export module Debug;
 
+import Bus;
 import CPU;
 import Util;
 
@@ -15,11 +16,13 @@ namespace Debug
 {
 	export
 	{
-		std::string Disassemble(u16 pc, u16* new_pc = nullptr);
-		std::vector<std::string> Disassemble(u16 pc, size_t num_instructions, u16* new_pc = nullptr);
+		std::string Disassemble(Bus& bus, u16 pc, u16* new_pc = nullptr);
+		std::vector<std::string> Disassemble(Bus& bus, u16 pc, size_t num_instructions, u16* new_pc = nullptr);
+		/* Whether a log file is open, i.e. whether the Log functions write anything */
+		bool IsLogging();
 		void LogDma(u16 src_addr);
 		void LogHdma(std::string_view type, uint dst_addr, uint src_addr, uint len);
-		void LogInstr(u8 opcode, u16 AF, u16 BC, u16 DE, u16 HL, u16 PC, u16 SP, u8 IE, u8 IF);
+		void LogInstr(Bus& bus, u8 opcode, u16 AF, u16 BC, u16 DE, u16 HL, u16 PC, u16 SP, u8 IE, u8 IF);
 		void LogInterrupt(CPU::Interrupt interrupt);
 		void LogIoRead(u16 addr, u8 value);
 		void LogIoWrite(u16 addr, u8 value);
@@ -30,26 +33,27 @@ namespace Debug
 		constexpr bool log_dma = logging_enabled && 0;
 		constexpr bool log_interrupts = logging_enabled && 0;
 		constexpr bool log_io = logging_enabled && 0;
-	}
+		constexpr bool count_io_accesses = logging_enabled && 0;
 
-	constexpr std::array<u8, 256> instr_len = {
-		1,3,1,1,1,1,2,1,3,1,1,1,1,1,2,1,
-		1,3,1,1,1,1,2,1,2,1,1,1,1,1,2,1,
-		2,3,1,1,1,1,2,1,2,1,1,1,1,1,2,1,
-		2,3,1,1,1,1,2,1,2,1,1,1,1,1,2,1,
-		1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
-		1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
-		1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
-		1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
-		1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
-		1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
-		1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
-		1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
-		1,1,3,3,3,1,2,1,1,1,3,2,3,3,2,1,
-		1,1,3,1,3,1,2,1,1,1,3,1,3,1,2,1,
-		2,1,1,1,1,1,2,1,2,1,3,1,1,1,2,1,
-		2,1,1,1,1,1,2,1,2,1,3,1,1,1,2,1
-	};
+		constexpr std::array<u8, 256> instr_len = {
+			1,3,1,1,1,1,2,1,3,1,1,1,1,1,2,1,
+			1,3,1,1,1,1,2,1,2,1,1,1,1,1,2,1,
+			2,3,1,1,1,1,2,1,2,1,1,1,1,1,2,1,
+			2,3,1,1,1,1,2,1,2,1,1,1,1,1,2,1,
+			1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+			1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+			1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+			1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+			1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+			1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+			1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+			1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+			1,1,3,3,3,1,2,1,1,1,3,2,3,3,2,1,
+			1,1,3,1,3,1,2,1,1,1,3,1,3,1,2,1,
+			2,1,1,1,1,1,2,1,2,1,3,1,1,1,2,1,
+			2,1,1,1,1,1,2,1,2,1,3,1,1,1,2,1
+		};
+	}
 
 	bool logging_disabled = true;
 
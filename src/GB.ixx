@@ -8,6 +8,7 @@ import CPU;
 import DMA;
 import Joypad;
 import PPU;
+import Scheduler;
 import Serial;
 import System;
 import Timer;
@@ -17,8 +18,17 @@ import <string>;
 import <string_view>;
 import <vector>;
 
-export struct GB : Core
+/* The components are the bases of the machine, each holding its own state; they reach one another through the
+   machine that they are part of. Any number of machines can run at once, on any threads, sharing only the images of
+   the ROMs that they have loaded (see 'Cartridge::LoadRomImage'). A machine is large and is not copyable, as the APU
+   channels point back into it; allocate it with e.g. 'std::make_unique<GB>()', which also zeroes its state. */
+export struct GB : Core, APU, Bus, Cartridge, CPU, DMA, Joypad, PPU, Scheduler, Serial, System, Timer
 {
+	GB() = default;
+	GB(const GB&) = delete;
+	GB& operator=(const GB&) = delete;
+
+
 	void ApplyNewSampleRate() override
 	{
 		APU::ApplyNewSampleRate();
@@ -33,28 +43,19 @@ export struct GB : Core
 
 	void DisableAudio() override
 	{
-		// TODO
+		APU::SetAudioOutputEnabled(false);
 	}
 
 
 	void EnableAudio() override
 	{
-		// TODO
+		APU::SetAudioOutputEnabled(true);
 	}
 
 
 	std::vector<std::string_view> GetActionNames() override
 	{
-		std::vector<std::string_view> names{};
-		names.emplace_back("A");
-		names.emplace_back("B");
-		names.emplace_back("Select");
-		names.emplace_back("Start");
-		names.emplace_back("Right");
-		names.emplace_back("Left");
-		names.emplace_back("Up");
-		names.emplace_back("Down");
-		return names;
+		return { Joypad::button_names.begin(), Joypad::button_names.end() };
 	}
 
 
@@ -66,6 +67,8 @@ export struct GB : Core
 
 	void Initialize() override
 	{
+		Scheduler::Initialize(); /* must come first, as the other components schedule their initial events */
+		System::Initialize(); /* the PPU and timer events depend on the speed */
 		APU::Initialize();
 		Bus::Initialize();
 		Cartridge::Initialize();
@@ -74,7 +77,6 @@ export struct GB : Core
 		Joypad::Initialize();
 		PPU::Initialize();
 		Serial::Initialize();
-		System::Initialize();
 		Timer::Initialize();
 	}
 
@@ -115,6 +117,8 @@ export struct GB : Core
 
 	void Reset() override
 	{ // TODO: reset vs initialize
+		Scheduler::Initialize();
+		System::Initialize();
 		APU::Initialize();
 		Bus::Initialize();
 		Cartridge::Initialize();
@@ -123,14 +127,36 @@ export struct GB : Core
 		Joypad::Initialize();
 		PPU::Initialize();
 		Serial::Initialize();
-		System::Initialize();
 		Timer::Initialize();
 	}
 
 
 	void Run() override
 	{
-		CPU::Run();
+		CPU::RunFrame();
+	}
+
+
+	/* Run until the given number of m-cycles have been run in total over all calls. An instruction is never split,
+	   so a call may run a few m-cycles too many; these are taken off the next call. */
+	void RunCycles(u64 m_cycles)
+	{
+		CPU::RunCycles(m_cycles);
+	}
+
+
+	/* Run until the PPU has finished the current frame, i.e., until VBlank is entered */
+	void RunFrame()
+	{
+		CPU::RunFrame();
+	}
+
+
+	/* Run until the predicate holds; it is checked before every instruction. It is passed the CPU of the machine, which
+	   it can cast back to the machine, as in the scheduler's callbacks. */
+	void RunUntil(bool(*predicate)(CPU& cpu))
+	{
+		CPU::RunUntil(predicate);
 	}
 
 
@@ -143,6 +169,7 @@ export struct GB : Core
 		DMA::StreamState(stream);
 		Joypad::StreamState(stream);
 		PPU::StreamState(stream);
+		Scheduler::StreamState(stream);
 		Serial::StreamState(stream);
 		System::StreamState(stream);
 		Timer::StreamState(stream);
@@ -0,0 +1,1108 @@
+module CPU;
+
+import Bus;
+import Debug;
+import GB;
+import Scheduler;
+import System;
+import UserMessage;
+
+import <optional>;
+
+/* The JIT compiles the longest prefix of a hot block that it can into x86-64 code. The prefix is straight-line code that
+   only touches the registers and memory backed by host memory (WRAM, cart RAM, HRAM and reads of ROM), and its
+   instructions take a fixed number of m-cycles. Compiled code is therefore only entered when no scheduled event is due
+   before it ends (see 'RunCompiledBlock'), so that the other components need not be stepped while it runs; the time is
+   advanced by the m-cycles of the instructions run once it returns. Accesses to anything else (I/O, VRAM, OAM, banking
+   controllers) exit to the interpreter before the instruction, which then accesses the bus as usual; instructions that
+   can change the control flow or the interrupt state are never compiled.
+   Blocks are only decoded from ROM, which no write can change, and are keyed on the host memory that they were decoded
+   from; a bank switch leaves the block in 'RunBlock', and flushing the block cache drops all compiled code. */
+
+namespace
+{
+	using X64::AluOp;
+	using X64::Cond;
+	using X64::Reg;
+	using X64::ShiftOp;
+
+	constexpr u8 zero_flag = 0x80;
+	constexpr u8 neg_flag = 0x40;
+	constexpr u8 half_flag = 0x20;
+	constexpr u8 carry_flag = 0x10;
+	constexpr u8 all_flags = 0xF0;
+
+	/* Where the SM83 registers are kept while compiled code runs, indexed like the 8-bit registers in opcodes; F takes
+	   the place of (HL). SP is kept in ebp, and the page tables of the bus in rdi and rsi. eax, ecx, edx and ebx are
+	   free for temporaries, with ecx collecting the flags computed by an instruction. */
+	constexpr std::array<Reg, 8> host_reg8 = { Reg::r9, Reg::r10, Reg::r11, Reg::r12, Reg::r13, Reg::r14, Reg::r15, Reg::r8 };
+	constexpr Reg host_a = Reg::r8;
+	constexpr Reg host_f = Reg::r15;
+	constexpr Reg host_sp = Reg::rbp;
+	constexpr Reg read_page_table = Reg::rdi;
+	constexpr Reg write_page_table = Reg::rsi;
+
+	constexpr uint reg_idx_h = 4;
+	constexpr uint reg_idx_l = 5;
+	constexpr uint reg_idx_f = 6;
+	constexpr uint reg_idx_a = 7;
+
+	/* Callee-saved in the System V and the Windows x64 ABI, and used by compiled code */
+	constexpr std::array saved_regs = { Reg::rbx, Reg::rbp, Reg::rsi, Reg::rdi, Reg::r12, Reg::r13, Reg::r14, Reg::r15 };
+
+	enum class Access {
+		Read, Write, ReadWrite
+	};
+
+	struct OpInfo
+	{
+		u8 m_cycles;
+		u8 flags_read;
+		u8 flags_written;
+		/* Accesses memory through the page tables, which may have no host memory for it; the code then exits to the
+		   interpreter before the instruction */
+		bool may_exit;
+	};
+
+	/* What compiled code returns: how many instructions it ran, the m-cycles and bytes that they take, and the opcode of
+	   the last one (of the second byte of a CB-prefixed one, like the interpreter sets 'opcode') */
+	constexpr u32 PackExit(uint num_ops, uint m_cycles, uint length, u8 last_opcode)
+	{
+		return num_ops | m_cycles << 8 | length << 16 | last_opcode << 24;
+	}
+
+
+	bool IsHramAddress(uint addr)
+	{
+		return addr >= 0xFF80 && addr <= 0xFFFE;
+	}
+
+
+	/* The timing and flag usage of an instruction that can be compiled, or nothing if it cannot */
+	std::optional<OpInfo> DescribeOp(const u8* code)
+	{
+		u8 opcode = code[0];
+		if (opcode >= 0x40 && opcode <= 0x7F) { /* LD r8, r8 */
+			if (opcode == 0x76) { /* HALT */
+				return std::nullopt;
+			}
+			bool hl = (opcode & 7) == 6 || (opcode >> 3 & 7) == 6;
+			return OpInfo{ u8(hl ? 2 : 1), 0, 0, hl };
+		}
+		if (opcode >= 0x80 && opcode <= 0xBF) { /* ALU A, r8 */
+			uint op = opcode >> 3 & 7;
+			bool hl = (opcode & 7) == 6;
+			return OpInfo{ u8(hl ? 2 : 1), u8(op == 1 || op == 3 ? carry_flag : 0), all_flags, hl };
+		}
+		switch (opcode) {
+		case 0x00: /* NOP */
+			return OpInfo{ 1, 0, 0, false };
+
+		case 0x01: case 0x11: case 0x21: case 0x31: /* LD r16, u16 */
+			return OpInfo{ 3, 0, 0, false };
+
+		case 0x02: case 0x12: case 0x22: case 0x32: /* LD (r16), A */
+		case 0x0A: case 0x1A: case 0x2A: case 0x3A: /* LD A, (r16) */
+			return OpInfo{ 2, 0, 0, true };
+
+		case 0x03: case 0x13: case 0x23: case 0x33: /* INC r16 */
+		case 0x0B: case 0x1B: case 0x2B: case 0x3B: /* DEC r16 */
+		case 0xF9: /* LD SP, HL */
+			return OpInfo{ 2, 0, 0, false };
+
+		case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x3C: /* INC r8 */
+		case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x3D: /* DEC r8 */
+			return OpInfo{ 1, 0, zero_flag | neg_flag | half_flag, false };
+
+		case 0x34: case 0x35: /* INC (HL), DEC (HL) */
+			return OpInfo{ 3, 0, zero_flag | neg_flag | half_flag, true };
+
+		case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E: /* LD r8, u8 */
+			return OpInfo{ 2, 0, 0, false };
+
+		case 0x36: /* LD (HL), u8 */
+			return OpInfo{ 3, 0, 0, true };
+
+		case 0x07: case 0x0F: /* RLCA, RRCA */
+			return OpInfo{ 1, 0, all_flags, false };
+
+		case 0x17: case 0x1F: /* RLA, RRA */
+			return OpInfo{ 1, carry_flag, all_flags, false };
+
+		case 0x09: case 0x19: case 0x29: case 0x39: /* ADD HL, r16 */
+			return OpInfo{ 2, 0, neg_flag | half_flag | carry_flag, false };
+
+		case 0x2F: /* CPL */
+			return OpInfo{ 1, 0, neg_flag | half_flag, false };
+
+		case 0x37: /* SCF */
+			return OpInfo{ 1, 0, neg_flag | half_flag | carry_flag, false };
+
+		case 0x3F: /* CCF */
+			return OpInfo{ 1, carry_flag, neg_flag | half_flag | carry_flag, false };
+
+		case 0xC6: case 0xD6: case 0xE6: case 0xEE: case 0xF6: case 0xFE: /* ALU A, u8 */
+			return OpInfo{ 2, 0, all_flags, false };
+
+		case 0xCE: case 0xDE: /* ADC A, u8; SBC A, u8 */
+			return OpInfo{ 2, carry_flag, all_flags, false };
+
+		case 0xC1: case 0xD1: case 0xE1: /* POP r16 */
+			return OpInfo{ 3, 0, 0, true };
+
+		case 0xF1: /* POP AF */
+			return OpInfo{ 3, 0, all_flags, true };
+
+		case 0xC5: case 0xD5: case 0xE5: /* PUSH r16 */
+			return OpInfo{ 4, 0, 0, true };
+
+		case 0xF5: /* PUSH AF */
+			return OpInfo{ 4, all_flags, 0, true };
+
+		case 0xE0: case 0xF0: /* LD (FF00+u8), A; LD A, (FF00+u8) */
+			if (IsHramAddress(0xFF00 | code[1])) {
+				return OpInfo{ 3, 0, 0, false };
+			}
+			return std::nullopt;
+
+		case 0xEA: case 0xFA: { /* LD (u16), A; LD A, (u16) */
+			uint addr = code[1] | code[2] << 8;
+			if (IsHramAddress(addr)) {
+				return OpInfo{ 4, 0, 0, false };
+			}
+			if (addr >= 0x8000 && addr <= 0x9FFF || addr >= 0xFE00) { /* VRAM, OAM, I/O or IE; never host memory */
+				return std::nullopt;
+			}
+			return OpInfo{ 4, 0, 0, true };
+		}
+
+		case 0xE8: /* ADD SP, s8 */
+			return OpInfo{ 4, 0, all_flags, false };
+
+		case 0xF8: /* LD HL, SP+s8 */
+			return OpInfo{ 3, 0, all_flags, false };
+
+		case 0xCB: {
+			u8 cb_opcode = code[1];
+			bool hl = (cb_opcode & 7) == 6;
+			switch (cb_opcode >> 6) {
+			case 0: { /* rotates, shifts and SWAP */
+				uint op = cb_opcode >> 3 & 7;
+				return OpInfo{ u8(hl ? 4 : 2), u8(op == 2 || op == 3 ? carry_flag : 0), all_flags, hl };
+			}
+			case 1: /* BIT */
+				return OpInfo{ u8(hl ? 3 : 2), 0, zero_flag | neg_flag | half_flag, hl };
+			default: /* RES, SET */
+				return OpInfo{ u8(hl ? 4 : 2), 0, 0, hl };
+			}
+		}
+
+		default:
+			return std::nullopt;
+		}
+	}
+
+
+	struct BlockCompiler
+	{
+		X64::Emitter e;
+
+		void* regs;
+		u8* read_hl;
+		u8* hram;
+		const u8* const* read_pages;
+		u8* const* write_pages;
+		std::array<s32, 8> reg8_offsets; /* of each 8-bit register in 'regs', indexed like 'host_reg8' */
+		s32 sp_offset;
+
+		/* Jumps to code emitted after the block: to the HRAM check of a memory access, and to the exits before an
+		   instruction */
+		struct SlowAccess { std::array<size_t, 2> jumps; uint num_jumps; size_t resume; u32 exit; };
+		struct Exit { size_t jump; u32 exit; };
+		std::vector<SlowAccess> slow_accesses;
+		std::vector<Exit> exits;
+
+		void Alu8(uint op, Reg operand, u8 live);
+		void CbOp(u8 cb_opcode, Reg reg, u8 live);
+		void EmitBlockEnd(u32 exit);
+		void EmitOp(const u8* code, u8 live, u32 exit);
+		void EmitPrologue();
+		/* Set edx to 1 if the condition holds, else 0, and add it to the flags in ecx at the position of 'flag' */
+		void FlagIf(Cond cond, u8 flag);
+		/* Point rdx to the host memory of the address in ecx; exits before the instruction if it has none */
+		void HostPointer(Access access, u32 exit);
+		void IncDec(Reg reg, bool dec, u8 live);
+		void PairToReg(Reg dst, uint high_idx, uint low_idx);
+		void RegToPair(uint high_idx, uint low_idx, Reg src); /* 'src' must be a 16-bit value, and is clobbered */
+		void RotateShift(uint op, Reg reg, u8 live, bool clear_zero);
+		void SetFlags(u8 mask); /* set the flags in 'mask' from ecx, leaving the other flags */
+		void StoreReadHl(Reg value);
+	};
+
+
+	void BlockCompiler::Alu8(uint op, Reg operand, u8 live)
+	{
+		/* 'op' as encoded in opcodes: ADD, ADC, SUB, SBC, AND, XOR, OR, CP. The operand is never eax, ecx or edx. */
+		u8 mask = live & all_flags;
+		if (op >= 4 && op <= 6) {
+			e.Alu(op == 4 ? AluOp::And : op == 5 ? AluOp::Xor : AluOp::Or, host_a, operand);
+			if (mask) {
+				e.Alu(AluOp::Xor, Reg::rcx, Reg::rcx);
+				if (mask & zero_flag) {
+					e.Test(host_a, 0xFF);
+					FlagIf(Cond::Equal, zero_flag);
+				}
+				if (op == 4 && mask & half_flag) {
+					e.Alu(AluOp::Or, Reg::rcx, half_flag);
+				}
+				SetFlags(mask);
+			}
+			return;
+		}
+		/* The result is computed in 32 bits, so that a carry (or a borrow, which wraps around) puts it above 0xFF, and
+		   bit 4 of lhs ^ rhs ^ result is the carry (or borrow) into bit 4 */
+		bool sub = op >= 2;
+		bool with_carry = op == 1 || op == 3;
+		if (with_carry) {
+			e.Mov(Reg::rdx, host_f);
+			e.Shift(ShiftOp::Shr, Reg::rdx, 4);
+			e.Alu(AluOp::And, Reg::rdx, 1);
+		}
+		e.Mov(Reg::rax, host_a);
+		e.Alu(sub ? AluOp::Sub : AluOp::Add, Reg::rax, operand);
+		if (with_carry) {
+			e.Alu(sub ? AluOp::Sub : AluOp::Add, Reg::rax, Reg::rdx);
+		}
+		if (mask) {
+			e.Alu(AluOp::Xor, Reg::rcx, Reg::rcx);
+			if (mask & carry_flag) {
+				e.Alu(AluOp::Cmp, Reg::rax, 0xFF);
+				FlagIf(Cond::Above, carry_flag);
+			}
+			if (mask & half_flag) {
+				e.Mov(Reg::rdx, host_a);
+				e.Alu(AluOp::Xor, Reg::rdx, operand);
+				e.Alu(AluOp::Xor, Reg::rdx, Reg::rax);
+				e.Alu(AluOp::And, Reg::rdx, 0x10);
+				e.Shift(ShiftOp::Shl, Reg::rdx, 1);
+				e.Alu(AluOp::Or, Reg::rcx, Reg::rdx);
+			}
+			if (mask & zero_flag) {
+				e.Test(Reg::rax, 0xFF);
+				FlagIf(Cond::Equal, zero_flag);
+			}
+			if (sub && mask & neg_flag) {
+				e.Alu(AluOp::Or, Reg::rcx, neg_flag);
+			}
+			SetFlags(mask);
+		}
+		if (op != 7) {
+			e.Movzx8(host_a, Reg::rax);
+		}
+	}
+
+
+	void BlockCompiler::CbOp(u8 cb_opcode, Reg reg, u8 live)
+	{
+		uint bit = cb_opcode >> 3 & 7;
+		switch (cb_opcode >> 6) {
+		case 0:
+			RotateShift(bit, reg, live, false);
+			break;
+
+		case 1: { /* BIT */
+			u8 mask = live & (zero_flag | neg_flag | half_flag);
+			if (mask) {
+				e.Alu(AluOp::Xor, Reg::rcx, Reg::rcx);
+				if (mask & zero_flag) {
+					e.Test(reg, 1 << bit);
+					FlagIf(Cond::Equal, zero_flag);
+				}
+				if (mask & half_flag) {
+					e.Alu(AluOp::Or, Reg::rcx, half_flag);
+				}
+				SetFlags(mask);
+			}
+			break;
+		}
+
+		case 2: /* RES */
+			e.Alu(AluOp::And, reg, ~(1 << bit) & 0xFF);
+			break;
+
+		case 3: /* SET */
+			e.Alu(AluOp::Or, reg, 1 << bit);
+			break;
+		}
+	}
+
+
+	void BlockCompiler::EmitBlockEnd(u32 exit)
+	{
+		/* Write the registers back, and return the exit. Exits before an instruction jump here too, with their own
+		   exit in eax, as do the accesses to HRAM once they have found it. */
+		e.Mov(Reg::rax, exit);
+		size_t epilogue = e.GetSize();
+		e.Mov64(Reg::rcx, std::bit_cast<u64>(regs));
+		for (uint i = 0; i < 8; ++i) {
+			e.StoreByte(Reg::rcx, reg8_offsets[i], host_reg8[i]);
+		}
+		e.StoreWord(Reg::rcx, sp_offset, host_sp);
+		for (auto it = saved_regs.rbegin(); it != saved_regs.rend(); ++it) {
+			e.Pop(*it);
+		}
+		e.Ret();
+		for (const SlowAccess& access : slow_accesses) {
+			for (uint i = 0; i < access.num_jumps; ++i) {
+				e.Bind(access.jumps[i]);
+			}
+			e.Alu(AluOp::Cmp, Reg::rcx, 0xFF80);
+			exits.push_back({ e.Jcc(Cond::Below), access.exit });
+			e.Alu(AluOp::Cmp, Reg::rcx, 0xFFFF);
+			exits.push_back({ e.Jcc(Cond::AboveOrEqual), access.exit });
+			e.Mov64(Reg::rdx, std::bit_cast<u64>(hram) - 0xFF80);
+			e.Alu64(AluOp::Add, Reg::rdx, Reg::rcx);
+			e.JmpTo(access.resume);
+		}
+		for (const Exit& exit : exits) {
+			e.Bind(exit.jump);
+			e.Mov(Reg::rax, exit.exit);
+			e.JmpTo(epilogue);
+		}
+	}
+
+
+	void BlockCompiler::EmitOp(const u8* code, u8 live, u32 exit)
+	{
+		/* Must agree with 'DescribeOp' */
+		u8 opcode = code[0];
+		if (opcode >= 0x40 && opcode <= 0x7F) { /* LD r8, r8 */
+			uint dst = opcode >> 3 & 7, src = opcode & 7;
+			if (src == 6) {
+				PairToReg(Reg::rcx, reg_idx_h, reg_idx_l);
+				HostPointer(Access::Read, exit);
+				e.LoadByte(host_reg8[dst], Reg::rdx, 0);
+				StoreReadHl(host_reg8[dst]);
+			}
+			else if (dst == 6) {
+				PairToReg(Reg::rcx, reg_idx_h, reg_idx_l);
+				HostPointer(Access::Write, exit);
+				e.StoreByte(Reg::rdx, 0, host_reg8[src]);
+			}
+			else if (dst != src) {
+				e.Mov(host_reg8[dst], host_reg8[src]);
+			}
+			return;
+		}
+		if (opcode >= 0x80 && opcode <= 0xBF) { /* ALU A, r8 */
+			uint src = opcode & 7;
+			if (src == 6) {
+				PairToReg(Reg::rcx, reg_idx_h, reg_idx_l);
+				HostPointer(Access::Read, exit);
+				e.LoadByte(Reg::rbx, Reg::rdx, 0);
+				StoreReadHl(Reg::rbx);
+				Alu8(opcode >> 3 & 7, Reg::rbx, live);
+			}
+			else {
+				Alu8(opcode >> 3 & 7, host_reg8[src], live);
+			}
+			return;
+		}
+		/* The register pairs BC, DE, HL as encoded in bits 4-5 of opcodes, and SP as 3 */
+		uint pair = opcode >> 4 & 3;
+		uint high_idx = 2 * pair, low_idx = 2 * pair + 1;
+		switch (opcode) {
+		case 0x00: /* NOP */
+			break;
+
+		case 0x01: case 0x11: case 0x21: case 0x31: /* LD r16, u16 */
+			if (pair == 3) {
+				e.Mov(host_sp, u32(code[1] | code[2] << 8));
+			}
+			else {
+				e.Mov(host_reg8[high_idx], code[2]);
+				e.Mov(host_reg8[low_idx], code[1]);
+			}
+			break;
+
+		case 0x02: case 0x12: /* LD (r16), A */
+			PairToReg(Reg::rcx, high_idx, low_idx);
+			HostPointer(Access::Write, exit);
+			e.StoreByte(Reg::rdx, 0, host_a);
+			break;
+
+		case 0x0A: case 0x1A: /* LD A, (r16) */
+			PairToReg(Reg::rcx, high_idx, low_idx);
+			HostPointer(Access::Read, exit);
+			e.LoadByte(host_a, Reg::rdx, 0);
+			break;
+
+		case 0x22: case 0x32: /* LD (HL+), A; LD (HL-), A */
+		case 0x2A: case 0x3A: /* LD A, (HL+); LD A, (HL-) */
+			PairToReg(Reg::rcx, reg_idx_h, reg_idx_l);
+			if (opcode & 8) {
+				HostPointer(Access::Read, exit);
+				e.LoadByte(host_a, Reg::rdx, 0);
+			}
+			else {
+				HostPointer(Access::Write, exit);
+				e.StoreByte(Reg::rdx, 0, host_a);
+			}
+			e.Alu(pair == 2 ? AluOp::Add : AluOp::Sub, Reg::rcx, 1);
+			e.Alu(AluOp::And, Reg::rcx, 0xFFFF);
+			RegToPair(reg_idx_h, reg_idx_l, Reg::rcx);
+			break;
+
+		case 0x03: case 0x13: case 0x23: case 0x33: /* INC r16 */
+		case 0x0B: case 0x1B: case 0x2B: case 0x3B: { /* DEC r16 */
+			AluOp op = opcode & 8 ? AluOp::Sub : AluOp::Add;
+			if (pair == 3) {
+				e.Alu(op, host_sp, 1);
+				e.Alu(AluOp::And, host_sp, 0xFFFF);
+			}
+			else {
+				PairToReg(Reg::rax, high_idx, low_idx);
+				e.Alu(op, Reg::rax, 1);
+				e.Alu(AluOp::And, Reg::rax, 0xFFFF);
+				RegToPair(high_idx, low_idx, Reg::rax);
+			}
+			break;
+		}
+
+		case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x3C: /* INC r8 */
+		case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x3D: /* DEC r8 */
+			IncDec(host_reg8[opcode >> 3 & 7], opcode & 1, live);
+			break;
+
+		case 0x34: case 0x35: /* INC (HL), DEC (HL) */
+			PairToReg(Reg::rcx, reg_idx_h, reg_idx_l);
+			HostPointer(Access::ReadWrite, exit);
+			e.LoadByte(Reg::rbx, Reg::rdx, 0);
+			StoreReadHl(Reg::rbx);
+			e.Push(Reg::rdx);
+			IncDec(Reg::rbx, opcode & 1, live);
+			e.Pop(Reg::rdx);
+			e.StoreByte(Reg::rdx, 0, Reg::rbx);
+			break;
+
+		case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E: /* LD r8, u8 */
+			e.Mov(host_reg8[opcode >> 3 & 7], code[1]);
+			break;
+
+		case 0x36: /* LD (HL), u8 */
+			PairToReg(Reg::rcx, reg_idx_h, reg_idx_l);
+			HostPointer(Access::Write, exit);
+			e.Mov(Reg::rax, code[1]);
+			e.StoreByte(Reg::rdx, 0, Reg::rax);
+			break;
+
+		case 0x07: case 0x0F: case 0x17: case 0x1F: /* RLCA, RRCA, RLA, RRA */
+			RotateShift(opcode >> 3 & 3, host_a, live, true);
+			break;
+
+		case 0x09: case 0x19: case 0x29: case 0x39: { /* ADD HL, r16 */
+			u8 mask = live & (neg_flag | half_flag | carry_flag);
+			PairToReg(Reg::rax, reg_idx_h, reg_idx_l);
+			if (pair == 3) {
+				e.Mov(Reg::rbx, host_sp);
+			}
+			else {
+				PairToReg(Reg::rbx, high_idx, low_idx);
+			}
+			e.Mov(Reg::rdx, Reg::rax);
+			e.Alu(AluOp::Xor, Reg::rdx, Reg::rbx);
+			e.Alu(AluOp::Add, Reg::rax, Reg::rbx);
+			if (mask) {
+				if (mask & half_flag) { /* the carry into bit 12, moved to bit 5 */
+					e.Alu(AluOp::Xor, Reg::rdx, Reg::rax);
+					e.Alu(AluOp::And, Reg::rdx, 0x1000);
+					e.Shift(ShiftOp::Shr, Reg::rdx, 7);
+					e.Mov(Reg::rcx, Reg::rdx);
+				}
+				else {
+					e.Alu(AluOp::Xor, Reg::rcx, Reg::rcx);
+				}
+				if (mask & carry_flag) {
+					e.Alu(AluOp::Cmp, Reg::rax, 0xFFFF);
+					FlagIf(Cond::Above, carry_flag);
+				}
+				SetFlags(mask);
+			}
+			e.Alu(AluOp::And, Reg::rax, 0xFFFF);
+			RegToPair(reg_idx_h, reg_idx_l, Reg::rax);
+			break;
+		}
+
+		case 0x2F: { /* CPL */
+			u8 mask = live & (neg_flag | half_flag);
+			e.Alu(AluOp::Xor, host_a, 0xFF);
+			if (mask) {
+				e.Alu(AluOp::Or, host_f, mask);
+			}
+			break;
+		}
+
+		case 0x37: { /* SCF */
+			u8 mask = live & (neg_flag | half_flag | carry_flag);
+			if (mask) {
+				e.Alu(AluOp::And, host_f, ~mask & 0xFF);
+				e.Alu(AluOp::Or, host_f, mask & carry_flag);
+			}
+			break;
+		}
+
+		case 0x3F: { /* CCF */
+			u8 mask = live & (neg_flag | half_flag | carry_flag);
+			if (mask & carry_flag) {
+				e.Alu(AluOp::Xor, host_f, carry_flag);
+			}
+			if (mask & (neg_flag | half_flag)) {
+				e.Alu(AluOp::And, host_f, ~(mask & (neg_flag | half_flag)) & 0xFF);
+			}
+			break;
+		}
+
+		case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE: /* ALU A, u8 */
+			e.Mov(Reg::rbx, code[1]);
+			Alu8(opcode >> 3 & 7, Reg::rbx, live);
+			break;
+
+		case 0xC1: case 0xD1: case 0xE1: case 0xF1: { /* POP r16 */
+			uint pop_high_idx = pair == 3 ? reg_idx_a : high_idx;
+			uint pop_low_idx = pair == 3 ? reg_idx_f : low_idx;
+			e.Mov(Reg::rcx, host_sp);
+			HostPointer(Access::Read, exit);
+			e.Mov64(Reg::rbx, Reg::rdx);
+			e.Mov(Reg::rcx, host_sp);
+			e.Alu(AluOp::Add, Reg::rcx, 1);
+			e.Alu(AluOp::And, Reg::rcx, 0xFFFF);
+			HostPointer(Access::Read, exit);
+			e.LoadByte(host_reg8[pop_low_idx], Reg::rbx, 0);
+			e.LoadByte(host_reg8[pop_high_idx], Reg::rdx, 0);
+			if (pair == 3) {
+				e.Alu(AluOp::And, host_f, all_flags);
+			}
+			e.Alu(AluOp::Add, host_sp, 2);
+			e.Alu(AluOp::And, host_sp, 0xFFFF);
+			break;
+		}
+
+		case 0xC5: case 0xD5: case 0xE5: case 0xF5: { /* PUSH r16 */
+			uint push_high_idx = pair == 3 ? reg_idx_a : high_idx;
+			uint push_low_idx = pair == 3 ? reg_idx_f : low_idx;
+			e.Mov(Reg::rcx, host_sp);
+			e.Alu(AluOp::Sub, Reg::rcx, 1);
+			e.Alu(AluOp::And, Reg::rcx, 0xFFFF);
+			HostPointer(Access::Write, exit);
+			e.Mov64(Reg::rbx, Reg::rdx);
+			e.Mov(Reg::rcx, host_sp);
+			e.Alu(AluOp::Sub, Reg::rcx, 2);
+			e.Alu(AluOp::And, Reg::rcx, 0xFFFF);
+			HostPointer(Access::Write, exit);
+			e.StoreByte(Reg::rbx, 0, host_reg8[push_high_idx]);
+			e.StoreByte(Reg::rdx, 0, host_reg8[push_low_idx]);
+			e.Alu(AluOp::Sub, host_sp, 2);
+			e.Alu(AluOp::And, host_sp, 0xFFFF);
+			break;
+		}
+
+		case 0xE0: case 0xF0: /* LD (FF00+u8), A; LD A, (FF00+u8) */
+		case 0xEA: case 0xFA: { /* LD (u16), A; LD A, (u16) */
+			uint addr = opcode & 0x0A ? code[1] | code[2] << 8 : 0xFF00 | code[1];
+			bool load = opcode & 0x10;
+			if (IsHramAddress(addr)) {
+				e.Mov64(Reg::rdx, std::bit_cast<u64>(hram + (addr - 0xFF80)));
+			}
+			else {
+				e.Mov(Reg::rcx, u32(addr));
+				HostPointer(load ? Access::Read : Access::Write, exit);
+			}
+			if (load) {
+				e.LoadByte(host_a, Reg::rdx, 0);
+			}
+			else {
+				e.StoreByte(Reg::rdx, 0, host_a);
+			}
+			break;
+		}
+
+		case 0xE8: case 0xF8: { /* ADD SP, s8; LD HL, SP+s8 */
+			u8 offset = code[1];
+			u8 mask = live & all_flags;
+			if (mask) {
+				e.Alu(AluOp::Xor, Reg::rcx, Reg::rcx);
+				if (mask & half_flag) { /* (SP & 0xF) + (offset & 0xF) > 0xF */
+					e.Mov(Reg::rax, host_sp);
+					e.Alu(AluOp::And, Reg::rax, 0xF);
+					e.Alu(AluOp::Cmp, Reg::rax, 0xF - (offset & 0xF));
+					FlagIf(Cond::Above, half_flag);
+				}
+				if (mask & carry_flag) { /* (SP & 0xFF) + offset > 0xFF */
+					e.Mov(Reg::rax, host_sp);
+					e.Alu(AluOp::And, Reg::rax, 0xFF);
+					e.Alu(AluOp::Cmp, Reg::rax, 0xFF - offset);
+					FlagIf(Cond::Above, carry_flag);
+				}
+				SetFlags(mask);
+			}
+			e.Mov(Reg::rax, host_sp);
+			e.Alu(AluOp::Add, Reg::rax, s8(offset));
+			e.Alu(AluOp::And, Reg::rax, 0xFFFF);
+			if (opcode == 0xE8) {
+				e.Mov(host_sp, Reg::rax);
+			}
+			else {
+				RegToPair(reg_idx_h, reg_idx_l, Reg::rax);
+			}
+			break;
+		}
+
+		case 0xF9: /* LD SP, HL */
+			PairToReg(host_sp, reg_idx_h, reg_idx_l);
+			break;
+
+		case 0xCB: {
+			u8 cb_opcode = code[1];
+			if ((cb_opcode & 7) != 6) {
+				CbOp(cb_opcode, host_reg8[cb_opcode & 7], live);
+				break;
+			}
+			bool bit = cb_opcode >> 6 == 1;
+			PairToReg(Reg::rcx, reg_idx_h, reg_idx_l);
+			HostPointer(bit ? Access::Read : Access::ReadWrite, exit);
+			e.LoadByte(Reg::rbx, Reg::rdx, 0);
+			StoreReadHl(Reg::rbx);
+			if (bit) {
+				CbOp(cb_opcode, Reg::rbx, live);
+			}
+			else {
+				e.Push(Reg::rdx);
+				CbOp(cb_opcode, Reg::rbx, live);
+				e.Pop(Reg::rdx);
+				e.StoreByte(Reg::rdx, 0, Reg::rbx);
+			}
+			break;
+		}
+
+		default:
+			assert(false);
+		}
+	}
+
+
+	void BlockCompiler::EmitPrologue()
+	{
+		for (Reg reg : saved_regs) {
+			e.Push(reg);
+		}
+		e.Mov64(Reg::rcx, std::bit_cast<u64>(regs));
+		for (uint i = 0; i < 8; ++i) {
+			e.LoadByte(host_reg8[i], Reg::rcx, reg8_offsets[i]);
+		}
+		e.LoadWord(host_sp, Reg::rcx, sp_offset);
+		e.Mov64(read_page_table, std::bit_cast<u64>(read_pages));
+		e.Mov64(write_page_table, std::bit_cast<u64>(write_pages));
+	}
+
+
+	void BlockCompiler::FlagIf(Cond cond, u8 flag)
+	{
+		e.Setcc(cond, Reg::rdx);
+		e.Movzx8(Reg::rdx, Reg::rdx);
+		e.Shift(ShiftOp::Shl, Reg::rdx, u8(std::countr_zero(flag)));
+		e.Alu(AluOp::Or, Reg::rcx, Reg::rdx);
+	}
+
+
+	void BlockCompiler::HostPointer(Access access, u32 exit)
+	{
+		/* The same as 'Bus::Read'/'Bus::Write' do, except for HRAM (see 'EmitBlockEnd'). A read-modify-write needs
+		   the same memory behind the page for both. ecx is left as it was. */
+		SlowAccess slow{ .num_jumps = 0, .exit = exit };
+		e.Mov(Reg::rax, Reg::rcx);
+		e.Shift(ShiftOp::Shr, Reg::rax, 8);
+		if (access == Access::ReadWrite) {
+			e.LoadIndexed64(Reg::rdx, write_page_table, Reg::rax);
+			e.LoadIndexed64(Reg::rax, read_page_table, Reg::rax);
+			e.Test64(Reg::rdx, Reg::rdx);
+			slow.jumps[slow.num_jumps++] = e.Jcc(Cond::Equal);
+			e.Alu64(AluOp::Cmp, Reg::rdx, Reg::rax);
+			slow.jumps[slow.num_jumps++] = e.Jcc(Cond::NotEqual);
+		}
+		else {
+			e.LoadIndexed64(Reg::rdx, access == Access::Read ? read_page_table : write_page_table, Reg::rax);
+			e.Test64(Reg::rdx, Reg::rdx);
+			slow.jumps[slow.num_jumps++] = e.Jcc(Cond::Equal);
+		}
+		e.Movzx8(Reg::rax, Reg::rcx);
+		e.Alu64(AluOp::Add, Reg::rdx, Reg::rax);
+		slow.resume = e.GetSize();
+		slow_accesses.push_back(slow);
+	}
+
+
+	void BlockCompiler::IncDec(Reg reg, bool dec, u8 live)
+	{
+		u8 mask = live & (zero_flag | neg_flag | half_flag);
+		e.Alu(dec ? AluOp::Sub : AluOp::Add, reg, 1);
+		e.Alu(AluOp::And, reg, 0xFF);
+		if (!mask) {
+			return;
+		}
+		e.Alu(AluOp::Xor, Reg::rcx, Reg::rcx);
+		if (mask & zero_flag) {
+			e.Test(reg, 0xFF);
+			FlagIf(Cond::Equal, zero_flag);
+		}
+		if (mask & half_flag) { /* the low nibble wrapped around */
+			e.Mov(Reg::rax, reg);
+			e.Alu(AluOp::And, Reg::rax, 0xF);
+			e.Alu(AluOp::Cmp, Reg::rax, dec ? 0xF : 0);
+			FlagIf(Cond::Equal, half_flag);
+		}
+		if (dec && mask & neg_flag) {
+			e.Alu(AluOp::Or, Reg::rcx, neg_flag);
+		}
+		SetFlags(mask);
+	}
+
+
+	void BlockCompiler::PairToReg(Reg dst, uint high_idx, uint low_idx)
+	{
+		e.Mov(dst, host_reg8[high_idx]);
+		e.Shift(ShiftOp::Shl, dst, 8);
+		e.Alu(AluOp::Or, dst, host_reg8[low_idx]);
+	}
+
+
+	void BlockCompiler::RegToPair(uint high_idx, uint low_idx, Reg src)
+	{
+		e.Movzx8(host_reg8[low_idx], src);
+		e.Shift(ShiftOp::Shr, src, 8);
+		e.Mov(host_reg8[high_idx], src);
+	}
+
+
+	void BlockCompiler::RotateShift(uint op, Reg reg, u8 live, bool clear_zero)
+	{
+		/* 'op' as encoded in CB-prefixed opcodes: RLC, RRC, RL, RR, SLA, SRA, SWAP, SRL. eax is set to the carry out. */
+		switch (op) {
+		case 0: /* RLC */
+		case 4: /* SLA */
+			e.Mov(Reg::rax, reg);
+			e.Shift(ShiftOp::Shr, Reg::rax, 7);
+			e.Shift(ShiftOp::Shl, reg, 1);
+			if (op == 0) {
+				e.Alu(AluOp::Or, reg, Reg::rax);
+			}
+			e.Alu(AluOp::And, reg, 0xFF);
+			break;
+
+		case 1: /* RRC */
+			e.Mov(Reg::rax, reg);
+			e.Alu(AluOp::And, Reg::rax, 1);
+			e.Shift(ShiftOp::Shr, reg, 1);
+			e.Mov(Reg::rdx, Reg::rax);
+			e.Shift(ShiftOp::Shl, Reg::rdx, 7);
+			e.Alu(AluOp::Or, reg, Reg::rdx);
+			break;
+
+		case 2: /* RL */
+			e.Mov(Reg::rdx, host_f);
+			e.Shift(ShiftOp::Shr, Reg::rdx, 4);
+			e.Alu(AluOp::And, Reg::rdx, 1);
+			e.Mov(Reg::rax, reg);
+			e.Shift(ShiftOp::Shr, Reg::rax, 7);
+			e.Shift(ShiftOp::Shl, reg, 1);
+			e.Alu(AluOp::Or, reg, Reg::rdx);
+			e.Alu(AluOp::And, reg, 0xFF);
+			break;
+
+		case 3: /* RR */
+			e.Mov(Reg::rdx, host_f);
+			e.Shift(ShiftOp::Shl, Reg::rdx, 3);
+			e.Alu(AluOp::And, Reg::rdx, 0x80);
+			e.Mov(Reg::rax, reg);
+			e.Alu(AluOp::And, Reg::rax, 1);
+			e.Shift(ShiftOp::Shr, reg, 1);
+			e.Alu(AluOp::Or, reg, Reg::rdx);
+			break;
+
+		case 5: /* SRA */
+			e.Mov(Reg::rax, reg);
+			e.Alu(AluOp::And, Reg::rax, 1);
+			e.Mov(Reg::rdx, reg);
+			e.Alu(AluOp::And, Reg::rdx, 0x80);
+			e.Shift(ShiftOp::Shr, reg, 1);
+			e.Alu(AluOp::Or, reg, Reg::rdx);
+			break;
+
+		case 6: /* SWAP */
+			e.Mov(Reg::rax, reg);
+			e.Shift(ShiftOp::Shl, Reg::rax, 4);
+			e.Shift(ShiftOp::Shr, reg, 4);
+			e.Alu(AluOp::Or, reg, Reg::rax);
+			e.Alu(AluOp::And, reg, 0xFF);
+			e.Alu(AluOp::Xor, Reg::rax, Reg::rax);
+			break;
+
+		case 7: /* SRL */
+			e.Mov(Reg::rax, reg);
+			e.Alu(AluOp::And, Reg::rax, 1);
+			e.Shift(ShiftOp::Shr, reg, 1);
+			break;
+		}
+		u8 mask = live & all_flags;
+		if (!mask) {
+			return;
+		}
+		if (mask & carry_flag) {
+			e.Mov(Reg::rcx, Reg::rax);
+			e.Shift(ShiftOp::Shl, Reg::rcx, 4);
+		}
+		else {
+			e.Alu(AluOp::Xor, Reg::rcx, Reg::rcx);
+		}
+		if (mask & zero_flag && !clear_zero) {
+			e.Test(reg, 0xFF);
+			FlagIf(Cond::Equal, zero_flag);
+		}
+		SetFlags(mask);
+	}
+
+
+	void BlockCompiler::SetFlags(u8 mask)
+	{
+		if (mask == all_flags) {
+			e.Mov(host_f, Reg::rcx);
+		}
+		else {
+			e.Alu(AluOp::And, host_f, ~mask & 0xFF);
+			e.Alu(AluOp::Or, host_f, Reg::rcx);
+		}
+	}
+
+
+	void BlockCompiler::StoreReadHl(Reg value)
+	{
+		e.Mov64(Reg::rax, std::bit_cast<u64>(read_hl));
+		e.StoreByte(Reg::rax, 0, value);
+	}
+}
+
+
+void CPU::CompileBlock(Block& block)
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* Find the prefix, leaving out an instruction whose operands are in the next page (which may be backed by other
+	   memory than 'block.code'), and the flags that are read before they are written again. Every exit can see all
+	   flags, so they are all live where the code may exit. */
+	std::array<OpInfo, max_block_length> infos;
+	uint num_ops = 0;
+	uint offset = 0;
+	uint page_bytes_left = 0x100 - (block.start_pc & 0xFF);
+	while (num_ops < block.num_ops && offset + block.ops[num_ops].length <= page_bytes_left) {
+		std::optional<OpInfo> info = DescribeOp(block.code + offset);
+		if (!info) {
+			break;
+		}
+		infos[num_ops] = *info;
+		offset += block.ops[num_ops++].length;
+	}
+	if (num_ops < jit_min_block_length) {
+		return;
+	}
+	std::array<u8, max_block_length> live_flags;
+	u8 live = all_flags;
+	for (uint i = num_ops; i-- > 0; ) {
+		live_flags[i] = live;
+		live = infos[i].may_exit ? all_flags : live & ~infos[i].flags_written | infos[i].flags_read;
+	}
+
+	auto offset_in_regs = [this](const void* reg) {
+		return s32(static_cast<const u8*>(reg) - reinterpret_cast<const u8*>(&regs));
+	};
+	BlockCompiler compiler{
+		.regs = &regs,
+		.read_hl = &read_hl,
+		.hram = gb.Bus::GetHramHostPointer(),
+		.read_pages = gb.Bus::GetReadPageTable(),
+		.write_pages = gb.Bus::GetWritePageTable(),
+		.reg8_offsets = { offset_in_regs(&regs.B), offset_in_regs(&regs.C), offset_in_regs(&regs.D),
+			offset_in_regs(&regs.E), offset_in_regs(&regs.H), offset_in_regs(&regs.L), offset_in_regs(&regs.F),
+			offset_in_regs(&regs.A) },
+		.sp_offset = offset_in_regs(&regs.sp)
+	};
+	compiler.EmitPrologue();
+	u32 exit = PackExit(0, 0, 0, 0);
+	uint m_cycles = 0;
+	offset = 0;
+	for (uint i = 0; i < num_ops; ++i) {
+		const u8* code = block.code + offset;
+		compiler.EmitOp(code, live_flags[i], exit);
+		m_cycles += infos[i].m_cycles;
+		offset += block.ops[i].length;
+		exit = PackExit(i + 1, m_cycles, offset, code[0] == 0xCB ? code[1] : code[0]);
+	}
+	compiler.EmitBlockEnd(exit);
+
+	const u8* native_code = jit_code.Add(compiler.e.GetCode());
+	if (!native_code) { /* out of room; start over */
+		DropCompiledCode();
+		native_code = jit_code.Add(compiler.e.GetCode());
+		if (!native_code) {
+			return;
+		}
+	}
+	block.native_code = reinterpret_cast<u32(*)()>(native_code);
+	block.native_m_cycles = m_cycles;
+}
+
+
+void CPU::DropCompiledCode()
+{
+	for (Block& block : block_cache) {
+		block.native_code = nullptr;
+		block.run_count = 0;
+	}
+	jit_code.Clear();
+}
+
+
+void CPU::RestoreWritableMemory(const std::vector<u8>& snapshot)
+{
+	GB& gb = static_cast<GB&>(*this);
+	u8* const* write_pages = gb.Bus::GetWritePageTable();
+	auto it = snapshot.begin();
+	for (uint page = 0; page < 0x100; ++page) {
+		if (write_pages[page]) {
+			std::copy_n(it, 0x100, write_pages[page]);
+			it += 0x100;
+		}
+	}
+	std::copy_n(it, 0x80, gb.Bus::GetHramHostPointer());
+}
+
+
+uint CPU::RunCompiledBlock(Block& block)
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* Called before the first instruction of the block, and returns how many of its instructions were run. Blocks
+	   are compiled once they have been run 'jit_hot_block_threshold' times. The other components are not stepped
+	   while compiled code runs, so it is only entered if no event is due before its last m-cycle, and if the run would
+	   not end before its last instruction. Nor is it entered while 'attention' is set (e.g. during the EI delay), as
+	   'RunBlock' then returns to 'Run' after the first instruction; it is also left to the interpreter while
+	   instructions are logged. */
+	if (!block.native_code) {
+		if (block.run_count >= jit_hot_block_threshold || ++block.run_count < jit_hot_block_threshold) {
+			return 0;
+		}
+		CompileBlock(block);
+		if (!block.native_code) {
+			return 0;
+		}
+	}
+	if (block.native_m_cycles >= gb.Scheduler::GetCyclesUntilNextEvent()
+		|| gb.Scheduler::GetTime() + block.native_m_cycles > run_until_time || attention) {
+		return 0;
+	}
+	if constexpr (Debug::log_instr) {
+		if (Debug::IsLogging()) {
+			return 0;
+		}
+	}
+	if (jit_validation_enabled) {
+		return RunCompiledBlockInLockstep(block);
+	}
+	Flags(); /* compiled code keeps F up to date itself */
+	u32 exit = block.native_code();
+	uint num_ops = exit & 0xFF;
+	gb.Scheduler::SkipCycles(exit >> 8 & 0xFF);
+	regs.pc += exit >> 16 & 0xFF;
+	if (num_ops > 0) {
+		opcode = exit >> 24;
+	}
+	return num_ops;
+}
+
+
+uint CPU::RunCompiledBlockInLockstep(Block& block)
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* The interpreter is the reference. The compiled code is run first, and what it did is put aside and undone; the
+	   instructions that it ran are then interpreted from the same state, and the registers, the memory that compiled
+	   code can write and the time are compared. On a mismatch, the block is left to the interpreter from then on. */
+	Flags();
+	Registers entry_regs = regs;
+	u8 entry_read_hl = read_hl;
+	SnapshotWritableMemory(jit_entry_memory);
+
+	u32 exit = block.native_code();
+	uint num_ops = exit & 0xFF;
+	Registers compiled_regs = regs;
+	compiled_regs.pc += exit >> 16 & 0xFF;
+	u8 compiled_read_hl = read_hl;
+	SnapshotWritableMemory(jit_exit_memory);
+
+	RestoreWritableMemory(jit_entry_memory);
+	regs = entry_regs;
+	read_hl = entry_read_hl;
+	u64 start_time = gb.Scheduler::GetTime();
+	for (uint i = 0; i < num_ops; ++i) {
+		const MicroOp& op = block.ops[i];
+		opcode = op.opcode;
+		++regs.pc;
+		WaitCycle(); /* the opcode fetch */
+		(this->*op.handler)();
+	}
+	Flags();
+	SnapshotWritableMemory(jit_entry_memory);
+
+	bool match = std::memcmp(&regs, &compiled_regs, sizeof(Registers)) == 0
+		&& read_hl == compiled_read_hl
+		&& (num_ops == 0 || opcode == exit >> 24)
+		&& gb.Scheduler::GetTime() - start_time == (exit >> 8 & 0xFF)
+		&& jit_entry_memory == jit_exit_memory;
+	if (!match) {
+		gb.System::ShowMessage(std::format("The compiled block at ${:04X} does not match the interpreter after {} "
+			"instruction(s); it is left to the interpreter.", block.start_pc, num_ops), UserMessage::Type::Warning);
+		block.native_code = nullptr;
+	}
+	return num_ops;
+}
+
+
+bool CPU::SetJitEnabled(bool enabled)
+{
+	DropCompiledCode();
+	if (enabled && !jit_code.IsAllocated()) {
+		enabled = jit_code.Allocate(jit_code_buffer_size);
+	}
+	if (!enabled) {
+		jit_code.Free();
+	}
+	jit_enabled = enabled;
+	return enabled;
+}
+
+
+void CPU::SetJitValidationEnabled(bool enabled)
+{
+	jit_validation_enabled = enabled;
+}
+
+
+void CPU::SnapshotWritableMemory(std::vector<u8>& snapshot)
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* All that compiled code can write: the pages backed by host memory, and HRAM */
+	u8* const* write_pages = gb.Bus::GetWritePageTable();
+	snapshot.clear();
+	for (uint page = 0; page < 0x100; ++page) {
+		if (write_pages[page]) {
+			snapshot.insert(snapshot.end(), write_pages[page], write_pages[page] + 0x100);
+		}
+	}
+	u8* hram = gb.Bus::GetHramHostPointer();
+	snapshot.insert(snapshot.end(), hram, hram + 0x80);
+}
\ No newline at end of file
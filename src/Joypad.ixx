@@ -3,27 +3,31 @@ export module Joypad;
 import Util;
 
 import <array>;
+import <string_view>;
 import <utility>;
 
-namespace Joypad
+export struct Joypad
 {
-	export
-	{
-		enum class Button {
-			A, B, Select, Start, Right, Left, Up, Down
-		};
-
-		void Initialize();
-		void NotifyButtonPressed(uint button_index);
-		void NotifyButtonReleased(uint button_index);
-		u8 ReadP1();
-		void StreamState(SerializationStream& stream);
-		void WriteP1(u8 data);
-	}
+	enum class Button {
+		A, B, Select, Start, Right, Left, Up, Down
+	};
 
+	/* Indexed like 'Button' */
+	static constexpr std::array<std::string_view, 8> button_names = {
+		"A", "B", "Select", "Start", "Right", "Left", "Up", "Down"
+	};
+
+	void Initialize();
+	void NotifyButtonPressed(uint button_index);
+	void NotifyButtonReleased(uint button_index);
+	u8 ReadP1();
+	void StreamState(SerializationStream& stream);
+	void WriteP1(u8 data);
+
+private:
 	void UpdateOutputLines();
 
 	u8 p1;
 
 	std::array<bool, 8> button_currently_held;
-}
\ No newline at end of file
+};
\ No newline at end of file
@@ -1,5 +1,6 @@
 #define SDL_MAIN_HANDLED
 
+import BatchRunner;
 import Core;
 import Emulator;
 import Frontend;
@@ -9,9 +10,16 @@ import UserMessage;
 import <format>;
 import <memory>;
 import <string>;
+import <string_view>;
 
 int main(int argc, char** argv)
 {
+	/* Batch mode, without the frontend: --batch <path to manifest> [--scaling]; see 'BatchRunner::ParseManifest' */
+	if (argc >= 3 && std::string_view(argv[1]) == "--batch") {
+		bool measure_scaling = argc >= 4 && std::string_view(argv[3]) == "--scaling";
+		return BatchRunner::RunManifest(argv[2], measure_scaling);
+	}
+
 	std::shared_ptr<Core> core = std::make_shared<GB>();
 	Emulator::SetCore(core);
 	if (!Frontend::Initialize()) {
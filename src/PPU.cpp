@@ -2,877 +2,1637 @@ module PPU;
 
 import CPU;
 import DMA;
+import GB;
 import PPU.Palettes;
+import Scheduler;
 import System;
+import UserMessage;
 import Video;
 
-namespace PPU
+u8 PPU::ReadBCPD()
 {
-	u8 ReadBCPD()
-	{
-		u8 addr = bcps & 0x3F;
-		return bg_palette_ram[addr];
-	}
+	u8 addr = bcps & 0x3F;
+	return bg_palette_ram[addr];
+}
 
 
-	u8 ReadBCPS()
-	{
-		return bcps | 0x40; /* bit 6 always reads 1 (?) */
-	}
+u8 PPU::ReadBCPS()
+{
+	return bcps | 0x40; /* bit 6 always reads 1 (?) */
+}
 
 
-	u8 ReadBGP()
-	{
-		return bgp;
-	}
+u8 PPU::ReadBGP()
+{
+	return bgp;
+}
 
 
-	u8 ReadLCDC()
-	{
-		return std::bit_cast<u8, decltype(lcdc)>(lcdc);
-	}
+u8 PPU::ReadLCDC()
+{
+	return std::bit_cast<u8, decltype(lcdc)>(lcdc);
+}
 
 
-	u8 ReadLY()
-	{
-		return ly;
-	}
+u8 PPU::ReadLY()
+{
+	Sync();
+	return ly;
+}
 
 
-	u8 ReadLYC()
-	{
-		return lyc;
-	}
+u8 PPU::ReadLYC()
+{
+	return lyc;
+}
 
 
-	u8 ReadOamCpu(u16 addr)
-	{
-		return stat.lcd_mode <= 1 ? oam[addr] : 0xFF;
-	}
+u8 PPU::ReadOamCpu(u16 addr)
+{
+	Sync();
+	return stat.lcd_mode <= 1 ? oam[addr] : 0xFF;
+}
 
 
-	u8 ReadOBP0()
-	{
-		return obp_dmg[0];
-	}
+u8 PPU::ReadOBP0()
+{
+	return obp_dmg[0];
+}
 
 
-	u8 ReadOBP1()
-	{
-		return obp_dmg[1];
-	}
+u8 PPU::ReadOBP1()
+{
+	return obp_dmg[1];
+}
 
 
-	u8 ReadOCPD()
-	{
-		u8 addr = ocps & 0x3F;
-		return obj_palette_ram[addr];
-	}
+u8 PPU::ReadOCPD()
+{
+	u8 addr = ocps & 0x3F;
+	return obj_palette_ram[addr];
+}
 
 
-	u8 ReadOCPS()
-	{
-		return ocps | 0x40; /* bit 6 always reads 1 (?) */
-	}
+u8 PPU::ReadOCPS()
+{
+	return ocps | 0x40; /* bit 6 always reads 1 (?) */
+}
 
 
-	u8 ReadOPRI()
-	{
-		static_assert(std::to_underlying(ObjPriorityMode::OamIndex) == 0);
-		static_assert(std::to_underlying(ObjPriorityMode::Coordinate) == 1);
-		return 0xFE | std::to_underlying(obj_priority_mode);
-	}
+u8 PPU::ReadOPRI()
+{
+	static_assert(std::to_underlying(ObjPriorityMode::OamIndex) == 0);
+	static_assert(std::to_underlying(ObjPriorityMode::Coordinate) == 1);
+	return 0xFE | std::to_underlying(obj_priority_mode);
+}
 
 
-	u8 ReadSCX()
-	{
-		return scx;
-	}
+u8 PPU::ReadSCX()
+{
+	return scx;
+}
 
 
-	u8 ReadSCY()
-	{
-		return scy;
-	}
+u8 PPU::ReadSCY()
+{
+	return scy;
+}
 
 
-	u8 ReadSTAT()
-	{
-		return std::bit_cast<u8, decltype(stat)>(stat) | 0x80;
-	}
+u8 PPU::ReadSTAT()
+{
+	Sync();
+	return std::bit_cast<u8, decltype(stat)>(stat) | 0x80;
+}
 
 
-	u8 ReadVBK()
-	{
-		return System::mode == System::Mode::CGB
-			? 0xFE | current_vram_bank
-			: 0xFF;
-	}
+u8 PPU::ReadVBK()
+{
+	GB& gb = static_cast<GB&>(*this);
+	return gb.System::mode == System::Mode::CGB
+		? 0xFE | current_vram_bank
+		: 0xFF;
+}
 
 
-	u8 ReadWX()
-	{
-		return wx;
-	}
+u8 PPU::ReadWX()
+{
+	return wx;
+}
 
 
-	u8 ReadWY()
-	{
-		return wy;
-	}
+u8 PPU::ReadWY()
+{
+	return wy;
+}
 
 
-	void WriteBCPD(u8 data)
-	{
-		u8 addr = bcps & 0x3F;
-		bg_palette_ram[addr] = data;
+void PPU::WriteBCPD(u8 data)
+{
+	SyncBeforeRegisterWrite();
+	u8 addr = bcps & 0x3F;
+	bg_palette_ram[addr] = data;
 
-		/* Update the bg palette containing actual RGB colors. */
-		u16 color_data = bg_palette_ram[addr & ~1] | bg_palette_ram[addr | 1] << 8;
-		auto col_index = addr / 2;
-		cgb_bg_palette[col_index] = CgbColorDataToRGB(color_data);
+	/* Update the bg palette containing actual RGB colors. */
+	u16 color_data = bg_palette_ram[addr & ~1] | bg_palette_ram[addr | 1] << 8;
+	auto col_index = addr / 2;
+	cgb_bg_palette[col_index] = CgbColorDataToRGB(color_data);
+	UpdateHostColours(col_index, 1);
 
-		if (bcps & 0x80) {
-			addr++;
-			bcps = addr & 0x3F | bcps & ~0x3F;
-		}
+	if (bcps & 0x80) {
+		addr++;
+		bcps = addr & 0x3F | bcps & ~0x3F;
 	}
+}
 
 
-	void WriteBCPS(u8 data)
-	{
-		bcps = data;
-	}
+void PPU::WriteBCPS(u8 data)
+{
+	Sync();
+	bcps = data;
+}
 
 
-	void WriteBGP(u8 data)
-	{
-		bgp = data;
-	}
+void PPU::WriteBGP(u8 data)
+{
+	SyncBeforeRegisterWrite();
+	bgp = data;
+	UpdateHostColours(0, 4);
+}
 
 
-	void WriteLCDC(u8 data)
-	{
-		u8 prev_lcdc = std::bit_cast<u8, decltype(lcdc)>(lcdc);
-		lcdc = std::bit_cast<decltype(lcdc), u8>(data);
-		ReadLcdcFlags();
-		if ((prev_lcdc ^ data) & 0x80) {
-			if (lcdc.lcd_enable) {
-				// TODO: probably something happens here
-				PrepareForNewScanline();
-			}
-			else {
-				stat_interrupt_cond = false;
-				SetLcdMode(LcdMode::HBlank);
-				ly = m_cycle_counter = framebuffer_pos = 0;
-			}
-			CheckStatInterrupt();
+void PPU::WriteLCDC(u8 data)
+{
+	SyncBeforeRegisterWrite();
+	u8 prev_lcdc = std::bit_cast<u8, decltype(lcdc)>(lcdc);
+	lcdc = std::bit_cast<decltype(lcdc), u8>(data);
+	ReadLcdcFlags();
+	if ((prev_lcdc ^ data) & 0x80) {
+		if (lcdc.lcd_enable) {
+			// TODO: probably something happens here
+			PrepareForNewScanline();
+		}
+		else {
+			stat_interrupt_cond = false;
+			SetLcdMode(LcdMode::HBlank);
+			ly = m_cycle_counter = framebuffer_pos = 0;
 		}
+		CheckStatInterrupt();
+		ScheduleNextEvent();
 	}
+}
 
 
-	void WriteLY(u8 data)
-	{
-		ly = 0;
-		m_cycle_counter = 0;
-		PrepareForNewFrame(); /* TODO: not sure exactly what should happen here */
-		PrepareForNewScanline();
-		CheckStatInterrupt();
-		wy_equalled_ly_this_frame |= wy == 0;
-	}
+void PPU::WriteLY(u8 data)
+{
+	SyncBeforeRegisterWrite();
+	ly = 0;
+	m_cycle_counter = 0;
+	PrepareForNewFrame(); /* TODO: not sure exactly what should happen here */
+	PrepareForNewScanline();
+	CheckStatInterrupt();
+	wy_equalled_ly_this_frame |= wy == 0;
+	ScheduleNextEvent();
+}
+
+
+void PPU::WriteLYC(u8 data)
+{
+	Sync();
+	lyc = data;
+	CheckStatInterrupt();
+}
 
 
-	void WriteLYC(u8 data)
-	{
-		lyc = data;
-		CheckStatInterrupt();
+void PPU::WriteOamCpu(u16 addr, u8 data)
+{
+	Sync();
+	if (stat.lcd_mode <= 1) {
+		oam[addr] = data;
 	}
+}
 
 
-	void WriteOamCpu(u16 addr, u8 data)
-	{
-		if (stat.lcd_mode <= 1) {
-			oam[addr] = data;
-		}
-	}
+void PPU::WriteOBP0(u8 data)
+{
+	SyncBeforeRegisterWrite();
+	obp_dmg[0] = data;
+	UpdateHostColours(ScanlineMixer::first_obj_colour_index, 4);
+}
 
 
-	void WriteOBP0(u8 data)
-	{
-		obp_dmg[0] = data;
-	}
+void PPU::WriteOBP1(u8 data)
+{
+	SyncBeforeRegisterWrite();
+	obp_dmg[1] = data;
+	UpdateHostColours(ScanlineMixer::first_obj_colour_index + 4, 4);
+}
+
+
+void PPU::WriteOCPD(u8 data)
+{
+	SyncBeforeRegisterWrite();
+	u8 addr = ocps & 0x3F;
+	obj_palette_ram[addr] = data;
 
+	/* Update the bg palette containing actual RGB colors. */
+	u16 color_data = obj_palette_ram[addr & ~1] | obj_palette_ram[addr | 1] << 8;
+	auto col_index = addr / 2;
+	cgb_obj_palette[col_index] = CgbColorDataToRGB(color_data);
+	UpdateHostColours(ScanlineMixer::first_obj_colour_index + col_index, 1);
 
-	void WriteOBP1(u8 data)
-	{
-		obp_dmg[1] = data;
+	if (ocps & 0x80) {
+		addr++;
+		ocps = addr & 0x3F | ocps & ~0x3F;
 	}
+}
 
 
-	void WriteOCPD(u8 data)
-	{
-		u8 addr = ocps & 0x3F;
-		obj_palette_ram[addr] = data;
+void PPU::WriteOCPS(u8 data)
+{
+	Sync();
+	ocps = data;
+}
 
-		/* Update the bg palette containing actual RGB colors. */
-		u16 color_data = obj_palette_ram[addr & ~1] | obj_palette_ram[addr | 1] << 8;
-		auto col_index = addr / 2;
-		cgb_obj_palette[col_index] = CgbColorDataToRGB(color_data);
 
-		if (ocps & 0x80) {
-			addr++;
-			ocps = addr & 0x3F | ocps & ~0x3F;
-		}
+void PPU::WriteOPRI(u8 data)
+{
+	SyncBeforeRegisterWrite();
+	if (data & 1) {
+		obj_priority_mode = ObjPriorityMode::Coordinate;
 	}
+	else {
+		obj_priority_mode = ObjPriorityMode::OamIndex;
+	}
+}
 
 
-	void WriteOCPS(u8 data)
-	{
-		ocps = data;
-	}
+void PPU::WriteSCX(u8 data)
+{
+	SyncBeforeRegisterWrite();
+	scx = data;
+}
 
 
-	void WriteOPRI(u8 data)
-	{
-		if (data & 1) {
-			obj_priority_mode = ObjPriorityMode::Coordinate;
-		}
-		else {
-			obj_priority_mode = ObjPriorityMode::OamIndex;
-		}
-	}
+void PPU::WriteSCY(u8 data)
+{
+	SyncBeforeRegisterWrite();
+	scy = data;
+}
 
 
-	void WriteSCX(u8 data)
-	{
-		scx = data;
-	}
+void PPU::WriteSTAT(u8 data)
+{
+	Sync();
+	/* Only bits 3-6 are writeable */
+	u8 prev_stat = std::bit_cast<u8, decltype(stat)>(stat);
+	u8 new_stat = prev_stat & ~0x78 | data & 0x78;
+	stat = std::bit_cast<decltype(stat), u8>(new_stat);
+	CheckStatInterrupt();
+	ScheduleNextEvent(); /* the HBlank STAT interrupt may have been enabled or disabled */
+}
 
 
-	void WriteSCY(u8 data)
-	{
-		scy = data;
+void PPU::WriteVBK(u8 data)
+{
+	GB& gb = static_cast<GB&>(*this);
+	SyncBeforeRegisterWrite();
+	if (gb.System::mode == System::Mode::CGB) {
+		current_vram_bank = data & 1;
 	}
+}
 
 
-	void WriteSTAT(u8 data)
-	{
-		/* Only bits 3-6 are writeable */
-		u8 prev_stat = std::bit_cast<u8, decltype(stat)>(stat);
-		u8 new_stat = prev_stat & ~0x78 | data & 0x78;
-		stat = std::bit_cast<decltype(stat), u8>(new_stat);
-		CheckStatInterrupt();
-	}
+void PPU::WriteWX(u8 data)
+{
+	SyncBeforeRegisterWrite();
+	wx = data;
+}
 
 
-	void WriteVBK(u8 data)
-	{
-		if (System::mode == System::Mode::CGB) {
-			current_vram_bank = data & 1;
-		}
-	}
+void PPU::WriteWY(u8 data)
+{
+	SyncBeforeRegisterWrite();
+	wy = data;
+	wy_equalled_ly_this_frame |= ly == wy;
+}
 
 
-	void WriteWX(u8 data)
-	{
-		wx = data;
-	}
+void PPU::SetDmgPalette(DmgPalette palette)
+{
+	SyncBeforeRegisterWrite();
+	dmg_palette = palette;
+	UpdateHostColours(0, 64);
+}
 
 
-	void WriteWY(u8 data)
-	{
-		wy = data;
-		wy_equalled_ly_this_frame |= ly == wy;
-	}
+void PPU::SetFramebufferMode(FramebufferMode mode)
+{
+	Sync();
+	framebuffer_mode = mode;
+}
 
 
-	void SetDmgPalette(DmgPalette palette)
-	{
-		dmg_palette = palette;
+void PPU::SetFrameSkip(uint render_every_nth_frame)
+{
+	Sync();
+	frame_render_interval = render_every_nth_frame;
+}
+
+
+void PPU::SetPixelFormat(PixelFormat format)
+{
+	Sync();
+	pixel_format = format;
+	UpdateHostColours(0, 64);
+	if (video_output_enabled) {
+		Video::SetPixelFormat(GetVideoPixelFormat());
 	}
+}
 
 
-	RGB CgbColorDataToRGB(u16 color_data)
-	{
-		u8 red = color_data & 0x1F;
-		u8 green = color_data >> 5 & 0x1F;
-		u8 blue = color_data >> 10 & 0x1F;
-		// convert each 5-bit channel to 8-bit channels (https://github.com/mattcurrie/dmg-acid2)
-		red = red << 3 | red >> 2;
-		green = green << 3 | green >> 2;
-		blue = blue << 3 | blue >> 2;
-		return { red, green, blue };
+void PPU::SetVideoOutputEnabled(bool enabled)
+{
+	video_output_enabled = enabled;
+	if (enabled) {
+		Video::SetFramebufferPtr(framebuffer.data());
+		Video::SetFramebufferSize(resolution_x, resolution_y);
+		Video::SetPixelFormat(GetVideoPixelFormat());
 	}
+}
+
+
+std::span<const u8> PPU::GetIndexedFramebuffer()
+{
+	return indexed_framebuffer;
+}
+
+
+std::span<const PPU::RGB, 64> PPU::GetScanlineColours(uint scanline)
+{
+	return scanline_colours[scanline];
+}
 
 
-	void Initialize(bool hle_boot_rom)
-	{
+PPU::RGB PPU::CgbColorDataToRGB(u16 color_data)
+{
+	u8 red = color_data & 0x1F;
+	u8 green = color_data >> 5 & 0x1F;
+	u8 blue = color_data >> 10 & 0x1F;
+	// convert each 5-bit channel to 8-bit channels (https://github.com/mattcurrie/dmg-acid2)
+	red = red << 3 | red >> 2;
+	green = green << 3 | green >> 2;
+	blue = blue << 3 | blue >> 2;
+	return { red, green, blue };
+}
+
+
+void PPU::Initialize(bool hle_boot_rom)
+{
+	GB& gb = static_cast<GB&>(*this);
+	if (video_output_enabled) {
 		Video::SetFramebufferPtr(framebuffer.data());
 		Video::SetFramebufferSize(resolution_x, resolution_y);
-		Video::SetPixelFormat(Video::PixelFormat::RGB888);
+	}
+	if (!ScanlineMixer::Initialize()) {
+		gb.System::ShowMessage(ScanlineMixer::self_test_failure_message, UserMessage::Type::Warning);
+	}
 
-		dmg_palette = Palettes::grayscale;
+	dmg_palette = Palettes::grayscale;
 
-		oam.fill(0);
-		vram.fill(0);
+	oam.fill(0);
+	vram.fill(0);
+	decoded_tile_is_stale.fill(true);
 
-		sprite_buffer.clear();
-		sprite_buffer.reserve(sprite_buffer_capacity);
-		ClearFifos();
+	sprite_buffer.Clear();
+	ClearFifos();
 
-		stat_interrupt_cond = false;
-		wy_equalled_ly_this_frame = false;
+	stat_interrupt_cond = false;
+	wy_equalled_ly_this_frame = false;
 
-		current_vram_bank = 0;
-		framebuffer_pos = 0;
-		leftmost_bg_pixels_to_discard = 0;
-		m_cycle_counter = 0;
-		oam_addr = 0;
+	current_vram_bank = 0;
+	framebuffer_pos = 0;
+	frame_counter = 0;
+	frame_is_rendered = true;
+	leftmost_bg_pixels_to_discard = 0;
+	m_cycle_counter = 0;
+	oam_addr = 0;
+	scanline_renderer_active = false;
+
+	bg_tile_fetcher.Reset(true);
+	sprite_fetcher.Reset();
+	pixel_shifter.Reset();
+
+	if (hle_boot_rom) {
+		bgp = 0xFC;
+		lcdc = std::bit_cast<decltype(lcdc), u8>(u8(0x91));
+		stat = std::bit_cast<decltype(stat), u8>(u8(0x81));
+	}
+	else {
+		bgp = 0;
+		lcdc = std::bit_cast<decltype(lcdc), u8>(u8(0));
+		stat = std::bit_cast<decltype(stat), u8>(u8(0));
+	}
+	ly = lyc = scx = scy = wx = wy = 0;
+	obp_dmg[0] = obp_dmg[1] = 0xFF;
+	UpdateHostColours(0, 64);
+	if (video_output_enabled) {
+		Video::SetPixelFormat(GetVideoPixelFormat());
+	}
+	ReadLcdcFlags();
+
+	obj_priority_mode = ObjPriorityMode::Coordinate;
+	SetLcdMode(LcdMode::SearchOam);
+
+	CheckStatInterrupt();
+
+	time_synced = gb.Scheduler::GetTime();
+	ScheduleNextEvent();
+}
 
-		bg_tile_fetcher.Reset(true);
-		sprite_fetcher.Reset();
-		pixel_shifter.Reset();
 
-		if (hle_boot_rom) {
-			bgp = 0xFC;
-			lcdc = std::bit_cast<decltype(lcdc), u8>(u8(0x91));
-			stat = std::bit_cast<decltype(stat), u8>(u8(0x81));
+void PPU::Sync()
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* Events due at the current m-cycle run before the PPU is stepped for it (see Scheduler::EventType).
+	   E.g., an OAM DMA byte copy must see the LCD mode from before the PPU has been stepped. */
+	CatchUp(gb.Scheduler::GetTime() - gb.Scheduler::IsRunningEvents());
+}
+
+
+void PPU::SyncBeforeRegisterWrite()
+{
+	Sync();
+	/* The scanline renderer relies on the registers staying the same throughout the pixel transfer */
+	if (scanline_renderer_active) {
+		FallBackToPixelFifo();
+		ScheduleNextEvent();
+	}
+}
+
+
+void PPU::FallBackToPixelFifo()
+{
+	/* The pixel FIFO state has been left as it was at the start of the pixel transfer, and nothing that
+	   affects it has changed since. Replay the elapsed part of the pixel transfer to bring it up to date. */
+	scanline_renderer_active = false;
+	for (uint i = 0; i < pixel_transfer_dots; ++i) {
+		UpdatePixelFetchers();
+	}
+}
+
+
+void PPU::CatchUp(u64 time)
+{
+	if (!lcdc.lcd_enable) {
+		time_synced = std::max(time, time_synced);
+		return;
+	}
+	while (time_synced < time) {
+		/* Skip over m-cycles during which nothing but the m-cycle counter would change. */
+		u64 idle_m_cycles = std::min(u64(GetIdleMCycles()), time - time_synced);
+		m_cycle_counter += uint(idle_m_cycles);
+		if (scanline_renderer_active) {
+			pixel_transfer_dots += 4 * uint(idle_m_cycles);
 		}
-		else {
-			bgp = 0;
-			lcdc = std::bit_cast<decltype(lcdc), u8>(u8(0));
-			stat = std::bit_cast<decltype(stat), u8>(u8(0));
+		time_synced += idle_m_cycles;
+		if (time_synced < time) {
+			Update();
+			++time_synced;
 		}
-		ly = lyc = scx = scy = wx = wy = 0;
-		obp_dmg[0] = obp_dmg[1] = 0xFF;
-		ReadLcdcFlags();
+	}
+}
 
-		obj_priority_mode = ObjPriorityMode::Coordinate;
-		SetLcdMode(LcdMode::SearchOam);
 
-		CheckStatInterrupt();
+uint PPU::GetIdleMCycles()
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* Returns how many of the upcoming calls to 'Update' would only increment 'm_cycle_counter'
+	   (and 'pixel_transfer_dots', while the scanline renderer waits for the pixel transfer to end).
+	   The last m-cycle of a scanline is never idle. */
+	uint m_cycles_per_scanline_at_speed = m_cycles_per_scanline * std::to_underlying(gb.System::speed);
+	if (ly < 144) {
+		if (m_cycle_counter <= 20 * std::to_underlying(gb.System::speed)) {
+			return 0;
+		}
+		else if (pixel_shifter.pixel_x_pos >= resolution_x) {
+			return m_cycles_per_scanline_at_speed - 1 - m_cycle_counter;
+		}
+		else if (scanline_renderer_active) {
+			return (pixel_transfer_length - pixel_transfer_dots + 3) / 4 - 1;
+		}
+		else {
+			return 0;
+		}
+	}
+	else if (ly == 144 && m_cycle_counter <= 1) {
+		return 1 - m_cycle_counter; /* VBlank is entered at m-cycle 1 */
 	}
+	else {
+		return m_cycles_per_scanline_at_speed - 1 - m_cycle_counter;
+	}
+}
 
 
-	void Update()
-	{
-		if (!lcdc.lcd_enable) {
-			return;
-		}
-		// 114 m-cycles per scanline in single-speed mode. for double-speed, all numbers should be doubled
-		// 154 scanlines in total (LY == current scanline). Only scanlines 0-143 are visible.
-		if (ly < 144) {
-			if (m_cycle_counter < 20 * std::to_underlying(System::speed)) {
-				ScanOam();
+void PPU::OnEvent()
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* The PPU event is the last one to run at its m-cycle, so the PPU can be stepped for it. */
+	CatchUp(gb.Scheduler::GetTime());
+	ScheduleNextEvent();
+}
+
+
+void PPU::ScheduleNextEvent()
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* The PPU must be stepped at every m-cycle where it may request an interrupt, finish a frame, or start an
+	   HDMA block copy; it cannot be left to catch up later on, as the CPU does not access the PPU to find out.
+	   These are the ends of scanlines (LY changes; OAM scan is entered) and the entering of VBlank. HBlank is entered
+	   when the pixel transfer has finished. If it matters (HBlank STAT interrupt enabled or HDMA active), the PPU
+	   is stepped at the start of the pixel transfer, when the scanline renderer works out when HBlank is entered.
+	   If the pixel FIFOs are used instead, the PPU is stepped every m-cycle of the pixel transfer. */
+	if (!lcdc.lcd_enable) {
+		gb.Scheduler::RemoveEvent(Scheduler::EventType::Ppu);
+		return;
+	}
+	uint speed = std::to_underlying(gb.System::speed);
+	/* Count of calls to 'Update' from 'time_synced', up to and including the one that should be run by the event. */
+	uint m_cycles_until_event = [&] {
+		if (ly < 144 && pixel_shifter.pixel_x_pos < resolution_x
+			&& (stat.hblank_stat_int_enable || gb.DMA::HdmaTransferActive())) {
+			if (m_cycle_counter <= 20 * speed) {
+				return 20 * speed - m_cycle_counter + 1;
+			}
+			else if (scanline_renderer_active) {
+				return (pixel_transfer_length - pixel_transfer_dots + 3) / 4;
 			}
 			else {
-				if (m_cycle_counter == 20 * std::to_underlying(System::speed)) {
-					SetLcdMode(LcdMode::DriverTransfer);
-					ClearFifos();
+				return 1u;
+			}
+		}
+		else if (ly == 144 && m_cycle_counter <= 1) {
+			return 2 - m_cycle_counter;
+		}
+		else {
+			return m_cycles_per_scanline * speed - m_cycle_counter;
+		}
+	}();
+	gb.Scheduler::AddEvent(Scheduler::EventType::Ppu, time_synced + m_cycles_until_event - gb.Scheduler::GetTime());
+}
+
+
+void PPU::Update()
+{
+	GB& gb = static_cast<GB&>(*this);
+	if (!lcdc.lcd_enable) {
+		return;
+	}
+	// 114 m-cycles per scanline in single-speed mode. for double-speed, all numbers should be doubled
+	// 154 scanlines in total (LY == current scanline). Only scanlines 0-143 are visible.
+	if (ly < 144) {
+		if (scanline_renderer_active && m_cycle_counter <= 20 * std::to_underlying(gb.System::speed)) {
+			FallBackToPixelFifo(); /* switched to double speed during the pixel transfer */
+		}
+		if (m_cycle_counter < 20 * std::to_underlying(gb.System::speed)) {
+			ScanOam();
+		}
+		else {
+			if (m_cycle_counter == 20 * std::to_underlying(gb.System::speed)) {
+				SetLcdMode(LcdMode::DriverTransfer);
+				ClearFifos();
+				scanline_renderer_active = SimulatePixelTransfer();
+				pixel_transfer_dots = 0;
+			}
+			if (scanline_renderer_active) {
+				pixel_transfer_dots += 4;
+				if (pixel_transfer_dots >= pixel_transfer_length) {
+					RenderScanline();
 				}
+			}
+			else {
 				for (int i = 0; i < 4; ++i) {
 					UpdatePixelFetchers();
 				}
 			}
 		}
-		else if (ly == 144 && m_cycle_counter == 1) {
-			EnterVBlank();
+	}
+	else if (ly == 144 && m_cycle_counter == 1) {
+		EnterVBlank();
+	}
+	if (++m_cycle_counter == m_cycles_per_scanline * std::to_underlying(gb.System::speed)) {
+		m_cycle_counter = 0;
+		if (ly == 153) {
+			ly = 0;
+			PrepareForNewFrame();
+			PrepareForNewScanline();
 		}
-		if (++m_cycle_counter == m_cycles_per_scanline * std::to_underlying(System::speed)) {
-			m_cycle_counter = 0;
-			if (ly == 153) {
-				ly = 0;
-				PrepareForNewFrame();
+		else {
+			ly++;
+			if (ly < 144) {
 				PrepareForNewScanline();
 			}
-			else {
-				ly++;
-				if (ly < 144) {
-					PrepareForNewScanline();
-				}
-			}
-			wy_equalled_ly_this_frame |= wy == ly;
-			CheckStatInterrupt();
 		}
+		wy_equalled_ly_this_frame |= wy == ly;
+		CheckStatInterrupt();
 	}
+}
+
+
+u8 PPU::ReadVRAM(u16 addr)
+{
+	addr &= (vram_bank_size - 1);
+	return vram[addr + current_vram_bank * vram_bank_size];
+}
+
+
+u8 PPU::ReadVramCpu(u16 addr)
+{
+	Sync();
+	return stat.lcd_mode == 3
+		? 0xFF
+		: ReadVRAM(addr);
+}
 
 
-	u8 ReadVRAM(u16 addr)
-	{
+void PPU::WriteVramCpu(u16 addr, u8 data)
+{
+	Sync();
+	if (stat.lcd_mode != 3) {
 		addr &= (vram_bank_size - 1);
-		return vram[addr + current_vram_bank * vram_bank_size];
+		vram[addr + current_vram_bank * vram_bank_size] = data;
+		if (addr < tile_data_size) {
+			decoded_tile_is_stale[addr / 16 + current_vram_bank * num_tiles_per_vram_bank] = true;
+		}
 	}
+}
 
 
-	u8 ReadVramCpu(u16 addr)
-	{
-		return stat.lcd_mode == 3
-			? 0xFF
-			: ReadVRAM(addr);
+PPU::DecodedTileRow PPU::GetDecodedTileRow(u16 addr)
+{
+	/* 'addr' is that of the first byte of the tile row in VRAM. A tile that is stale is decoded in full. */
+	uint tile_index = (addr & (vram_bank_size - 1)) / 16 + current_vram_bank * num_tiles_per_vram_bank;
+	auto& tile = decoded_tiles[tile_index];
+	if (decoded_tile_is_stale[tile_index]) {
+		const u8* tile_data = &vram[tile_index / num_tiles_per_vram_bank * vram_bank_size + tile_index % num_tiles_per_vram_bank * 16];
+		for (uint row = 0; row < 8; ++row) {
+			u8 tile_data_low = tile_data[2 * row], tile_data_high = tile_data[2 * row + 1];
+			tile[row] = {};
+			// Pixel 0 in the tile is bit 7 of tile data. Pixel 1 is bit 6 etc..
+			for (uint i = 0; i < 8; ++i) {
+				u16 col_id = GetBit(tile_data_high, 7 - i) << 1 | GetBit(tile_data_low, 7 - i);
+				tile[row].col_ids |= col_id << (14 - 2 * i);
+				tile[row].col_ids_x_flipped |= col_id << (2 * i);
+			}
+		}
+		decoded_tile_is_stale[tile_index] = false;
 	}
+	return tile[(addr / 2) & 7];
+}
 
 
-	void WriteVramCpu(u16 addr, u8 data)
-	{
-		if (stat.lcd_mode != 3) {
-			addr &= (vram_bank_size - 1);
-			vram[addr + current_vram_bank * vram_bank_size] = data;
-		}
+void PPU::EnterVBlank()
+{
+	GB& gb = static_cast<GB&>(*this);
+	bg_tile_fetcher.window_line_counter = -1;
+	SetLcdMode(LcdMode::VBlank);
+	gb.CPU::RequestInterrupt(CPU::Interrupt::VBlank);
+	gb.CPU::NotifyVBlank();
+	if (framebuffer_mode == FramebufferMode::Indexed && frame_is_rendered) {
+		ConvertIndexedFramebuffer();
+	}
+	if (video_output_enabled) {
+		Video::NotifyNewGameFrameReady(); /* also for skipped frames; the framebuffer still holds the last rendered one */
 	}
+}
 
 
-	void EnterVBlank()
-	{
-		bg_tile_fetcher.window_line_counter = -1;
-		SetLcdMode(LcdMode::VBlank);
-		CPU::RequestInterrupt(CPU::Interrupt::VBlank);
-		Video::NotifyNewGameFrameReady();
+void PPU::EnterHBlank()
+{
+	GB& gb = static_cast<GB&>(*this);
+	if (framebuffer_mode != FramebufferMode::Direct && gb.System::mode == System::Mode::CGB && frame_is_rendered) {
+		std::copy(cgb_bg_palette.begin(), cgb_bg_palette.end(), scanline_colours[ly].begin());
+		std::copy(cgb_obj_palette.begin(), cgb_obj_palette.end(),
+			scanline_colours[ly].begin() + ScanlineMixer::first_obj_colour_index);
+	}
+	SetLcdMode(LcdMode::HBlank);
+	if (gb.DMA::HdmaTransferActive()) {
+		gb.DMA::HdmaStartBlockCopy();
 	}
+	bg_tile_fetcher.paused = sprite_fetcher.paused = pixel_shifter.paused = true;
+}
 
 
-	void EnterHBlank()
-	{
-		SetLcdMode(LcdMode::HBlank);
-		if (DMA::HdmaTransferActive()) {
-			DMA::HdmaStartBlockCopy();
-		}
-		bg_tile_fetcher.paused = sprite_fetcher.paused = pixel_shifter.paused = true;
+void PPU::SetLcdMode(LcdMode lcd_mode)
+{
+	stat.lcd_mode = std::to_underlying(lcd_mode);
+	CheckStatInterrupt();
+}
+
+
+void PPU::CheckStatInterrupt()
+{
+	GB& gb = static_cast<GB&>(*this);
+	if (!lcdc.lcd_enable) {
+		return;
 	}
 
+	stat.lyc_equals_ly = ly == lyc;
 
-	void SetLcdMode(LcdMode lcd_mode)
-	{
-		stat.lcd_mode = std::to_underlying(lcd_mode);
-		CheckStatInterrupt();
+	bool stat_cond_met_ly_equals_lyc = ly == lyc && stat.lyc_equals_ly_stat_int_enable;
+	bool stat_cond_met_lcd_mode = stat.lcd_mode == 0 && stat.hblank_stat_int_enable
+		|| stat.lcd_mode == 1 && stat.vblank_stat_int_enable
+		|| stat.lcd_mode == 2 && stat.oam_stat_int_enable;
+	bool prev_stat_interrupt_cond = stat_interrupt_cond;
+	stat_interrupt_cond = stat_cond_met_ly_equals_lyc || stat_cond_met_lcd_mode;
+
+	if (!prev_stat_interrupt_cond && stat_interrupt_cond) {
+		gb.CPU::RequestInterrupt(CPU::Interrupt::Stat);
 	}
+}
 
 
-	void CheckStatInterrupt()
-	{
-		if (!lcdc.lcd_enable) {
-			return;
-		}
+void PPU::ReadLcdcFlags()
+{
+	sprite_height = lcdc.obj_size ? 16 : 8;
+	bg_tile_map_base_addr = lcdc.bg_tile_map_area ? 0x9C00 : 0x9800;
+	tile_data_base_addr = lcdc.bg_tile_data_area ? 0x8000 : 0x9000;
+	window_tile_map_base_addr = lcdc.window_tile_map_area ? 0x9C00 : 0x9800;
+	tile_nums_are_signed = tile_data_base_addr == 0x9000;
+}
 
-		stat.lyc_equals_ly = ly == lyc;
 
-		bool stat_cond_met_ly_equals_lyc = ly == lyc && stat.lyc_equals_ly_stat_int_enable;
-		bool stat_cond_met_lcd_mode = stat.lcd_mode == 0 && stat.hblank_stat_int_enable
-			|| stat.lcd_mode == 1 && stat.vblank_stat_int_enable
-			|| stat.lcd_mode == 2 && stat.oam_stat_int_enable;
-		bool prev_stat_interrupt_cond = stat_interrupt_cond;
-		stat_interrupt_cond = stat_cond_met_ly_equals_lyc || stat_cond_met_lcd_mode;
+template<PPU::TileType tile_type>
+u8 PPU::GetColourIndexFromPixel(FifoPixel pixel)
+{
+	GB& gb = static_cast<GB&>(*this);
+	if constexpr (tile_type == TileType::BG) {
+		return 4 * pixel.palette + pixel.col_id;
+	}
+	else {
+		u8 palette = gb.System::mode == System::Mode::DMG ? pixel.palette & 1 : pixel.palette;
+		return ScanlineMixer::first_obj_colour_index + 4 * palette + pixel.col_id;
+	}
+}
 
-		if (!prev_stat_interrupt_cond && stat_interrupt_cond) {
-			CPU::RequestInterrupt(CPU::Interrupt::Stat);
-		}
+
+Video::PixelFormat PPU::GetVideoPixelFormat()
+{
+	switch (pixel_format) {
+	case PixelFormat::RGB888: return Video::PixelFormat::RGB888;
+	case PixelFormat::RGBA8888: return Video::PixelFormat::RGBA8888;
+	case PixelFormat::XRGB8888: return Video::PixelFormat::XRGB8888;
+	case PixelFormat::RGB565: return Video::PixelFormat::RGB565;
+	default: std::unreachable();
 	}
+}
 
 
-	void ReadLcdcFlags()
-	{
-		sprite_height = lcdc.obj_size ? 16 : 8;
-		bg_tile_map_base_addr = lcdc.bg_tile_map_area ? 0x9C00 : 0x9800;
-		tile_data_base_addr = lcdc.bg_tile_data_area ? 0x8000 : 0x9000;
-		window_tile_map_base_addr = lcdc.window_tile_map_area ? 0x9C00 : 0x9800;
-		tile_nums_are_signed = tile_data_base_addr == 0x9000;
+u8 PPU::GetDmgShade(u8 colour_index)
+{
+	// which bits of the colour palette does the colour id map to?
+	auto shift = (colour_index & 3) * 2;
+	if (colour_index < ScanlineMixer::first_obj_colour_index) {
+		return bgp >> shift & 3;
+	}
+	else {
+		return obp_dmg[(colour_index - ScanlineMixer::first_obj_colour_index) / 4 & 1] >> shift & 3;
 	}
+}
 
 
-	template<TileType tile_type>
-	RGB GetColourFromPixel(FifoPixel pixel)
-	{
-		if (System::mode == System::Mode::DMG) {
-			// which bits of the colour palette does the colour id map to?
-			auto shift = pixel.col_id * 2;
-			auto col_index = [&] {
-				if constexpr (tile_type == TileType::BG) {
-					return bgp;
-				}
-				else {
-					return obp_dmg[pixel.palette & 1];
-				}
-			}() >> shift & 3;
-			return dmg_palette[col_index];
-		}
-		else {
-			auto col_index = 4 * pixel.palette + pixel.col_id;
-			if constexpr (tile_type == TileType::BG) {
-				return cgb_bg_palette[col_index];
+PPU::RGB PPU::GetCgbColour(u8 colour_index)
+{
+	if (colour_index < ScanlineMixer::first_obj_colour_index) {
+		return cgb_bg_palette[colour_index];
+	}
+	else {
+		return cgb_obj_palette[colour_index - ScanlineMixer::first_obj_colour_index];
+	}
+}
+
+
+void PPU::BackgroundTileFetcher::Step(PPU& ppu)
+{
+	switch (tile_fetch_state_machine[step]) {
+		case TileFetchStep::TileNum: {
+			u16 tile_num_addr;
+			u8 tile_col, tile_row;
+			if (window_reached) {
+				tile_num_addr = ppu.window_tile_map_base_addr;
+				tile_col = tile_x_pos;
+				tile_row = window_line_counter / 8;
 			}
 			else {
-				return cgb_obj_palette[col_index];
+				tile_num_addr = ppu.bg_tile_map_base_addr;
+				tile_col = (tile_x_pos + ppu.scx / 8) & 0x1F;
+				tile_row = ((ppu.ly + ppu.scy) & 0xFF) / 8;
 			}
+			tile_num_addr += (32 * tile_row + tile_col) & 0x3FF;
+			tile_num = ppu.tile_nums_are_signed ? (s8)ppu.ReadVRAM(tile_num_addr) : ppu.ReadVRAM(tile_num_addr);
+			step = (step + 1) & 7;
+			break;
 		}
-	}
-
 
-	void BackgroundTileFetcher::Step()
-	{
-		switch (tile_fetch_state_machine[step]) {
-			case TileFetchStep::TileNum: {
-				u16 tile_num_addr;
-				u8 tile_col, tile_row;
+		case TileFetchStep::TileDataLow:
+			tile_data_addr = ppu.tile_data_base_addr + 16 * tile_num + 2 * ([&] {
 				if (window_reached) {
-					tile_num_addr = window_tile_map_base_addr;
-					tile_col = tile_x_pos;
-					tile_row = window_line_counter / 8;
+					return window_line_counter;
 				}
 				else {
-					tile_num_addr = bg_tile_map_base_addr;
-					tile_col = (tile_x_pos + scx / 8) & 0x1F;
-					tile_row = ((ly + scy) & 0xFF) / 8;
+					return ppu.ly + ppu.scy;
 				}
-				tile_num_addr += (32 * tile_row + tile_col) & 0x3FF;
-				tile_num = tile_nums_are_signed ? (s8)ReadVRAM(tile_num_addr) : ReadVRAM(tile_num_addr);
+			}() % 8);
+			tile_data_low = ppu.ReadVRAM(tile_data_addr);
+			step = (step + 1) & 7;
+			break;
+
+		case TileFetchStep::TileDataHigh:
+			// The first time the background fetcher completes this step on a scanline, the status is fully reset and operation restarts at Step 1.
+			if (fetch_tile_data_high_step_reached_this_scanline) {
+				tile_data_high = ppu.ReadVRAM(tile_data_addr + 1);
 				step = (step + 1) & 7;
-				break;
 			}
+			else {
+				fetch_tile_data_high_step_reached_this_scanline = true;
+				step = 0;
+			}
+			break;
 
-			case TileFetchStep::TileDataLow:
-				tile_data_addr = tile_data_base_addr + 16 * tile_num + 2 * ([&] {
-					if (window_reached) {
-						return window_line_counter;
-					}
-					else {
-						return ly + scy;
-					}
-				}() % 8);
-				tile_data_low = ReadVRAM(tile_data_addr);
-				step = (step + 1) & 7;
-				break;
+		case TileFetchStep::PushTile:
+			// Step 4 is only executed if the background FIFO is fully empty.
+			// If it is not, this step repeats every cycle until it succeeds.
+			if (!ppu.bg_pixel_fifo.IsEmpty()) {
+				return;
+			}
+			ppu.bg_pixel_fifo.Push(tile_data_low, tile_data_high);
+			tile_x_pos = (tile_x_pos + 1) & 0x1F;
+			step = (step + 1) & 7;
+			break;
 
-			case TileFetchStep::TileDataHigh:
-				// The first time the background fetcher completes this step on a scanline, the status is fully reset and operation restarts at Step 1.
-				if (fetch_tile_data_high_step_reached_this_scanline) {
-					tile_data_high = ReadVRAM(tile_data_addr + 1);
-					step = (step + 1) & 7;
+		case TileFetchStep::Sleep:
+			step = (step + 1) & 7;
+			break;
+	}
+}
+
+
+void PPU::BackgroundTileFetcher::Reset(bool reset_window_line_counter)
+{
+	step = 0;
+	paused = window_reached = fetch_tile_data_high_step_reached_this_scanline = false;
+	tile_x_pos = 0;
+	if (reset_window_line_counter) {
+		window_line_counter = -1;
+	}
+}
+
+
+void PPU::SpriteFetcher::Step(PPU& ppu)
+{
+	switch (tile_fetch_state_machine[step]) {
+		case TileFetchStep::TileNum:
+			tile_num = sprite.tile_num;
+			if (ppu.sprite_height == 16)  {
+				// if 8x16 sprites are used, find if low or high tile is used for the current scanline
+				// To calculate the tile number of the top tile, the tile number in the OAM entry is used and the least significant bit is set to 0. 
+				// The tile number of the bottom tile is calculated by setting the least significant bit to 1.
+				if ((ppu.ly < sprite.pixel_y_pos - 8) ^ sprite.y_flip) {
+					tile_num &= 0xFE;
 				}
 				else {
-					fetch_tile_data_high_step_reached_this_scanline = true;
-					step = 0;
+					tile_num |= 1;
 				}
-				break;
+			}
+			break;
 
-			case TileFetchStep::PushTile:
-				// Step 4 is only executed if the background FIFO is fully empty.
-				// If it is not, this step repeats every cycle until it succeeds.
-				if (!bg_pixel_fifo.empty()) {
-					return;
+		case TileFetchStep::TileDataLow:
+			tile_addr = 0x8000 + 16 * tile_num + [&] {
+				if (sprite.y_flip) {
+					return 2 * (7 - (ppu.ly - sprite.pixel_y_pos + 16) % 8);
 				}
-				// Pixel 0 in the tile is bit 7 of tile data. Pixel 1 is bit 6 etc..
-				for (int i = 7; i >= 0; --i) {
-					// combine data 2 and data 1 to get the colour id for this pixel in the tile
-					u8 col_id = GetBit(tile_data_high, i) << 1 | GetBit(tile_data_low, i);
-					bg_pixel_fifo.emplace(col_id);
+				else {
+					return 2 * ((ppu.ly - sprite.pixel_y_pos + 16) % 8);
 				}
-				tile_x_pos = (tile_x_pos + 1) & 0x1F;
-				step = (step + 1) & 7;
-				break;
-
-			case TileFetchStep::Sleep:
-				step = (step + 1) & 7;
-				break;
+			}();
+			tile_data_low = ppu.ReadVRAM(tile_addr);
+			break;
+
+		case TileFetchStep::TileDataHigh:
+			tile_data_high = ppu.ReadVRAM(tile_addr + 1);
+			break;
+
+		case TileFetchStep::PushTile: {
+			// Only pixels which are actually visible on the screen are loaded into the FIFO
+			// e.g., if pixel shifter xPos = 0, then a sprite with an X-value of 8 would have all 8 pixels loaded, 
+			// while a sprite with an X-value of 7 would only have the rightmost 7 pixels loaded
+			// No need to worry about pixels going off the right side of the screen, since the PPU wouldn't push these pixels anyways
+			auto pixels_to_ignore_left = std::max(0, 8 + ppu.pixel_shifter.pixel_x_pos - sprite.pixel_x_pos);
+
+			if (ppu.obj_priority_mode == ObjPriorityMode::OamIndex) {
+				// TODO (CGB)
+			}
+			// Pixel 0 in the tile is bit 7 of tile data. Pixel 1 is bit 6 etc..
+			// insert as many pixels into FIFO as there are free slots
+			// if FIFO already contains n no. of pixels, insert only the last 8 - n pixels from the current sprite¨
+			auto InsertPixel = [&](int tile_data_bit_index) {
+				auto col_id = GetBit(tile_data_high, tile_data_bit_index) << 1 
+					| GetBit(tile_data_low, tile_data_bit_index);
+				ppu.sprite_pixel_fifo.Push(FifoPixel{ u8(col_id), sprite.palette, sprite.oam_index, sprite.obj_to_bg_priority });
+			};
+			auto num_pixels_to_insert = std::max(ppu.sprite_pixel_fifo.size, uint(pixels_to_ignore_left));
+			if (sprite.x_flip) {
+				for (int i = int(num_pixels_to_insert); i <= 7; ++i) {
+					InsertPixel(i);
+				}
+			}
+			else {
+				for (int i = 7 - int(num_pixels_to_insert); i >= 0; --i) {
+					InsertPixel(i);
+				}
+			}
+			ppu.bg_tile_fetcher.paused = ppu.pixel_shifter.paused = false;
+			this->paused = true;
+			break;
 		}
+
+		case TileFetchStep::Sleep:
+			break;
+	}
+
+	step = (step + 1) & 7;
+}
+
+
+void PPU::SpriteFetcher::Reset()
+{
+	step = 0;
+	paused = true; /* must find sprite in OAM before fetch starts */
+}
+
+
+void PPU::PixelShifter::Reset()
+{
+	pixel_x_pos = 0;
+	paused = false;
+}
+
+
+PPU::FifoPixel PPU::BgPixelFifo::Pop()
+{
+	// Pixel 0 in the tile is bit 7 of tile data. Pixel 1 is bit 6 etc..
+	u8 col_id = (plane_high >> 7) << 1 | plane_low >> 7;
+	plane_low <<= 1;
+	plane_high <<= 1;
+	size--;
+	return FifoPixel{ col_id };
+}
+
+
+void PPU::BgPixelFifo::Push(u8 tile_data_low, u8 tile_data_high, uint num_pixels)
+{
+	plane_low = tile_data_low;
+	plane_high = tile_data_high;
+	size = num_pixels;
+}
+
+
+PPU::FifoPixel PPU::SpritePixelFifo::Pop()
+{
+	FifoPixel pixel = pixels[head];
+	head = (head + 1) & 7;
+	size--;
+	return pixel;
+}
+
+
+void PPU::SpritePixelFifo::Push(FifoPixel pixel)
+{
+	pixels[(head + size) & 7] = pixel;
+	size++;
+}
+
+
+void PPU::SpriteBuffer::Push(const Sprite& sprite)
+{
+	/* OAM is scanned in order, so sprites with the same x position stay in OAM order */
+	uint i = size++;
+	for (; i > 0 && sprites[i - 1].pixel_x_pos > sprite.pixel_x_pos; --i) {
+		sprites[i] = sprites[i - 1];
 	}
+	sprites[i] = sprite;
+}
 
 
-	void BackgroundTileFetcher::Reset(bool reset_window_line_counter)
-	{
-		step = 0;
-		paused = window_reached = fetch_tile_data_high_step_reached_this_scanline = false;
-		tile_x_pos = 0;
-		if (reset_window_line_counter) {
-			window_line_counter = -1;
+std::optional<PPU::Sprite> PPU::SpriteBuffer::TakeNextSprite(PPU& ppu, uint max_pixel_x_pos)
+{
+	GB& gb = static_cast<GB&>(ppu);
+	/* The sprites yet to be fetched are sorted, so if the first one has not been reached, neither has any other */
+	if (next == size || sprites[next].pixel_x_pos > max_pixel_x_pos) {
+		return std::nullopt;
+	}
+	if (gb.System::mode == System::Mode::CGB && ppu.obj_priority_mode == ObjPriorityMode::OamIndex) {
+		/* Of the sprites that have been reached, the one first in OAM is fetched. It is moved in front of the others,
+		   so that the ones yet to be fetched stay sorted. */
+		uint candidate = next;
+		for (uint i = next + 1; i < size && sprites[i].pixel_x_pos <= max_pixel_x_pos; ++i) {
+			if (sprites[i].oam_index < sprites[candidate].oam_index) {
+				candidate = i;
+			}
 		}
+		std::rotate(sprites.begin() + next, sprites.begin() + candidate, sprites.begin() + candidate + 1);
 	}
+	return sprites[next++];
+}
 
 
-	void SpriteFetcher::Step()
-	{
-		switch (tile_fetch_state_machine[step]) {
-			case TileFetchStep::TileNum:
-				tile_num = sprite.tile_num;
-				if (sprite_height == 16)  {
-					// if 8x16 sprites are used, find if low or high tile is used for the current scanline
-					// To calculate the tile number of the top tile, the tile number in the OAM entry is used and the least significant bit is set to 0. 
-					// The tile number of the bottom tile is calculated by setting the least significant bit to 1.
-					if ((ly < sprite.pixel_y_pos - 8) ^ sprite.y_flip) {
-						tile_num &= 0xFE;
-					}
-					else {
-						tile_num |= 1;
-					}
-				}
-				break;
+void PPU::ShiftPixel()
+{
+	if (bg_pixel_fifo.IsEmpty()) {
+		return;
+	}
+	FifoPixel bg_pixel = bg_pixel_fifo.Pop();
 
-			case TileFetchStep::TileDataLow:
-				tile_addr = 0x8000 + 16 * tile_num + [&] {
-					if (sprite.y_flip) {
-						return 2 * (7 - (ly - sprite.pixel_y_pos + 16) % 8);
-					}
-					else {
-						return 2 * ((ly - sprite.pixel_y_pos + 16) % 8);
-					}
-				}();
-				tile_data_low = ReadVRAM(tile_addr);
-				break;
+	// SCX % 8 background pixels are discarded at the start of each scanline rather than being pushed to the LCD
+	if (leftmost_bg_pixels_to_discard > 0) {
+		leftmost_bg_pixels_to_discard--;
+		return;
+	}
 
-			case TileFetchStep::TileDataHigh:
-				tile_data_high = ReadVRAM(tile_addr + 1);
-				break;
+	std::optional<FifoPixel> sprite_pixel;
+	if (!sprite_pixel_fifo.IsEmpty()) {
+		sprite_pixel = sprite_pixel_fifo.Pop();
+	}
 
-			case TileFetchStep::PushTile: {
-				// Only pixels which are actually visible on the screen are loaded into the FIFO
-				// e.g., if pixel shifter xPos = 0, then a sprite with an X-value of 8 would have all 8 pixels loaded, 
-				// while a sprite with an X-value of 7 would only have the rightmost 7 pixels loaded
-				// No need to worry about pixels going off the right side of the screen, since the PPU wouldn't push these pixels anyways
-				auto pixels_to_ignore_left = std::max(0, 8 + pixel_shifter.pixel_x_pos - sprite.pixel_x_pos);
+	if (frame_is_rendered) {
+		WriteFramebufferPixel(MixPixels(bg_pixel, sprite_pixel));
+	}
+	PushPixel();
+}
 
-				if (obj_priority_mode == ObjPriorityMode::OamIndex) {
-					// TODO (CGB)
-				}
-				// Pixel 0 in the tile is bit 7 of tile data. Pixel 1 is bit 6 etc..
-				// insert as many pixels into FIFO as there are free slots
-				// if FIFO already contains n no. of pixels, insert only the last 8 - n pixels from the current sprite¨
-				auto InsertPixel = [&](int tile_data_bit_index) {
-					auto col_id = GetBit(tile_data_high, tile_data_bit_index) << 1 
-						| GetBit(tile_data_low, tile_data_bit_index);
-					sprite_pixel_fifo.emplace(col_id, sprite.palette, sprite.oam_index, sprite.obj_to_bg_priority);
-				};
-				auto num_pixels_to_insert = std::max(sprite_pixel_fifo.size(), std::size_t(pixels_to_ignore_left));
-				if (sprite.x_flip) {
-					for (int i = int(num_pixels_to_insert); i <= 7; ++i) {
-						InsertPixel(i);
-					}
-				}
-				else {
-					for (int i = 7 - int(num_pixels_to_insert); i >= 0; --i) {
-						InsertPixel(i);
-					}
-				}
-				bg_tile_fetcher.paused = pixel_shifter.paused = false;
-				this->paused = true;
-				break;
-			}
 
-			case TileFetchStep::Sleep:
-				break;
+u8 PPU::MixPixels(FifoPixel bg_pixel, std::optional<FifoPixel> sprite_pixel)
+{
+	GB& gb = static_cast<GB&>(*this);
+	if (gb.System::mode == System::Mode::DMG && !lcdc.bg_enable) {
+		bg_pixel.col_id = 0;
+	}
+	if (!sprite_pixel) {
+		return GetColourIndexFromPixel<TileType::BG>(bg_pixel);
+	}
+	if (gb.System::mode == System::Mode::DMG) {
+		if (sprite_pixel->col_id == 0 || sprite_pixel->bg_priority && bg_pixel.col_id != 0) {
+			return GetColourIndexFromPixel<TileType::BG>(bg_pixel);
+		}
+		else {
+			return GetColourIndexFromPixel<TileType::OBJ>(*sprite_pixel);
+		}
+	}
+	else { /* CGB */
+		if (lcdc.bg_enable) { /* Window Master Priority set */
+			// TODO: sprite pixel displayed even if sprite color id is 0?
+			return GetColourIndexFromPixel<TileType::OBJ>(*sprite_pixel);
+		}
+		else if (sprite_pixel->col_id == 0 || sprite_pixel->bg_priority && bg_pixel.col_id != 0) {
+			return GetColourIndexFromPixel<TileType::BG>(bg_pixel);
+		}
+		else {
+			return GetColourIndexFromPixel<TileType::OBJ>(*sprite_pixel);
 		}
+	}
+}
+
 
-		step = (step + 1) & 7;
+void PPU::PushPixel()
+{
+	if (++pixel_shifter.pixel_x_pos == resolution_x) {
+		EnterHBlank();
+	}
+	// After each pixel is shifted out, the PPU checks if it has reached the window.
+	// If it has, the background fetcher state is fully reset to step 1
+	if (!bg_tile_fetcher.window_reached) {
+		CheckIfWindowReached();
 	}
+}
 
 
-	void SpriteFetcher::Reset()
-	{
-		step = 0;
-		paused = true; /* must find sprite in OAM before fetch starts */
+void PPU::WriteFramebufferPixel(u8 colour_index)
+{
+	GB& gb = static_cast<GB&>(*this);
+	if (framebuffer_mode == FramebufferMode::Direct) {
+		WriteHostPixels({ &colour_index, 1 }, host_colours);
+	}
+	else {
+		indexed_framebuffer[framebuffer_pos] = gb.System::mode == System::Mode::DMG
+			? GetDmgShade(colour_index)
+			: colour_index;
+		framebuffer_pos++;
 	}
+}
 
 
-	void PixelShifter::Reset()
-	{
-		pixel_x_pos = 0;
-		paused = false;
+void PPU::WriteFramebufferScanline(const std::array<u8, ScanlineMixer::scanline_width>& colour_indices)
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* Like 'WriteFramebufferPixel' for each pixel */
+	if (framebuffer_mode == FramebufferMode::Direct) {
+		WriteHostPixels(colour_indices, host_colours);
+		return;
+	}
+	if (gb.System::mode == System::Mode::DMG) {
+		std::array<u8, 64> shades;
+		for (u8 colour_index : { 0, 1, 2, 3, 32, 33, 34, 35, 36, 37, 38, 39 }) {
+			shades[colour_index] = GetDmgShade(colour_index);
+		}
+		std::transform(colour_indices.begin(), colour_indices.end(), indexed_framebuffer.begin() + framebuffer_pos,
+			[&](u8 colour_index) { return shades[colour_index]; });
+	}
+	else {
+		std::copy(colour_indices.begin(), colour_indices.end(), indexed_framebuffer.begin() + framebuffer_pos);
 	}
+	framebuffer_pos += resolution_x;
+}
 
 
-	void ShiftPixel()
-	{
-		if (bg_pixel_fifo.empty()) {
-			return;
+void PPU::WriteHostPixels(std::span<const u8> colour_indices, const std::array<u32, 64>& colours)
+{
+	/* Writes the pixels at 'framebuffer_pos' onwards, with 'colours' being in the pixel format */
+	u8* out = framebuffer.data();
+	switch (pixel_format) {
+	case PixelFormat::RGB888:
+		out += 3 * framebuffer_pos;
+		for (u8 colour_index : colour_indices) {
+			u32 colour = colours[colour_index];
+			*out++ = u8(colour >> 16);
+			*out++ = u8(colour >> 8);
+			*out++ = u8(colour);
 		}
-		FifoPixel bg_pixel = bg_pixel_fifo.front();
-		bg_pixel_fifo.pop();
+		break;
 
-		// SCX % 8 background pixels are discarded at the start of each scanline rather than being pushed to the LCD
-		if (leftmost_bg_pixels_to_discard > 0) {
-			leftmost_bg_pixels_to_discard--;
-			return;
+	case PixelFormat::RGBA8888:
+	case PixelFormat::XRGB8888: {
+		u32* out_32 = reinterpret_cast<u32*>(out) + framebuffer_pos;
+		for (u8 colour_index : colour_indices) {
+			*out_32++ = colours[colour_index];
 		}
+		break;
+	}
 
-		RGB pixel = [&] {
-			if (System::mode == System::Mode::DMG && !lcdc.bg_enable) {
-				bg_pixel.col_id = 0;
-			}
-			if (sprite_pixel_fifo.empty()) {
-				return GetColourFromPixel<TileType::BG>(bg_pixel);
+	case PixelFormat::RGB565: {
+		u16* out_16 = reinterpret_cast<u16*>(out) + framebuffer_pos;
+		for (u8 colour_index : colour_indices) {
+			*out_16++ = u16(colours[colour_index]);
+		}
+		break;
+	}
+
+	default:
+		std::unreachable();
+	}
+	framebuffer_pos += uint(colour_indices.size());
+}
+
+
+void PPU::ConvertIndexedFramebuffer()
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* Applies the DMG palette, or the CGB palettes as they were when each scanline was drawn */
+	std::array<u32, 64> colours;
+	if (gb.System::mode == System::Mode::DMG) {
+		std::transform(dmg_palette.begin(), dmg_palette.end(), colours.begin(), [this](RGB rgb) { return RgbToHostPixel(rgb); });
+	}
+	framebuffer_pos = 0;
+	for (uint scanline = 0; scanline < resolution_y; ++scanline) {
+		if (gb.System::mode == System::Mode::CGB) {
+			std::transform(scanline_colours[scanline].begin(), scanline_colours[scanline].end(), colours.begin(),
+				[this](RGB rgb) { return RgbToHostPixel(rgb); });
+		}
+		WriteHostPixels({ &indexed_framebuffer[scanline * resolution_x], resolution_x }, colours);
+	}
+}
+
+
+u32 PPU::RgbToHostPixel(RGB rgb)
+{
+	switch (pixel_format) {
+	case PixelFormat::RGB888: return rgb.r << 16 | rgb.g << 8 | rgb.b;
+	case PixelFormat::RGBA8888: return u32(rgb.r << 24 | rgb.g << 16 | rgb.b << 8 | 0xFF);
+	case PixelFormat::XRGB8888: return u32(0xFF << 24 | rgb.r << 16 | rgb.g << 8 | rgb.b);
+	case PixelFormat::RGB565: return (rgb.r >> 3) << 11 | (rgb.g >> 2) << 5 | rgb.b >> 3;
+	default: std::unreachable();
+	}
+}
+
+
+void PPU::UpdateHostColours(u8 first_colour_index, uint num_colours)
+{
+	GB& gb = static_cast<GB&>(*this);
+	for (uint colour_index = first_colour_index; colour_index < first_colour_index + num_colours; ++colour_index) {
+		RGB rgb = gb.System::mode == System::Mode::DMG
+			? dmg_palette[GetDmgShade(colour_index)]
+			: GetCgbColour(colour_index);
+		host_colours[colour_index] = RgbToHostPixel(rgb);
+	}
+}
+
+
+void PPU::ScanOam()
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* This function is called once every m-cycle. It takes two t-cycles to check one oam entry. */
+	for (int i = 0; i < 2 && !sprite_buffer.IsFull(); ++i) {
+		u8 pixel_y_pos = oam[oam_addr];
+		if (ly + 16u >= pixel_y_pos && ly + 16u < pixel_y_pos + sprite_height) {
+			u8 pixel_x_pos = oam[oam_addr + 1];
+			u8 tile_num = oam[oam_addr + 2];
+			u8 attributes = oam[oam_addr + 3];
+			bool x_flip = attributes & 0x20;
+			bool y_flip = attributes & 0x40;
+			bool obj_to_bg_priority = attributes & 0x80;
+			if (gb.System::mode == System::Mode::DMG) {
+				bool palette = attributes & 0x10;
+				sprite_buffer.Push(Sprite{ tile_num, pixel_x_pos, pixel_y_pos, palette, obj_to_bg_priority, x_flip, y_flip });
 			}
 			else {
-				FifoPixel sprite_pixel = sprite_pixel_fifo.front();
-				sprite_pixel_fifo.pop();
-
-				if (System::mode == System::Mode::DMG) {
-					if (sprite_pixel.col_id == 0 || sprite_pixel.bg_priority && bg_pixel.col_id != 0) {
-						return GetColourFromPixel<TileType::BG>(bg_pixel);
-					}
-					else {
-						return GetColourFromPixel<TileType::OBJ>(sprite_pixel);
-					}
-				}
-				else { /* CGB */
-					if (lcdc.bg_enable) { /* Window Master Priority set */
-						// TODO: sprite pixel displayed even if sprite color id is 0?
-						return GetColourFromPixel<TileType::OBJ>(sprite_pixel);
-					}
-					else if (sprite_pixel.col_id == 0 || sprite_pixel.bg_priority && bg_pixel.col_id != 0) {
-						return GetColourFromPixel<TileType::BG>(bg_pixel);
-					}
-					else {
-						return GetColourFromPixel<TileType::OBJ>(sprite_pixel);
-					}
-				}
+				u8 palette = attributes & 7;
+				bool vram_bank = attributes & 8; // todo: how does this dictate which bank is used? isn't this set by writing to VBK?
+				u8 oam_index = oam_addr / 4;
+				sprite_buffer.Push(Sprite{ tile_num, pixel_x_pos, pixel_y_pos, palette, obj_to_bg_priority, x_flip, y_flip, vram_bank, oam_index });
 			}
-		}();
+		}
+		oam_addr += 4;
+	}
+}
+
 
-		PushPixel(pixel);
+void PPU::AttemptSpriteFetch()
+{
+	if (std::optional<Sprite> sprite = sprite_buffer.TakeNextSprite(*this, pixel_shifter.pixel_x_pos + 8)) {
+		sprite_fetcher.sprite = *sprite;
+		sprite_fetcher.paused = false;
+		bg_tile_fetcher.paused = pixel_shifter.paused = true;
+		bg_tile_fetcher.step = 0;
 	}
+}
 
 
-	void PushPixel(RGB pixel)
-	{
-		framebuffer[framebuffer_pos++] = pixel.r;
-		framebuffer[framebuffer_pos++] = pixel.g;
-		framebuffer[framebuffer_pos++] = pixel.b;
-		if (++pixel_shifter.pixel_x_pos == resolution_x) {
-			EnterHBlank();
-		}
-		// After each pixel is shifted out, the PPU checks if it has reached the window.
-		// If it has, the background fetcher state is fully reset to step 1
-		if (!bg_tile_fetcher.window_reached) {
-			CheckIfWindowReached();
+void PPU::ClearFifos()
+{
+	bg_pixel_fifo.Clear();
+	sprite_pixel_fifo.Clear();
+}
+
+
+void PPU::UpdatePixelFetchers()
+{
+	if (pixel_shifter.pixel_x_pos >= resolution_x) {
+		return;
+	}
+	if (lcdc.obj_enable) {
+		AttemptSpriteFetch();
+		if (!sprite_fetcher.paused) {
+			sprite_fetcher.Step(*this);
 		}
 	}
+	if (!bg_tile_fetcher.paused) {
+		bg_tile_fetcher.Step(*this);
+	}
+	if (!pixel_shifter.paused) {
+		ShiftPixel();
+	}
+}
 
 
-	void ScanOam()
-	{
-		/* This function is called once every m-cycle. It takes two t-cycles to check one oam entry. */
-		for (int i = 0; i < 2 && sprite_buffer.size() < sprite_buffer_capacity; ++i) {
-			u8 pixel_y_pos = oam[oam_addr];
-			if (ly + 16u >= pixel_y_pos && ly + 16u < pixel_y_pos + sprite_height) {
-				u8 pixel_x_pos = oam[oam_addr + 1];
-				u8 tile_num = oam[oam_addr + 2];
-				u8 attributes = oam[oam_addr + 3];
-				bool x_flip = attributes & 0x20;
-				bool y_flip = attributes & 0x40;
-				bool obj_to_bg_priority = attributes & 0x80;
-				if (System::mode == System::Mode::DMG) {
-					bool palette = attributes & 0x10;
-					sprite_buffer.emplace_back(tile_num, pixel_x_pos, pixel_y_pos, palette, obj_to_bg_priority, x_flip, y_flip);
-				}
-				else {
-					u8 palette = attributes & 7;
-					bool vram_bank = attributes & 8; // todo: how does this dictate which bank is used? isn't this set by writing to VBK?
-					u8 oam_index = oam_addr / 4;
-					sprite_buffer.emplace_back(tile_num, pixel_x_pos, pixel_y_pos, palette, obj_to_bg_priority, x_flip, y_flip, vram_bank, oam_index);
-				}
-			}
-			oam_addr += 4;
-		}
+void PPU::CheckIfWindowReached()
+{
+	// After each pixel is shifted out, the PPU checks if it has reached the window.
+	// If all of the below conditions apply, window fetching starts.
+	if (lcdc.window_enable && lcdc.bg_enable && wy_equalled_ly_this_frame && pixel_shifter.pixel_x_pos >= wx - 7) {
+		bg_tile_fetcher.step = 0;
+		bg_tile_fetcher.tile_x_pos = 0;
+		bg_tile_fetcher.window_reached = true;
+		bg_pixel_fifo.Clear();
+		bg_tile_fetcher.window_line_counter++;
 	}
+}
 
 
-	void AttemptSpriteFetch()
-	{
-		auto candidate = sprite_buffer.end();
+bool PPU::SimulatePixelTransfer()
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* Runs the state machine of 'UpdatePixelFetchers' for the scanline, but without any background pixel data,
+	   to find out after how many steps HBlank is entered, and from which pixel the window is shown. Sprites are
+	   fetched like in 'SpriteFetcher::Step', and their pixels are stored at the positions at which they would be
+	   shifted out. The PPU state is left untouched. Returns false if the scanline cannot be rendered in one pass. */
+	if (pixel_shifter.pixel_x_pos != 0 || bg_tile_fetcher.window_reached || bg_tile_fetcher.tile_x_pos != 0
+		|| bg_tile_fetcher.step != 0 || !sprite_fetcher.paused) { /* the fetchers may hold tile data read before a register write */
+		return false;
+	}
+	uint max_dots = 4 * (m_cycles_per_scanline - 20) * std::to_underlying(gb.System::speed);
+
+	SpriteBuffer sprites = sprite_buffer;
+	Sprite sprite = sprite_fetcher.sprite;
+	bool sprite_fetcher_paused = sprite_fetcher.paused;
+	uint sprite_fetcher_step = sprite_fetcher.step;
+	uint sprite_fifo_size = 0;
+	u8 sprite_tile_num = sprite_fetcher.tile_num;
+	u16 sprite_tile_addr = sprite_fetcher.tile_addr;
+
+	bool bg_fetcher_paused = bg_tile_fetcher.paused;
+	bool fetch_tile_data_high_step_reached = bg_tile_fetcher.fetch_tile_data_high_step_reached_this_scanline;
+	uint bg_fetcher_step = bg_tile_fetcher.step;
+	uint bg_fifo_size = 0;
+
+	bool pixel_shifter_paused = pixel_shifter.paused;
+	uint pixels_to_discard = leftmost_bg_pixels_to_discard;
+	uint x = 0;
+
+	scanline_layers.obj_present.fill(0);
+	scanline_window_x = std::numeric_limits<uint>::max();
+
+	for (uint dot = 1; dot <= max_dots; ++dot) {
+		if (lcdc.obj_enable) {
+			/* AttemptSpriteFetch */
+			if (std::optional<Sprite> next_sprite = sprites.TakeNextSprite(*this, x + 8)) {
+				sprite = *next_sprite;
+				sprite_fetcher_paused = false;
+				bg_fetcher_paused = pixel_shifter_paused = true;
+				bg_fetcher_step = 0;
+			}
+			/* SpriteFetcher::Step */
+			if (!sprite_fetcher_paused) {
+				switch (tile_fetch_state_machine[sprite_fetcher_step]) {
+				case TileFetchStep::TileNum:
+					sprite_tile_num = sprite.tile_num;
+					if (sprite_height == 16) {
+						if ((ly < sprite.pixel_y_pos - 8) ^ sprite.y_flip) {
+							sprite_tile_num &= 0xFE;
+						}
+						else {
+							sprite_tile_num |= 1;
+						}
+					}
+					break;
 
-		if (System::mode == System::Mode::DMG || obj_priority_mode == ObjPriorityMode::Coordinate) {
-			for (auto it = sprite_buffer.begin(); it != sprite_buffer.end(); ++it) {
-				if (it->pixel_x_pos <= pixel_shifter.pixel_x_pos + 8 && 
-					(candidate == sprite_buffer.end() || it->pixel_x_pos < candidate->pixel_x_pos)) {
-					candidate = it;
+				case TileFetchStep::TileDataLow:
+					sprite_tile_addr = 0x8000 + 16 * sprite_tile_num + 2 * (sprite.y_flip
+						? 7 - (ly - sprite.pixel_y_pos + 16) % 8
+						: (ly - sprite.pixel_y_pos + 16) % 8);
+					break;
+
+				case TileFetchStep::TileDataHigh:
+					break;
+
+				case TileFetchStep::PushTile: {
+					/* The n:th pixel in the sprite FIFO is shifted out together with the n:th next background pixel */
+					uint pixels_to_ignore_left = uint(std::max(0, 8 + int(x) - sprite.pixel_x_pos));
+					uint first_pixel = std::max(sprite_fifo_size, pixels_to_ignore_left);
+					if (frame_is_rendered) { /* the pixels themselves are not needed on skipped frames */
+						DecodedTileRow tile_row = GetDecodedTileRow(sprite_tile_addr);
+						u16 col_ids = sprite.x_flip ? tile_row.col_ids_x_flipped : tile_row.col_ids;
+						u8 colour_index = ScanlineMixer::first_obj_colour_index
+							+ 4 * (gb.System::mode == System::Mode::DMG ? sprite.palette & 1 : sprite.palette);
+						for (uint i = first_pixel; i <= 7; ++i) {
+							u8 col_id = col_ids >> (14 - 2 * i) & 3;
+							uint pixel_x_pos = x + sprite_fifo_size + i - first_pixel;
+							if (pixel_x_pos < resolution_x) {
+								scanline_layers.obj_col_ids[pixel_x_pos] = col_id;
+								scanline_layers.obj_colour_indices[pixel_x_pos] = colour_index;
+								scanline_layers.obj_present[pixel_x_pos] = 0xFF;
+								scanline_layers.obj_bg_priority[pixel_x_pos] = sprite.obj_to_bg_priority ? 0xFF : 0;
+							}
+							else {
+								leftover_sprite_pixels[pixel_x_pos - resolution_x] =
+									FifoPixel{ col_id, sprite.palette, sprite.oam_index, sprite.obj_to_bg_priority };
+							}
+						}
+					}
+					sprite_fifo_size += 8 - std::min(first_pixel, 8u);
+					bg_fetcher_paused = pixel_shifter_paused = false;
+					sprite_fetcher_paused = true;
+					break;
 				}
-			}
-		}
-		else { /* Oam index priority mode */
-			for (auto it = sprite_buffer.begin(); it != sprite_buffer.end(); ++it) {
-				if (it->pixel_x_pos <= pixel_shifter.pixel_x_pos + 8) {
-					candidate = it;
+
+				case TileFetchStep::Sleep:
 					break;
 				}
+				sprite_fetcher_step = (sprite_fetcher_step + 1) & 7;
 			}
 		}
+		/* BackgroundTileFetcher::Step */
+		if (!bg_fetcher_paused) {
+			switch (tile_fetch_state_machine[bg_fetcher_step]) {
+			case TileFetchStep::TileDataHigh:
+				if (fetch_tile_data_high_step_reached) {
+					bg_fetcher_step = (bg_fetcher_step + 1) & 7;
+				}
+				else {
+					fetch_tile_data_high_step_reached = true;
+					bg_fetcher_step = 0;
+				}
+				break;
+
+			case TileFetchStep::PushTile:
+				if (bg_fifo_size == 0) {
+					bg_fifo_size = 8;
+					bg_fetcher_step = (bg_fetcher_step + 1) & 7;
+				}
+				break;
 
-		if (candidate != sprite_buffer.end()) {
-			sprite_fetcher.sprite = *candidate;
-			sprite_buffer.erase(candidate);
-			sprite_fetcher.paused = false;
-			bg_tile_fetcher.paused = pixel_shifter.paused = true;
-			bg_tile_fetcher.step = 0;
+			default:
+				bg_fetcher_step = (bg_fetcher_step + 1) & 7;
+				break;
+			}
+		}
+		/* ShiftPixel */
+		if (!pixel_shifter_paused && bg_fifo_size > 0) {
+			--bg_fifo_size;
+			if (pixels_to_discard > 0) {
+				--pixels_to_discard;
+				continue;
+			}
+			if (sprite_fifo_size > 0) {
+				--sprite_fifo_size;
+			}
+			++x;
+			/* CheckIfWindowReached */
+			if (scanline_window_x == std::numeric_limits<uint>::max() && lcdc.window_enable && lcdc.bg_enable
+				&& wy_equalled_ly_this_frame && int(x) >= wx - 7) {
+				scanline_window_x = x;
+				bg_fetcher_step = 0;
+				bg_fifo_size = 0;
+			}
+			if (x == resolution_x) {
+				pixel_transfer_length = dot;
+				num_leftover_bg_fifo_pixels = bg_fifo_size;
+				num_leftover_sprite_fifo_pixels = sprite_fifo_size;
+				return true;
+			}
 		}
 	}
+	return false; /* HBlank would not be reached before the end of the scanline */
+}
 
 
-	void ClearFifos()
-	{
-		while (!bg_pixel_fifo.empty()) {
-			bg_pixel_fifo.pop();
+void PPU::RenderScanline()
+{
+	/* Renders the whole scanline at the step where the pixel FIFOs would have shifted out its last pixel.
+	   The pixels that would have been left in the FIFOs are put there; they are normally cleared when the next
+	   pixel transfer starts, but not if it is skipped over through a speed switch. On skipped frames, the pixels are
+	   not decoded (neither are 'leftover_sprite_pixels' filled in), so blank ones are put there instead. */
+	scanline_renderer_active = false;
+	if (scanline_window_x != std::numeric_limits<uint>::max()) {
+		bg_tile_fetcher.window_reached = true;
+		bg_tile_fetcher.window_line_counter++;
+	}
+	if (frame_is_rendered) {
+		DrawScanline();
+		for (uint i = 0; i < num_leftover_sprite_fifo_pixels; ++i) {
+			sprite_pixel_fifo.Push(leftover_sprite_pixels[i]);
 		}
-		while (!sprite_pixel_fifo.empty()) {
-			sprite_pixel_fifo.pop();
+	}
+	else {
+		bg_pixel_fifo.Push(0, 0, num_leftover_bg_fifo_pixels);
+		for (uint i = 0; i < num_leftover_sprite_fifo_pixels; ++i) {
+			sprite_pixel_fifo.Push(FifoPixel{});
 		}
 	}
+	pixel_shifter.pixel_x_pos = resolution_x;
+	EnterHBlank();
+}
 
 
-	void UpdatePixelFetchers()
-	{
-		if (pixel_shifter.pixel_x_pos >= resolution_x) {
-			return;
-		}
-		if (lcdc.obj_enable) {
-			AttemptSpriteFetch();
-			if (!sprite_fetcher.paused) {
-				sprite_fetcher.Step();
-			}
+void PPU::DrawScanline()
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* The background and window are drawn a tile at a time; the sprite pixels were placed by 'SimulatePixelTransfer'.
+	   The two are then mixed for the whole scanline at once. */
+	uint num_bg_pixels = resolution_x + num_leftover_bg_fifo_pixels;
+	std::array<u8, resolution_x + 8> bg_col_ids;
+	for (uint x = 0; x < num_bg_pixels; ) {
+		bool window = x >= scanline_window_x;
+		uint tile_pixel_index = window ? x - scanline_window_x : x + leftmost_bg_pixels_to_discard;
+		u8 tile_x_pos = tile_pixel_index / 8 & 0x1F;
+		u16 tile_num_addr;
+		int tile_row_index;
+		if (window) {
+			u8 tile_row = bg_tile_fetcher.window_line_counter / 8;
+			tile_num_addr = window_tile_map_base_addr + ((32 * tile_row + tile_x_pos) & 0x3FF);
+			tile_row_index = bg_tile_fetcher.window_line_counter % 8;
 		}
-		if (!bg_tile_fetcher.paused) {
-			bg_tile_fetcher.Step();
+		else {
+			u8 tile_col = (tile_x_pos + scx / 8) & 0x1F;
+			u8 tile_row = ((ly + scy) & 0xFF) / 8;
+			tile_num_addr = bg_tile_map_base_addr + ((32 * tile_row + tile_col) & 0x3FF);
+			tile_row_index = (ly + scy) % 8;
 		}
-		if (!pixel_shifter.paused) {
-			ShiftPixel();
+		s16 tile_num = tile_nums_are_signed ? (s8)ReadVRAM(tile_num_addr) : ReadVRAM(tile_num_addr);
+		u16 col_ids = GetDecodedTileRow(tile_data_base_addr + 16 * tile_num + 2 * tile_row_index).col_ids;
+		uint area_end = window ? num_bg_pixels : std::min(scanline_window_x, num_bg_pixels);
+		uint tile_end = std::min(area_end, x + 8 - tile_pixel_index % 8);
+		for (uint i = tile_pixel_index % 8; x < tile_end; ++x, ++i) {
+			bg_col_ids[x] = col_ids >> (14 - 2 * i) & 3;
 		}
 	}
 
-
-	void CheckIfWindowReached()
-	{
-		// After each pixel is shifted out, the PPU checks if it has reached the window.
-		// If all of the below conditions apply, window fetching starts.
-		if (lcdc.window_enable && lcdc.bg_enable && wy_equalled_ly_this_frame && pixel_shifter.pixel_x_pos >= wx - 7) {
-			bg_tile_fetcher.step = 0;
-			bg_tile_fetcher.tile_x_pos = 0;
-			bg_tile_fetcher.window_reached = true;
-			while (!bg_pixel_fifo.empty()) {
-				bg_pixel_fifo.pop();
-			}
-			bg_tile_fetcher.window_line_counter++;
-		}
+	std::copy_n(bg_col_ids.begin(), resolution_x, scanline_layers.bg_col_ids.begin());
+	ScanlineMixer::Rules rules = {
+		.bg_disabled = gb.System::mode == System::Mode::DMG && !lcdc.bg_enable,
+		.obj_always_shown = gb.System::mode == System::Mode::CGB && lcdc.bg_enable
+	};
+	std::array<u8, resolution_x> colour_indices;
+	ScanlineMixer::MixScanline(scanline_layers, rules, colour_indices);
+	WriteFramebufferScanline(colour_indices);
+	u8 leftover_plane_low = 0, leftover_plane_high = 0;
+	for (uint x = resolution_x; x < num_bg_pixels; ++x) {
+		leftover_plane_low |= (bg_col_ids[x] & 1) << (7 - (x - resolution_x));
+		leftover_plane_high |= (bg_col_ids[x] >> 1) << (7 - (x - resolution_x));
 	}
+	bg_pixel_fifo.Push(leftover_plane_low, leftover_plane_high, num_leftover_bg_fifo_pixels);
+}
 
 
-	void PrepareForNewScanline()
-	{
-		bg_tile_fetcher.Reset(false);
-		sprite_fetcher.Reset();
-		pixel_shifter.Reset();
-		sprite_buffer.clear();
-		oam_addr = 0;
-		// SCX % 8 bg pixels are discarded at the start of each scanline rather than being pushed to the LCD
-		leftmost_bg_pixels_to_discard = scx % 8;
-		SetLcdMode(LcdMode::SearchOam);
+void PPU::PrepareForNewScanline()
+{
+	if (scanline_renderer_active) { /* the scanline ended before the pixel transfer did, e.g. after a speed switch */
+		FallBackToPixelFifo();
 	}
+	bg_tile_fetcher.Reset(false);
+	sprite_fetcher.Reset();
+	pixel_shifter.Reset();
+	sprite_buffer.Clear();
+	oam_addr = 0;
+	// SCX % 8 bg pixels are discarded at the start of each scanline rather than being pushed to the LCD
+	leftmost_bg_pixels_to_discard = scx % 8;
+	SetLcdMode(LcdMode::SearchOam);
+}
 
 
-	void PrepareForNewFrame()
-	{
-		wy_equalled_ly_this_frame = ly == wy;
-		framebuffer_pos = 0;
-	}
+void PPU::PrepareForNewFrame()
+{
+	wy_equalled_ly_this_frame = ly == wy;
+	framebuffer_pos = 0;
+	frame_is_rendered = frame_render_interval != 0 && ++frame_counter % frame_render_interval == 0;
+}
 
 
-	void StreamState(SerializationStream& stream)
-	{
-		/* TODO */
-	}
+void PPU::StreamState(SerializationStream& stream)
+{
+	/* The settings of the frontend (DMG palette, pixel and framebuffer format, frame skip, video output) are not part
+	   of the state. The framebuffer is, as a state may be saved in the middle of a frame. */
+	stream.StreamPrimitive(obj_priority_mode);
+	stream.StreamPrimitive(bg_tile_fetcher);
+	stream.StreamPrimitive(pixel_shifter);
+	stream.StreamPrimitive(bg_pixel_fifo);
+	stream.StreamPrimitive(sprite_pixel_fifo);
+	stream.StreamPrimitive(sprite_buffer);
+	stream.StreamPrimitive(sprite_fetcher);
+	stream.StreamPrimitive(frame_is_rendered);
+	stream.StreamPrimitive(scanline_renderer_active);
+	stream.StreamPrimitive(stat_interrupt_cond);
+	stream.StreamPrimitive(tile_nums_are_signed);
+	stream.StreamPrimitive(wy_equalled_ly_this_frame);
+	stream.StreamPrimitive(current_vram_bank);
+	stream.StreamPrimitive(frame_counter);
+	stream.StreamPrimitive(framebuffer_pos);
+	stream.StreamPrimitive(leftmost_bg_pixels_to_discard);
+	stream.StreamPrimitive(m_cycle_counter);
+	stream.StreamPrimitive(num_leftover_bg_fifo_pixels);
+	stream.StreamPrimitive(num_leftover_sprite_fifo_pixels);
+	stream.StreamPrimitive(oam_addr);
+	stream.StreamPrimitive(pixel_transfer_dots);
+	stream.StreamPrimitive(pixel_transfer_length);
+	stream.StreamPrimitive(scanline_window_x);
+	stream.StreamPrimitive(sprite_height);
+	/* Streamed along with the scheduler's time, so that the catch-up after a load starts from where it was saved */
+	stream.StreamPrimitive(time_synced);
+	stream.StreamPrimitive(bgp);
+	stream.StreamPrimitive(ly);
+	stream.StreamPrimitive(lyc);
+	stream.StreamPrimitive(scx);
+	stream.StreamPrimitive(scy);
+	stream.StreamPrimitive(wx);
+	stream.StreamPrimitive(wy);
+	stream.StreamPrimitive(bcps);
+	stream.StreamPrimitive(ocps);
+	stream.StreamPrimitive(lcdc);
+	stream.StreamPrimitive(stat);
+	stream.StreamPrimitive(bg_tile_map_base_addr);
+	stream.StreamPrimitive(tile_data_base_addr);
+	stream.StreamPrimitive(window_tile_map_base_addr);
+	stream.StreamArray(framebuffer);
+	stream.StreamArray(indexed_framebuffer);
+	stream.StreamArray(scanline_colours);
+	stream.StreamArray(obp_dmg);
+	stream.StreamArray(vram);
+	stream.StreamArray(oam);
+	stream.StreamArray(bg_palette_ram);
+	stream.StreamArray(obj_palette_ram);
+	stream.StreamArray(cgb_bg_palette);
+	stream.StreamArray(cgb_obj_palette);
+	stream.StreamPrimitive(scanline_layers);
+	stream.StreamArray(leftover_sprite_pixels);
+	/* Derived from the above */
+	decoded_tile_is_stale.fill(true);
+	UpdateHostColours(0, 64);
 }
\ No newline at end of file
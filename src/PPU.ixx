@@ -1,68 +1,100 @@
 export module PPU;
 
+import PPU.ScanlineMixer;
+import Scheduler;
 import Util;
+import Video;
 
 import <algorithm>;
 import <array>;
 import <bit>;
-import <queue>;
+import <limits>;
+import <optional>;
+import <span>;
 import <utility>;
-import <vector>;
 
-namespace PPU
+export struct PPU
 {
-	export
+	struct RGB
 	{
-		struct RGB
-		{
-			u8 r, g, b;
-		};
-
-		using DmgPalette = std::array<RGB, 4>;
-
-		void Initialize(bool hle_boot_rom);
-		u8 ReadBCPD();
-		u8 ReadBCPS();
-		u8 ReadBGP();
-		u8 ReadLCDC();
-		u8 ReadLY();
-		u8 ReadLYC();
-		u8 ReadOamCpu(u16 addr); // TODO: impl
-		u8 ReadOBP0();
-		u8 ReadOBP1();
-		u8 ReadOCPD();
-		u8 ReadOCPS();
-		u8 ReadOPRI();
-		u8 ReadSCX();
-		u8 ReadSCY();
-		u8 ReadSTAT();
-		u8 ReadVBK();
-		u8 ReadVramCpu(u16 addr);
-		u8 ReadWY();
-		u8 ReadWX();
-		void SetDmgPalette(DmgPalette palette);
-		void StreamState(SerializationStream& stream);
-		void Update();
-		void WriteBCPD(u8 data);
-		void WriteBCPS(u8 data);
-		void WriteBGP(u8 data);
-		void WriteLCDC(u8 data);
-		void WriteLY(u8 data);
-		void WriteLYC(u8 data);
-		void WriteOamCpu(u16 addr, u8 data);
-		void WriteOBP0(u8 data);
-		void WriteOBP1(u8 data);
-		void WriteOCPD(u8 data);
-		void WriteOCPS(u8 data);
-		void WriteOPRI(u8 data);
-		void WriteSCX(u8 data);
-		void WriteSCY(u8 data);
-		void WriteSTAT(u8 data);
-		void WriteVBK(u8 data);
-		void WriteVramCpu(u16 addr, u8 data);
-		void WriteWX(u8 data);
-		void WriteWY(u8 data);
-	}
+		u8 r, g, b;
+	};
+
+	using DmgPalette = std::array<RGB, 4>;
+
+	enum class FramebufferMode {
+		Direct, /* pixels are written in the pixel format as they are shifted out */
+		Indexed, /* colour indices are written, and are converted to the pixel format once the frame is complete */
+		IndexedOnly /* colour indices are written, and are not converted; for frontends that only need the indices */
+	};
+
+	/* The 32-bit and 16-bit formats are written as native-endian words, so that each pixel is a single store */
+	enum class PixelFormat {
+		RGB888, /* three bytes per pixel: red, green, blue */
+		RGBA8888, /* red in the most significant byte, and alpha (always 0xFF) in the least significant byte */
+		XRGB8888, /* the most significant byte is unused (always 0xFF), and blue is in the least significant byte */
+		RGB565 /* five bits of red in the most significant bits, six bits of green, and five bits of blue */
+	};
+
+	/* DMG: the shade (0-3) of each pixel. CGB: the index of each pixel's colour among the colours of its scanline;
+	   0-31 are the background colours (four per palette), and 32-63 the sprite colours. */
+	std::span<const u8> GetIndexedFramebuffer();
+	/* CGB: the colours of the scanline as they were when it was drawn, in the indexed framebuffer modes */
+	std::span<const RGB, 64> GetScanlineColours(uint scanline);
+	void Initialize(bool hle_boot_rom);
+	u8 ReadBCPD();
+	u8 ReadBCPS();
+	u8 ReadBGP();
+	u8 ReadLCDC();
+	u8 ReadLY();
+	u8 ReadLYC();
+	u8 ReadOamCpu(u16 addr); // TODO: impl
+	u8 ReadOBP0();
+	u8 ReadOBP1();
+	u8 ReadOCPD();
+	u8 ReadOCPS();
+	u8 ReadOPRI();
+	u8 ReadSCX();
+	u8 ReadSCY();
+	u8 ReadSTAT();
+	u8 ReadVBK();
+	u8 ReadVramCpu(u16 addr);
+	u8 ReadWY();
+	u8 ReadWX();
+	void ScheduleNextEvent();
+	void SetDmgPalette(DmgPalette palette);
+	void SetFramebufferMode(FramebufferMode mode);
+	/* Only every n:th frame is drawn; 1 draws every frame, and 0 none. The framebuffer keeps the last drawn frame.
+	   The PPU timing, and so everything the CPU can observe, is the same for drawn and skipped frames. */
+	void SetFrameSkip(uint render_every_nth_frame);
+	void SetPixelFormat(PixelFormat format);
+	/* If disabled, the frontend is not told of the framebuffer or of new frames, so that instances can run headless
+	   on threads other than the frontend's. The framebuffer is still written to. */
+	void SetVideoOutputEnabled(bool enabled);
+	void StreamState(SerializationStream& stream);
+	void Sync();
+	void WriteBCPD(u8 data);
+	void WriteBCPS(u8 data);
+	void WriteBGP(u8 data);
+	void WriteLCDC(u8 data);
+	void WriteLY(u8 data);
+	void WriteLYC(u8 data);
+	void WriteOamCpu(u16 addr, u8 data);
+	void WriteOBP0(u8 data);
+	void WriteOBP1(u8 data);
+	void WriteOCPD(u8 data);
+	void WriteOCPS(u8 data);
+	void WriteOPRI(u8 data);
+	void WriteSCX(u8 data);
+	void WriteSCY(u8 data);
+	void WriteSTAT(u8 data);
+	void WriteVBK(u8 data);
+	void WriteVramCpu(u16 addr, u8 data);
+	void WriteWX(u8 data);
+	void WriteWY(u8 data);
+
+private:
+	friend struct Scheduler; /* runs the event handler */
 
 	enum class LcdMode : u8 {
 		HBlank, VBlank, SearchOam, DriverTransfer
@@ -80,7 +112,7 @@ namespace PPU
 		BG, OBJ
 	};
 
-	constexpr std::array tile_fetch_state_machine = {
+	static constexpr std::array tile_fetch_state_machine = {
 		TileFetchStep::Sleep, TileFetchStep::TileNum,
 		TileFetchStep::Sleep, TileFetchStep::TileDataLow,
 		TileFetchStep::Sleep, TileFetchStep::TileDataHigh,
@@ -90,7 +122,7 @@ namespace PPU
 	struct BackgroundTileFetcher // note: also includes window tiles
 	{
 		void Reset(bool reset_window_line_counter);
-		void Step();
+		void Step(PPU& ppu);
 
 		bool fetch_tile_data_high_step_reached_this_scanline;
 		bool paused;
@@ -102,7 +134,7 @@ namespace PPU
 		u8 tile_data_low, tile_data_high;
 		u16 tile_data_addr;
 		s16 tile_num;
-	} bg_tile_fetcher;
+	} bg_tile_fetcher{};
 
 	// either DMG or CGB
 	struct FifoPixel
@@ -117,13 +149,46 @@ namespace PPU
 		// OAM pixels on CGB: all arguments
 	};
 
+	/* The colour ids of the eight pixels of a tile row, two bits each, with the leftmost pixel in the top bits */
+	struct DecodedTileRow
+	{
+		u16 col_ids;
+		u16 col_ids_x_flipped;
+	};
+
 	struct PixelShifter
 	{
 		void Reset();
 
 		u8 pixel_x_pos = 0;
 		bool paused = false;
-	} pixel_shifter;
+	} pixel_shifter{};
+
+	/* Background pixels are only pushed a whole tile at a time, when the FIFO is empty, and only their colour ids are used.
+	   The FIFO is kept like on hardware: as two shift registers holding the bit planes of the tile data, with the next
+	   pixel to be shifted out in bit 7. */
+	struct BgPixelFifo
+	{
+		void Clear() { size = 0; }
+		bool IsEmpty() const { return size == 0; }
+		FifoPixel Pop();
+		void Push(u8 tile_data_low, u8 tile_data_high, uint num_pixels = 8); // the pixels are taken from the top bits
+
+		u8 plane_low, plane_high;
+		uint size = 0;
+	} bg_pixel_fifo{};
+
+	/* A sprite fetch only fills the slots not taken by the pixels of earlier sprites, so at most eight pixels are held */
+	struct SpritePixelFifo
+	{
+		void Clear() { size = 0; }
+		bool IsEmpty() const { return size == 0; }
+		FifoPixel Pop();
+		void Push(FifoPixel pixel);
+
+		std::array<FifoPixel, 8> pixels;
+		uint head = 0, size = 0;
+	} sprite_pixel_fifo{};
 
 	// either DMG or CGB
 	struct Sprite
@@ -144,10 +209,24 @@ namespace PPU
 		u8 oam_index; /* cgb */
 	};
 
+	/* The sprites found on the scanline by the OAM scan, kept sorted by x position so that whether the next sprite
+	   is to be fetched takes a single comparison. Fetched sprites are stepped over rather than erased. */
+	struct SpriteBuffer
+	{
+		void Clear() { size = next = 0; }
+		bool IsFull() const { return size == capacity; }
+		void Push(const Sprite& sprite);
+		std::optional<Sprite> TakeNextSprite(PPU& ppu, uint max_pixel_x_pos); // the next sprite to fetch, if it has been reached
+
+		static constexpr uint capacity = 10;
+		std::array<Sprite, capacity> sprites;
+		uint size = 0, next = 0;
+	} sprite_buffer{};
+
 	struct SpriteFetcher
 	{
 		void Reset();
-		void Step();
+		void Step(PPU& ppu);
 
 		bool paused; // == true even if it is looking for sprites in OAM
 		uint step;
@@ -155,47 +234,83 @@ namespace PPU
 
 		u8 tile_data_low, tile_data_high, tile_num;
 		u16 tile_addr;
-	} sprite_fetcher;
+	} sprite_fetcher{};
 
 	template<TileType>
-	RGB GetColourFromPixel(FifoPixel pixel);
+	u8 GetColourIndexFromPixel(FifoPixel pixel);
 
 	void AttemptSpriteFetch();
+	void CatchUp(u64 time);
 	RGB CgbColorDataToRGB(u16 color_data);
 	void CheckIfWindowReached();
 	void CheckStatInterrupt();
 	void ClearFifos();
+	void ConvertIndexedFramebuffer();
+	void DrawScanline();
 	void EnterHBlank();
 	void EnterVBlank();
+	void FallBackToPixelFifo();
+	RGB GetCgbColour(u8 colour_index);
+	DecodedTileRow GetDecodedTileRow(u16 addr);
+	u8 GetDmgShade(u8 colour_index);
+	uint GetIdleMCycles();
+	Video::PixelFormat GetVideoPixelFormat();
+	u8 MixPixels(FifoPixel bg_pixel, std::optional<FifoPixel> sprite_pixel);
+	void OnEvent();
 	void PrepareForNewFrame();
 	void PrepareForNewScanline();
-	void PushPixel(RGB rgb);
+	void PushPixel();
 	void ReadLcdcFlags();
 	u8 ReadVRAM(u16 addr);
+	void RenderScanline();
+	u32 RgbToHostPixel(RGB rgb);
 	void ScanOam();
 	void SetLcdMode(LcdMode mode);
 	void ShiftPixel();
+	bool SimulatePixelTransfer();
+	void SyncBeforeRegisterWrite();
+	void Update();
+	void UpdateHostColours(u8 first_colour_index, uint num_colours);
 	void UpdatePixelFetchers();
-
-	constexpr uint resolution_x = 160;
-	constexpr uint resolution_y = 144;
-	constexpr uint num_colour_channels = 3;
-	constexpr uint framebuffer_size = resolution_x * resolution_y * num_colour_channels;
-	constexpr uint m_cycles_per_scanline = 144;
-	constexpr uint sprite_buffer_capacity = 10;
-	constexpr uint vram_bank_size = 0x2000;
-
+	void WriteFramebufferPixel(u8 colour_index);
+	void WriteFramebufferScanline(const std::array<u8, ScanlineMixer::scanline_width>& colour_indices);
+	void WriteHostPixels(std::span<const u8> colour_indices, const std::array<u32, 64>& colours);
+
+	static constexpr uint resolution_x = 160;
+	static constexpr uint resolution_y = 144;
+	static constexpr uint max_bytes_per_pixel = 4;
+	static constexpr uint framebuffer_size = resolution_x * resolution_y * max_bytes_per_pixel;
+	static constexpr uint m_cycles_per_scanline = 144;
+	static constexpr uint tile_data_size = 0x1800; /* per VRAM bank; the tile maps follow */
+	static constexpr uint num_tiles_per_vram_bank = tile_data_size / 16;
+	static constexpr uint vram_bank_size = 0x2000;
+
+	bool frame_is_rendered; /* if not, the pixels are not fetched, mixed or written; see 'SetFrameSkip' */
+	/* Set from the start of the pixel transfer until HBlank, if the scanline is to be rendered in one pass rather
+	   than through the pixel FIFOs. Falls back to the FIFOs if a register affecting the rendering is written to. */
+	bool scanline_renderer_active;
 	bool stat_interrupt_cond = false;
 	bool tile_nums_are_signed = false;
+	bool video_output_enabled = true;
 	bool wy_equalled_ly_this_frame;
 
 	uint current_vram_bank;
-	uint framebuffer_pos;
+	uint frame_counter;
+	uint frame_render_interval = 1;
+	uint framebuffer_pos; /* in pixels */
 	uint leftmost_bg_pixels_to_discard;
 	uint m_cycle_counter;
+	uint num_leftover_bg_fifo_pixels; /* pixels left in the FIFOs when the scanline renderer enters HBlank */
+	uint num_leftover_sprite_fifo_pixels;
 	uint oam_addr;
+	uint pixel_transfer_dots; /* number of calls to 'UpdatePixelFetchers' that the scanline renderer has stood in for */
+	uint pixel_transfer_length; /* number of such calls after which HBlank is entered */
+	uint scanline_window_x; /* pixel from which the window is shown, or the max uint value if it is not reached */
 	uint sprite_height;
 
+	/* The PPU is stepped lazily; this is the last m-cycle (scheduler time) that it has been stepped for. */
+	u64 time_synced;
+
 	/* registers */
 	u8 bgp;
 	u8 ly;
@@ -238,10 +353,17 @@ namespace PPU
 	u16 window_tile_map_base_addr;
 
 	DmgPalette dmg_palette;
+	FramebufferMode framebuffer_mode = FramebufferMode::Direct;
+	PixelFormat pixel_format = PixelFormat::RGB888;
 
-	std::array<u8, framebuffer_size> framebuffer;
+	alignas(max_bytes_per_pixel) std::array<u8, framebuffer_size> framebuffer;
+	std::array<u8, resolution_x * resolution_y> indexed_framebuffer;
+	std::array<std::array<RGB, 64>, resolution_y> scanline_colours; /* cgb; snapshots of the palettes at each HBlank */
 	std::array<u8, 2> obp_dmg; // OBP0 and OBP1
 	std::array<u8, 0x4000> vram;
+	/* Tile data of both VRAM banks, decoded on first use after having been written to */
+	std::array<std::array<DecodedTileRow, 8>, 2 * num_tiles_per_vram_bank> decoded_tiles;
+	std::array<bool, 2 * num_tiles_per_vram_bank> decoded_tile_is_stale;
 	std::array<u8, 0xA0> oam;
 	// Palette memory. Each array defines 8 palettes, with each palette consisting of four colours. Each colour is two bytes.
 	std::array<u8, 0x40> bg_palette_ram; /* cgb */
@@ -249,9 +371,12 @@ namespace PPU
 	// actual colours resulting from the above palette memory. 8 palettes of 4 colours each.
 	std::array<RGB, 0x20> cgb_bg_palette; /* cgb */
 	std::array<RGB, 0x20> cgb_obj_palette; /* cgb */
+	// the colour of each colour index in the pixel format, with the DMG palettes applied. Rebuilt on palette writes.
+	std::array<u32, 64> host_colours;
 
-	std::queue<FifoPixel> bg_pixel_fifo;
-	std::queue<FifoPixel> sprite_pixel_fifo;
 
-	std::vector<Sprite> sprite_buffer;
-}
\ No newline at end of file
+	/* The background and sprite pixels of the scanline being rendered in one pass, and the sprite pixels left in the
+	   sprite FIFO at HBlank */
+	ScanlineMixer::Layers scanline_layers;
+	std::array<FifoPixel, 8> leftover_sprite_pixels;
+};
\ No newline at end of file
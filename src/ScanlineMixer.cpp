@@ -0,0 +1,193 @@
+module;
+
+/* The vectorized kernels and their detection are only built for x86 hosts; other hosts use the scalar kernel */
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define X86_HOST 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#include <cpuid.h>
+/* Lets the AVX2 kernel use AVX2 intrinsics without building the whole program for AVX2 */
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define X86_HOST 0
+#endif
+
+module PPU.ScanlineMixer;
+
+namespace ScanlineMixer
+{
+	bool Initialize()
+	{
+		bool self_test_passed = true;
+		std::call_once(implementation_detected, [&] {
+			implementation = DetectImplementation();
+			if (implementation != Implementation::Scalar && !SelfTest()) {
+				self_test_passed = false;
+				implementation = Implementation::Scalar;
+			}
+		});
+		return self_test_passed;
+	}
+
+
+	void MixScanline(const Layers& layers, Rules rules, std::array<u8, scanline_width>& colour_indices)
+	{
+		switch (implementation) {
+		case Implementation::Scalar: MixScanlineScalar(layers, rules, colour_indices); break;
+#if X86_HOST
+		case Implementation::Sse2: MixScanlineSse2(layers, rules, colour_indices); break;
+		case Implementation::Avx2: MixScanlineAvx2(layers, rules, colour_indices); break;
+#endif
+		}
+	}
+
+
+#if X86_HOST
+	std::array<u32, 4> Cpuid(u32 leaf, u32 subleaf)
+	{
+		std::array<u32, 4> regs{}; /* eax, ebx, ecx, edx */
+#ifdef _MSC_VER
+		__cpuidex(reinterpret_cast<int*>(regs.data()), int(leaf), int(subleaf));
+#else
+		__get_cpuid_count(leaf, subleaf, &regs[0], &regs[1], &regs[2], &regs[3]);
+#endif
+		return regs;
+	}
+#endif
+
+
+	Implementation DetectImplementation()
+	{
+#if X86_HOST
+		std::array<u32, 4> regs = Cpuid(0, 0);
+		u32 max_leaf = regs[0];
+		regs = Cpuid(1, 0);
+		bool sse2 = GetBit(regs[3], 26);
+		bool os_saves_ymm = GetBit(regs[2], 27) && GetBit(regs[2], 28) /* OSXSAVE, AVX */
+			&& (ReadXcr0() & 6) == 6; /* XMM and YMM state enabled by the OS */
+		if (max_leaf >= 7 && os_saves_ymm) {
+			regs = Cpuid(7, 0);
+			if (GetBit(regs[1], 5)) {
+				return Implementation::Avx2;
+			}
+		}
+		return sse2 ? Implementation::Sse2 : Implementation::Scalar;
+#else
+		return Implementation::Scalar;
+#endif
+	}
+
+
+	void MixScanlineScalar(const Layers& layers, Rules rules, std::array<u8, scanline_width>& colour_indices)
+	{
+		for (uint x = 0; x < scanline_width; ++x) {
+			u8 bg_col_id = rules.bg_disabled ? 0 : layers.bg_col_ids[x];
+			bool show_obj = layers.obj_present[x] && (rules.obj_always_shown
+				|| layers.obj_col_ids[x] != 0 && !(layers.obj_bg_priority[x] && bg_col_id != 0));
+			colour_indices[x] = show_obj
+				? layers.obj_colour_indices[x] + layers.obj_col_ids[x]
+				: bg_col_id;
+		}
+	}
+
+
+#if X86_HOST
+	void MixScanlineSse2(const Layers& layers, Rules rules, std::array<u8, scanline_width>& colour_indices)
+	{
+		static_assert(scanline_width % 16 == 0);
+		__m128i zero = _mm_setzero_si128();
+		for (uint x = 0; x < scanline_width; x += 16) {
+			__m128i bg_col_ids = rules.bg_disabled
+				? zero
+				: _mm_loadu_si128((const __m128i*)&layers.bg_col_ids[x]);
+			__m128i obj_col_ids = _mm_loadu_si128((const __m128i*)&layers.obj_col_ids[x]);
+			__m128i show_obj = _mm_loadu_si128((const __m128i*)&layers.obj_present[x]);
+			if (!rules.obj_always_shown) {
+				__m128i obj_transparent = _mm_cmpeq_epi8(obj_col_ids, zero);
+				__m128i obj_behind_bg = _mm_andnot_si128(_mm_cmpeq_epi8(bg_col_ids, zero),
+					_mm_loadu_si128((const __m128i*)&layers.obj_bg_priority[x]));
+				show_obj = _mm_andnot_si128(_mm_or_si128(obj_transparent, obj_behind_bg), show_obj);
+			}
+			__m128i obj_colour_indices = _mm_add_epi8(obj_col_ids,
+				_mm_loadu_si128((const __m128i*)&layers.obj_colour_indices[x]));
+			__m128i result = _mm_or_si128(_mm_and_si128(show_obj, obj_colour_indices),
+				_mm_andnot_si128(show_obj, bg_col_ids));
+			_mm_storeu_si128((__m128i*)&colour_indices[x], result);
+		}
+	}
+
+
+	TARGET_AVX2 void MixScanlineAvx2(const Layers& layers, Rules rules, std::array<u8, scanline_width>& colour_indices)
+	{
+		static_assert(scanline_width % 32 == 0);
+		__m256i zero = _mm256_setzero_si256();
+		for (uint x = 0; x < scanline_width; x += 32) {
+			__m256i bg_col_ids = rules.bg_disabled
+				? zero
+				: _mm256_loadu_si256((const __m256i*)&layers.bg_col_ids[x]);
+			__m256i obj_col_ids = _mm256_loadu_si256((const __m256i*)&layers.obj_col_ids[x]);
+			__m256i show_obj = _mm256_loadu_si256((const __m256i*)&layers.obj_present[x]);
+			if (!rules.obj_always_shown) {
+				__m256i obj_transparent = _mm256_cmpeq_epi8(obj_col_ids, zero);
+				__m256i obj_behind_bg = _mm256_andnot_si256(_mm256_cmpeq_epi8(bg_col_ids, zero),
+					_mm256_loadu_si256((const __m256i*)&layers.obj_bg_priority[x]));
+				show_obj = _mm256_andnot_si256(_mm256_or_si256(obj_transparent, obj_behind_bg), show_obj);
+			}
+			__m256i obj_colour_indices = _mm256_add_epi8(obj_col_ids,
+				_mm256_loadu_si256((const __m256i*)&layers.obj_colour_indices[x]));
+			__m256i result = _mm256_blendv_epi8(bg_col_ids, obj_colour_indices, show_obj);
+			_mm256_storeu_si256((__m256i*)&colour_indices[x], result);
+		}
+	}
+
+
+	u64 ReadXcr0()
+	{
+		/* Only to be called if CPUID reports OSXSAVE */
+#ifdef _MSC_VER
+		return _xgetbv(0);
+#else
+		u32 eax, edx;
+		asm volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return u64(edx) << 32 | eax;
+#endif
+	}
+#endif
+
+
+	bool SelfTest()
+	{
+		/* Mixes random scanlines with both the selected and the scalar implementation, under each set of rules */
+		u32 rng_state = 0x9E3779B9;
+		auto Random = [&] {
+			rng_state ^= rng_state << 13;
+			rng_state ^= rng_state >> 17;
+			rng_state ^= rng_state << 5;
+			return rng_state;
+		};
+		Layers layers;
+		std::array<u8, scanline_width> expected, result;
+		for (uint i = 0; i < num_self_test_scanlines; ++i) {
+			for (uint x = 0; x < scanline_width; ++x) {
+				u32 random = Random();
+				layers.bg_col_ids[x] = random & 3;
+				layers.obj_col_ids[x] = random >> 2 & 3;
+				layers.obj_colour_indices[x] = first_obj_colour_index + 4 * (random >> 4 & 7);
+				layers.obj_present[x] = GetBit(random, 7) ? 0xFF : 0;
+				layers.obj_bg_priority[x] = GetBit(random, 8) ? 0xFF : 0;
+			}
+			for (Rules rules : { Rules{ false, false }, Rules{ false, true }, Rules{ true, false }, Rules{ true, true } }) {
+				MixScanlineScalar(layers, rules, expected);
+				MixScanline(layers, rules, result);
+				if (result != expected) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+export module PPU.ScanlineMixer;
+
+import Util;
+
+import <array>;
+import <mutex>;
+import <string_view>;
+
+/* Resolves which of the background and sprite pixels is shown for each pixel of a scanline, like 'PPU::MixPixels'
+   does one pixel at a time, and gives the index of its colour in a table holding the 32 background colours followed by
+   the 32 sprite colours. Vectorized with SSE2 or AVX2, depending on what the host CPU supports (on x86 hosts; others
+   only have the scalar version); the scalar version is the reference which the others are checked against when
+   initializing. */
+
+namespace ScanlineMixer
+{
+	export
+	{
+		constexpr uint scanline_width = 160;
+		constexpr u8 first_obj_colour_index = 32;
+
+		/* The background is always drawn with palette 0, so the colour index of a background pixel is its colour id */
+		struct Layers
+		{
+			std::array<u8, scanline_width> bg_col_ids;
+			std::array<u8, scanline_width> obj_col_ids;
+			std::array<u8, scanline_width> obj_colour_indices; // colour index of colour id 0 of the sprite's palette
+			std::array<u8, scanline_width> obj_present; // 0xFF where there is a sprite pixel, else 0
+			std::array<u8, scanline_width> obj_bg_priority; // 0xFF where the OBJ-to-BG priority bit is set, else 0
+		};
+
+		struct Rules
+		{
+			bool bg_disabled; // DMG: the background is drawn with colour id 0 (LCDC bit 0 cleared)
+			bool obj_always_shown; // CGB: sprite pixels are shown over the background regardless (LCDC bit 0 set)
+		};
+
+		constexpr std::string_view self_test_failure_message =
+			"The vectorized scanline mixer does not match the scalar one; using the scalar one.";
+
+		/* Picks the fastest implementation that the host supports, once. Returns false on the call that found the
+		   vectorized one not to match the scalar one, which is then used instead; the caller reports it. */
+		bool Initialize();
+		void MixScanline(const Layers& layers, Rules rules, std::array<u8, scanline_width>& colour_indices);
+	}
+
+	enum class Implementation {
+		Scalar, Sse2, Avx2
+	};
+
+	Implementation DetectImplementation();
+	void MixScanlineScalar(const Layers& layers, Rules rules, std::array<u8, scanline_width>& colour_indices);
+	bool SelfTest();
+
+	/* x86 only */
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	std::array<u32, 4> Cpuid(u32 leaf, u32 subleaf);
+	void MixScanlineAvx2(const Layers& layers, Rules rules, std::array<u8, scanline_width>& colour_indices);
+	void MixScanlineSse2(const Layers& layers, Rules rules, std::array<u8, scanline_width>& colour_indices);
+	u64 ReadXcr0();
+#endif
+
+	constexpr uint num_self_test_scanlines = 64;
+
+	/* The implementation only depends on the host, so it is detected once and shared by all machines */
+	Implementation implementation = Implementation::Scalar;
+	std::once_flag implementation_detected;
+}
\ No newline at end of file
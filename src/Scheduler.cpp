@@ -0,0 +1,110 @@
+module Scheduler;
+
+import APU;
+import DMA;
+import GB;
+import PPU;
+import Serial;
+import Timer;
+
+void Scheduler::AddEvent(EventType event_type, u64 m_cycles_until_fire)
+{
+	RemoveEvent(event_type);
+	u64 fire_time = time + m_cycles_until_fire;
+	auto it = std::find_if(events.begin(), events.end(), [event_type, fire_time](const Event& event) {
+		return event.time > fire_time || event.time == fire_time && event.type > event_type;
+	});
+	events.emplace(it, event_type, fire_time);
+	next_event_time = events.front().time;
+}
+
+
+void Scheduler::AdvanceCycle()
+{
+	if (++time >= next_event_time) {
+		RunDueEvents();
+	}
+}
+
+
+u64 Scheduler::GetCyclesUntilNextEvent()
+{
+	return next_event_time - time;
+}
+
+
+u64 Scheduler::GetTime()
+{
+	return time;
+}
+
+
+void Scheduler::Initialize()
+{
+	time = 0;
+	running_events = false;
+	next_event_time = std::numeric_limits<u64>::max();
+	events.clear();
+	events.reserve(num_event_types);
+}
+
+
+bool Scheduler::IsRunningEvents()
+{
+	return running_events;
+}
+
+
+void Scheduler::RemoveEvent(EventType event_type)
+{
+	auto it = std::find_if(events.begin(), events.end(), [event_type](const Event& event) {
+		return event.type == event_type;
+	});
+	if (it != events.end()) {
+		events.erase(it);
+		next_event_time = events.empty()
+			? std::numeric_limits<u64>::max()
+			: events.front().time;
+	}
+}
+
+
+void Scheduler::RunDueEvents()
+{
+	GB& gb = static_cast<GB&>(*this);
+	// A callback may add new events (including one of its own type), so the event is popped before it is run
+	running_events = true;
+	while (!events.empty() && events.front().time <= time) {
+		EventType event_type = events.front().type;
+		events.erase(events.begin());
+		next_event_time = events.empty()
+			? std::numeric_limits<u64>::max()
+			: events.front().time;
+		switch (event_type) {
+		case EventType::ApuSync: gb.APU::OnSyncEvent(); break;
+		case EventType::Dma: gb.DMA::Update(); break;
+		case EventType::Serial: gb.Serial::UpdateTransfer(); break;
+		case EventType::Timer: gb.Timer::OnEvent(); break;
+		case EventType::Ppu: gb.PPU::OnEvent(); break;
+		}
+	}
+	running_events = false;
+}
+
+
+void Scheduler::SkipCycles(u64 m_cycles)
+{
+	assert(time + m_cycles < next_event_time);
+	time += m_cycles;
+}
+
+
+void Scheduler::StreamState(SerializationStream& stream)
+{
+	/* What an event does only depends on its type, so only the types and times of the pending events are streamed */
+	stream.StreamPrimitive(time);
+	stream.StreamVector(events);
+	next_event_time = events.empty()
+		? std::numeric_limits<u64>::max()
+		: events.front().time;
+}
\ No newline at end of file
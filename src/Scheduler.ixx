@@ -0,0 +1,58 @@
+export module Scheduler;
+
+import Util;
+
+import <algorithm>;
+import <array>;
+import <cassert>;
+import <limits>;
+import <utility>;
+import <vector>;
+
+/* Components that do not need to be stepped every m-cycle register the time of their next
+   "interesting" m-cycle here (a TIMA overflow, a serial bit being shifted, a DMA byte copy, ...),
+   and are only run when that time arrives, or when the CPU accesses one of their registers. */
+
+export struct Scheduler
+{
+	/* Events due at the same m-cycle fire in the order listed here. The PPU is stepped last, like it
+	   would be if every component was stepped each m-cycle (the DMA writes to OAM before the PPU reads it). */
+	enum class EventType {
+		ApuSync, Dma, Serial, Timer, Ppu
+	};
+
+	/* If an event of the same type is already pending, it is replaced. What an event does is fixed by its type
+	   (see 'RunDueEvents'), so that the pending events are all that a save state needs to hold. */
+	void AddEvent(EventType event_type, u64 m_cycles_until_fire);
+	void AdvanceCycle();
+	/* At least 1, as events due at the current time have already been run. */
+	u64 GetCyclesUntilNextEvent();
+	u64 GetTime();
+	void Initialize();
+	bool IsRunningEvents();
+	void RemoveEvent(EventType event_type);
+	/* Advance the time by 'm_cycles' without running any events; there may be none due in that time. */
+	void SkipCycles(u64 m_cycles);
+	void StreamState(SerializationStream& stream);
+
+private:
+	struct Event
+	{
+		EventType type;
+		u64 time;
+	};
+
+	void RunDueEvents();
+
+	static constexpr uint num_event_types = 5;
+
+	/* Number of m-cycles that have been stepped since the system was initialized. */
+	u64 time;
+	/* Set while the events due at 'time' are being run, i.e., before the m-cycle has been fully stepped. */
+	bool running_events;
+	/* Time of the earliest pending event, cached so that AdvanceCycle only needs a single comparison. */
+	u64 next_event_time = std::numeric_limits<u64>::max();
+
+	/* Pending events sorted by time (earliest first), and then by type. */
+	std::vector<Event> events;
+};
\ No newline at end of file
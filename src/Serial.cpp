@@ -1,80 +1,97 @@
 module Serial;
 
 import CPU;
+import GB;
+import Scheduler;
 
-namespace Serial
+std::string_view Serial::GetCapturedOutput()
 {
-	void Initialize()
-	{
-		transfer_active = false;
-		sb = sc = 0; /* TODO: what are def values? */
-	}
+	return captured_output;
+}
 
 
-	u8 ReadSB()
-	{
-		return sb;
-	}
+void Serial::Initialize()
+{
+	transfer_active = false;
+	sb = sc = 0; /* TODO: what are def values? */
+	captured_output.clear();
+}
 
 
-	u8 ReadSC()
-	{
-		return sc;
-	}
+u8 Serial::ReadSB()
+{
+	return sb;
+}
 
 
-	void StreamState(SerializationStream& stream)
-	{
-		stream.StreamPrimitive(transfer_active);
-		stream.StreamPrimitive(outgoing_byte);
-		stream.StreamPrimitive(sb);
-		stream.StreamPrimitive(sc);
-		stream.StreamPrimitive(m_cycles_until_transfer_update);
-		stream.StreamPrimitive(num_bits_transferred);
-	}
+u8 Serial::ReadSC()
+{
+	return sc;
+}
+
 
+void Serial::SetOutputCaptureEnabled(bool enabled)
+{
+	output_capture_enabled = enabled;
+}
 
-	void TriggerTransfer()
-	{
-		if (!transfer_active) { /* TODO: correct? */
-			transfer_active = true;
-			m_cycles_until_transfer_update = m_cycles_per_transfer_update;
-			outgoing_byte = sb;
-			num_bits_transferred = 0;
+
+void Serial::StreamState(SerializationStream& stream)
+{
+	stream.StreamPrimitive(transfer_active);
+	stream.StreamPrimitive(outgoing_byte);
+	stream.StreamPrimitive(sb);
+	stream.StreamPrimitive(sc);
+	stream.StreamPrimitive(num_bits_transferred);
+}
+
+
+void Serial::TriggerTransfer()
+{
+	GB& gb = static_cast<GB&>(*this);
+	if (!transfer_active) { /* TODO: correct? */
+		transfer_active = true;
+		outgoing_byte = sb;
+		num_bits_transferred = 0;
+		if (output_capture_enabled) {
+			captured_output.push_back(char(outgoing_byte));
 		}
+		gb.Scheduler::AddEvent(Scheduler::EventType::Serial, m_cycles_per_transfer_update);
 	}
-		
+}
 	
-	void Update()
-	{
-		if (transfer_active && --m_cycles_until_transfer_update == 0) {
-			++num_bits_transferred;
-			// see https://gbdev.io/pandocs/Serial_Data_Transfer_(Link_Cable).html for the blend of outgoing and incoming bytes
-			sb = (outgoing_byte << num_bits_transferred) | (incoming_byte >> (8 - num_bits_transferred));
-			bool transfer_complete = num_bits_transferred == 8;
-			if (transfer_complete) {
-				sc &= 0x7F;
-				CPU::RequestInterrupt(CPU::Interrupt::Serial);
-				transfer_active = false;
-			}
-			else {
-				m_cycles_until_transfer_update = m_cycles_per_transfer_update;
-			}
+
+void Serial::UpdateTransfer()
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* Called by the scheduler each time a bit has been shifted */
+	if (transfer_active) {
+		++num_bits_transferred;
+		// see https://gbdev.io/pandocs/Serial_Data_Transfer_(Link_Cable).html for the blend of outgoing and incoming bytes
+		sb = (outgoing_byte << num_bits_transferred) | (incoming_byte >> (8 - num_bits_transferred));
+		bool transfer_complete = num_bits_transferred == 8;
+		if (transfer_complete) {
+			sc &= 0x7F;
+			gb.CPU::RequestInterrupt(CPU::Interrupt::Serial);
+			transfer_active = false;
+		}
+		else {
+			gb.Scheduler::AddEvent(Scheduler::EventType::Serial, m_cycles_per_transfer_update);
 		}
 	}
+}
 
 
-	void WriteSB(u8 data)
-	{
-		sb = data;
-	}
+void Serial::WriteSB(u8 data)
+{
+	sb = data;
+}
 
 
-	void WriteSC(u8 data)
-	{
-		sc = data;
-		if (data == 0x81) {
-			TriggerTransfer();
-		}
+void Serial::WriteSC(u8 data)
+{
+	sc = data;
+	if (data == 0x81) {
+		TriggerTransfer();
 	}
 }
\ No newline at end of file
@@ -1,31 +1,41 @@
 export module Serial;
 
+import Scheduler;
 import Util;
 
-namespace Serial
+import <string>;
+import <string_view>;
+
+export struct Serial
 {
-	export
-	{
-		void Initialize();
-		u8 ReadSB();
-		u8 ReadSC();
-		void StreamState(SerializationStream& stream);
-		void Update();
-		void WriteSB(u8 data);
-		void WriteSC(u8 data);
-	}
+	/* The bytes sent since 'Initialize', if capturing them has been enabled */
+	std::string_view GetCapturedOutput();
+	void Initialize();
+	u8 ReadSB();
+	u8 ReadSC();
+	/* Keep the bytes sent over the link cable, e.g. the results that test ROMs print to it */
+	void SetOutputCaptureEnabled(bool enabled);
+	void StreamState(SerializationStream& stream);
+	void WriteSB(u8 data);
+	void WriteSC(u8 data);
+
+private:
+	friend struct Scheduler; /* runs the event handler */
 
 	void TriggerTransfer();
+	void UpdateTransfer();
 
-	constexpr u8 incoming_byte = 0;
+	static constexpr u8 incoming_byte = 0;
 
-	constexpr uint m_cycles_per_transfer_update = 2048;
+	static constexpr uint m_cycles_per_transfer_update = 2048;
 
+	bool output_capture_enabled = false;
 	bool transfer_active;
 
 	u8 outgoing_byte;
 	u8 sb, sc;
 	
-	uint m_cycles_until_transfer_update;
 	uint num_bits_transferred;
-}
\ No newline at end of file
+
+	std::string captured_output;
+};
\ No newline at end of file
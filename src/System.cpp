@@ -1,79 +1,105 @@
 module System;
 
-import APU;
-import Bus;
-import CPU;
-import DMA;
-import Serial;
-import Timer;
+import GB;
 import PPU;
+import Scheduler;
+import Timer;
+import UserMessage;
 
-namespace System
+void System::EndSpeedSwitchInitialization()
 {
-	void EndSpeedSwitchInitialization()
-	{
-		if (speed == Speed::Single) {
-			speed = Speed::Double;
-		}
-		else {
-			speed = Speed::Single;
-		}
-		prepare_speed_switch = false;
+	GB& gb = static_cast<GB&>(*this);
+	/* The PPU's scanline length and the timer's frame sequencer period depend on the speed */
+	gb.PPU::Sync();
+	gb.Timer::Sync();
+	if (speed == Speed::Single) {
+		speed = Speed::Double;
 	}
-
-
-	void Initialize()
-	{
-		prepare_speed_switch = false;
+	else {
 		speed = Speed::Single;
 	}
+	prepare_speed_switch = false;
+	gb.PPU::ScheduleNextEvent();
+	gb.Timer::ScheduleNextEvent();
+}
 
 
-	u8 ReadKey1()
-	{
-		// bits 1-6 always return 1. in DMG mode, always return 0xFF
-		if (mode == Mode::DMG) {
-			return 0xFF;
-		}
-		else {
-			static_assert(std::to_underlying(Speed::Single) == 1);
-			static_assert(std::to_underlying(Speed::Double) == 2);
-			bool bit0 = prepare_speed_switch;
-			bool bit7 = std::to_underlying(speed) - 1;
-			return 0x7E | bit0 | bit7 << 7;
-		}
-	}
+std::string_view System::GetCapturedMessages()
+{
+	return captured_messages;
+}
 
 
-	bool SpeedSwitchPrepared()
-	{
-		return prepare_speed_switch;
-	}
+void System::Initialize()
+{
+	prepare_speed_switch = false;
+	speed = Speed::Single;
+}
 
 
-	void StepAllComponentsButCpu()
-	{
-		APU::Update();
-		DMA::Update();
-		PPU::Update();
-		Serial::Update();
-		Timer::Update();
+u8 System::ReadKey1()
+{
+	// bits 1-6 always return 1. in DMG mode, always return 0xFF
+	if (mode == Mode::DMG) {
+		return 0xFF;
+	}
+	else {
+		static_assert(std::to_underlying(Speed::Single) == 1);
+		static_assert(std::to_underlying(Speed::Double) == 2);
+		bool bit0 = prepare_speed_switch;
+		bool bit7 = std::to_underlying(speed) - 1;
+		return 0x7E | bit0 | bit7 << 7;
 	}
+}
 
 
-	void StreamState(SerializationStream& stream)
-	{
-		stream.StreamPrimitive(speed);
-		stream.StreamPrimitive(prepare_speed_switch);
+void System::SetMessageCaptureEnabled(bool enabled)
+{
+	message_capture_enabled = enabled;
+}
+
+
+void System::ShowMessage(std::string_view message, UserMessage::Type type)
+{
+	if (!message_capture_enabled) {
+		UserMessage::Show(message, type);
+		return;
+	}
+	/* A message is kept only once in a row, as e.g. an illegal opcode in a loop would report itself on every iteration */
+	std::string line = std::string(message) + '\n';
+	if (!captured_messages.ends_with(line)) {
+		captured_messages += line;
 	}
+}
+
+
+bool System::SpeedSwitchPrepared()
+{
+	return prepare_speed_switch;
+}
 
 
-	void WriteKey1(u8 data)
-	{
-		if (mode == Mode::CGB) {
-			if (!prepare_speed_switch && (data & 1)) {
-				prepare_speed_switch = true;
-			}
+void System::StepAllComponentsButCpu()
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* All components are driven by the scheduler; they are run only when they have an event due,
+	   or when the CPU accesses one of their registers. */
+	gb.Scheduler::AdvanceCycle();
+}
+
+
+void System::StreamState(SerializationStream& stream)
+{
+	stream.StreamPrimitive(speed);
+	stream.StreamPrimitive(prepare_speed_switch);
+}
+
+
+void System::WriteKey1(u8 data)
+{
+	if (mode == Mode::CGB) {
+		if (!prepare_speed_switch && (data & 1)) {
+			prepare_speed_switch = true;
 		}
 	}
 }
\ No newline at end of file
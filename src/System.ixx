@@ -1,10 +1,13 @@
 export module System;
 
+import UserMessage;
 import Util;
 
+import <string>;
+import <string_view>;
 import <utility>;
 
-export namespace System
+export struct System
 {
 	enum class Mode {
 		DMG, CGB
@@ -15,16 +18,25 @@ export namespace System
 	} speed = Speed::Single;
 
 	void EndSpeedSwitchInitialization();
+	/* The messages that the machine would have shown, one per line, if capturing them has been enabled */
+	std::string_view GetCapturedMessages();
 	void Initialize();
 	u8 ReadKey1();
+	/* Keep the messages of the machine rather than showing them, e.g. when it does not run on the frontend's thread */
+	void SetMessageCaptureEnabled(bool enabled);
+	/* Show a message to the user, or keep it if capturing messages has been enabled */
+	void ShowMessage(std::string_view message, UserMessage::Type type);
 	bool SpeedSwitchPrepared();
 	void StepAllComponentsButCpu();
 	void StreamState(SerializationStream& stream);
 	void WriteKey1(u8 data);
 
-	constexpr uint m_cycles_per_frame_base = 17556;
-	constexpr uint m_cycles_per_sec_base = 1048576;
-	constexpr uint t_cycles_per_sec_base = 4194304;
+	static constexpr uint m_cycles_per_frame_base = 17556;
+	static constexpr uint m_cycles_per_sec_base = 1048576;
+	static constexpr uint t_cycles_per_sec_base = 4194304;
 
+	bool message_capture_enabled = false;
 	bool prepare_speed_switch; /* change by writing to KEY1.0 */
-}
\ No newline at end of file
+
+	std::string captured_messages;
+};
\ No newline at end of file
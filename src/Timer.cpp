@@ -2,112 +2,227 @@ module Timer;
 
 import APU;
 import CPU;
+import GB;
+import Scheduler;
 import System;
 
-namespace Timer
+void Timer::Initialize()
 {
-	void Initialize()
-	{
-		WriteDIV(0x00);
-		WriteTAC(0x04);
-		WriteTIMA(0x00);
-		WriteTMA(0x00);
-		prev_tima_and_result = prev_div_and_result = 0;
-		awaiting_interrupt_request = false;
-		div_enabled = true;
-	}
+	GB& gb = static_cast<GB&>(*this);
+	time_synced = gb.Scheduler::GetTime();
+	WriteDIV(0x00);
+	WriteTAC(0x04);
+	WriteTIMA(0x00);
+	WriteTMA(0x00);
+	prev_tima_and_result = prev_div_and_result = 0;
+	awaiting_interrupt_request = false;
+	div_enabled = true;
+	ScheduleNextEvent();
+}
+
+
+u16 Timer::GetFrameSeqDivMask()
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* Step the APU frame sequencer when bit 13 of DIV becomes 1 (bit 14 in double speed mode).
+	   This is equivalent to bits 0-12 being cleared (0-13 in double speed mode). */
+	return 0x3FFF >> (2 - std::to_underlying(gb.System::speed));
+}
 
 
-	u8 ReadDIV()
-	{
-		return div >> 8;
-	}
+uint Timer::GetTimaDivPeriod()
+{
+	/* TIMA is incremented on the falling edge of the DIV bit selected by TAC, which happens each time
+	   the bits up to and including it wrap around to 0. */
+	return 2u << and_bit_pos[and_bit_pos_index];
+}
 
 
-	u8 ReadTAC()
-	{
-		return tac;
-	}
+uint Timer::MCyclesUntilFrameSeqStep()
+{
+	/* DIV is always a multiple of 4, as it is only ever incremented by 4 or reset */
+	uint period = GetFrameSeqDivMask() + 1u;
+	return (period - (div & (period - 1))) / 4;
+}
 
 
-	u8 ReadTIMA()
-	{
-		return tima;
-	}
+uint Timer::MCyclesUntilTimaTick()
+{
+	uint period = GetTimaDivPeriod();
+	return (period - (div & (period - 1))) / 4;
+}
 
 
-	u8 ReadTMA()
-	{
-		return tma;
-	}
+bool Timer::NextMCycleMustBeStepped()
+{
+	// A pending TIMA reload must be carried out on the next m-cycle. Also, writes to DIV and TAC, as well as speed switches,
+	// may cause a falling edge on the next m-cycle without the selected DIV bit having been cleared by an ordinary increment.
+	bool tima_and_result = tima_enabled && (div >> and_bit_pos[and_bit_pos_index] & 1);
+	bool div_and_result = div & GetFrameSeqDivMask();
+	return awaiting_interrupt_request || tima_and_result != prev_tima_and_result || div_and_result != prev_div_and_result;
+}
 
 
-	void StreamState(SerializationStream& stream)
-	{
-		stream.StreamPrimitive(awaiting_interrupt_request);
-		stream.StreamPrimitive(div_enabled);
-		stream.StreamPrimitive(prev_div_and_result);
-		stream.StreamPrimitive(prev_tima_and_result);
-		stream.StreamPrimitive(tima_enabled);
-		stream.StreamPrimitive(tac);
-		stream.StreamPrimitive(tima);
-		stream.StreamPrimitive(tma);
-		stream.StreamPrimitive(div);
-		stream.StreamPrimitive(and_bit_pos_index);
-	}
+void Timer::OnEvent()
+{
+	Sync();
+	ScheduleNextEvent();
+}
+
+
+u8 Timer::ReadDIV()
+{
+	Sync();
+	return div >> 8;
+}
+
+
+u8 Timer::ReadTAC()
+{
+	return tac;
+}
+
+
+u8 Timer::ReadTIMA()
+{
+	Sync();
+	return tima;
+}
+
+
+u8 Timer::ReadTMA()
+{
+	return tma;
+}
 
 
-	void Update()
-	{
-		if (awaiting_interrupt_request) {
-			tima = tma;
-			CPU::RequestInterrupt(CPU::Interrupt::Timer);
-			awaiting_interrupt_request = false;
+void Timer::ScheduleNextEvent()
+{
+	GB& gb = static_cast<GB&>(*this);
+	/* The timer needs to be run when TIMA overflows (more precisely, one m-cycle later when it is reloaded and the interrupt
+	   is requested), and when the APU frame sequencer is stepped. Inbetween, it is only synced when the CPU accesses it. */
+	u64 m_cycles_until_event = [&]() -> u64 {
+		if (NextMCycleMustBeStepped()) {
+			return 1;
+		}
+		u64 m_cycles_until_frame_seq_step = MCyclesUntilFrameSeqStep();
+		if (!tima_enabled) {
+			return m_cycles_until_frame_seq_step;
 		}
+		u64 m_cycles_until_overflow = MCyclesUntilTimaTick() + u64(0xFF - tima) * (GetTimaDivPeriod() / 4);
+		return std::min(m_cycles_until_frame_seq_step, m_cycles_until_overflow + 1);
+	}();
+	gb.Scheduler::AddEvent(Scheduler::EventType::Timer, m_cycles_until_event);
+}
 
-		if (div_enabled) {
-			div += 4; /* one increment per t-cycle */
-			static constexpr std::array and_bit_pos = { 9, 3, 5, 7 };
-			bool and_result = tima_enabled && (div >> and_bit_pos[and_bit_pos_index] & 1);
-			if (and_result == 0 && prev_tima_and_result == 1) {
-				if (++tima == 0) {
-					awaiting_interrupt_request = true; /* 1 m-cycle delay until interrupt fire */
-				}
-			}
-			prev_tima_and_result = and_result;
-			/* Step the APU frame sequencer when bit 13 of DIV becomes 1 (bit 14 in double speed mode).
-			   This is equivalent to bits 0-12 being cleared (0-13 in double speed mode). */
-			and_result = div & (0x3FFF >> (2 - std::to_underlying(System::speed)));
-			if (APU::Enabled() && and_result == 0 && prev_div_and_result == 1) {
-				APU::StepFrameSequencer();
+
+void Timer::StreamState(SerializationStream& stream)
+{
+	stream.StreamPrimitive(awaiting_interrupt_request);
+	stream.StreamPrimitive(div_enabled);
+	stream.StreamPrimitive(prev_div_and_result);
+	stream.StreamPrimitive(prev_tima_and_result);
+	stream.StreamPrimitive(tima_enabled);
+	stream.StreamPrimitive(tac);
+	stream.StreamPrimitive(tima);
+	stream.StreamPrimitive(tma);
+	stream.StreamPrimitive(div);
+	stream.StreamPrimitive(and_bit_pos_index);
+	stream.StreamPrimitive(time_synced);
+}
+
+
+void Timer::Step()
+{
+	GB& gb = static_cast<GB&>(*this);
+	if (awaiting_interrupt_request) {
+		tima = tma;
+		gb.CPU::RequestInterrupt(CPU::Interrupt::Timer);
+		awaiting_interrupt_request = false;
+	}
+
+	if (div_enabled) {
+		div += 4; /* one increment per t-cycle */
+		bool and_result = tima_enabled && (div >> and_bit_pos[and_bit_pos_index] & 1);
+		if (and_result == 0 && prev_tima_and_result == 1) {
+			if (++tima == 0) {
+				awaiting_interrupt_request = true; /* 1 m-cycle delay until interrupt fire */
 			}
-			prev_div_and_result = and_result;
 		}
+		prev_tima_and_result = and_result;
+		and_result = div & GetFrameSeqDivMask();
+		if (gb.APU::Enabled() && and_result == 0 && prev_div_and_result == 1) {
+			gb.APU::StepFrameSequencer();
+		}
+		prev_div_and_result = and_result;
 	}
+}
 
 
-	void WriteDIV(u8 data)
-	{
-		div = 0;
+void Timer::Sync()
+{
+	GB& gb = static_cast<GB&>(*this);
+	u64 now = gb.Scheduler::GetTime();
+	while (time_synced < now) {
+		if (!div_enabled || NextMCycleMustBeStepped()) {
+			Step();
+			++time_synced;
+			continue;
+		}
+		// Advance DIV in bulk, up until the next TIMA increment or frame sequencer step, whichever comes first.
+		// Both of these always coincide with a scheduled event (see ScheduleNextEvent), which is what makes it
+		// safe for the frame sequencer to sync the APU up to the current time.
+		uint m_cycles_until_tima_tick = MCyclesUntilTimaTick();
+		uint m_cycles_until_frame_seq_step = MCyclesUntilFrameSeqStep();
+		u64 m_cycles = std::min(now - time_synced, u64(m_cycles_until_frame_seq_step));
+		if (tima_enabled) {
+			m_cycles = std::min(m_cycles, u64(m_cycles_until_tima_tick));
+		}
+		div += u16(4 * m_cycles);
+		time_synced += m_cycles;
+		if (tima_enabled && m_cycles == m_cycles_until_tima_tick) {
+			if (++tima == 0) {
+				awaiting_interrupt_request = true;
+			}
+		}
+		if (m_cycles == m_cycles_until_frame_seq_step && gb.APU::Enabled()) {
+			gb.APU::StepFrameSequencer();
+		}
+		prev_tima_and_result = tima_enabled && (div >> and_bit_pos[and_bit_pos_index] & 1);
+		prev_div_and_result = div & GetFrameSeqDivMask();
 	}
+}
 
 
-	void WriteTAC(u8 data)
-	{
-		tac = data & 7; /* Only the lower 3 bits are R/W. TODO: what do the rest return? */
-		and_bit_pos_index = data & 3;
-		tima_enabled = data & 4;
-	}
+void Timer::WriteDIV(u8 data)
+{
+	Sync();
+	div = 0;
+	ScheduleNextEvent();
+}
 
 
-	void WriteTIMA(u8 data)
-	{
-		tima = data;
-	}
+void Timer::WriteTAC(u8 data)
+{
+	Sync();
+	tac = data & 7; /* Only the lower 3 bits are R/W. TODO: what do the rest return? */
+	and_bit_pos_index = data & 3;
+	tima_enabled = data & 4;
+	ScheduleNextEvent();
+}
 
 
-	void WriteTMA(u8 data)
-	{
-		tma = data;
-	}
+void Timer::WriteTIMA(u8 data)
+{
+	Sync();
+	tima = data;
+	ScheduleNextEvent();
+}
+
+
+void Timer::WriteTMA(u8 data)
+{
+	Sync();
+	tma = data;
+	ScheduleNextEvent();
 }
\ No newline at end of file
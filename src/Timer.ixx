@@ -1,23 +1,39 @@
 export module Timer;
 
+import Scheduler;
 import Util;
 
-namespace Timer
+import <algorithm>;
+import <array>;
+import <utility>;
+
+export struct Timer
 {
-	export
-	{
-		void Initialize();
-		u8 ReadDIV();
-		u8 ReadTAC();
-		u8 ReadTIMA();
-		u8 ReadTMA();
-		void StreamState(SerializationStream& stream);
-		void Update();
-		void WriteDIV(u8 data);
-		void WriteTAC(u8 data);
-		void WriteTIMA(u8 data);
-		void WriteTMA(u8 data);
-	}
+	void Initialize();
+	u8 ReadDIV();
+	u8 ReadTAC();
+	u8 ReadTIMA();
+	u8 ReadTMA();
+	void ScheduleNextEvent();
+	void StreamState(SerializationStream& stream);
+	void Sync();
+	void WriteDIV(u8 data);
+	void WriteTAC(u8 data);
+	void WriteTIMA(u8 data);
+	void WriteTMA(u8 data);
+
+private:
+	friend struct Scheduler; /* runs the event handler */
+
+	u16 GetFrameSeqDivMask();
+	uint GetTimaDivPeriod();
+	uint MCyclesUntilFrameSeqStep();
+	uint MCyclesUntilTimaTick();
+	bool NextMCycleMustBeStepped();
+	void OnEvent();
+	void Step();
+
+	static constexpr std::array and_bit_pos = { 9, 3, 5, 7 };
 
 	bool awaiting_interrupt_request;
 	bool div_enabled;
@@ -31,4 +47,7 @@ namespace Timer
 	u16 div;
 
 	uint and_bit_pos_index = 0;
-}
\ No newline at end of file
+
+	/* The scheduler time up until which the timer has been stepped */
+	u64 time_synced;
+};
\ No newline at end of file
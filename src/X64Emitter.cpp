@@ -0,0 +1,354 @@
+module;
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define X64_HOST 1
+#else
+#define X64_HOST 0
+#endif
+
+module CPU.X64Emitter;
+
+namespace X64
+{
+	void Emitter::Alu(AluOp op, Reg dst, Reg src)
+	{
+		EmitRex(false, uint(src), 0, uint(dst));
+		Emit8(u8(op) << 3 | 1);
+		EmitRm(uint(src), dst);
+	}
+
+
+	void Emitter::Alu(AluOp op, Reg dst, s32 imm)
+	{
+		EmitRex(false, 0, 0, uint(dst));
+		if (imm >= -128 && imm <= 127) {
+			Emit8(0x83);
+			EmitRm(uint(op), dst);
+			Emit8(u8(imm));
+		}
+		else {
+			Emit8(0x81);
+			EmitRm(uint(op), dst);
+			Emit32(u32(imm));
+		}
+	}
+
+
+	void Emitter::Alu64(AluOp op, Reg dst, Reg src)
+	{
+		EmitRex(true, uint(src), 0, uint(dst));
+		Emit8(u8(op) << 3 | 1);
+		EmitRm(uint(src), dst);
+	}
+
+
+	void Emitter::Bind(size_t jump)
+	{
+		u32 rel = u32(code.size() - (jump + 4));
+		std::memcpy(code.data() + jump, &rel, 4);
+	}
+
+
+	void Emitter::Clear()
+	{
+		code.clear();
+	}
+
+
+	std::span<const u8> Emitter::GetCode()
+	{
+		return code;
+	}
+
+
+	size_t Emitter::GetSize()
+	{
+		return code.size();
+	}
+
+
+	size_t Emitter::Jcc(Cond cond)
+	{
+		Emit8(0x0F);
+		Emit8(0x80 | u8(cond));
+		Emit32(0);
+		return code.size() - 4;
+	}
+
+
+	void Emitter::JmpTo(size_t target)
+	{
+		Emit8(0xE9);
+		Emit32(u32(target - (code.size() + 4)));
+	}
+
+
+	void Emitter::LoadByte(Reg dst, Reg base, s32 disp)
+	{
+		EmitRex(false, uint(dst), 0, uint(base));
+		Emit8(0x0F);
+		Emit8(0xB6);
+		EmitMem(uint(dst), base, disp);
+	}
+
+
+	void Emitter::LoadIndexed64(Reg dst, Reg base, Reg index)
+	{
+		EmitRex(true, uint(dst), uint(index), uint(base));
+		Emit8(0x8B);
+		EmitMem(uint(dst), base, 0, index);
+	}
+
+
+	void Emitter::LoadWord(Reg dst, Reg base, s32 disp)
+	{
+		EmitRex(false, uint(dst), 0, uint(base));
+		Emit8(0x0F);
+		Emit8(0xB7);
+		EmitMem(uint(dst), base, disp);
+	}
+
+
+	void Emitter::Mov(Reg dst, Reg src)
+	{
+		EmitRex(false, uint(src), 0, uint(dst));
+		Emit8(0x89);
+		EmitRm(uint(src), dst);
+	}
+
+
+	void Emitter::Mov(Reg dst, u32 imm)
+	{
+		EmitRex(false, 0, 0, uint(dst));
+		Emit8(0xB8 | uint(dst) & 7);
+		Emit32(imm);
+	}
+
+
+	void Emitter::Mov64(Reg dst, Reg src)
+	{
+		EmitRex(true, uint(src), 0, uint(dst));
+		Emit8(0x89);
+		EmitRm(uint(src), dst);
+	}
+
+
+	void Emitter::Mov64(Reg dst, u64 imm)
+	{
+		EmitRex(true, 0, 0, uint(dst));
+		Emit8(0xB8 | uint(dst) & 7);
+		Emit64(imm);
+	}
+
+
+	void Emitter::Movzx8(Reg dst, Reg src)
+	{
+		/* Without a REX prefix, byte registers 4-7 are AH, CH, DH and BH rather than SPL, BPL, SIL and DIL */
+		EmitRex(false, uint(dst), 0, uint(src), uint(src) >= 4);
+		Emit8(0x0F);
+		Emit8(0xB6);
+		EmitRm(uint(dst), src);
+	}
+
+
+	void Emitter::Pop(Reg reg)
+	{
+		EmitRex(false, 0, 0, uint(reg));
+		Emit8(0x58 | uint(reg) & 7);
+	}
+
+
+	void Emitter::Push(Reg reg)
+	{
+		EmitRex(false, 0, 0, uint(reg));
+		Emit8(0x50 | uint(reg) & 7);
+	}
+
+
+	void Emitter::Ret()
+	{
+		Emit8(0xC3);
+	}
+
+
+	void Emitter::Setcc(Cond cond, Reg dst)
+	{
+		EmitRex(false, 0, 0, uint(dst), uint(dst) >= 4);
+		Emit8(0x0F);
+		Emit8(0x90 | u8(cond));
+		EmitRm(0, dst);
+	}
+
+
+	void Emitter::Shift(ShiftOp op, Reg dst, u8 amount)
+	{
+		EmitRex(false, 0, 0, uint(dst));
+		Emit8(0xC1);
+		EmitRm(uint(op), dst);
+		Emit8(amount);
+	}
+
+
+	void Emitter::StoreByte(Reg base, s32 disp, Reg src)
+	{
+		EmitRex(false, uint(src), 0, uint(base), uint(src) >= 4);
+		Emit8(0x88);
+		EmitMem(uint(src), base, disp);
+	}
+
+
+	void Emitter::StoreWord(Reg base, s32 disp, Reg src)
+	{
+		Emit8(0x66);
+		EmitRex(false, uint(src), 0, uint(base));
+		Emit8(0x89);
+		EmitMem(uint(src), base, disp);
+	}
+
+
+	void Emitter::Test(Reg dst, u32 imm)
+	{
+		EmitRex(false, 0, 0, uint(dst));
+		Emit8(0xF7);
+		EmitRm(0, dst);
+		Emit32(imm);
+	}
+
+
+	void Emitter::Test64(Reg dst, Reg src)
+	{
+		EmitRex(true, uint(src), 0, uint(dst));
+		Emit8(0x85);
+		EmitRm(uint(src), dst);
+	}
+
+
+	void Emitter::EmitMem(uint reg, Reg base, s32 disp, Reg index)
+	{
+		/* A base of RSP/R12 can only be encoded with a SIB byte, and one of RBP/R13 only with a displacement */
+		uint mod = disp == 0 && (uint(base) & 7) != 5 ? 0 : disp >= -128 && disp <= 127 ? 1 : 2;
+		if (index != Reg::rsp || (uint(base) & 7) == 4) {
+			uint scale = index != Reg::rsp ? 3 : 0;
+			Emit8(u8(mod << 6 | (reg & 7) << 3 | 4));
+			Emit8(u8(scale << 6 | (uint(index) & 7) << 3 | uint(base) & 7));
+		}
+		else {
+			Emit8(u8(mod << 6 | (reg & 7) << 3 | uint(base) & 7));
+		}
+		if (mod == 1) {
+			Emit8(u8(disp));
+		}
+		else if (mod == 2) {
+			Emit32(u32(disp));
+		}
+	}
+
+
+	void Emitter::EmitRex(bool wide, uint reg, uint index, uint base, bool force)
+	{
+		u8 rex = 0x40 | wide << 3 | (reg >> 3) << 2 | (index >> 3) << 1 | base >> 3;
+		if (rex != 0x40 || force) {
+			Emit8(rex);
+		}
+	}
+
+
+	void Emitter::EmitRm(uint reg, Reg rm)
+	{
+		Emit8(u8(0xC0 | (reg & 7) << 3 | uint(rm) & 7));
+	}
+
+
+	void Emitter::Emit8(u8 value)
+	{
+		code.push_back(value);
+	}
+
+
+	void Emitter::Emit32(u32 value)
+	{
+		for (int i = 0; i < 4; ++i) {
+			code.push_back(u8(value >> 8 * i));
+		}
+	}
+
+
+	void Emitter::Emit64(u64 value)
+	{
+		for (int i = 0; i < 8; ++i) {
+			code.push_back(u8(value >> 8 * i));
+		}
+	}
+
+
+	CodeBuffer::~CodeBuffer()
+	{
+		Free();
+	}
+
+
+	const u8* CodeBuffer::Add(std::span<const u8> code)
+	{
+#if X64_HOST
+		if (!memory || code.size() > size - used) {
+			return nullptr;
+		}
+		if (mprotect(memory, size, PROT_READ | PROT_WRITE) != 0) {
+			return nullptr;
+		}
+		u8* dst = memory + used;
+		std::memcpy(dst, code.data(), code.size());
+		used += code.size();
+		/* x86 keeps the instruction cache coherent by itself, so there is nothing to flush */
+		if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+			return nullptr;
+		}
+		return dst;
+#else
+		return nullptr;
+#endif
+	}
+
+
+	bool CodeBuffer::Allocate(size_t size)
+	{
+#if X64_HOST
+		Free();
+		void* mapping = mmap(nullptr, size, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mapping == MAP_FAILED) {
+			return false;
+		}
+		memory = static_cast<u8*>(mapping);
+		this->size = size;
+		used = 0;
+		return true;
+#else
+		return false;
+#endif
+	}
+
+
+	void CodeBuffer::Clear()
+	{
+		used = 0;
+	}
+
+
+	void CodeBuffer::Free()
+	{
+#if X64_HOST
+		if (memory) {
+			munmap(memory, size);
+		}
+#endif
+		memory = nullptr;
+		size = used = 0;
+	}
+
+
+	bool CodeBuffer::IsAllocated()
+	{
+		return memory != nullptr;
+	}
+}
\ No newline at end of file
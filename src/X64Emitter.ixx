@@ -0,0 +1,101 @@
+export module CPU.X64Emitter;
+
+import Util;
+
+import <cstring>;
+import <span>;
+import <vector>;
+
+/* A minimal x86-64 assembler for the JIT (see 'CPU::CompileBlock'), covering only the instructions that it emits, and
+   the executable memory that the code is run from. Register operands are 32 bits wide unless the name of the function
+   says otherwise; like on the hardware, writing a 32-bit register clears the upper half of the 64-bit one. */
+
+namespace X64
+{
+	export
+	{
+		enum class Reg : u8 {
+			rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi, r8, r9, r10, r11, r12, r13, r14, r15
+		};
+
+		/* Conditions of Jcc and SETcc, as compared unsigned */
+		enum class Cond : u8 {
+			Below = 2, AboveOrEqual = 3, Equal = 4, NotEqual = 5, BelowOrEqual = 6, Above = 7
+		};
+
+		/* The /digit of the group 1 instructions */
+		enum class AluOp : u8 {
+			Add, Or, Adc, Sbb, And, Sub, Xor, Cmp
+		};
+
+		/* The /digit of the group 2 instructions */
+		enum class ShiftOp : u8 {
+			Rol = 0, Ror = 1, Shl = 4, Shr = 5, Sar = 7
+		};
+
+		struct Emitter
+		{
+			void Alu(AluOp op, Reg dst, Reg src);
+			void Alu(AluOp op, Reg dst, s32 imm);
+			void Alu64(AluOp op, Reg dst, Reg src);
+			/* Make the jump emitted at 'jump' (as returned by 'Jcc') go to the current end of the code */
+			void Bind(size_t jump);
+			void Clear();
+			std::span<const u8> GetCode();
+			size_t GetSize();
+			/* Emit a jump to a location not yet known; returns what to pass to 'Bind' once it is */
+			size_t Jcc(Cond cond);
+			void JmpTo(size_t target);
+			void LoadByte(Reg dst, Reg base, s32 disp); /* movzx dst, byte [base + disp] */
+			void LoadIndexed64(Reg dst, Reg base, Reg index); /* mov dst, qword [base + index * 8] */
+			void LoadWord(Reg dst, Reg base, s32 disp); /* movzx dst, word [base + disp] */
+			void Mov(Reg dst, Reg src);
+			void Mov(Reg dst, u32 imm);
+			void Mov64(Reg dst, Reg src);
+			void Mov64(Reg dst, u64 imm);
+			void Movzx8(Reg dst, Reg src); /* movzx dst, src8 */
+			void Pop(Reg reg);
+			void Push(Reg reg);
+			void Ret();
+			void Setcc(Cond cond, Reg dst); /* setcc dst8 */
+			void Shift(ShiftOp op, Reg dst, u8 amount);
+			void StoreByte(Reg base, s32 disp, Reg src); /* mov byte [base + disp], src8 */
+			void StoreWord(Reg base, s32 disp, Reg src); /* mov word [base + disp], src16 */
+			void Test(Reg dst, u32 imm);
+			void Test64(Reg dst, Reg src);
+
+		private:
+			void EmitMem(uint reg, Reg base, s32 disp, Reg index = Reg::rsp /* none */);
+			void EmitRex(bool wide, uint reg, uint index, uint base, bool force = false);
+			void EmitRm(uint reg, Reg rm); /* register-direct ModRM */
+			void Emit8(u8 value);
+			void Emit32(u32 value);
+			void Emit64(u64 value);
+
+			std::vector<u8> code;
+		};
+
+		/* Memory that code is copied to and run from. It is only ever writable or executable, never both; 'Add' makes
+		   it writable for as long as it takes to copy the code. Allocating fails on hosts other than x86-64 Linux. */
+		struct CodeBuffer
+		{
+			CodeBuffer() = default;
+			CodeBuffer(const CodeBuffer&) = delete;
+			CodeBuffer& operator=(const CodeBuffer&) = delete;
+			~CodeBuffer();
+
+			/* Returns where the code was copied to, or nullptr if there is no room left (or no memory allocated) */
+			const u8* Add(std::span<const u8> code);
+			bool Allocate(size_t size);
+			/* Drop all code that has been added */
+			void Clear();
+			void Free();
+			bool IsAllocated();
+
+		private:
+			u8* memory = nullptr;
+			size_t size = 0;
+			size_t used = 0;
+		};
+	}
+}
\ No newline at end of file